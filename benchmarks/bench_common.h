@@ -0,0 +1,23 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+// Shared by the bench_* executables.
+
+namespace pm {
+
+constexpr uint32_t BENCH_ITERATIONS = 50;
+
+// average wall time of one call in milliseconds
+template<typename F>
+double measureMs(F&& function, uint32_t iterations = BENCH_ITERATIONS) {
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < iterations; i++) {
+		function();
+	}
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+}
+
+}// namespace pm
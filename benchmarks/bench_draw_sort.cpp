@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "bench_common.h"
+#include "scene/draw_sort.h"
+
+// Compares the previous comparator sort, which followed the material and index
+// buffer pointers of every draw, against the radix sort over packed draw keys.
+
+namespace {
+
+constexpr uint32_t DRAW_COUNTS[] = { 10'000, 100'000, 1'000'000 };
+constexpr uint32_t PIPELINE_COUNT = 2;
+constexpr uint32_t MATERIAL_COUNT = 512;
+constexpr uint32_t MESH_COUNT = 2048;
+// fewer than BENCH_ITERATIONS, a million draws through the comparator sort is slow
+constexpr uint32_t ITERATIONS = 20;
+
+// stand ins for the renderer types, heap allocated like the real ones
+struct LegacyMaterial {
+		uint32_t pipeline;
+		uint32_t materialIndex;
+};
+
+struct LegacyMesh {
+		uint32_t meshId;
+};
+
+// roughly the size of RenderObject, so the comparator misses the cache the same way
+struct LegacyDraw {
+		const LegacyMesh* indexBuffer;
+		const LegacyMaterial* material;
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		float depth;
+		uint8_t padding[148];
+		uint64_t sortKey;
+};
+
+}// namespace
+
+int main() {
+	std::mt19937 rng{ 1337 };
+	std::uniform_int_distribution<uint32_t> materialDist{ 0, MATERIAL_COUNT - 1 };
+	std::uniform_int_distribution<uint32_t> meshDist{ 0, MESH_COUNT - 1 };
+	std::uniform_real_distribution<float> depthDist{ 0.5f, 2000.f };
+
+	std::vector<LegacyMaterial> materials(MATERIAL_COUNT);
+	for (uint32_t i = 0; i < MATERIAL_COUNT; i++) {
+		materials[i] = LegacyMaterial{ .pipeline = i % PIPELINE_COUNT, .materialIndex = i };
+	}
+	std::vector<LegacyMesh> meshes(MESH_COUNT);
+	for (uint32_t i = 0; i < MESH_COUNT; i++) {
+		meshes[i].meshId = i;
+	}
+
+	std::printf("%10s %16s %16s %16s\n", "draws", "comparator ms", "std::sort keys", "radix ms");
+
+	pm::DrawKeySorter sorter;
+	for (uint32_t drawCount : DRAW_COUNTS) {
+		std::vector<LegacyDraw> draws(drawCount);
+		std::vector<uint64_t> keys(drawCount);
+		for (uint32_t i = 0; i < drawCount; i++) {
+			LegacyDraw& draw = draws[i];
+			draw.material = &materials[materialDist(rng)];
+			draw.indexBuffer = &meshes[meshDist(rng)];
+			draw.firstIndex = 0;
+			draw.indexCount = 36;
+			draw.depth = depthDist(rng);
+			draw.sortKey = pm::opaqueSortKey(pm::MaterialPass::MainColor, draw.material->pipeline, false, draw.indexBuffer->meshId, 0, 0, draw.material->materialIndex, draw.depth);
+			keys[i] = draw.sortKey;
+		}
+
+		std::vector<uint32_t> order(drawCount);
+		const double comparatorMs = pm::measureMs([&]() {
+			for (uint32_t i = 0; i < drawCount; i++) {
+				order[i] = i;
+			}
+			std::sort(order.begin(), order.end(), [&](uint32_t iA, uint32_t iB) {
+				const LegacyDraw& A = draws[iA];
+				const LegacyDraw& B = draws[iB];
+				if (A.material->pipeline != B.material->pipeline) {
+					return A.material->pipeline < B.material->pipeline;
+				}
+				if (A.indexBuffer != B.indexBuffer) {
+					return A.indexBuffer < B.indexBuffer;
+				}
+				return A.material < B.material;
+			});
+		}, ITERATIONS);
+
+		std::vector<uint64_t> sortedKeys;
+		const double keySortMs = pm::measureMs([&]() {
+			sortedKeys = keys;
+			std::sort(sortedKeys.begin(), sortedKeys.end());
+		}, ITERATIONS);
+
+		const double radixMs = pm::measureMs([&]() {
+			// copy the keys out of the draws like VulkanRenderer::sortDraws does
+			for (uint32_t i = 0; i < drawCount; i++) {
+				keys[i] = draws[i].sortKey;
+			}
+			sorter.sort(keys, order);
+		}, ITERATIONS);
+
+		for (uint32_t i = 0; i < drawCount; i++) {
+			if (keys[order[i]] != sortedKeys[i]) {
+				std::printf("radix sort order mismatch at %u\n", i);
+				return 1;
+			}
+		}
+
+		std::printf("%10u %16.3f %16.3f %16.3f\n", drawCount, comparatorMs, keySortMs, radixMs);
+	}
+
+	return 0;
+}
@@ -0,0 +1,125 @@
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include <glm/gtx/transform.hpp>
+
+#include "bench_common.h"
+#include "scene/occlusion_buffer.h"
+
+// Rasterizes a grid of buildings into the software occlusion buffer and tests
+// small boxes scattered between them, like props in a city block.
+
+namespace {
+
+constexpr uint32_t GRID_SIZE = 16;
+constexpr float GRID_SPACING = 12.f;
+constexpr uint32_t TEST_BOX_COUNT = 50'000;
+
+// unit cube from -1 to 1
+pm::OccluderMesh makeBox() {
+	pm::OccluderMesh box;
+	for (uint32_t corner = 0; corner < 8; corner++) {
+		box.positions.push_back(glm::vec3{ corner & 1 ? 1.f : -1.f, corner & 2 ? 1.f : -1.f, corner & 4 ? 1.f : -1.f });
+	}
+	box.indices = { 0, 2, 1, 1, 2, 3, 4, 5, 6, 5, 7, 6,
+		0, 1, 4, 1, 5, 4, 2, 6, 3, 3, 6, 7,
+		0, 4, 2, 2, 4, 6, 1, 3, 5, 3, 7, 5 };
+	box.radius = std::sqrt(3.f);
+	return box;
+}
+
+}// namespace
+
+int main() {
+	std::mt19937 rng{ 1337 };
+	std::uniform_real_distribution<float> height{ 4.f, 30.f };
+	std::uniform_real_distribution<float> unit{ 0.f, 1.f };
+
+	// same projection as the renderer, reversed Z and flipped Y
+	const float aspect = static_cast<float>(pm::OCCLUSION_WIDTH) / static_cast<float>(pm::OCCLUSION_HEIGHT);
+	glm::mat4 proj = glm::perspective(glm::radians(70.f), aspect, 10000.f, 0.1f);
+	proj[1][1] *= -1;
+	const glm::vec3 eye{ 0.f, 1.7f, 5.f };
+	const glm::mat4 view = glm::lookAt(eye, eye + glm::vec3{ 0.2f, 0.f, -1.f }, glm::vec3{ 0.f, 1.f, 0.f });
+	const glm::mat4 viewproj = proj * view;
+
+	// buildings fill most of each grid cell, the streets between them stay open
+	const pm::OccluderMesh box = makeBox();
+	const float gridOrigin = -0.5f * GRID_SIZE * GRID_SPACING;
+	std::vector<glm::mat4> buildings;
+	for (uint32_t z = 0; z < GRID_SIZE; z++) {
+		for (uint32_t x = 0; x < GRID_SIZE; x++) {
+			const float h = height(rng);
+			const glm::vec3 center{ gridOrigin + (x + 0.5f) * GRID_SPACING, h * 0.5f, -(z + 0.5f) * GRID_SPACING };
+			buildings.push_back(glm::translate(center) * glm::scale(glm::vec3{ GRID_SPACING * 0.35f, h * 0.5f, GRID_SPACING * 0.35f }));
+		}
+	}
+
+	struct TestBox {
+			glm::vec3 min;
+			glm::vec3 max;
+	};
+	std::vector<TestBox> testBoxes(TEST_BOX_COUNT);
+	for (TestBox& test : testBoxes) {
+		const glm::vec3 position{ gridOrigin + unit(rng) * GRID_SIZE * GRID_SPACING, 0.f, -unit(rng) * GRID_SIZE * GRID_SPACING };
+		test.min = position;
+		test.max = position + glm::vec3{ 1.f, 1.f + unit(rng), 1.f };
+	}
+
+	pm::OcclusionBuffer buffer;
+	const double rasterMs = pm::measureMs([&]() {
+		buffer.begin(viewproj);
+		for (const glm::mat4& transform : buildings) {
+			buffer.addOccluder(box, transform);
+		}
+		buffer.rasterize();
+	});
+
+	uint32_t visibleCount = 0;
+	const double testMs = pm::measureMs([&]() {
+		visibleCount = 0;
+		for (const TestBox& test : testBoxes) {
+			visibleCount += buffer.isVisible(test.min, test.max, glm::mat4{ 1.f }) ? 1 : 0;
+		}
+	});
+
+	// a box inside a building right ahead of the camera is hidden by the building's front
+	// faces, one between the camera and the first row of buildings never is
+	const glm::vec3 hiddenCenter = glm::vec3{ buildings[2 * GRID_SIZE + GRID_SIZE / 2][3] };
+	if (buffer.isVisible(hiddenCenter - glm::vec3{ 0.5f }, hiddenCenter + glm::vec3{ 0.5f }, glm::mat4{ 1.f })) {
+		std::printf("box inside a building is visible\n");
+		return 1;
+	}
+	const glm::vec3 openCenter = eye + glm::vec3{ 0.6f, -1.f, -3.f };
+	if (!buffer.isVisible(openCenter - glm::vec3{ 0.5f }, openCenter + glm::vec3{ 0.5f }, glm::mat4{ 1.f })) {
+		std::printf("box in front of every building is occluded\n");
+		return 1;
+	}
+	if (visibleCount == 0 || visibleCount == TEST_BOX_COUNT) {
+		std::printf("%u of %u scattered boxes visible, expected some in the streets and some hidden\n", visibleCount, TEST_BOX_COUNT);
+		return 1;
+	}
+
+	uint32_t coveredPixels = 0;
+	for (uint32_t i = 0; i < pm::OCCLUSION_WIDTH * pm::OCCLUSION_HEIGHT; i++) {
+		coveredPixels += buffer.depth()[i] > 0.f ? 1 : 0;
+	}
+
+#if defined(__AVX__)
+	const char* path = "AVX";
+#elif defined(__SSE2__)
+	const char* path = "SSE2";
+#else
+	const char* path = "scalar";
+#endif
+
+	std::printf("buffer: %ux%u, %s, iterations: %u\n", pm::OCCLUSION_WIDTH, pm::OCCLUSION_HEIGHT, path, pm::BENCH_ITERATIONS);
+	std::printf("occluders: %u, triangles after clipping: %u\n", buffer.occluderCount(), buffer.triangleCount());
+	std::printf("coverage                       : %8.1f %%\n", 100.0 * coveredPixels / (pm::OCCLUSION_WIDTH * pm::OCCLUSION_HEIGHT));
+	std::printf("bin + rasterize                : %8.3f ms\n", rasterMs);
+	std::printf("test %u boxes               : %8.3f ms (%.1f ns/box)\n", TEST_BOX_COUNT, testMs, testMs * 1e6 / TEST_BOX_COUNT);
+	std::printf("occluded                       : %8.1f %%\n", 100.0 * (TEST_BOX_COUNT - visibleCount) / TEST_BOX_COUNT);
+
+	return 0;
+}
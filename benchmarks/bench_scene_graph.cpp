@@ -0,0 +1,133 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <glm/gtx/transform.hpp>
+
+#include "bench_common.h"
+#include "scene/scene_graph.h"
+
+// Compares the flat SceneGraph transform update against the previous
+// shared_ptr node tree on a randomly generated 100k node hierarchy.
+
+namespace {
+
+// copy of the old pointer based scene node, kept here as the reference
+struct LegacyNode {
+		std::weak_ptr<LegacyNode> parent;
+		std::vector<std::shared_ptr<LegacyNode>> children;
+
+		glm::mat4 localTransform;
+		glm::mat4 worldTransform;
+
+		void refreshTransform(const glm::mat4& parentMatrix) {
+			worldTransform = parentMatrix * localTransform;
+			for (auto c : children) {
+				c->refreshTransform(worldTransform);
+			}
+		}
+};
+
+constexpr uint32_t NODE_COUNT = 100'000;
+constexpr uint32_t ROOT_COUNT = 64;
+
+}// namespace
+
+int main() {
+	std::mt19937 rng{ 1337 };
+	std::uniform_real_distribution<float> offset{ -1.f, 1.f };
+
+	// parents are picked among recent nodes, which gives a mix of deep chains and wide fans
+	std::vector<int32_t> parents(NODE_COUNT);
+	std::vector<glm::mat4> locals(NODE_COUNT);
+	for (uint32_t i = 0; i < NODE_COUNT; i++) {
+		if (i < ROOT_COUNT) {
+			parents[i] = pm::SceneGraph::NO_PARENT;
+		} else {
+			std::uniform_int_distribution<uint32_t> pick{ i > 256 ? i - 256 : 0, i - 1 };
+			parents[i] = static_cast<int32_t>(pick(rng));
+		}
+		locals[i] = glm::translate(glm::vec3{ offset(rng), offset(rng), offset(rng) }) * glm::rotate(offset(rng), glm::vec3{ 0.f, 1.f, 0.f });
+	}
+
+	// legacy pointer tree, nodes are allocated in a shuffled order like a real loader would
+	std::vector<std::shared_ptr<LegacyNode>> legacyNodes(NODE_COUNT);
+	std::vector<uint32_t> allocationOrder(NODE_COUNT);
+	for (uint32_t i = 0; i < NODE_COUNT; i++) {
+		allocationOrder[i] = i;
+	}
+	std::shuffle(allocationOrder.begin(), allocationOrder.end(), rng);
+	for (uint32_t i : allocationOrder) {
+		legacyNodes[i] = std::make_shared<LegacyNode>();
+		legacyNodes[i]->localTransform = locals[i];
+	}
+
+	std::vector<std::shared_ptr<LegacyNode>> legacyRoots;
+	for (uint32_t i = 0; i < NODE_COUNT; i++) {
+		if (parents[i] == pm::SceneGraph::NO_PARENT) {
+			legacyRoots.push_back(legacyNodes[i]);
+		} else {
+			legacyNodes[parents[i]]->children.push_back(legacyNodes[i]);
+			legacyNodes[i]->parent = legacyNodes[parents[i]];
+		}
+	}
+
+	pm::SceneGraph graph;
+	graph.reserve(NODE_COUNT);
+	for (uint32_t i = 0; i < NODE_COUNT; i++) {
+		graph.addNode(parents[i], locals[i]);
+	}
+
+	double legacyMs = pm::measureMs([&]() {
+		for (auto& root : legacyRoots) {
+			root->refreshTransform(glm::mat4{ 1.f });
+		}
+	});
+
+	double flatFullMs = pm::measureMs([&]() {
+		for (uint32_t i = 0; i < ROOT_COUNT; i++) {
+			graph.markDirty(i);
+		}
+		graph.updateTransforms();
+	});
+
+	// only one percent of the nodes moved this frame
+	std::uniform_int_distribution<uint32_t> pickNode{ 0, NODE_COUNT - 1 };
+	double flatPartialMs = pm::measureMs([&]() {
+		for (uint32_t i = 0; i < NODE_COUNT / 100; i++) {
+			graph.markDirty(pickNode(rng));
+		}
+		graph.updateTransforms();
+	});
+
+	double flatCleanMs = pm::measureMs([&]() {
+		graph.updateTransforms();
+	});
+
+	// both representations must agree on the final world matrices
+	for (uint32_t i = 0; i < ROOT_COUNT; i++) {
+		graph.markDirty(i);
+	}
+	graph.updateTransforms();
+
+	float maxError = 0.f;
+	for (uint32_t i = 0; i < NODE_COUNT; i++) {
+		for (int c = 0; c < 4; c++) {
+			for (int r = 0; r < 4; r++) {
+				maxError = std::max(maxError, std::abs(graph.worldTransforms[i][c][r] - legacyNodes[i]->worldTransform[c][r]));
+			}
+		}
+	}
+
+	std::printf("nodes: %u, iterations: %u\n", NODE_COUNT, pm::BENCH_ITERATIONS);
+	std::printf("legacy Node::refreshTransform   : %8.3f ms\n", legacyMs);
+	std::printf("SceneGraph full update          : %8.3f ms (%.2fx)\n", flatFullMs, legacyMs / flatFullMs);
+	std::printf("SceneGraph 1%% dirty update      : %8.3f ms (%.2fx)\n", flatPartialMs, legacyMs / flatPartialMs);
+	std::printf("SceneGraph clean update         : %8.3f ms\n", flatCleanMs);
+	std::printf("max world matrix difference     : %g\n", maxError);
+
+	return 0;
+}
@@ -7,10 +7,20 @@ layout(set = 0, binding = 0) uniform SceneData {
 	vec4 sunlightColor;
 } sceneData;
 
-layout(set = 1, binding = 0) uniform GLTFMaterialData {
+// bindless material table, see BindlessTable. every draw picks its entry with a material index
+layout(set = 1, binding = 0) uniform texture2D textures[];
+layout(set = 1, binding = 1) uniform sampler samplers[];
+
+// must match GPUMaterialData on the CPU side
+struct MaterialData {
 	vec4 colorFactors;
-	vec4 metal_rough_factors;
-} materialData;
+	vec4 metalRoughFactors;
+	uint colorTexture;
+	uint colorSampler;
+	uint metalRoughTexture;
+	uint metalRoughSampler;
+};
 
-layout(set = 1, binding = 1) uniform sampler2D colorTex;
-layout(set = 1, binding = 2) uniform sampler2D metalRoughTex;
+layout(set = 1, binding = 2, std430) readonly buffer MaterialBuffer {
+	MaterialData materials[];
+} materialBuffer;
@@ -1,19 +1,25 @@
 #version 450
 
 #extension GL_GOOGLE_include_directive : require
+#extension GL_EXT_nonuniform_qualifier : require
 
 #include "input_structures.glsl"
 
 layout (location = 0) in vec3 inNormal;
 layout (location = 1) in vec3 inColor;
 layout (location = 2) in vec2 inUV;
+layout (location = 3) flat in uint inMaterial;
 
 layout (location = 0) out vec4 outFragColor;
 
 void main() {
 	float lightValue = max(dot(inNormal, sceneData.sunlightDirection.xyz), 0.1f);
 
-	vec3 color = inColor * texture(colorTex,inUV).xyz;
+	// the indirect path mixes materials inside a draw, so the texture indices are not uniform
+	MaterialData material = materialBuffer.materials[inMaterial];
+	vec4 albedo = texture(sampler2D(textures[nonuniformEXT(material.colorTexture)], samplers[nonuniformEXT(material.colorSampler)]), inUV);
+
+	vec3 color = inColor * albedo.xyz;
 	vec3 ambient = color *  sceneData.ambientColor.xyz;
 
 	outFragColor = vec4(color * lightValue *  sceneData.sunlightColor.w + ambient, 1.0f);
@@ -0,0 +1,44 @@
+#version 460
+
+#extension GL_GOOGLE_include_directive : require
+#extension GL_EXT_buffer_reference : require
+
+#include "input_structures.glsl"
+#include "vertex_layout.glsl"
+
+layout (location = 0) out vec3 outNormal;
+layout (location = 1) out vec3 outColor;
+layout (location = 2) out vec2 outUV;
+layout (location = 3) flat out uint outMaterial;
+
+// must match GPUObjectData on the CPU side
+struct ObjectData {
+	mat4 transform;
+	vec4 sphere;
+	uint indexCount;
+	uint firstIndex;
+	uint batchId;
+	uint commandOffset;
+	VertexBuffer vertexBuffer;
+	uint materialIndex;
+	uint objectId;
+};
+
+layout(set = 2, binding = 0, std430) readonly buffer ObjectBuffer {
+	ObjectData objects[];
+} objectBuffer;
+
+void main() {
+	// the culling pass stores the object index in firstInstance
+	ObjectData object = objectBuffer.objects[gl_InstanceIndex];
+	DecodedVertex v = loadVertex(object.vertexBuffer, uint(gl_VertexIndex));
+
+	vec4 position = vec4(v.position, 1.0f);
+
+	gl_Position =  sceneData.viewproj * object.transform * position;
+
+	outNormal = (object.transform * vec4(v.normal, 0.f)).xyz;
+	outColor = v.color.xyz * materialBuffer.materials[object.materialIndex].colorFactors.xyz;
+	outUV = v.uv;
+	outMaterial = object.materialIndex;
+}
@@ -0,0 +1,97 @@
+// vertex pulling for the layout selected with PM_VERTEX_LAYOUT, must match src/scene/vertex_layout.h
+// 0: full, 1: compact, 2: quantized
+
+#ifndef PM_VERTEX_LAYOUT
+#define PM_VERTEX_LAYOUT 1
+#endif
+
+struct DecodedVertex {
+	vec3 position;
+	vec3 normal;
+	vec2 uv;
+	vec4 color;
+};
+
+#if PM_VERTEX_LAYOUT == 0
+
+struct Vertex {
+	vec3 position;
+	float uv_x;
+	vec3 normal;
+	float uv_y;
+	vec4 color;
+};
+
+layout(buffer_reference, std430) readonly buffer VertexBuffer {
+	Vertex vertices[];
+};
+
+#else
+
+vec3 decodeOctahedral(uint packed) {
+	vec2 e = unpackSnorm2x16(packed);
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0) {
+		n.xy = (1.0 - abs(e.yx)) * vec2(e.x >= 0.0 ? 1.0 : -1.0, e.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return normalize(n);
+}
+
+#if PM_VERTEX_LAYOUT == 1
+
+struct Vertex {
+	float px;
+	float py;
+	float pz;
+	uint normal;
+	uint uv;
+	uint color;
+};
+
+layout(buffer_reference, std430) readonly buffer VertexBuffer {
+	Vertex vertices[];
+};
+
+#else
+
+struct Vertex {
+	uint positionXY;
+	uint positionZ;
+	uint normal;
+	uint uv;
+	uint color;
+};
+
+// the mesh bounds used to quantize positions come first
+layout(buffer_reference, std430) readonly buffer VertexBuffer {
+	vec4 positionOffset;
+	vec4 positionScale;
+	Vertex vertices[];
+};
+
+#endif
+#endif
+
+DecodedVertex loadVertex(VertexBuffer vertexBuffer, uint index) {
+	Vertex v = vertexBuffer.vertices[index];
+	DecodedVertex decoded;
+
+#if PM_VERTEX_LAYOUT == 0
+	decoded.position = v.position;
+	decoded.normal = v.normal;
+	decoded.uv = vec2(v.uv_x, v.uv_y);
+	decoded.color = v.color;
+#else
+#if PM_VERTEX_LAYOUT == 1
+	decoded.position = vec3(v.px, v.py, v.pz);
+#else
+	vec3 unorm = vec3(unpackUnorm2x16(v.positionXY), unpackUnorm2x16(v.positionZ).x);
+	decoded.position = vertexBuffer.positionOffset.xyz + unorm * vertexBuffer.positionScale.xyz;
+#endif
+	decoded.normal = decodeOctahedral(v.normal);
+	decoded.uv = unpackHalf2x16(v.uv);
+	decoded.color = unpackUnorm4x8(v.color);
+#endif
+
+	return decoded;
+}
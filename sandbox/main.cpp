@@ -1,9 +1,75 @@
+#include <charconv>
+#include <iostream>
+#include <optional>
+#include <string_view>
+
 #include "primal.h"
 
-int main() {
+namespace {
+
+void printUsage() {
+	std::cout << "Usage: sandbox [--headless] [--software] [--frames N] [--readback N] [--screenshot file.ppm]\n"
+						 "               [--benchmark report.json] [--camera-path file] [--warmup N] [--dt seconds]\n";
+}
+
+// the whole argument has to be a number, anything else is a usage error
+template<typename T>
+std::optional<T> parseNumber(std::string_view text) {
+	T value{};
+	const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+	if (error != std::errc{} || end != text.data() + text.size()) {
+		return std::nullopt;
+	}
+	return value;
+}
+
+}// namespace
+
+int main(int argc, char** argv) {
+	pm::PrimalAppConfig config{};
+	for (int i = 1; i < argc; i++) {
+		const std::string_view arg = argv[i];
+		const bool hasValue = i + 1 < argc;
+		bool valid = true;
+		if (arg == "--headless") {
+			config.headless = true;
+		} else if (arg == "--software") {
+			config.softwareDevice = true;
+		} else if (arg == "--frames" && hasValue) {
+			const auto frames = parseNumber<uint32_t>(argv[++i]);
+			valid = frames.has_value();
+			config.frameCount = frames.value_or(0);
+		} else if (arg == "--readback" && hasValue) {
+			const auto interval = parseNumber<uint32_t>(argv[++i]);
+			valid = interval.has_value();
+			config.readbackInterval = interval.value_or(0);
+		} else if (arg == "--screenshot" && hasValue) {
+			config.screenshotPath = argv[++i];
+		} else if (arg == "--benchmark" && hasValue) {
+			config.benchmarkReportPath = argv[++i];
+		} else if (arg == "--camera-path" && hasValue) {
+			config.cameraPathFile = argv[++i];
+		} else if (arg == "--warmup" && hasValue) {
+			const auto warmup = parseNumber<uint32_t>(argv[++i]);
+			valid = warmup.has_value();
+			config.warmupFrames = warmup.value_or(0);
+		} else if (arg == "--dt" && hasValue) {
+			const auto timeStep = parseNumber<float>(argv[++i]);
+			valid = timeStep.has_value() && *timeStep >= 0.f;
+			config.benchmarkTimeStep = timeStep.value_or(0.f);
+		} else {
+			valid = false;
+		}
+
+		if (!valid) {
+			printUsage();
+			return 1;
+		}
+	}
+
 	pm::PrimalApp app;
 
-	app.init();
+	app.init(config);
 	app.run();
 	app.cleanup();
 
@@ -0,0 +1,320 @@
+#include "benchmark.h"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string_view>
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+#include "json.h"
+
+namespace pm {
+
+namespace {
+
+constexpr double MB = 1024.0 * 1024.0;
+
+struct MetricSource {
+		const char* name;
+		double (*value)(const BenchmarkFrame& frame);
+		// digits after the point in the frames array, the summary always has 3
+		int precision;
+		// 0 means the frame has no sample, for the GPU time that arrives late
+		bool zeroIsMissing;
+};
+
+// the report order, every metric is "higher is worse"
+const std::array<MetricSource, 8> METRICS = { {
+	{ "cpuFrameMs", [](const BenchmarkFrame& f) { return static_cast<double>(f.cpuFrameTime); }, 3, false },
+	{ "gpuFrameMs", [](const BenchmarkFrame& f) { return static_cast<double>(f.gpuFrameTime); }, 3, true },
+	{ "sceneUpdateMs", [](const BenchmarkFrame& f) { return static_cast<double>(f.sceneUpdateTime); }, 3, false },
+	{ "meshDrawMs", [](const BenchmarkFrame& f) { return static_cast<double>(f.meshDrawTime); }, 3, false },
+	{ "drawCalls", [](const BenchmarkFrame& f) { return static_cast<double>(f.drawCallCount); }, 0, false },
+	{ "triangles", [](const BenchmarkFrame& f) { return static_cast<double>(f.triangleCount); }, 0, false },
+	{ "gpuMemoryMB", [](const BenchmarkFrame& f) { return static_cast<double>(f.gpuMemoryBytes) / MB; }, 3, false },
+	{ "cpuMemoryMB", [](const BenchmarkFrame& f) { return static_cast<double>(f.cpuMemoryBytes) / MB; }, 3, false },
+} };
+
+// the statistics of every metric, in report order
+const std::array<std::pair<const char*, double BenchmarkMetric::*>, 6> METRIC_STATS = { {
+	{ "min", &BenchmarkMetric::min },
+	{ "avg", &BenchmarkMetric::avg },
+	{ "p50", &BenchmarkMetric::p50 },
+	{ "p90", &BenchmarkMetric::p90 },
+	{ "p99", &BenchmarkMetric::p99 },
+	{ "max", &BenchmarkMetric::max },
+} };
+
+// nearest rank, like RollingTimings
+double percentile(std::span<const double> sorted, size_t percent) {
+	const size_t index = (sorted.size() * percent + 99) / 100 - 1;
+	return sorted[std::min(index, sorted.size() - 1)];
+}
+
+// Just enough JSON to read reports back, anything but the summary is skipped
+class JsonReader {
+	public:
+		explicit JsonReader(std::string_view text) : m_text(text) {}
+
+		// true and past c when c is the next character
+		bool consume(char c) {
+			skipWhitespace();
+			if (m_pos < m_text.size() && m_text[m_pos] == c) {
+				m_pos++;
+				return true;
+			}
+			return false;
+		}
+
+		std::optional<std::string> string() {
+			if (!consume('"')) {
+				return {};
+			}
+			std::string value;
+			while (m_pos < m_text.size()) {
+				const char c = m_text[m_pos++];
+				if (c == '"') {
+					return value;
+				}
+				// NOTE: escapes are kept as the character after the backslash. \u escapes only appear in
+				// the run settings, which are skipped
+				if (c == '\\' && m_pos < m_text.size()) {
+					value += m_text[m_pos++];
+				} else {
+					value += c;
+				}
+			}
+			return {};
+		}
+
+		std::optional<double> number() {
+			skipWhitespace();
+			double value{};
+			const auto [end, error] = std::from_chars(m_text.data() + m_pos, m_text.data() + m_text.size(), value);
+			if (error != std::errc{}) {
+				return {};
+			}
+			m_pos = static_cast<size_t>(end - m_text.data());
+			return value;
+		}
+
+		bool skipValue() {
+			skipWhitespace();
+			if (m_pos >= m_text.size()) {
+				return false;
+			}
+			if (m_text[m_pos] == '"') {
+				return string().has_value();
+			}
+			if (m_text[m_pos] != '{' && m_text[m_pos] != '[') {
+				// numbers, true, false and null
+				while (m_pos < m_text.size() && std::string_view{ ",}] \t\r\n" }.find(m_text[m_pos]) == std::string_view::npos) {
+					m_pos++;
+				}
+				return true;
+			}
+
+			uint32_t depth = 0;
+			while (m_pos < m_text.size()) {
+				const char c = m_text[m_pos];
+				if (c == '"') {
+					if (!string()) {
+						return false;
+					}
+					continue;
+				}
+				m_pos++;
+				if (c == '{' || c == '[') {
+					depth++;
+				} else if ((c == '}' || c == ']') && --depth == 0) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+	private:
+		void skipWhitespace() {
+			while (m_pos < m_text.size() && std::string_view{ " \t\r\n" }.find(m_text[m_pos]) != std::string_view::npos) {
+				m_pos++;
+			}
+		}
+
+		std::string_view m_text;
+		size_t m_pos{ 0 };
+};
+
+std::optional<BenchmarkMetric> readMetric(JsonReader& json, std::string name) {
+	BenchmarkMetric metric{ .name = std::move(name) };
+	if (!json.consume('{')) {
+		return {};
+	}
+	while (!json.consume('}')) {
+		const auto stat = json.string();
+		if (!stat || !json.consume(':')) {
+			return {};
+		}
+		const auto value = json.number();
+		if (!value) {
+			return {};
+		}
+		for (const auto& [statName, member] : METRIC_STATS) {
+			if (*stat == statName) {
+				metric.*member = *value;
+			}
+		}
+		json.consume(',');
+	}
+	return metric;
+}
+
+}// namespace
+
+std::vector<BenchmarkMetric> summarizeBenchmark(std::span<const BenchmarkFrame> frames) {
+	std::vector<BenchmarkMetric> summary;
+	std::vector<double> values;
+	for (const MetricSource& source : METRICS) {
+		values.clear();
+		for (const BenchmarkFrame& frame : frames) {
+			const double value = source.value(frame);
+			if (!source.zeroIsMissing || value > 0.0) {
+				values.push_back(value);
+			}
+		}
+		if (values.empty()) {
+			continue;
+		}
+
+		std::sort(values.begin(), values.end());
+		double sum = 0.0;
+		for (double value : values) {
+			sum += value;
+		}
+		summary.push_back(BenchmarkMetric{
+			.name = source.name,
+			.min = values.front(),
+			.avg = sum / static_cast<double>(values.size()),
+			.p50 = percentile(values, 50),
+			.p90 = percentile(values, 90),
+			.p99 = percentile(values, 99),
+			.max = values.back() });
+	}
+	return summary;
+}
+
+bool writeBenchmarkReport(const std::string& path, const BenchmarkInfo& info, std::span<const BenchmarkFrame> frames) {
+	std::ofstream file(path);
+	if (!file.is_open()) {
+		std::cout << std::format("Failed to write benchmark report {}\n", path);
+		return false;
+	}
+
+	file << "{\n";
+	file << std::format("\t\"scene\": \"{}\",\n", escapeJson(info.scene));
+	file << std::format("\t\"device\": \"{}\",\n", escapeJson(info.device));
+	file << std::format("\t\"renderPath\": \"{}\",\n", escapeJson(info.renderPath));
+	file << std::format("\t\"cameraPath\": \"{}\",\n", escapeJson(info.cameraPath));
+	file << std::format("\t\"width\": {},\n\t\"height\": {},\n", info.width, info.height);
+	file << std::format("\t\"timeStep\": {},\n\t\"warmupFrames\": {},\n\t\"frameCount\": {},\n", info.timeStep, info.warmupFrames, frames.size());
+
+	const std::vector<BenchmarkMetric> summary = summarizeBenchmark(frames);
+	file << "\t\"summary\": {";
+	for (size_t i = 0; i < summary.size(); i++) {
+		file << std::format("{}\n\t\t\"{}\": {{", i > 0 ? "," : "", summary[i].name);
+		for (size_t stat = 0; stat < METRIC_STATS.size(); stat++) {
+			file << std::format("{}\"{}\": {:.3f}", stat > 0 ? ", " : "", METRIC_STATS[stat].first, summary[i].*METRIC_STATS[stat].second);
+		}
+		file << "}";
+	}
+	file << "\n\t},\n";
+
+	file << "\t\"frames\": [";
+	for (size_t i = 0; i < frames.size(); i++) {
+		file << std::format("{}\n\t\t{{", i > 0 ? "," : "");
+		for (size_t m = 0; m < METRICS.size(); m++) {
+			file << std::format("{}\"{}\": {:.{}f}", m > 0 ? ", " : "", METRICS[m].name, METRICS[m].value(frames[i]), METRICS[m].precision);
+		}
+		file << "}";
+	}
+	file << "\n\t]\n}\n";
+
+	std::cout << std::format("Wrote benchmark report of {} frames to {}\n", frames.size(), path);
+	return true;
+}
+
+std::optional<std::vector<BenchmarkMetric>> readBenchmarkSummary(const std::string& path) {
+	std::ifstream file(path);
+	if (!file.is_open()) {
+		std::cout << std::format("Failed to open benchmark report {}\n", path);
+		return {};
+	}
+	std::stringstream buffer;
+	buffer << file.rdbuf();
+	const std::string text = buffer.str();
+
+	auto invalid = [&]() {
+		std::cout << std::format("{} is not a benchmark report\n", path);
+		return std::optional<std::vector<BenchmarkMetric>>{};
+	};
+
+	JsonReader json(text);
+	std::optional<std::vector<BenchmarkMetric>> summary;
+	if (!json.consume('{')) {
+		return invalid();
+	}
+	while (!json.consume('}')) {
+		const auto key = json.string();
+		if (!key || !json.consume(':')) {
+			return invalid();
+		}
+
+		if (*key == "summary") {
+			summary.emplace();
+			if (!json.consume('{')) {
+				return invalid();
+			}
+			while (!json.consume('}')) {
+				auto name = json.string();
+				if (!name || !json.consume(':')) {
+					return invalid();
+				}
+				auto metric = readMetric(json, std::move(*name));
+				if (!metric) {
+					return invalid();
+				}
+				summary->push_back(std::move(*metric));
+				json.consume(',');
+			}
+		} else if (!json.skipValue()) {
+			return invalid();
+		}
+		json.consume(',');
+	}
+
+	if (!summary) {
+		return invalid();
+	}
+	return summary;
+}
+
+uint64_t processResidentBytes() {
+#if defined(__linux__)
+	// total and resident pages
+	std::ifstream statm("/proc/self/statm");
+	uint64_t totalPages = 0;
+	uint64_t residentPages = 0;
+	if (statm >> totalPages >> residentPages) {
+		return residentPages * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+	}
+#endif
+	return 0;
+}
+
+}// namespace pm
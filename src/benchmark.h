@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+// Reports of the deterministic benchmark mode (PrimalAppConfig::benchmarkReportPath).
+// The JSON report holds the run's settings, percentiles of every metric and the raw
+// frames. tools/bench_compare reads the summaries of two reports and flags regressions.
+namespace pm {
+
+// one measured frame
+struct BenchmarkFrame {
+		// milliseconds, wall time of the whole frame
+		float cpuFrameTime;
+		// read back FRAME_OVERLAP frames late, 0 when no timestamps arrived this frame
+		float gpuFrameTime;
+		float sceneUpdateTime;
+		float meshDrawTime;
+		uint32_t drawCallCount;
+		uint32_t triangleCount;
+		uint64_t gpuMemoryBytes;
+		uint64_t cpuMemoryBytes;
+};
+
+struct BenchmarkInfo {
+		std::string scene;
+		std::string device;
+		std::string renderPath;
+		// "scripted orbit" or the path file
+		std::string cameraPath;
+		uint32_t width;
+		uint32_t height;
+		// seconds the camera moves per frame
+		float timeStep;
+		// frames drawn before the measured ones, not part of the report
+		uint32_t warmupFrames;
+};
+
+struct BenchmarkMetric {
+		std::string name;
+		double min;
+		double avg;
+		double p50;
+		double p90;
+		double p99;
+		double max;
+};
+
+// one entry per metric in a fixed order. metrics that were never sampled (the GPU
+// frame time without timestamp queries) are left out
+std::vector<BenchmarkMetric> summarizeBenchmark(std::span<const BenchmarkFrame> frames);
+
+bool writeBenchmarkReport(const std::string& path, const BenchmarkInfo& info, std::span<const BenchmarkFrame> frames);
+// the "summary" of a report written by writeBenchmarkReport
+std::optional<std::vector<BenchmarkMetric>> readBenchmarkSummary(const std::string& path);
+
+// resident set size of this process, 0 where it can't be queried
+uint64_t processResidentBytes();
+
+}// namespace pm
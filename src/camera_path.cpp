@@ -0,0 +1,123 @@
+#include "camera_path.h"
+
+#include <algorithm>
+#include <cassert>
+#include <fstream>
+#include <numbers>
+#include <sstream>
+
+#include <glm/gtx/spline.hpp>
+
+namespace pm {
+
+void CameraPath::addKey(const CameraKey& key) {
+	assert(m_keys.empty() || key.time >= m_keys.back().time);
+	m_keys.push_back(key);
+}
+
+CameraKey CameraPath::sample(float time) const {
+	assert(!m_keys.empty());
+	if (m_keys.size() == 1 || time <= m_keys.front().time) {
+		return m_keys.front();
+	}
+	if (time >= m_keys.back().time) {
+		return m_keys.back();
+	}
+
+	// the segment between k1 and k2 contains time, k0 and k3 only shape the tangents
+	const auto next = std::upper_bound(m_keys.begin(), m_keys.end(), time, [](float t, const CameraKey& key) { return t < key.time; });
+	const size_t i2 = static_cast<size_t>(next - m_keys.begin());
+	const size_t i1 = i2 - 1;
+	const CameraKey& k0 = m_keys[i1 > 0 ? i1 - 1 : 0];
+	const CameraKey& k1 = m_keys[i1];
+	const CameraKey& k2 = m_keys[i2];
+	const CameraKey& k3 = m_keys[std::min(i2 + 1, m_keys.size() - 1)];
+
+	const float span = k2.time - k1.time;
+	const float s = span > 0.f ? (time - k1.time) / span : 0.f;
+
+	const glm::vec2 angles = glm::catmullRom(glm::vec2{ k0.pitch, k0.yaw }, glm::vec2{ k1.pitch, k1.yaw }, glm::vec2{ k2.pitch, k2.yaw }, glm::vec2{ k3.pitch, k3.yaw }, s);
+	return CameraKey{
+		.time = time,
+		.position = glm::catmullRom(k0.position, k1.position, k2.position, k3.position, s),
+		.pitch = angles.x,
+		.yaw = angles.y
+	};
+}
+
+void CameraPath::apply(float time, Camera& camera) const {
+	const CameraKey key = sample(time);
+	camera.position = key.position;
+	camera.pitch = key.pitch;
+	camera.yaw = key.yaw;
+	camera.velocity = glm::vec3(0.f);
+}
+
+bool CameraPath::save(const std::string& path) const {
+	std::ofstream file(path);
+	if (!file.is_open()) {
+		std::cout << std::format("Failed to write camera path {}\n", path);
+		return false;
+	}
+
+	file << "# time x y z pitch yaw\n";
+	for (const CameraKey& key : m_keys) {
+		file << std::format("{} {} {} {} {} {}\n", key.time, key.position.x, key.position.y, key.position.z, key.pitch, key.yaw);
+	}
+	return true;
+}
+
+std::optional<CameraPath> CameraPath::load(const std::string& path) {
+	std::ifstream file(path);
+	if (!file.is_open()) {
+		std::cout << std::format("Failed to open camera path {}\n", path);
+		return {};
+	}
+
+	CameraPath cameraPath;
+	std::string line;
+	for (size_t lineNumber = 1; std::getline(file, line); lineNumber++) {
+		if (line.empty() || line.front() == '#') {
+			continue;
+		}
+
+		std::istringstream values(line);
+		CameraKey key{};
+		if (!(values >> key.time >> key.position.x >> key.position.y >> key.position.z >> key.pitch >> key.yaw)) {
+			std::cout << std::format("{}:{}: expected 'time x y z pitch yaw'\n", path, lineNumber);
+			return {};
+		}
+		if (!cameraPath.empty() && key.time < cameraPath.m_keys.back().time) {
+			std::cout << std::format("{}:{}: keys must be in increasing time\n", path, lineNumber);
+			return {};
+		}
+		cameraPath.addKey(key);
+	}
+
+	if (cameraPath.empty()) {
+		std::cout << std::format("Camera path {} has no keys\n", path);
+		return {};
+	}
+	return cameraPath;
+}
+
+CameraPath CameraPath::orbit(const glm::vec3& center, float radius, float height, float duration, uint32_t keyCount) {
+	assert(keyCount >= 2);
+	CameraPath path;
+	// looking at center from above or below it
+	const float pitch = std::atan2(-height, radius);
+	for (uint32_t i = 0; i < keyCount; i++) {
+		const float t = static_cast<float>(i) / static_cast<float>(keyCount - 1);
+		const float angle = t * 2.f * std::numbers::pi_v<float>;
+		path.addKey(CameraKey{
+			.time = t * duration,
+			.position = center + glm::vec3{ std::sin(angle) * radius, height, std::cos(angle) * radius },
+			.pitch = pitch,
+			// the camera looks down -z, so facing center is a yaw of -angle. it keeps
+			// growing instead of wrapping, which would make the spline spin around
+			.yaw = -angle });
+	}
+	return path;
+}
+
+}// namespace pm
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <optional>
+
+#include "camera.h"
+
+namespace pm {
+
+struct CameraKey {
+		// seconds from the start of the path
+		float time;
+		glm::vec3 position;
+		float pitch;
+		float yaw;
+};
+
+// Camera keys sampled with a Catmull-Rom spline, so the camera passes through every key
+// without the jumps of linear interpolation. Drives the camera of benchmark runs, which
+// then see the same frames on every run.
+class CameraPath {
+	public:
+		// keys must be added in increasing time
+		void addKey(const CameraKey& key);
+		void clear() { m_keys.clear(); }
+
+		bool empty() const { return m_keys.empty(); }
+		size_t keyCount() const { return m_keys.size(); }
+		float duration() const { return m_keys.empty() ? 0.f : m_keys.back().time; }
+
+		// time is clamped to the path
+		CameraKey sample(float time) const;
+		// moves the camera to the sample and stops it, so Camera::update doesn't move it further
+		void apply(float time, Camera& camera) const;
+
+		// one "time x y z pitch yaw" line per key
+		bool save(const std::string& path) const;
+		static std::optional<CameraPath> load(const std::string& path);
+
+		// circles around center at the given radius and height, always looking at center
+		static CameraPath orbit(const glm::vec3& center, float radius, float height, float duration, uint32_t keyCount = 16);
+
+	private:
+		std::vector<CameraKey> m_keys;
+};
+
+}// namespace pm
@@ -0,0 +1,23 @@
+#include "json.h"
+
+#include <format>
+
+namespace pm {
+
+std::string escapeJson(std::string_view text) {
+	std::string escaped;
+	escaped.reserve(text.size());
+	for (char c : text) {
+		if (c == '"' || c == '\\') {
+			escaped += '\\';
+			escaped += c;
+		} else if (static_cast<unsigned char>(c) < 0x20) {
+			escaped += std::format("\\u{:04x}", static_cast<unsigned char>(c));
+		} else {
+			escaped += c;
+		}
+	}
+	return escaped;
+}
+
+}// namespace pm
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace pm {
+
+// text for a JSON string literal, without the quotes. quotes and backslashes get a
+// backslash, control characters become \u escapes
+std::string escapeJson(std::string_view text);
+
+}// namespace pm
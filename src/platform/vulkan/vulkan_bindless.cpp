@@ -0,0 +1,220 @@
+#include "vulkan_bindless.h"
+
+namespace pm {
+
+template<typename Handle>
+std::optional<std::pair<uint32_t, bool>> BindlessTable::Slots<Handle>::acquire(Handle handle, uint32_t capacity) {
+	auto it = indices.find(handle);
+	if (it != indices.end()) {
+		refCounts[it->second]++;
+		return std::pair{ it->second, false };
+	}
+
+	uint32_t slot = 0;
+	if (!freeList.empty()) {
+		slot = freeList.back();
+		freeList.pop_back();
+	} else if (handles.size() < capacity) {
+		slot = static_cast<uint32_t>(handles.size());
+		handles.push_back(VK_NULL_HANDLE);
+		refCounts.push_back(0);
+	} else {
+		return std::nullopt;
+	}
+
+	indices[handle] = slot;
+	handles[slot] = handle;
+	refCounts[slot] = 1;
+	liveCount++;
+	return std::pair{ slot, true };
+}
+
+template<typename Handle>
+void BindlessTable::Slots<Handle>::release(uint32_t slot) {
+	if (slot >= refCounts.size() || refCounts[slot] == 0) {
+		return;
+	}
+	if (--refCounts[slot] > 0) {
+		return;
+	}
+
+	// the descriptor is left as is, nothing indexes a free slot
+	indices.erase(handles[slot]);
+	handles[slot] = VK_NULL_HANDLE;
+	freeList.push_back(slot);
+	liveCount--;
+}
+
+void BindlessTable::init(VkDevice device, VmaAllocator allocator) {
+	m_device = device;
+	m_allocator = allocator;
+
+	VkDescriptorSetLayoutBinding bindings[3]{};
+	bindings[0].binding = 0;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+	bindings[0].descriptorCount = MAX_BINDLESS_TEXTURES;
+	bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	bindings[1].binding = 1;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+	bindings[1].descriptorCount = MAX_BINDLESS_SAMPLERS;
+	bindings[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	bindings[2].binding = 2;
+	bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[2].descriptorCount = 1;
+	bindings[2].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	// slots are filled as scenes load, most of them stay empty
+	const VkDescriptorBindingFlags arrayFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+	VkDescriptorBindingFlags bindingFlags[3] = { arrayFlags, arrayFlags, 0 };
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfo flagsInfo = { .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO };
+	flagsInfo.bindingCount = 3;
+	flagsInfo.pBindingFlags = bindingFlags;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = { .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+	layoutInfo.pNext = &flagsInfo;
+	layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+	layoutInfo.bindingCount = 3;
+	layoutInfo.pBindings = bindings;
+	VK_CHECK(vkCreateDescriptorSetLayout(m_device, &layoutInfo, nullptr, &m_layout));
+
+	VkDescriptorPoolSize poolSizes[] = {
+		{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, MAX_BINDLESS_TEXTURES },
+		{ VK_DESCRIPTOR_TYPE_SAMPLER, MAX_BINDLESS_SAMPLERS },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 }
+	};
+
+	VkDescriptorPoolCreateInfo poolInfo = { .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+	poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+	poolInfo.maxSets = 1;
+	poolInfo.poolSizeCount = 3;
+	poolInfo.pPoolSizes = poolSizes;
+	VK_CHECK(vkCreateDescriptorPool(m_device, &poolInfo, nullptr, &m_pool));
+
+	VkDescriptorSetAllocateInfo allocInfo = { .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+	allocInfo.descriptorPool = m_pool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &m_layout;
+	VK_CHECK(vkAllocateDescriptorSets(m_device, &allocInfo, &m_set));
+
+	VkBufferCreateInfo bufferInfo = { .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+	bufferInfo.size = MAX_BINDLESS_MATERIALS * sizeof(GPUMaterialData);
+	bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+	VmaAllocationCreateInfo vmaallocInfo = {};
+	vmaallocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+	vmaallocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+	VK_CHECK(vmaCreateBuffer(m_allocator, &bufferInfo, &vmaallocInfo, &m_materialBuffer.buffer, &m_materialBuffer.allocation, &m_materialBuffer.info));
+	m_materials = static_cast<GPUMaterialData*>(m_materialBuffer.info.pMappedData);
+
+	VkDescriptorBufferInfo materialInfo{ .buffer = m_materialBuffer.buffer, .offset = 0, .range = VK_WHOLE_SIZE };
+	VkWriteDescriptorSet write = { .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+	write.dstSet = m_set;
+	write.dstBinding = 2;
+	write.descriptorCount = 1;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	write.pBufferInfo = &materialInfo;
+	vkUpdateDescriptorSets(m_device, 1, &write, 0, nullptr);
+}
+
+void BindlessTable::cleanup() {
+	vmaDestroyBuffer(m_allocator, m_materialBuffer.buffer, m_materialBuffer.allocation);
+	vkDestroyDescriptorPool(m_device, m_pool, nullptr);
+	vkDestroyDescriptorSetLayout(m_device, m_layout, nullptr);
+}
+
+void BindlessTable::writeDescriptor(uint32_t binding, uint32_t slot, VkImageView imageView, VkSampler sampler) {
+	VkDescriptorImageInfo imageInfo{ .sampler = sampler, .imageView = imageView, .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+
+	VkWriteDescriptorSet write = { .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+	write.dstSet = m_set;
+	write.dstBinding = binding;
+	write.dstArrayElement = slot;
+	write.descriptorCount = 1;
+	write.descriptorType = imageView != VK_NULL_HANDLE ? VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLER;
+	write.pImageInfo = &imageInfo;
+	vkUpdateDescriptorSets(m_device, 1, &write, 0, nullptr);
+}
+
+uint32_t BindlessTable::addTexture(VkImageView imageView) {
+	auto slot = m_textures.acquire(imageView, MAX_BINDLESS_TEXTURES);
+	if (!slot.has_value()) {
+		std::cout << std::format("Bindless texture table full ({} textures)\n", MAX_BINDLESS_TEXTURES);
+		// the fallback is referenced like any other slot so releasing it stays balanced
+		m_textures.refCounts[0]++;
+		return 0;
+	}
+	if (slot->second) {
+		writeDescriptor(0, slot->first, imageView, VK_NULL_HANDLE);
+	}
+	return slot->first;
+}
+
+uint32_t BindlessTable::addSampler(VkSampler sampler) {
+	auto slot = m_samplers.acquire(sampler, MAX_BINDLESS_SAMPLERS);
+	if (!slot.has_value()) {
+		std::cout << std::format("Bindless sampler table full ({} samplers)\n", MAX_BINDLESS_SAMPLERS);
+		m_samplers.refCounts[0]++;
+		return 0;
+	}
+	if (slot->second) {
+		writeDescriptor(1, slot->first, VK_NULL_HANDLE, sampler);
+	}
+	return slot->first;
+}
+
+void BindlessTable::releaseTexture(uint32_t slot) {
+	m_textures.release(slot);
+}
+
+void BindlessTable::releaseSampler(uint32_t slot) {
+	m_samplers.release(slot);
+}
+
+uint32_t BindlessTable::addMaterial(const GPUMaterialData& material) {
+	uint32_t slot = 0;
+	if (!m_freeMaterials.empty()) {
+		slot = m_freeMaterials.back();
+		m_freeMaterials.pop_back();
+	} else if (m_materialCopies.size() < MAX_BINDLESS_MATERIALS) {
+		slot = static_cast<uint32_t>(m_materialCopies.size());
+		m_materialCopies.emplace_back();
+		m_materialUsed.push_back(0);
+	} else {
+		std::cout << std::format("Bindless material table full ({} materials)\n", MAX_BINDLESS_MATERIALS);
+		// nothing owns the references taken for this material
+		releaseTexture(material.colorTexture);
+		releaseSampler(material.colorSampler);
+		releaseTexture(material.metalRoughTexture);
+		releaseSampler(material.metalRoughSampler);
+		return 0;
+	}
+
+	// the caller's references move to the material
+	m_materials[slot] = material;
+	m_materialCopies[slot] = material;
+	m_materialUsed[slot] = 1;
+	m_materialLiveCount++;
+	return slot;
+}
+
+void BindlessTable::releaseMaterial(uint32_t slot) {
+	if (slot >= m_materialUsed.size() || m_materialUsed[slot] == 0) {
+		return;
+	}
+
+	// the mapped copy lives in write combined memory, read the CPU one
+	const GPUMaterialData& material = m_materialCopies[slot];
+	releaseTexture(material.colorTexture);
+	releaseSampler(material.colorSampler);
+	releaseTexture(material.metalRoughTexture);
+	releaseSampler(material.metalRoughSampler);
+
+	m_materialUsed[slot] = 0;
+	m_freeMaterials.push_back(slot);
+	m_materialLiveCount--;
+}
+
+}// namespace pm
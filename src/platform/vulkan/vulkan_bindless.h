@@ -0,0 +1,93 @@
+#pragma once
+
+#include <unordered_map>
+
+#include "vk_types.h"
+
+namespace pm {
+
+// sizes of the descriptor arrays, slot 0 of each one is the fallback
+constexpr uint32_t MAX_BINDLESS_TEXTURES = 4096;
+constexpr uint32_t MAX_BINDLESS_SAMPLERS = 64;
+constexpr uint32_t MAX_BINDLESS_MATERIALS = 4096;
+
+// one entry of the material buffer, must match MaterialData in input_structures.glsl
+struct GPUMaterialData {
+		glm::vec4 colorFactors;
+		glm::vec4 metalRoughFactors;
+		// slots in the texture and sampler arrays
+		uint32_t colorTexture;
+		uint32_t colorSampler;
+		uint32_t metalRoughTexture;
+		uint32_t metalRoughSampler;
+};
+static_assert(sizeof(GPUMaterialData) == 48, "GPUMaterialData must match the std430 layout in the shaders");
+
+// Global descriptor table for every material, bound once as set 1 of the mesh pipelines:
+//   binding 0: texture2D array, binding 1: sampler array, binding 2: GPUMaterialData buffer.
+// Draws select their material with an index (push constant or object buffer), so switching
+// materials never touches descriptors.
+// The arrays are update after bind and partially bound, new textures can be added while
+// frames using the set are in flight. Images and samplers are reference counted, the
+// same handle always maps to the same slot.
+// NOTE: not thread safe, and released slots are reused right away. Only release what the
+// GPU is done with, after vkDeviceWaitIdle or the fences of every frame that used it.
+class BindlessTable {
+	public:
+		void init(VkDevice device, VmaAllocator allocator);
+		void cleanup();
+
+		// 0 when the table is full
+		uint32_t addTexture(VkImageView imageView);
+		uint32_t addSampler(VkSampler sampler);
+		void releaseTexture(uint32_t slot);
+		void releaseSampler(uint32_t slot);
+
+		// takes over the caller's references on the textures and samplers the material points
+		// at (from addTexture/addSampler), no extra reference is added. they are released with
+		// the material, or right away when the table is full and 0 is returned
+		uint32_t addMaterial(const GPUMaterialData& material);
+		void releaseMaterial(uint32_t slot);
+
+		VkDescriptorSetLayout layout() const { return m_layout; }
+		VkDescriptorSet set() const { return m_set; }
+		uint32_t textureCount() const { return m_textures.liveCount; }
+		uint32_t materialCount() const { return m_materialLiveCount; }
+
+	private:
+		// reference counted slots of one descriptor array
+		template<typename Handle>
+		struct Slots {
+				std::unordered_map<Handle, uint32_t> indices;
+				std::vector<Handle> handles;
+				std::vector<uint32_t> refCounts;
+				std::vector<uint32_t> freeList;
+				uint32_t liveCount{ 0 };
+
+				// slot of handle and whether its descriptor has to be written, nullopt when full
+				std::optional<std::pair<uint32_t, bool>> acquire(Handle handle, uint32_t capacity);
+				void release(uint32_t slot);
+		};
+
+		void writeDescriptor(uint32_t binding, uint32_t slot, VkImageView imageView, VkSampler sampler);
+
+		VkDevice m_device{ VK_NULL_HANDLE };
+		VmaAllocator m_allocator{ VK_NULL_HANDLE };
+
+		VkDescriptorPool m_pool{ VK_NULL_HANDLE };
+		VkDescriptorSetLayout m_layout{ VK_NULL_HANDLE };
+		VkDescriptorSet m_set{ VK_NULL_HANDLE };
+
+		Slots<VkImageView> m_textures;
+		Slots<VkSampler> m_samplers;
+
+		// persistently mapped, the GPU reads it directly
+		AllocatedBuffer m_materialBuffer{};
+		GPUMaterialData* m_materials{ nullptr };
+		std::vector<GPUMaterialData> m_materialCopies;
+		std::vector<uint32_t> m_freeMaterials;
+		std::vector<uint8_t> m_materialUsed;
+		uint32_t m_materialLiveCount{ 0 };
+};
+
+}// namespace pm
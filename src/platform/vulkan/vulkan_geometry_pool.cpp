@@ -0,0 +1,263 @@
+#include "vulkan_geometry_pool.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace pm {
+
+void RangeAllocator::init(VkDeviceSize capacity, VkDeviceSize granularity) {
+	m_capacity = capacity;
+	m_granularity = granularity;
+	m_used = 0;
+	m_allocations.clear();
+	m_freeRanges.clear();
+	m_freeRanges[0] = capacity;
+}
+
+std::optional<VkDeviceSize> RangeAllocator::allocate(VkDeviceSize size) {
+	size = std::max<VkDeviceSize>((size + m_granularity - 1) / m_granularity * m_granularity, m_granularity);
+
+	// best fit, the free list stays short since neighbours are merged
+	auto best = m_freeRanges.end();
+	for (auto it = m_freeRanges.begin(); it != m_freeRanges.end(); ++it) {
+		if (it->second >= size && (best == m_freeRanges.end() || it->second < best->second)) {
+			best = it;
+		}
+	}
+	if (best == m_freeRanges.end()) {
+		return std::nullopt;
+	}
+
+	const VkDeviceSize offset = best->first;
+	const VkDeviceSize remaining = best->second - size;
+	m_freeRanges.erase(best);
+	if (remaining > 0) {
+		m_freeRanges[offset + size] = remaining;
+	}
+
+	m_allocations[offset] = size;
+	m_used += size;
+	return offset;
+}
+
+void RangeAllocator::free(VkDeviceSize offset) {
+	auto allocation = m_allocations.find(offset);
+	if (allocation == m_allocations.end()) {
+		return;
+	}
+	VkDeviceSize size = allocation->second;
+	m_allocations.erase(allocation);
+	m_used -= size;
+
+	// merge with the free range after and before this one
+	auto next = m_freeRanges.find(offset + size);
+	if (next != m_freeRanges.end()) {
+		size += next->second;
+		m_freeRanges.erase(next);
+	}
+	auto inserted = m_freeRanges.emplace(offset, size).first;
+	if (inserted != m_freeRanges.begin()) {
+		auto previous = std::prev(inserted);
+		if (previous->first + previous->second == offset) {
+			previous->second += size;
+			m_freeRanges.erase(inserted);
+		}
+	}
+}
+
+std::unordered_map<VkDeviceSize, VkDeviceSize> RangeAllocator::compact() {
+	std::unordered_map<VkDeviceSize, VkDeviceSize> moves;
+	std::map<VkDeviceSize, VkDeviceSize> packed;
+
+	VkDeviceSize head = 0;
+	for (const auto& [offset, size] : m_allocations) {
+		moves[offset] = head;
+		packed[head] = size;
+		head += size;
+	}
+
+	m_allocations = std::move(packed);
+	m_freeRanges.clear();
+	if (head < m_capacity) {
+		m_freeRanges[head] = m_capacity - head;
+	}
+	return moves;
+}
+
+VkDeviceSize RangeAllocator::largestFreeRange() const {
+	VkDeviceSize largest = 0;
+	for (const auto& [offset, size] : m_freeRanges) {
+		largest = std::max(largest, size);
+	}
+	return largest;
+}
+
+float RangeAllocator::fragmentation() const {
+	const VkDeviceSize freeBytes = m_capacity - m_used;
+	if (freeBytes == 0) {
+		return 0.f;
+	}
+	return 1.f - static_cast<float>(largestFreeRange()) / static_cast<float>(freeBytes);
+}
+
+void GeometryPool::init(VkDevice device, VmaAllocator allocator, VkDeviceSize blockSize, VkBufferUsageFlags usage) {
+	m_device = device;
+	m_allocator = allocator;
+	// compaction copies between two pool buffers
+	m_usage = usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+	m_blockSize = blockSize;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	addBlock(m_blockSize);
+}
+
+void GeometryPool::cleanup() {
+	releaseRetired();
+	for (const Block& block : m_blocks) {
+		vmaDestroyBuffer(m_allocator, block.buffer.buffer, block.buffer.allocation);
+	}
+	m_blocks.clear();
+}
+
+AllocatedBuffer GeometryPool::createPoolBuffer(VkDeviceSize size) const {
+	VkBufferCreateInfo bufferInfo = { .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+	bufferInfo.size = size;
+	bufferInfo.usage = m_usage;
+
+	VmaAllocationCreateInfo vmaallocInfo = {};
+	vmaallocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+	AllocatedBuffer buffer{};
+	VK_CHECK(vmaCreateBuffer(m_allocator, &bufferInfo, &vmaallocInfo, &buffer.buffer, &buffer.allocation, &buffer.info));
+	return buffer;
+}
+
+VkDeviceAddress GeometryPool::bufferAddress(VkBuffer buffer) const {
+	VkBufferDeviceAddressInfo addressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = buffer };
+	return vkGetBufferDeviceAddress(m_device, &addressInfo);
+}
+
+void GeometryPool::addBlock(VkDeviceSize capacity) {
+	Block& block = m_blocks.emplace_back();
+	block.ranges.init(capacity, GEOMETRY_POOL_ALIGNMENT);
+	block.buffer = createPoolBuffer(capacity);
+	block.address = bufferAddress(block.buffer.buffer);
+}
+
+GeometryRange GeometryPool::allocate(VkDeviceSize size) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (uint32_t i = 0; i < m_blocks.size(); i++) {
+		if (const std::optional<VkDeviceSize> offset = m_blocks[i].ranges.allocate(size)) {
+			return GeometryRange{ .block = i, .offset = *offset };
+		}
+	}
+
+	// every block is full, ranges larger than a block get one of their own size
+	const VkDeviceSize capacity = std::max(m_blockSize, (size + GEOMETRY_POOL_ALIGNMENT - 1) / GEOMETRY_POOL_ALIGNMENT * GEOMETRY_POOL_ALIGNMENT);
+	std::cout << std::format("Geometry pool full, adding a {:.0f} MB block\n", static_cast<double>(capacity) / (1024.0 * 1024.0));
+	addBlock(capacity);
+
+	const auto block = static_cast<uint32_t>(m_blocks.size() - 1);
+	const std::optional<VkDeviceSize> offset = m_blocks[block].ranges.allocate(size);
+	assert(offset.has_value());
+	return GeometryRange{ .block = block, .offset = *offset };
+}
+
+void GeometryPool::free(const GeometryRange& range) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	assert(range.block < m_blocks.size());
+	m_blocks[range.block].ranges.free(range.offset);
+}
+
+std::vector<std::unordered_map<VkDeviceSize, VkDeviceSize>> GeometryPool::compact(VkCommandBuffer cmd) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	std::vector<std::unordered_map<VkDeviceSize, VkDeviceSize>> blockMoves;
+	blockMoves.reserve(m_blocks.size());
+	for (Block& block : m_blocks) {
+		// sizes are read before compact() rewrites the allocation map
+		std::vector<VkBufferCopy> copies;
+		copies.reserve(block.ranges.allocations().size());
+		for (const auto& [offset, size] : block.ranges.allocations()) {
+			copies.push_back(VkBufferCopy{ .srcOffset = offset, .dstOffset = 0, .size = size });
+		}
+
+		std::unordered_map<VkDeviceSize, VkDeviceSize>& moves = blockMoves.emplace_back(block.ranges.compact());
+		for (VkBufferCopy& copy : copies) {
+			copy.dstOffset = moves.at(copy.srcOffset);
+		}
+
+		AllocatedBuffer packed = createPoolBuffer(block.ranges.capacity());
+		if (!copies.empty()) {
+			vkCmdCopyBuffer(cmd, block.buffer.buffer, packed.buffer, static_cast<uint32_t>(copies.size()), copies.data());
+		}
+
+		m_retired.push_back(block.buffer);
+		block.buffer = packed;
+		block.address = bufferAddress(block.buffer.buffer);
+	}
+
+	VkMemoryBarrier2 barrier{ .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2 };
+	barrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+	barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+	barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+	barrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT;
+
+	VkDependencyInfo depInfo{ .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+	depInfo.memoryBarrierCount = 1;
+	depInfo.pMemoryBarriers = &barrier;
+	vkCmdPipelineBarrier2(cmd, &depInfo);
+
+	return blockMoves;
+}
+
+void GeometryPool::releaseRetired() {
+	for (const AllocatedBuffer& buffer : m_retired) {
+		vmaDestroyBuffer(m_allocator, buffer.buffer, buffer.allocation);
+	}
+	m_retired.clear();
+}
+
+VkBuffer GeometryPool::buffer(uint32_t block) const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_blocks[block].buffer.buffer;
+}
+
+VkDeviceAddress GeometryPool::address(uint32_t block) const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_blocks[block].address;
+}
+
+uint32_t GeometryPool::blockCount() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return static_cast<uint32_t>(m_blocks.size());
+}
+
+VkDeviceSize GeometryPool::used() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	VkDeviceSize used = 0;
+	for (const Block& block : m_blocks) {
+		used += block.ranges.used();
+	}
+	return used;
+}
+
+VkDeviceSize GeometryPool::capacity() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	VkDeviceSize capacity = 0;
+	for (const Block& block : m_blocks) {
+		capacity += block.ranges.capacity();
+	}
+	return capacity;
+}
+
+float GeometryPool::fragmentation() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	float fragmentation = 0.f;
+	for (const Block& block : m_blocks) {
+		fragmentation = std::max(fragmentation, block.ranges.fragmentation());
+	}
+	return fragmentation;
+}
+
+}// namespace pm
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+#include "vk_types.h"
+
+namespace pm {
+
+// every range starts on and is sized in multiples of this, enough for any std430 struct
+// read through a buffer reference and for the 32 bit words of 16 bit index ranges
+constexpr VkDeviceSize GEOMETRY_POOL_ALIGNMENT = 16;
+
+// Free list sub-allocator over [0, capacity). Picks the smallest free range that fits and
+// merges neighbouring free ranges on free, so fragmentation only comes from live ranges
+// in between. CPU only, the offsets mean whatever the owner maps them to.
+class RangeAllocator {
+	public:
+		void init(VkDeviceSize capacity, VkDeviceSize granularity);
+
+		// nullopt when no free range is large enough
+		std::optional<VkDeviceSize> allocate(VkDeviceSize size);
+		void free(VkDeviceSize offset);
+
+		// packs every live range to the front in offset order, returns old offset -> new offset
+		std::unordered_map<VkDeviceSize, VkDeviceSize> compact();
+
+		VkDeviceSize capacity() const { return m_capacity; }
+		VkDeviceSize used() const { return m_used; }
+		VkDeviceSize largestFreeRange() const;
+		// 0 when all free space is one range, close to 1 when it is split into many small ones
+		float fragmentation() const;
+		// offset -> size of every live range
+		const std::map<VkDeviceSize, VkDeviceSize>& allocations() const { return m_allocations; }
+
+	private:
+		VkDeviceSize m_capacity{ 0 };
+		VkDeviceSize m_granularity{ 1 };
+		VkDeviceSize m_used{ 0 };
+		std::map<VkDeviceSize, VkDeviceSize> m_freeRanges;
+		std::map<VkDeviceSize, VkDeviceSize> m_allocations;
+};
+
+// a range of a GeometryPool, offset is in bytes from the start of the block's buffer
+struct GeometryRange {
+		uint32_t block;
+		VkDeviceSize offset;
+};
+
+// Device local buffers shared by the geometry of every mesh, which only owns a range of
+// one of them. Draws of meshes in the same block then share a single index buffer binding,
+// and vertices are pulled from the block address plus the mesh offset.
+// The pool starts with one block and adds another whenever no block has room, so existing
+// ranges never move outside of compact.
+// allocate and free are thread safe, meshes are uploaded from the loader threads.
+class GeometryPool {
+	public:
+		// blockSize is the size of every block, except for ranges larger than that
+		void init(VkDevice device, VmaAllocator allocator, VkDeviceSize blockSize, VkBufferUsageFlags usage);
+		void cleanup();
+
+		GeometryRange allocate(VkDeviceSize size);
+		void free(const GeometryRange& range);
+
+		// moves every range to the front of a new buffer per block, recorded into cmd. the
+		// old buffers stay alive until releaseRetired, call it once cmd has finished executing.
+		// returns old offset -> new offset of every block, buffer() and address() change too
+		// NOTE: nothing may allocate, free or read the pool while this runs
+		std::vector<std::unordered_map<VkDeviceSize, VkDeviceSize>> compact(VkCommandBuffer cmd);
+		void releaseRetired();
+
+		VkBuffer buffer(uint32_t block) const;
+		VkDeviceAddress address(uint32_t block) const;
+		uint32_t blockCount() const;
+		// over every block
+		VkDeviceSize used() const;
+		VkDeviceSize capacity() const;
+		// of the most fragmented block, compact packs each block on its own
+		float fragmentation() const;
+
+	private:
+		struct Block {
+				AllocatedBuffer buffer;
+				VkDeviceAddress address;
+				RangeAllocator ranges;
+		};
+
+		AllocatedBuffer createPoolBuffer(VkDeviceSize size) const;
+		VkDeviceAddress bufferAddress(VkBuffer buffer) const;
+		// m_mutex must be held
+		void addBlock(VkDeviceSize capacity);
+
+		VkDevice m_device{ VK_NULL_HANDLE };
+		VmaAllocator m_allocator{ VK_NULL_HANDLE };
+		VkBufferUsageFlags m_usage{ 0 };
+		VkDeviceSize m_blockSize{ 0 };
+
+		mutable std::mutex m_mutex;
+		std::vector<Block> m_blocks;
+		std::vector<AllocatedBuffer> m_retired;
+};
+
+}// namespace pm
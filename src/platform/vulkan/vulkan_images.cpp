@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "vulkan_images.h"
 #include "vulkan_structures_helpers.h"
 
@@ -14,7 +16,11 @@ void transitionImage(VkCommandBuffer cmd, VkImage image, VkImageLayout currentLa
 	imageBarrier.oldLayout = currentLayout;
 	imageBarrier.newLayout = newLayout;
 
-	VkImageAspectFlags aspectMask = newLayout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+	// depth images are only ever moved between depth layouts, UNDEFINED aside
+	auto isDepthLayout = [](VkImageLayout layout) {
+		return layout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL || layout == VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL;
+	};
+	VkImageAspectFlags aspectMask = isDepthLayout(currentLayout) || isDepthLayout(newLayout) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
 	imageBarrier.subresourceRange = imageSubresourceRange(aspectMask);
 	imageBarrier.image = image;
 
@@ -64,4 +70,92 @@ void copyImageToImage(VkCommandBuffer cmd, VkImage source, VkImage destination,
 	vkCmdBlitImage2(cmd, &blitInfo);
 }
 
+void generateMipmaps(VkCommandBuffer cmd, VkImage image, VkExtent2D imageSize, uint32_t mipLevels) {
+	VkImageMemoryBarrier2 imageBarrier{ .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+	imageBarrier.image = image;
+	imageBarrier.subresourceRange = imageSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT);
+	imageBarrier.subresourceRange.levelCount = 1;
+
+	VkDependencyInfo depInfo{};
+	depInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+	depInfo.imageMemoryBarrierCount = 1;
+	depInfo.pImageMemoryBarriers = &imageBarrier;
+
+	for (uint32_t mip = 0; mip < mipLevels; mip++) {
+		VkExtent2D halfSize = { std::max(imageSize.width / 2, 1u), std::max(imageSize.height / 2, 1u) };
+
+		// the level was written by the copy or the previous blit, read it from here on
+		imageBarrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+		imageBarrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+		imageBarrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+		imageBarrier.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT;
+		imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		imageBarrier.subresourceRange.baseMipLevel = mip;
+		vkCmdPipelineBarrier2(cmd, &depInfo);
+
+		if (mip + 1 < mipLevels) {
+			VkImageBlit2 blitRegion{ .sType = VK_STRUCTURE_TYPE_IMAGE_BLIT_2, .pNext = nullptr };
+
+			blitRegion.srcOffsets[1].x = static_cast<int32_t>(imageSize.width);
+			blitRegion.srcOffsets[1].y = static_cast<int32_t>(imageSize.height);
+			blitRegion.srcOffsets[1].z = 1;
+
+			blitRegion.dstOffsets[1].x = static_cast<int32_t>(halfSize.width);
+			blitRegion.dstOffsets[1].y = static_cast<int32_t>(halfSize.height);
+			blitRegion.dstOffsets[1].z = 1;
+
+			blitRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			blitRegion.srcSubresource.baseArrayLayer = 0;
+			blitRegion.srcSubresource.layerCount = 1;
+			blitRegion.srcSubresource.mipLevel = mip;
+
+			blitRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			blitRegion.dstSubresource.baseArrayLayer = 0;
+			blitRegion.dstSubresource.layerCount = 1;
+			blitRegion.dstSubresource.mipLevel = mip + 1;
+
+			VkBlitImageInfo2 blitInfo{ .sType = VK_STRUCTURE_TYPE_BLIT_IMAGE_INFO_2, .pNext = nullptr };
+			blitInfo.dstImage = image;
+			blitInfo.dstImageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			blitInfo.srcImage = image;
+			blitInfo.srcImageLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+			blitInfo.filter = VK_FILTER_LINEAR;
+			blitInfo.regionCount = 1;
+			blitInfo.pRegions = &blitRegion;
+
+			vkCmdBlitImage2(cmd, &blitInfo);
+
+			imageSize = halfSize;
+		}
+	}
+
+	// every level is a blit source now, hand the whole chain to the shaders
+	imageBarrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+	imageBarrier.srcAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT;
+	imageBarrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+	imageBarrier.dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+	imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	imageBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	imageBarrier.subresourceRange = imageSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT);
+	vkCmdPipelineBarrier2(cmd, &depInfo);
+}
+
+void memoryBarrier(VkCommandBuffer cmd, VkPipelineStageFlags2 srcStage, VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess) {
+	VkMemoryBarrier2 barrier{ .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2 };
+
+	barrier.srcStageMask = srcStage;
+	barrier.srcAccessMask = srcAccess;
+	barrier.dstStageMask = dstStage;
+	barrier.dstAccessMask = dstAccess;
+
+	VkDependencyInfo depInfo{};
+	depInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+
+	depInfo.memoryBarrierCount = 1;
+	depInfo.pMemoryBarriers = &barrier;
+
+	vkCmdPipelineBarrier2(cmd, &depInfo);
+}
+
 }// namespace pm
@@ -7,4 +7,11 @@ namespace pm {
 void transitionImage(VkCommandBuffer cmd, VkImage image, VkImageLayout currentLayout, VkImageLayout newLayout);
 void copyImageToImage(VkCommandBuffer cmd, VkImage source, VkImage destination, VkExtent2D srcSize, VkExtent2D dstSize);
 
+// fill levels [1, mipLevels) by blitting each level into the next one. every level must be in
+// VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL with level 0 written, they all end up in SHADER_READ_ONLY_OPTIMAL
+void generateMipmaps(VkCommandBuffer cmd, VkImage image, VkExtent2D imageSize, uint32_t mipLevels);
+
+// global memory dependency, used between passes that communicate through buffers
+void memoryBarrier(VkCommandBuffer cmd, VkPipelineStageFlags2 srcStage, VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess);
+
 }// namespace pm
@@ -4,15 +4,24 @@
 
 #include "vk_types.h"
 #include "vulkan_renderer.h"
+#include "scene/mesh_optimize.h"
+#include "scene/texture_compress.h"
+#include "trace.h"
 #include <glm/gtx/quaternion.hpp>
+#include <tbb/parallel_for.h>
+#include <tbb/task_group.h>
 
 
 namespace pm {
 
-std::optional<AllocatedImage> loadImage(VulkanRenderer* renderer, fastgltf::Asset& asset, fastgltf::Image& image) {
-	AllocatedImage newImage{};
+void StbiDeleter::operator()(unsigned char* pixels) const {
+	stbi_image_free(pixels);
+}
 
+std::optional<ImageData> decodeImage(fastgltf::Asset& asset, fastgltf::Image& image) {
+	PM_TRACE_ZONE("decodeImage");
 	int width{}, height{}, nrChannels{};
+	unsigned char* data = nullptr;
 
 	std::visit(
 		fastgltf::visitor{
@@ -24,30 +33,10 @@ std::optional<AllocatedImage> loadImage(VulkanRenderer* renderer, fastgltf::Asse
 
 				const std::string path(filePath.uri.path().begin(),
 					filePath.uri.path().end());// Thanks C++.
-				unsigned char* data = stbi_load(path.c_str(), &width, &height, &nrChannels, 4);
-				if (data) {
-					VkExtent3D imagesize;
-					imagesize.width = width;
-					imagesize.height = height;
-					imagesize.depth = 1;
-
-					newImage = renderer->createImage(data, imagesize, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, false);
-
-					stbi_image_free(data);
-				}
+				data = stbi_load(path.c_str(), &width, &height, &nrChannels, 4);
 			},
 			[&](fastgltf::sources::Vector& vector) {
-				unsigned char* data = stbi_load_from_memory(vector.bytes.data(), static_cast<int>(vector.bytes.size()), &width, &height, &nrChannels, 4);
-				if (data) {
-					VkExtent3D imagesize;
-					imagesize.width = width;
-					imagesize.height = height;
-					imagesize.depth = 1;
-
-					newImage = renderer->createImage(data, imagesize, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, false);
-
-					stbi_image_free(data);
-				}
+				data = stbi_load_from_memory(vector.bytes.data(), static_cast<int>(vector.bytes.size()), &width, &height, &nrChannels, 4);
 			},
 			[&](fastgltf::sources::BufferView& view) {
 				auto& bufferView = asset.bufferViews[view.bufferViewIndex];
@@ -58,35 +47,155 @@ std::optional<AllocatedImage> loadImage(VulkanRenderer* renderer, fastgltf::Asse
 																			// are already loaded into a vector.
 										 [](auto& arg) {},
 										 [&](fastgltf::sources::Vector& vector) {
-											 unsigned char* data = stbi_load_from_memory(vector.bytes.data() + bufferView.byteOffset,
+											 data = stbi_load_from_memory(vector.bytes.data() + bufferView.byteOffset,
 												 static_cast<int>(bufferView.byteLength),
 												 &width,
 												 &height,
 												 &nrChannels,
 												 4);
-											 if (data) {
-												 VkExtent3D imagesize;
-												 imagesize.width = width;
-												 imagesize.height = height;
-												 imagesize.depth = 1;
-
-												 newImage = renderer->createImage(data, imagesize, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, false);
-
-												 stbi_image_free(data);
-											 }
 										 } },
 					buffer.data);
 			},
 		},
 		image.data);
 
-	// if any of the attempts to load the data failed, we havent written the image
-	// so handle is null
-	if (newImage.image == VK_NULL_HANDLE) {
+	if (data == nullptr) {
 		return {};
-	} else {
-		return newImage;
 	}
+
+	return ImageData{
+		.width = static_cast<uint32_t>(width),
+		.height = static_cast<uint32_t>(height),
+		.pixels = std::unique_ptr<unsigned char, StbiDeleter>{ data }
+	};
+}
+
+std::optional<AllocatedImage> loadImage(VulkanRenderer* renderer, fastgltf::Asset& asset, fastgltf::Image& image) {
+	std::optional<ImageData> decoded = decodeImage(asset, image);
+
+	// if decoding failed we havent written the image
+	if (!decoded.has_value()) {
+		return {};
+	}
+
+	VkExtent3D imagesize;
+	imagesize.width = decoded->width;
+	imagesize.height = decoded->height;
+	imagesize.depth = 1;
+
+	return renderer->createImage(decoded->pixels.get(), imagesize, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, true);
+}
+
+Bounds computeBounds(std::span<const Vertex> vertices) {
+	Bounds bounds{};
+	if (vertices.empty()) {
+		return bounds;
+	}
+
+	glm::vec3 minpos = vertices[0].position;
+	glm::vec3 maxpos = vertices[0].position;
+	for (const Vertex& v : vertices) {
+		minpos = glm::min(minpos, v.position);
+		maxpos = glm::max(maxpos, v.position);
+	}
+
+	bounds.origin = (maxpos + minpos) / 2.f;
+	bounds.extents = (maxpos - minpos) / 2.f;
+
+	// the sphere is centered on the AABB but only as big as the furthest vertex,
+	// which is tighter than the AABB diagonal for most meshes
+	float maxDistance2 = 0.f;
+	for (const Vertex& v : vertices) {
+		const glm::vec3 d = v.position - bounds.origin;
+		maxDistance2 = std::max(maxDistance2, glm::dot(d, d));
+	}
+	bounds.sphereRadius = std::sqrt(maxDistance2);
+
+	return bounds;
+}
+
+MeshData buildMeshData(fastgltf::Asset& gltf, fastgltf::Mesh& mesh) {
+	PM_TRACE_ZONE("buildMeshData");
+	MeshData meshData{};
+	meshData.name = mesh.name;
+
+	std::vector<uint32_t>& indices = meshData.indices;
+	std::vector<Vertex>& vertices = meshData.vertices;
+
+	for (auto&& p : mesh.primitives) {
+		GeoSurface newSurface{};
+		newSurface.startIndex = (uint32_t)indices.size();
+		newSurface.count = (uint32_t)gltf.accessors[p.indicesAccessor.value()].count;
+
+		size_t initial_vtx = vertices.size();
+
+		// load indices
+		{
+			fastgltf::Accessor& indexaccessor = gltf.accessors[p.indicesAccessor.value()];
+			indices.reserve(indices.size() + indexaccessor.count);
+
+			fastgltf::iterateAccessor<std::uint32_t>(gltf, indexaccessor, [&](std::uint32_t idx) {
+				indices.push_back(idx + initial_vtx);
+			});
+		}
+
+		// load vertex positions
+		{
+			fastgltf::Accessor& posAccessor = gltf.accessors[p.findAttribute("POSITION")->second];
+			vertices.resize(vertices.size() + posAccessor.count);
+
+			fastgltf::iterateAccessorWithIndex<glm::vec3>(gltf, posAccessor, [&](glm::vec3 v, size_t index) {
+				Vertex newvtx{};
+				newvtx.position = v;
+				newvtx.normal = { 1, 0, 0 };
+				newvtx.color = glm::vec4{ 1.f };
+				newvtx.uv_x = 0;
+				newvtx.uv_y = 0;
+				vertices[initial_vtx + index] = newvtx;
+			});
+		}
+
+		// load vertex normals
+		auto normals = p.findAttribute("NORMAL");
+		if (normals != p.attributes.end()) {
+
+			fastgltf::iterateAccessorWithIndex<glm::vec3>(gltf, gltf.accessors[(*normals).second], [&](glm::vec3 v, size_t index) {
+				vertices[initial_vtx + index].normal = v;
+			});
+		}
+
+		// load UVs
+		auto uv = p.findAttribute("TEXCOORD_0");
+		if (uv != p.attributes.end()) {
+
+			fastgltf::iterateAccessorWithIndex<glm::vec2>(gltf, gltf.accessors[(*uv).second], [&](glm::vec2 v, size_t index) {
+				vertices[initial_vtx + index].uv_x = v.x;
+				vertices[initial_vtx + index].uv_y = v.y;
+			});
+		}
+
+		// load vertex colors
+		auto colors = p.findAttribute("COLOR_0");
+		if (colors != p.attributes.end()) {
+
+			fastgltf::iterateAccessorWithIndex<glm::vec4>(gltf, gltf.accessors[(*colors).second], [&](glm::vec4 v, size_t index) {
+				vertices[initial_vtx + index].color = v;
+			});
+		}
+
+		newSurface.bounds = computeBounds(std::span<const Vertex>(vertices).subspan(initial_vtx));
+		newSurface.lods[0] = LodLevel{ .startIndex = newSurface.startIndex, .count = newSurface.count, .error = 0.f };
+		newSurface.lodCount = 1;
+
+		meshData.surfaces.push_back(newSurface);
+		if (p.materialIndex.has_value()) {
+			meshData.materialIndices.push_back(p.materialIndex.value());
+		} else {
+			meshData.materialIndices.push_back(std::nullopt);
+		}
+	}
+
+	return meshData;
 }
 
 std::optional<std::vector<std::shared_ptr<MeshAsset>>> loadGltfMeshes(pm::VulkanRenderer* renderer, std::filesystem::path filePath) {
@@ -110,92 +219,25 @@ std::optional<std::vector<std::shared_ptr<MeshAsset>>> loadGltfMeshes(pm::Vulkan
 	}
 
 	// Process gltf
-	std::vector<std::shared_ptr<MeshAsset>> meshes;
-
-	std::vector<uint32_t> indices;
-	std::vector<Vertex> vertices;
-	for (fastgltf::Mesh& mesh : gltf.meshes) {
-		MeshAsset newmesh;
-
-		newmesh.name = mesh.name;
-
-		indices.clear();
-		vertices.clear();
-
-		for (auto&& p : mesh.primitives) {
-			GeoSurface newSurface{};
-			newSurface.startIndex = (uint32_t)indices.size();
-			newSurface.count = (uint32_t)gltf.accessors[p.indicesAccessor.value()].count;
-
-			size_t initial_vtx = vertices.size();
-
-			// load indexes
-			{
-				fastgltf::Accessor& indexaccessor = gltf.accessors[p.indicesAccessor.value()];
-				indices.reserve(indices.size() + indexaccessor.count);
-
-				fastgltf::iterateAccessor<std::uint32_t>(gltf, indexaccessor, [&](std::uint32_t idx) {
-					indices.push_back(idx + initial_vtx);
-				});
-			}
-
-			// load vertex positions
-			{
-				fastgltf::Accessor& posAccessor = gltf.accessors[p.findAttribute("POSITION")->second];
-				vertices.resize(vertices.size() + posAccessor.count);
-
-				fastgltf::iterateAccessorWithIndex<glm::vec3>(gltf, posAccessor, [&](glm::vec3 v, size_t index) {
-					Vertex newvtx{};
-					newvtx.position = v;
-					newvtx.normal = { 1, 0, 0 };
-					newvtx.color = glm::vec4{ 1.f };
-					newvtx.uv_x = 0;
-					newvtx.uv_y = 0;
-					vertices[initial_vtx + index] = newvtx;
-				});
-			}
-
-			// load vertex normals
-			auto normals = p.findAttribute("NORMAL");
-			if (normals != p.attributes.end()) {
-
-				fastgltf::iterateAccessorWithIndex<glm::vec3>(gltf, gltf.accessors[(*normals).second], [&](glm::vec3 v, size_t index) {
-					vertices[initial_vtx + index].normal = v;
-				});
-			}
+	std::vector<std::shared_ptr<MeshAsset>> meshes(gltf.meshes.size());
 
-			// load UVs
-			auto uv = p.findAttribute("TEXCOORD_0");
-			if (uv != p.attributes.end()) {
-
-				fastgltf::iterateAccessorWithIndex<glm::vec2>(gltf, gltf.accessors[(*uv).second], [&](glm::vec2 v, size_t index) {
-					vertices[initial_vtx + index].uv_x = v.x;
-					vertices[initial_vtx + index].uv_y = v.y;
-				});
-			}
-
-			// load vertex colors
-			auto colors = p.findAttribute("COLOR_0");
-			if (colors != p.attributes.end()) {
-
-				fastgltf::iterateAccessorWithIndex<glm::vec4>(gltf, gltf.accessors[(*colors).second], [&](glm::vec4 v, size_t index) {
-					vertices[initial_vtx + index].color = v;
-				});
-			}
-			newmesh.surfaces.push_back(newSurface);
-		}
+	tbb::parallel_for(size_t(0), gltf.meshes.size(), [&](size_t i) {
+		MeshData meshData = buildMeshData(gltf, gltf.meshes[i]);
 
 		// display the vertex normals
 		constexpr bool OverrideColors = false;
 		if (OverrideColors) {
-			for (Vertex& vtx : vertices) {
+			for (Vertex& vtx : meshData.vertices) {
 				vtx.color = glm::vec4(vtx.normal, 1.f);
 			}
 		}
-		newmesh.meshBuffers = renderer->uploadMesh(indices, vertices);
 
-		meshes.emplace_back(std::make_shared<MeshAsset>(std::move(newmesh)));
-	}
+		auto newmesh = std::make_shared<MeshAsset>();
+		newmesh->name = std::move(meshData.name);
+		newmesh->surfaces = std::move(meshData.surfaces);
+		newmesh->meshBuffers = renderer->uploadMesh(meshData.indices, meshData.vertices);
+		meshes[i] = std::move(newmesh);
+	});
 
 	return meshes;
 }
@@ -230,30 +272,20 @@ VkSamplerMipmapMode extractMipmapMode(fastgltf::Filter filter) {
 	}
 }
 
-std::optional<std::shared_ptr<LoadedGLTF>> loadGltf(VulkanRenderer* renderer, std::string_view filePath) {
-	std::cout << std::format("Loading GLTF: {}", filePath) << '\n';
-
-	auto scene = std::make_shared<LoadedGLTF>();
-	scene->renderer = renderer;
-	LoadedGLTF& file = *scene.get();
-
+std::optional<fastgltf::Asset> parseGltf(const std::filesystem::path& path) {
 	fastgltf::Parser parser{};
 
 	constexpr auto gltfOptions = fastgltf::Options::DontRequireValidAssetMember | fastgltf::Options::AllowDouble | fastgltf::Options::LoadGLBBuffers | fastgltf::Options::LoadExternalBuffers;
 	// fastgltf::Options::LoadExternalImages;
 
 	fastgltf::GltfDataBuffer data;
-	data.loadFromFile(filePath);
-
-	fastgltf::Asset gltf;
-
-	std::filesystem::path path = filePath;
+	data.loadFromFile(path);
 
 	auto type = fastgltf::determineGltfFileType(&data);
 	if (type == fastgltf::GltfType::glTF) {
 		auto load = parser.loadGLTF(&data, path.parent_path(), gltfOptions);
 		if (load) {
-			gltf = std::move(load.get());
+			return std::move(load.get());
 		} else {
 			std::cerr << "Failed to load glTF: " << fastgltf::to_underlying(load.error()) << std::endl;
 			return {};
@@ -261,7 +293,7 @@ std::optional<std::shared_ptr<LoadedGLTF>> loadGltf(VulkanRenderer* renderer, st
 	} else if (type == fastgltf::GltfType::GLB) {
 		auto load = parser.loadBinaryGLTF(&data, path.parent_path(), gltfOptions);
 		if (load) {
-			gltf = std::move(load.get());
+			return std::move(load.get());
 		} else {
 			std::cerr << "Failed to load glTF: " << fastgltf::to_underlying(load.error()) << std::endl;
 			return {};
@@ -270,42 +302,322 @@ std::optional<std::shared_ptr<LoadedGLTF>> loadGltf(VulkanRenderer* renderer, st
 		std::cerr << "Failed to determine glTF container" << std::endl;
 		return {};
 	}
+}
+
+SceneGraph buildSceneGraph(fastgltf::Asset& gltf) {
+	// glTF does not guarantee that parents are listed before their children, so walk
+	// the hierarchy from the roots to get the topological order the scene graph needs
+	std::vector<int32_t> gltfParents(gltf.nodes.size(), SceneGraph::NO_PARENT);
+	for (size_t i = 0; i < gltf.nodes.size(); i++) {
+		for (auto& c : gltf.nodes[i].children) {
+			gltfParents[c] = static_cast<int32_t>(i);
+		}
+	}
+
+	std::vector<size_t> order;
+	order.reserve(gltf.nodes.size());
+	for (size_t i = 0; i < gltf.nodes.size(); i++) {
+		if (gltfParents[i] == SceneGraph::NO_PARENT) {
+			order.push_back(i);
+		}
+	}
+	for (size_t head = 0; head < order.size(); head++) {
+		for (auto& c : gltf.nodes[order[head]].children) {
+			order.push_back(c);
+		}
+	}
+
+	SceneGraph graph;
+	std::vector<int32_t> sceneIndices(gltf.nodes.size(), SceneGraph::NO_PARENT);
+	graph.reserve(order.size());
+
+	for (size_t gltfIndex : order) {
+		fastgltf::Node& node = gltf.nodes[gltfIndex];
+
+		glm::mat4 localTransform{ 1.f };
+		std::visit(fastgltf::visitor{
+								 [&](fastgltf::Node::TransformMatrix matrix) {
+									 memcpy(&localTransform, matrix.data(), sizeof(matrix));
+								 },
+								 [&](fastgltf::Node::TRS transform) {
+									 glm::vec3 tl(transform.translation[0], transform.translation[1], transform.translation[2]);
+									 glm::quat rot(transform.rotation[3], transform.rotation[0], transform.rotation[1], transform.rotation[2]);
+									 glm::vec3 sc(transform.scale[0], transform.scale[1], transform.scale[2]);
+
+									 glm::mat4 tm = glm::translate(glm::mat4(1.f), tl);
+									 glm::mat4 rm = glm::toMat4(rot);
+									 glm::mat4 sm = glm::scale(glm::mat4(1.f), sc);
+
+									 localTransform = tm * rm * sm;
+								 } },
+			node.transform);
+
+		const int32_t gltfParent = gltfParents[gltfIndex];
+		const int32_t parent = gltfParent == SceneGraph::NO_PARENT ? SceneGraph::NO_PARENT : sceneIndices[gltfParent];
+		const int32_t meshIndex = node.meshIndex.has_value() ? static_cast<int32_t>(*node.meshIndex) : SceneGraph::NO_MESH;
+
+		sceneIndices[gltfIndex] = static_cast<int32_t>(graph.addNode(parent, localTransform, meshIndex, std::string{ node.name.c_str() }));
+	}
+
+	return graph;
+}
 
-	std::vector<DescriptorAllocator::PoolSizeRatio> sizes = {
-		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3 },
-		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3 },
-		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 }
+MaterialPass extractMaterialPass(const fastgltf::Material& material) {
+	if (material.alphaMode == fastgltf::AlphaMode::Blend) {
+		return MaterialPass::Transparent;
+	}
+	return MaterialPass::MainColor;
+}
+
+namespace {
+
+// the CPU stage of a whole file, decoded on worker threads
+struct DecodedGltf {
+		std::vector<std::optional<ImageData>> images;
+		std::vector<MeshData> meshes;
+};
+
+// runs on the worker that built the mesh, before it is uploaded or cooked
+MeshOptimizeStats processMeshData(MeshData& meshData, const MeshProcessOptions& options) {
+	PM_TRACE_ZONE("processMeshData");
+	MeshOptimizeStats stats{};
+	if (options.optimize) {
+		std::vector<IndexRange> ranges;
+		ranges.reserve(meshData.surfaces.size());
+		for (const GeoSurface& surface : meshData.surfaces) {
+			ranges.push_back(IndexRange{ .startIndex = surface.startIndex, .count = surface.count });
+		}
+		stats = optimizeMesh(meshData.indices, meshData.vertices, ranges);
+	}
+
+	// after the optimizer so LOD 0 keeps its cache order and the levels reuse deduplicated vertices
+	if (options.generateLods) {
+		for (GeoSurface& surface : meshData.surfaces) {
+			const IndexRange source{ .startIndex = surface.startIndex, .count = surface.count };
+			surface.lodCount = generateLods(meshData.indices, meshData.vertices, source, surface.lods);
+		}
+	}
+
+	// last, it reorders the triangles of every level
+	if (options.buildMeshlets) {
+		for (GeoSurface& surface : meshData.surfaces) {
+			for (uint32_t level = 0; level < surface.lodCount; level++) {
+				LodLevel& lod = surface.lods[level];
+				const IndexRange range{ .startIndex = lod.startIndex, .count = lod.count };
+				lod.firstMeshlet = static_cast<uint32_t>(meshData.meshlets.size());
+				lod.meshletCount = buildMeshlets(meshData.indices, meshData.vertices, range, meshData.meshlets);
+			}
+		}
+	}
+
+	return stats;
+}
+
+// the occluder only covers LOD 0 of the opaque surfaces, transparent ones hide nothing
+OccluderMesh buildMeshOccluder(std::span<const uint32_t> indices, std::span<const Vertex> vertices, std::span<const GeoSurface> surfaces, const std::function<bool(size_t)>& isOpaque) {
+	std::vector<IndexRange> ranges;
+	for (size_t i = 0; i < surfaces.size(); i++) {
+		if (isOpaque(i)) {
+			ranges.push_back(IndexRange{ .startIndex = surfaces[i].startIndex, .count = surfaces[i].count });
+		}
+	}
+	return buildOccluder(indices, vertices, ranges);
+}
+
+// stats are gathered on worker threads and printed once in glTF order
+void printMeshProcessStats(const std::vector<MeshData>& meshes, const std::vector<MeshOptimizeStats>& stats, const MeshProcessOptions& options) {
+	if (options.optimize) {
+		size_t verticesBefore = 0;
+		size_t verticesAfter = 0;
+		for (size_t i = 0; i < meshes.size(); i++) {
+			const MeshOptimizeStats& s = stats[i];
+			std::cout << std::format("Mesh {}: {} -> {} vertices, ACMR {:.3f} -> {:.3f}, ATVR {:.3f} -> {:.3f}\n",
+					meshes[i].name, s.vertexCountBefore, s.vertexCountAfter, s.acmrBefore, s.acmrAfter, s.atvrBefore, s.atvrAfter);
+			verticesBefore += s.vertexCountBefore;
+			verticesAfter += s.vertexCountAfter;
+		}
+		std::cout << std::format("Optimized {} meshes: {} -> {} vertices\n", meshes.size(), verticesBefore, verticesAfter);
+	}
+
+	if (options.generateLods) {
+		// surfaces with a shorter chain count their coarsest level for the missing ones
+		std::array<size_t, MAX_LOD_COUNT> triangles{};
+		for (const MeshData& mesh : meshes) {
+			for (const GeoSurface& surface : mesh.surfaces) {
+				for (uint32_t level = 0; level < MAX_LOD_COUNT; level++) {
+					triangles[level] += surface.lods[std::min(level, surface.lodCount - 1)].count / 3;
+				}
+			}
+		}
+
+		std::string levels;
+		for (uint32_t level = 0; level < MAX_LOD_COUNT; level++) {
+			levels += std::format(" LOD{} {}", level, triangles[level]);
+		}
+		std::cout << std::format("LOD triangles:{}\n", levels);
+	}
+}
+
+// usedImages flags the images to decode, empty decodes every image
+DecodedGltf decodeGltf(fastgltf::Asset& gltf, const MeshProcessOptions& meshOptions, const std::vector<uint8_t>& usedImages = {}) {
+	DecodedGltf decoded;
+	decoded.images.resize(gltf.images.size());
+	decoded.meshes.resize(gltf.meshes.size());
+
+	tbb::task_group decodeTasks;
+	decodeTasks.run([&]() {
+		tbb::parallel_for(size_t(0), gltf.images.size(), [&](size_t i) {
+			if (usedImages.empty() || usedImages[i]) {
+				decoded.images[i] = decodeImage(gltf, gltf.images[i]);
+			}
+		});
+	});
+	std::vector<MeshOptimizeStats> meshStats(gltf.meshes.size());
+	decodeTasks.run([&]() {
+		tbb::parallel_for(size_t(0), gltf.meshes.size(), [&](size_t i) {
+			decoded.meshes[i] = buildMeshData(gltf, gltf.meshes[i]);
+			meshStats[i] = processMeshData(decoded.meshes[i], meshOptions);
+		});
+	});
+	decodeTasks.wait();
+
+	printMeshProcessStats(decoded.meshes, meshStats, meshOptions);
+
+	return decoded;
+}
+
+VkSampler createSampler(VkDevice device, VkFilter magFilter, VkFilter minFilter, VkSamplerMipmapMode mipmapMode) {
+	VkSamplerCreateInfo samplerCreateInfo = {
+		.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+		.pNext = nullptr
 	};
+	samplerCreateInfo.maxLod = VK_LOD_CLAMP_NONE;
+	samplerCreateInfo.minLod = 0;
 
-	file.descriptorPool.init(renderer->m_device, gltf.materials.size(), sizes);
-	for (fastgltf::Sampler& sampler : gltf.samplers) {
-		VkSamplerCreateInfo samplerCreateInfo = {
-			.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
-			.pNext = nullptr
-		};
-		samplerCreateInfo.maxLod = VK_LOD_CLAMP_NONE;
-		samplerCreateInfo.minLod = 0;
+	samplerCreateInfo.magFilter = magFilter;
+	samplerCreateInfo.minFilter = minFilter;
 
-		samplerCreateInfo.magFilter = extractFilter(sampler.magFilter.value_or(fastgltf::Filter::Nearest));
-		samplerCreateInfo.minFilter = extractFilter(sampler.minFilter.value_or(fastgltf::Filter::Nearest));
+	samplerCreateInfo.mipmapMode = mipmapMode;
 
-		samplerCreateInfo.mipmapMode = extractMipmapMode(sampler.minFilter.value_or(fastgltf::Filter::Nearest));
+	VkSampler newSampler{};
+	vkCreateSampler(device, &samplerCreateInfo, nullptr, &newSampler);
+	return newSampler;
+}
+
+// add the material to the bindless table, the file releases it on unload. colorImage
+// and colorSampler are only used when colorImage is set
+std::shared_ptr<GLTFMaterial> createMaterial(VulkanRenderer* renderer, LoadedGLTF& file, const GLTFMetallic_Roughness::MaterialConstants& constants, MaterialPass passType, const AllocatedImage* colorImage, VkSampler colorSampler) {
+	auto newMat = std::make_shared<GLTFMaterial>();
+
+	GLTFMetallic_Roughness::MaterialResources materialResources{};
+	materialResources.constants = constants;
+	// default the material textures
+	materialResources.colorImage = renderer->whiteImage;
+	materialResources.colorSampler = renderer->defaultSamplerLinear;
+	materialResources.metalRoughImage = renderer->whiteImage;
+	materialResources.metalRoughSampler = renderer->defaultSamplerLinear;
+
+	if (colorImage != nullptr) {
+		materialResources.colorImage = *colorImage;
+		materialResources.colorSampler = colorSampler;
+	}
+
+	// build material
+	newMat->data = renderer->metalRoughMaterial.writeMaterial(passType, materialResources, renderer->m_bindless);
+	// slot 0 is the renderer's default material, a full table falls back to it
+	if (newMat->data.materialIndex != 0) {
+		file.materialSlots.push_back(newMat->data.materialIndex);
+	}
+	return newMat;
+}
+
+}// namespace
+
+std::optional<std::shared_ptr<LoadedGLTF>> loadGltf(VulkanRenderer* renderer, std::string_view filePath, const MeshProcessOptions& meshOptions) {
+	PM_TRACE_ZONE("loadGltf");
+	std::cout << std::format("Loading GLTF: {}", filePath) << '\n';
+
+	std::filesystem::path path = filePath;
+
+	// prefer the cooked cache when it was built from this exact file. its block compressed
+	// textures need device support, the source is decoded to RGBA8 instead
+	{
+		CookedSceneFile cooked;
+		if (cooked.open(cookedScenePath(path)) && cooked.matchesSource(path)) {
+			const bool blockCompressed = std::any_of(cooked.images().begin(), cooked.images().end(), [](const CookedImage& image) {
+				return image.valid != 0 && isBlockCompressed(static_cast<VkFormat>(image.format));
+			});
+			if (blockCompressed && !renderer->supportsTextureCompressionBC()) {
+				std::cout << std::format("Skipping cooked scene {}: BC textures are not supported, cook it with --uncompressed", cookedScenePath(path).string()) << '\n';
+			} else {
+				std::cout << std::format("Using cooked scene: {}", cookedScenePath(path).string()) << '\n';
+				return loadCookedScene(renderer, cooked);
+			}
+		}
+	}
+
+	std::optional<fastgltf::Asset> parsed = parseGltf(path);
+	if (!parsed.has_value()) {
+		return {};
+	}
+	fastgltf::Asset& gltf = *parsed;
+
+	auto scene = std::make_shared<LoadedGLTF>();
+	scene->renderer = renderer;
+	LoadedGLTF& file = *scene.get();
 
-		VkSampler newSampler{};
-		vkCreateSampler(renderer->m_device, &samplerCreateInfo, nullptr, &newSampler);
+	for (fastgltf::Sampler& sampler : gltf.samplers) {
+		VkFilter magFilter = extractFilter(sampler.magFilter.value_or(fastgltf::Filter::Nearest));
+		VkFilter minFilter = extractFilter(sampler.minFilter.value_or(fastgltf::Filter::Nearest));
+		VkSamplerMipmapMode mipmapMode = extractMipmapMode(sampler.minFilter.value_or(fastgltf::Filter::Nearest));
 
-		file.samplers.push_back(newSampler);
+		file.samplers.push_back(createSampler(renderer->m_device, magFilter, minFilter, mipmapMode));
 	}
 
 	// temporal arrays for all the objects to use while creating the GLTF data
 	std::vector<std::shared_ptr<MeshAsset>> meshes;
-	std::vector<std::shared_ptr<Node>> nodes;
 	std::vector<AllocatedImage> images;
 	std::vector<std::shared_ptr<GLTFMaterial>> materials;
 
+	// decode images and convert meshes on worker threads. each task hands its result to
+	// the upload manager as soon as it is ready, results are stored by glTF index so the
+	// output does not depend on the order the tasks finish in
+	std::vector<std::optional<AllocatedImage>> loadedImages(gltf.images.size());
+	std::vector<MeshData> meshData(gltf.meshes.size());
+	std::vector<GPUMeshBuffers> meshBuffers(gltf.meshes.size());
+	std::vector<MeshOptimizeStats> meshStats(gltf.meshes.size());
+
+	tbb::task_group loadTasks;
+	loadTasks.run([&]() {
+		tbb::parallel_for(size_t(0), gltf.images.size(), [&](size_t i) {
+			loadedImages[i] = loadImage(renderer, gltf, gltf.images[i]);
+		});
+	});
+	loadTasks.run([&]() {
+		tbb::parallel_for(size_t(0), gltf.meshes.size(), [&](size_t i) {
+			meshData[i] = buildMeshData(gltf, gltf.meshes[i]);
+			meshStats[i] = processMeshData(meshData[i], meshOptions);
+			meshBuffers[i] = renderer->uploadMesh(meshData[i].indices, meshData[i].vertices, meshData[i].meshlets);
+			// surfaces without a material get materials[0], see below
+			meshData[i].occluder = buildMeshOccluder(meshData[i].indices, meshData[i].vertices, meshData[i].surfaces, [&](size_t surface) {
+				const size_t materialIndex = meshData[i].materialIndices[surface].value_or(0);
+				return materialIndex >= gltf.materials.size() || extractMaterialPass(gltf.materials[materialIndex]) != MaterialPass::Transparent;
+			});
+
+			// the staging copy is done, only the surfaces are needed from here on
+			meshData[i].indices = {};
+			meshData[i].vertices = {};
+			meshData[i].meshlets = {};
+		});
+	});
+	loadTasks.wait();
+
+	printMeshProcessStats(meshData, meshStats, meshOptions);
+
 	// load textures
-	for (fastgltf::Image& image : gltf.images) {
-		auto img = loadImage(renderer, gltf, image);
+	for (size_t i = 0; i < gltf.images.size(); i++) {
+		fastgltf::Image& image = gltf.images[i];
+		auto& img = loadedImages[i];
 
 		if (img.has_value()) {
 			images.push_back(*img);
@@ -316,16 +628,9 @@ std::optional<std::shared_ptr<LoadedGLTF>> loadGltf(VulkanRenderer* renderer, st
 		}
 	}
 
-	// create buffer to hold the material data
-	file.materialDataBuffer = renderer->createBuffer(sizeof(GLTFMetallic_Roughness::MaterialConstants) * gltf.materials.size(), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-	int data_index = 0;
-	auto sceneMaterialConstants = static_cast<GLTFMetallic_Roughness::MaterialConstants*>(file.materialDataBuffer.info.pMappedData);
-
 	// Load materials
-	for (fastgltf::Material& mat : gltf.materials) {
-		auto newMat = std::make_shared<GLTFMaterial>();
-		materials.push_back(newMat);
-		file.materials[mat.name.c_str()] = newMat;
+	for (size_t i = 0; i < gltf.materials.size(); i++) {
+		fastgltf::Material& mat = gltf.materials[i];
 
 		GLTFMetallic_Roughness::MaterialConstants constants{};
 		constants.colorFactors.x = mat.pbrData.baseColorFactor[0];
@@ -335,197 +640,374 @@ std::optional<std::shared_ptr<LoadedGLTF>> loadGltf(VulkanRenderer* renderer, st
 
 		constants.metalRoughFactors.x = mat.pbrData.metallicFactor;
 		constants.metalRoughFactors.y = mat.pbrData.roughnessFactor;
-		// write material parameters to buffer
-		sceneMaterialConstants[data_index] = constants;
-
-		MaterialPass passType = MaterialPass::MainColor;
-		if (mat.alphaMode == fastgltf::AlphaMode::Blend) {
-			passType = MaterialPass::Transparent;
-		}
 
-		GLTFMetallic_Roughness::MaterialResources materialResources{};
-		// default the material textures
-		materialResources.colorImage = renderer->whiteImage;
-		materialResources.colorSampler = renderer->defaultSamplerLinear;
-		materialResources.metalRoughImage = renderer->whiteImage;
-		materialResources.metalRoughSampler = renderer->defaultSamplerLinear;
-
-		// set the uniform buffer for the material data
-		materialResources.dataBuffer = file.materialDataBuffer.buffer;
-		materialResources.dataBufferOffset = data_index * sizeof(GLTFMetallic_Roughness::MaterialConstants);
 		// grab textures from gltf file
+		const AllocatedImage* colorImage = nullptr;
+		VkSampler colorSampler = VK_NULL_HANDLE;
 		if (mat.pbrData.baseColorTexture.has_value()) {
 			size_t img = gltf.textures[mat.pbrData.baseColorTexture.value().textureIndex].imageIndex.value();
 			size_t sampler = gltf.textures[mat.pbrData.baseColorTexture.value().textureIndex].samplerIndex.value();
 
-			materialResources.colorImage = images[img];
-			materialResources.colorSampler = file.samplers[sampler];
+			colorImage = &images[img];
+			colorSampler = file.samplers[sampler];
 		}
-		// build material
-		newMat->data = renderer->metalRoughMaterial.writeMaterial(renderer->m_device, passType, materialResources, file.descriptorPool);
 
-		data_index++;
+		auto newMat = createMaterial(renderer, file, constants, extractMaterialPass(mat), colorImage, colorSampler);
+		materials.push_back(newMat);
+		file.materials[mat.name.c_str()] = newMat;
 	}
 
-	// use the same vectors for all meshes so that the memory doesnt reallocate as often
-	std::vector<uint32_t> indices;
-	std::vector<Vertex> vertices;
+	for (size_t i = 0; i < gltf.meshes.size(); i++) {
+		fastgltf::Mesh& mesh = gltf.meshes[i];
 
-	for (auto& mesh : gltf.meshes) {
 		std::shared_ptr<MeshAsset> newmesh = std::make_shared<MeshAsset>();
 		meshes.push_back(newmesh);
 		file.meshes[mesh.name.c_str()] = newmesh;
 		newmesh->name = mesh.name;
+		newmesh->surfaces = std::move(meshData[i].surfaces);
+		newmesh->meshBuffers = meshBuffers[i];
+		newmesh->occluder = std::move(meshData[i].occluder);
 
-		// clear the mesh arrays each mesh, we dont want to merge them by error
-		indices.clear();
-		vertices.clear();
+		for (size_t surface = 0; surface < newmesh->surfaces.size(); surface++) {
+			// TODO: This can fail if the file doesn't have any materials.
+			// We should have a "default" material as part of the engine
+			const std::optional<size_t>& materialIndex = meshData[i].materialIndices[surface];
+			if (materialIndex.has_value()) {
+				newmesh->surfaces[surface].material = materials[materialIndex.value()];
+			} else {
+				newmesh->surfaces[surface].material = materials[0];
+			}
+		}
+	}
 
-		for (auto&& p : mesh.primitives) {
-			GeoSurface newSurface;
-			newSurface.startIndex = (uint32_t)indices.size();
-			newSurface.count = (uint32_t)gltf.accessors[p.indicesAccessor.value()].count;
+	// load all nodes and their meshes
+	file.scene = buildSceneGraph(gltf);
+	file.meshList = meshes;
+	for (uint32_t i = 0; i < file.scene.size(); i++) {
+		file.nodes[file.scene.names[i]] = i;
+	}
 
-			size_t initial_vtx = vertices.size();
+	file.scene.updateTransforms();
+	file.assignObjectIds();
 
-			// load indices
-			{
-				fastgltf::Accessor& indexaccessor = gltf.accessors[p.indicesAccessor.value()];
-				indices.reserve(indices.size() + indexaccessor.count);
+	return scene;
+}
 
-				fastgltf::iterateAccessor<std::uint32_t>(gltf, indexaccessor, [&](std::uint32_t idx) {
-					indices.push_back(idx + initial_vtx);
-				});
-			}
+std::optional<std::shared_ptr<LoadedGLTF>> loadCookedScene(VulkanRenderer* renderer, const CookedSceneFile& cooked) {
+	PM_TRACE_ZONE("loadCookedScene");
+	auto scene = std::make_shared<LoadedGLTF>();
+	scene->renderer = renderer;
+	LoadedGLTF& file = *scene.get();
 
-			// load vertex positions
-			{
-				fastgltf::Accessor& posAccessor = gltf.accessors[p.findAttribute("POSITION")->second];
-				vertices.resize(vertices.size() + posAccessor.count);
-
-				fastgltf::iterateAccessorWithIndex<glm::vec3>(gltf, posAccessor, [&](glm::vec3 v, size_t index) {
-					Vertex newvtx;
-					newvtx.position = v;
-					newvtx.normal = { 1, 0, 0 };
-					newvtx.color = glm::vec4{ 1.f };
-					newvtx.uv_x = 0;
-					newvtx.uv_y = 0;
-					vertices[initial_vtx + index] = newvtx;
-				});
-			}
+	for (const CookedSampler& sampler : cooked.samplers()) {
+		file.samplers.push_back(createSampler(renderer->m_device, static_cast<VkFilter>(sampler.magFilter), static_cast<VkFilter>(sampler.minFilter), static_cast<VkSamplerMipmapMode>(sampler.mipmapMode)));
+	}
 
-			// load vertex normals
-			auto normals = p.findAttribute("NORMAL");
-			if (normals != p.attributes.end()) {
+	// texels and vertex streams are copied straight from the mapping into staging memory
+	std::vector<AllocatedImage> images;
+	for (const CookedImage& image : cooked.images()) {
+		std::span<const uint8_t> texels = cooked.blob<uint8_t>(image.dataOffset, image.dataSize);
+		const std::string name{ cooked.string(image.name) };
+		const auto format = static_cast<VkFormat>(image.format);
 
-				fastgltf::iterateAccessorWithIndex<glm::vec3>(gltf, gltf.accessors[(*normals).second], [&](glm::vec3 v, size_t index) {
-					vertices[initial_vtx + index].normal = v;
-				});
-			}
+		if (image.valid == 0 || image.mipLevels == 0 || texels.empty() || texels.size() != mipChainSize(format, image.width, image.height, image.mipLevels)) {
+			images.push_back(renderer->errorCheckerboardImage);
+			std::cout << "gltf failed to load texture " << name << std::endl;
+			continue;
+		}
 
-			// load UVs
-			auto uv = p.findAttribute("TEXCOORD_0");
-			if (uv != p.attributes.end()) {
+		AllocatedImage newImage = renderer->createImage(texels, VkExtent3D{ image.width, image.height, 1 }, format, image.mipLevels, VK_IMAGE_USAGE_SAMPLED_BIT);
+		images.push_back(newImage);
+		file.images[name] = newImage;
+	}
 
-				fastgltf::iterateAccessorWithIndex<glm::vec2>(gltf, gltf.accessors[(*uv).second], [&](glm::vec2 v, size_t index) {
-					vertices[initial_vtx + index].uv_x = v.x;
-					vertices[initial_vtx + index].uv_y = v.y;
-				});
-			}
+	std::vector<std::shared_ptr<GLTFMaterial>> materials;
+	std::span<const CookedMaterial> cookedMaterials = cooked.materials();
+	for (size_t i = 0; i < cookedMaterials.size(); i++) {
+		const CookedMaterial& mat = cookedMaterials[i];
 
-			// load vertex colors
-			auto colors = p.findAttribute("COLOR_0");
-			if (colors != p.attributes.end()) {
+		GLTFMetallic_Roughness::MaterialConstants constants{};
+		constants.colorFactors = glm::vec4{ mat.colorFactors[0], mat.colorFactors[1], mat.colorFactors[2], mat.colorFactors[3] };
+		constants.metalRoughFactors.x = mat.metalRoughFactors[0];
+		constants.metalRoughFactors.y = mat.metalRoughFactors[1];
+
+		const AllocatedImage* colorImage = nullptr;
+		VkSampler colorSampler = VK_NULL_HANDLE;
+		if (mat.colorImage >= 0 && static_cast<size_t>(mat.colorImage) < images.size() && static_cast<size_t>(mat.colorSampler) < file.samplers.size()) {
+			colorImage = &images[mat.colorImage];
+			colorSampler = file.samplers[mat.colorSampler];
+		}
 
-				fastgltf::iterateAccessorWithIndex<glm::vec4>(gltf, gltf.accessors[(*colors).second], [&](glm::vec4 v, size_t index) {
-					vertices[initial_vtx + index].color = v;
-				});
-			}
+		auto newMat = createMaterial(renderer, file, constants, static_cast<MaterialPass>(mat.passType), colorImage, colorSampler);
+		materials.push_back(newMat);
+		file.materials[std::string{ cooked.string(mat.name) }] = newMat;
+	}
 
-			// TODO: This can fail if the file doesn't have any materials.
-			// We should have a "default" material as part of the engine
-			if (p.materialIndex.has_value()) {
-				newSurface.material = materials[p.materialIndex.value()];
-			} else {
-				newSurface.material = materials[0];
-			}
+	// open() validated every range, the streams are already in their GPU form
+	std::span<const CookedSurface> cookedSurfaces = cooked.surfaces();
+	for (const CookedMesh& mesh : cooked.meshes()) {
+		std::span<const uint8_t> vertexData = cooked.blob<uint8_t>(mesh.vertexOffset, packedVertexSize(mesh.vertexCount));
+		std::span<const uint8_t> indexData = cooked.blob<uint8_t>(mesh.indexOffset, mesh.indexCount * mesh.indexSize);
+		std::span<const Meshlet> meshlets = cooked.blob<Meshlet>(mesh.meshletOffset, mesh.meshletCount);
+		const VkIndexType indexType = mesh.indexSize == sizeof(uint16_t) ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+
+		auto newmesh = std::make_shared<MeshAsset>();
+		newmesh->name = cooked.string(mesh.name);
+		newmesh->meshBuffers = renderer->uploadPackedMesh(vertexData, static_cast<uint32_t>(mesh.vertexCount), indexData, indexType, meshlets);
+
+		std::span<const CookedSurface> meshSurfaces = cookedSurfaces.subspan(mesh.firstSurface, mesh.surfaceCount);
 
+		for (const CookedSurface& surface : meshSurfaces) {
+			GeoSurface newSurface{};
+			newSurface.startIndex = surface.startIndex;
+			newSurface.count = surface.count;
+			newSurface.bounds.origin = glm::vec3{ surface.origin[0], surface.origin[1], surface.origin[2] };
+			newSurface.bounds.extents = glm::vec3{ surface.extents[0], surface.extents[1], surface.extents[2] };
+			newSurface.bounds.sphereRadius = surface.sphereRadius;
+			newSurface.lodCount = std::clamp(surface.lodCount, 1u, MAX_LOD_COUNT);
+			for (uint32_t level = 0; level < newSurface.lodCount; level++) {
+				const CookedLod& lod = surface.lods[level];
+				newSurface.lods[level] = LodLevel{ .startIndex = lod.startIndex,
+					.count = lod.count,
+					.error = lod.error,
+					.firstMeshlet = lod.firstMeshlet,
+					.meshletCount = lod.meshletCount };
+			}
+			// same fallback as the glTF path
+			newSurface.material = surface.materialIndex >= 0 ? materials[surface.materialIndex] : materials[0];
 			newmesh->surfaces.push_back(newSurface);
 		}
 
-		newmesh->meshBuffers = renderer->uploadMesh(indices, vertices);
+		std::span<const glm::vec3> occluderPositions = cooked.blob<glm::vec3>(mesh.occluderPositionOffset, mesh.occluderPositionCount);
+		std::span<const uint32_t> occluderIndices = cooked.blob<uint32_t>(mesh.occluderIndexOffset, mesh.occluderIndexCount);
+		newmesh->occluder.positions.assign(occluderPositions.begin(), occluderPositions.end());
+		newmesh->occluder.indices.assign(occluderIndices.begin(), occluderIndices.end());
+		newmesh->occluder.center = glm::vec3{ mesh.occluderCenter[0], mesh.occluderCenter[1], mesh.occluderCenter[2] };
+		newmesh->occluder.radius = mesh.occluderRadius;
+
+		file.meshList.push_back(newmesh);
+		file.meshes[newmesh->name] = newmesh;
 	}
 
-	// load all nodes and their meshes
-	for (fastgltf::Node& node : gltf.nodes) {
-		std::shared_ptr<Node> newNode;
+	std::span<const CookedNode> nodes = cooked.nodes();
+	file.scene.reserve(nodes.size());
+	for (const CookedNode& node : nodes) {
+		glm::mat4 localTransform;
+		memcpy(&localTransform, node.localTransform, sizeof(localTransform));
 
-		// find if the node has a mesh, and if it does hook it to the mesh pointer and allocate it with the meshnode class
-		if (node.meshIndex.has_value()) {
-			newNode = std::make_shared<MeshNode>();
-			dynamic_cast<MeshNode*>(newNode.get())->mesh = meshes[*node.meshIndex];
-		} else {
-			newNode = std::make_shared<Node>();
-		}
+		const uint32_t sceneIndex = file.scene.addNode(node.parent, localTransform, node.meshIndex, std::string{ cooked.string(node.name) });
+		file.nodes[file.scene.names[sceneIndex]] = sceneIndex;
+	}
 
-		nodes.push_back(newNode);
-		file.nodes[node.name.c_str()];
+	file.scene.updateTransforms();
+	file.assignObjectIds();
 
-		std::visit(fastgltf::visitor{
-								 [&](fastgltf::Node::TransformMatrix matrix) {
-									 memcpy(&newNode->localTransform, matrix.data(), sizeof(matrix));
-								 },
-								 [&](fastgltf::Node::TRS transform) {
-									 glm::vec3 tl(transform.translation[0], transform.translation[1], transform.translation[2]);
-									 glm::quat rot(transform.rotation[3], transform.rotation[0], transform.rotation[1], transform.rotation[2]);
-									 glm::vec3 sc(transform.scale[0], transform.scale[1], transform.scale[2]);
+	return scene;
+}
 
-									 glm::mat4 tm = glm::translate(glm::mat4(1.f), tl);
-									 glm::mat4 rm = glm::toMat4(rot);
-									 glm::mat4 sm = glm::scale(glm::mat4(1.f), sc);
+bool cookGltf(const std::filesystem::path& source, const std::filesystem::path& destination, const CookOptions& options) {
+	std::optional<SourceStamp> stamp = sourceStamp(source);
+	if (!stamp.has_value()) {
+		std::cout << std::format("Cannot read {}\n", source.string());
+		return false;
+	}
 
-									 newNode->localTransform = tm * rm * sm;
-								 } },
-			node.transform);
+	std::optional<fastgltf::Asset> parsed = parseGltf(source);
+	if (!parsed.has_value()) {
+		return false;
 	}
+	fastgltf::Asset& gltf = *parsed;
 
-	// Setup transform hierarchy
-	for (int i = 0; i < gltf.nodes.size(); i++) {
-		fastgltf::Node& node = gltf.nodes[i];
-		std::shared_ptr<Node>& sceneNode = nodes[i];
+	// materials only bind the base color texture, images sampled as metal-rough or normal
+	// maps alone are left out instead of being encoded for nothing
+	std::vector<uint8_t> colorImages(gltf.images.size(), 0);
+	for (fastgltf::Material& mat : gltf.materials) {
+		if (mat.pbrData.baseColorTexture.has_value()) {
+			const std::optional<size_t>& imageIndex = gltf.textures[mat.pbrData.baseColorTexture->textureIndex].imageIndex;
+			if (imageIndex.has_value()) {
+				colorImages[*imageIndex] = 1;
+			}
+		}
+	}
+
+	DecodedGltf decoded = decodeGltf(gltf, options.meshes, colorImages);
+	CookedSceneWriter writer;
+
+	for (fastgltf::Sampler& sampler : gltf.samplers) {
+		writer.samplers.push_back(CookedSampler{
+			.magFilter = static_cast<uint32_t>(extractFilter(sampler.magFilter.value_or(fastgltf::Filter::Nearest))),
+			.minFilter = static_cast<uint32_t>(extractFilter(sampler.minFilter.value_or(fastgltf::Filter::Nearest))),
+			.mipmapMode = static_cast<uint32_t>(extractMipmapMode(sampler.minFilter.value_or(fastgltf::Filter::Nearest))) });
+	}
+
+	const VkFormat imageFormat = options.compressTextures ? compressedFormat(TextureUsage::Color) : VK_FORMAT_R8G8B8A8_UNORM;
 
-		for (auto& c : node.children) {
-			sceneNode->children.push_back(nodes[c]);
-			nodes[c]->parent = sceneNode;
+	// mip chains are built and encoded on worker threads, blocks of a level are spread too
+	std::vector<std::vector<uint8_t>> textures(gltf.images.size());
+	tbb::parallel_for(size_t(0), gltf.images.size(), [&](size_t i) {
+		if (const std::optional<ImageData>& data = decoded.images[i]; data.has_value()) {
+			textures[i] = buildTexture(data->pixels.get(), data->width, data->height, imageFormat, mipLevelCount(data->width, data->height), options.mipFilter);
 		}
+	});
+
+	// the cooked image table only holds the color images, materials index it through this
+	std::vector<int32_t> cookedImages(gltf.images.size(), -1);
+	for (size_t i = 0; i < gltf.images.size(); i++) {
+		if (!colorImages[i]) {
+			continue;
+		}
+		CookedImage image{};
+		image.name = writer.addString(gltf.images[i].name.c_str());
+
+		if (const std::optional<ImageData>& data = decoded.images[i]; data.has_value()) {
+			image.width = data->width;
+			image.height = data->height;
+			image.valid = 1;
+			image.format = imageFormat;
+			image.mipLevels = mipLevelCount(data->width, data->height);
+			image.dataSize = textures[i].size();
+			image.dataOffset = writer.addBlob(textures[i].data(), textures[i].size());
+		}
+		cookedImages[i] = static_cast<int32_t>(writer.images.size());
+		writer.images.push_back(image);
 	}
 
-	// find the top nodes, with no parents
-	for (auto& node : nodes) {
-		if (node->parent.lock() == nullptr) {
-			file.topNodes.push_back(node);
-			node->refreshTransform(glm::mat4{ 1.f });
+	for (fastgltf::Material& mat : gltf.materials) {
+		CookedMaterial material{};
+		material.name = writer.addString(mat.name.c_str());
+		for (int c = 0; c < 4; c++) {
+			material.colorFactors[c] = mat.pbrData.baseColorFactor[c];
+		}
+		material.metalRoughFactors[0] = mat.pbrData.metallicFactor;
+		material.metalRoughFactors[1] = mat.pbrData.roughnessFactor;
+		material.colorImage = -1;
+		material.colorSampler = -1;
+		if (mat.pbrData.baseColorTexture.has_value()) {
+			const fastgltf::Texture& texture = gltf.textures[mat.pbrData.baseColorTexture.value().textureIndex];
+			material.colorImage = cookedImages[texture.imageIndex.value()];
+			material.colorSampler = static_cast<int32_t>(texture.samplerIndex.value());
 		}
+		material.passType = static_cast<uint32_t>(extractMaterialPass(mat));
+		writer.materials.push_back(material);
 	}
 
-	return scene;
+	// vertices are packed and indices narrowed here, so loading only copies them. the
+	// occluder is built from the full vertices, which the cooked file no longer has
+	std::vector<uint8_t> packedVertices;
+	std::vector<uint16_t> narrowIndices;
+	for (MeshData& meshData : decoded.meshes) {
+		CookedMesh mesh{};
+		mesh.name = writer.addString(meshData.name);
+		mesh.firstSurface = static_cast<uint32_t>(writer.surfaces.size());
+		mesh.surfaceCount = static_cast<uint32_t>(meshData.surfaces.size());
+
+		packedVertices.resize(packedVertexSize(meshData.vertices.size()));
+		packVertices<VERTEX_LAYOUT>(meshData.vertices, packedVertices.data());
+		mesh.vertexCount = meshData.vertices.size();
+		mesh.vertexOffset = writer.addBlob(packedVertices.data(), packedVertices.size());
+
+		mesh.indexCount = meshData.indices.size();
+		if (useUint16Indices(meshData.vertices.size())) {
+			narrowIndices.resize(meshData.indices.size());
+			std::transform(meshData.indices.begin(), meshData.indices.end(), narrowIndices.begin(), [](uint32_t index) { return static_cast<uint16_t>(index); });
+			mesh.indexSize = sizeof(uint16_t);
+			mesh.indexOffset = writer.addBlob(narrowIndices.data(), narrowIndices.size() * sizeof(uint16_t));
+		} else {
+			mesh.indexSize = sizeof(uint32_t);
+			mesh.indexOffset = writer.addBlob(meshData.indices.data(), meshData.indices.size() * sizeof(uint32_t));
+		}
+
+		mesh.meshletCount = meshData.meshlets.size();
+		mesh.meshletOffset = writer.addBlob(meshData.meshlets.data(), meshData.meshlets.size() * sizeof(Meshlet));
+
+		// surfaces without a material get materials[0], like in loadGltf
+		const OccluderMesh occluder = buildMeshOccluder(meshData.indices, meshData.vertices, meshData.surfaces, [&](size_t surface) {
+			const size_t materialIndex = meshData.materialIndices[surface].value_or(0);
+			return materialIndex >= gltf.materials.size() || extractMaterialPass(gltf.materials[materialIndex]) != MaterialPass::Transparent;
+		});
+		mesh.occluderPositionCount = occluder.positions.size();
+		mesh.occluderPositionOffset = writer.addBlob(occluder.positions.data(), occluder.positions.size() * sizeof(glm::vec3));
+		mesh.occluderIndexCount = occluder.indices.size();
+		mesh.occluderIndexOffset = writer.addBlob(occluder.indices.data(), occluder.indices.size() * sizeof(uint32_t));
+		for (int c = 0; c < 3; c++) {
+			mesh.occluderCenter[c] = occluder.center[c];
+		}
+		mesh.occluderRadius = occluder.radius;
+		writer.meshes.push_back(mesh);
+
+		for (size_t s = 0; s < meshData.surfaces.size(); s++) {
+			const GeoSurface& geoSurface = meshData.surfaces[s];
+			const std::optional<size_t>& materialIndex = meshData.materialIndices[s];
+
+			CookedSurface surface{};
+			surface.startIndex = geoSurface.startIndex;
+			surface.count = geoSurface.count;
+			surface.materialIndex = materialIndex.has_value() ? static_cast<int32_t>(*materialIndex) : -1;
+			surface.sphereRadius = geoSurface.bounds.sphereRadius;
+			for (int c = 0; c < 3; c++) {
+				surface.origin[c] = geoSurface.bounds.origin[c];
+				surface.extents[c] = geoSurface.bounds.extents[c];
+			}
+			surface.lodCount = geoSurface.lodCount;
+			for (uint32_t level = 0; level < geoSurface.lodCount; level++) {
+				const LodLevel& lod = geoSurface.lods[level];
+				surface.lods[level] = CookedLod{ .startIndex = lod.startIndex,
+					.count = lod.count,
+					.error = lod.error,
+					.firstMeshlet = lod.firstMeshlet,
+					.meshletCount = lod.meshletCount };
+			}
+			writer.surfaces.push_back(surface);
+		}
+	}
+
+	SceneGraph graph = buildSceneGraph(gltf);
+	for (uint32_t i = 0; i < graph.size(); i++) {
+		CookedNode node{};
+		node.name = writer.addString(graph.names[i]);
+		node.parent = graph.parents[i];
+		node.meshIndex = graph.meshIndices[i];
+		memcpy(node.localTransform, &graph.localTransforms[i], sizeof(node.localTransform));
+		writer.nodes.push_back(node);
+	}
+
+	return writer.write(destination, *stamp);
 }
 
 void LoadedGLTF::draw(const glm::mat4& topMatrix, DrawContext& ctx) {
-	for (auto& n : topNodes) {
-		n->draw(topMatrix, ctx);
+	scene.updateTransforms();
+	drawRange(topMatrix, 0, scene.meshNodes.size(), ctx);
+}
+
+void LoadedGLTF::drawRange(const glm::mat4& topMatrix, size_t begin, size_t end, DrawContext& ctx) const {
+	SurfaceEmitter emitter{ ctx };
+	for (size_t i = begin; i < end; i++) {
+		const uint32_t node = scene.meshNodes[i];
+		drawMesh(*meshList[scene.meshIndices[node]], topMatrix * scene.worldTransforms[node], objectIdBase + firstObjectIds[i], emitter);
+	}
+}
+
+void LoadedGLTF::assignObjectIds() {
+	firstObjectIds.resize(scene.meshNodes.size());
+	objectIdCount = 0;
+	for (size_t i = 0; i < scene.meshNodes.size(); i++) {
+		firstObjectIds[i] = objectIdCount;
+		objectIdCount += static_cast<uint32_t>(meshList[scene.meshIndices[scene.meshNodes[i]]]->surfaces.size());
 	}
 }
 
 void LoadedGLTF::clearAll() {
 	VkDevice dv = renderer->m_device;
 
-	descriptorPool.destroyPools(dv);
-	renderer->destroyBuffer(materialDataBuffer);
+	// also drops the references on the images and samplers destroyed below
+	for (uint32_t slot : materialSlots) {
+		renderer->m_bindless.releaseMaterial(slot);
+	}
 
-	for (auto& [k, v] : meshes) {
-		renderer->destroyBuffer(v->meshBuffers.indexBuffer);
-		renderer->destroyBuffer(v->meshBuffers.vertexBuffer);
+	// hands the ranges back to the geometry pools. meshList, as meshes is keyed by name and
+	// drops meshes whose names repeat or are empty
+	for (auto& mesh : meshList) {
+		renderer->releaseMesh(mesh->meshBuffers);
 	}
 
 	for (auto& [k, v] : images) {
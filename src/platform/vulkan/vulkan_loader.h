@@ -1,6 +1,12 @@
 #pragma once
 
 #include "platform/vulkan/vulkan_descriptor.h"
+#include "scene/cooked_scene.h"
+#include "scene/lod.h"
+#include "scene/meshlet.h"
+#include "scene/mip_filter.h"
+#include "scene/occlusion_buffer.h"
+#include "scene/scene_graph.h"
 #include "vk_types.h"
 #include <fastgltf/glm_element_traits.hpp>
 #include <fastgltf/parser.hpp>
@@ -13,10 +19,22 @@ struct GLTFMaterial {
 		MaterialInstance data;
 };
 
+// local space bounds of a surface, both as an AABB and as a bounding sphere
+struct Bounds {
+		glm::vec3 origin;
+		float sphereRadius;
+		glm::vec3 extents;
+};
+
 struct GeoSurface {
 		uint32_t startIndex;
 		uint32_t count;
+		Bounds bounds;
 		std::shared_ptr<GLTFMaterial> material;
+
+		// lods[0] is [startIndex, startIndex + count), coarser levels follow in the same index buffer
+		std::array<LodLevel, MAX_LOD_COUNT> lods;
+		uint32_t lodCount;
 };
 
 struct MeshAsset {
@@ -24,36 +42,94 @@ struct MeshAsset {
 
 		std::vector<GeoSurface> surfaces;
 		GPUMeshBuffers meshBuffers;
+
+		// simplified opaque surfaces for the CPU occlusion buffer, empty when the mesh
+		// can't be used as an occluder
+		OccluderMesh occluder;
+};
+
+// CPU side of a mesh, converted from the glTF accessors before anything touches the GPU.
+// surfaces have no material yet, materialIndices holds the glTF material of each one
+struct MeshData {
+		std::string name;
+
+		std::vector<uint32_t> indices;
+		std::vector<Vertex> vertices;
+		std::vector<Meshlet> meshlets;
+
+		std::vector<GeoSurface> surfaces;
+		std::vector<std::optional<size_t>> materialIndices;
+
+		OccluderMesh occluder;
+};
+
+struct StbiDeleter {
+		void operator()(unsigned char* pixels) const;
+};
+
+// RGBA8 pixels decoded from a glTF image
+struct ImageData {
+		uint32_t width;
+		uint32_t height;
+		std::unique_ptr<unsigned char, StbiDeleter> pixels;
 };
 
 
 struct AllocatedImage;
 class VulkanRenderer;
 
+Bounds computeBounds(std::span<const Vertex> vertices);
+
+// CPU stage of the loader, safe to call from several threads on the same asset
+MeshData buildMeshData(fastgltf::Asset& asset, fastgltf::Mesh& mesh);
+std::optional<ImageData> decodeImage(fastgltf::Asset& asset, fastgltf::Image& image);
+
+std::optional<fastgltf::Asset> parseGltf(const std::filesystem::path& path);
+// node hierarchy of the asset in topological order
+SceneGraph buildSceneGraph(fastgltf::Asset& asset);
+MaterialPass extractMaterialPass(const fastgltf::Material& material);
+
 std::optional<std::vector<std::shared_ptr<MeshAsset>>> loadGltfMeshes(pm::VulkanRenderer* engine, std::filesystem::path filePath);
 
-struct LoadedGLTF : public IRenderable {
+struct DrawContext;
+
+struct LoadedGLTF {
 
 		// storage for all the data on a given glTF file
 		std::unordered_map<std::string, std::shared_ptr<MeshAsset>> meshes;
-		std::unordered_map<std::string, std::shared_ptr<Node>> nodes;
+		std::unordered_map<std::string, uint32_t> nodes;
 		std::unordered_map<std::string, AllocatedImage> images;
 		std::unordered_map<std::string, std::shared_ptr<GLTFMaterial>> materials;
 
-		// nodes that dont have a parent, for iterating through the file in tree order
-		std::vector<std::shared_ptr<Node>> topNodes;
+		// meshes in file order, indexed by SceneGraph::meshIndices
+		std::vector<std::shared_ptr<MeshAsset>> meshList;
 
-		std::vector<VkSampler> samplers;
+		// flat transform hierarchy for every node in the file
+		SceneGraph scene;
+
+		// first object id (see RenderObject::objectId) of every scene.meshNodes entry,
+		// relative to objectIdBase. each surface of a mesh node owns one id
+		std::vector<uint32_t> firstObjectIds;
+		uint32_t objectIdCount{ 0 };
+		// set by the renderer, so the ids of all drawn scenes are disjoint
+		uint32_t objectIdBase{ 0 };
 
-		DescriptorAllocator descriptorPool;
+		std::vector<VkSampler> samplers;
 
-		AllocatedBuffer materialDataBuffer;
+		// entries of the renderer's bindless material table owned by this file
+		std::vector<uint32_t> materialSlots;
 
 		VulkanRenderer* renderer;
 
 		~LoadedGLTF() { clearAll(); };
 
-		virtual void draw(const glm::mat4& topMatrix, DrawContext& ctx);
+		void draw(const glm::mat4& topMatrix, DrawContext& ctx);
+
+		// emit draws for scene.meshNodes[begin, end). world transforms must be up to date
+		void drawRange(const glm::mat4& topMatrix, size_t begin, size_t end, DrawContext& ctx) const;
+
+		// fills firstObjectIds and objectIdCount, once the nodes and meshes are loaded
+		void assignObjectIds();
 
 	private:
 		void clearAll();
@@ -61,7 +137,32 @@ struct LoadedGLTF : public IRenderable {
 
 std::optional<AllocatedImage> loadImage(VulkanRenderer* renderer, fastgltf::Asset& asset, fastgltf::Image& image);
 
-std::optional<std::shared_ptr<LoadedGLTF>> loadGltf(VulkanRenderer* renderer, std::string_view filePath);
+// CPU passes run on glTF meshes between accessor conversion and upload
+struct MeshProcessOptions {
+		// vertex dedup and cache/overdraw/fetch reordering, see scene/mesh_optimize.h
+		bool optimize{ true };
+		// simplified levels appended to every surface, see scene/lod.h
+		bool generateLods{ true };
+		// clusters for every level, used by RenderPath::Clusters, see scene/meshlet.h
+		bool buildMeshlets{ true };
+};
+
+// loads the cooked cache next to filePath when it is up to date, the glTF file otherwise.
+// meshOptions only applies to glTF files, cooked scenes were processed by the cooker
+std::optional<std::shared_ptr<LoadedGLTF>> loadGltf(VulkanRenderer* renderer, std::string_view filePath, const MeshProcessOptions& meshOptions = {});
+std::optional<std::shared_ptr<LoadedGLTF>> loadCookedScene(VulkanRenderer* renderer, const CookedSceneFile& cooked);
+
+struct CookOptions {
+		// BC7 when set, RGBA8 otherwise. both get full mip chains. only base color images are
+		// cooked, materials bind no other texture. devices without BC support skip
+		// compressed caches and load the source with RGBA8 textures
+		bool compressTextures{ true };
+		MipFilter mipFilter{ MipFilter::Kaiser };
+		MeshProcessOptions meshes{};
+};
+
+// convert a glTF file into a cooked scene, see cooked_scene.h
+bool cookGltf(const std::filesystem::path& source, const std::filesystem::path& destination, const CookOptions& options = {});
 
 
 }// namespace pm
@@ -0,0 +1,279 @@
+#include "vulkan_profiler.h"
+
+#include <algorithm>
+
+#include "trace.h"
+
+namespace pm {
+
+namespace {
+
+// the order of the results follows the order of the bits
+constexpr VkQueryPipelineStatisticFlags PIPELINE_STATISTICS =
+	VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT
+	| VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT
+	| VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT
+	| VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+constexpr uint32_t PIPELINE_STATISTIC_COUNT = 4;
+
+// value and availability of one query, as written with VK_QUERY_RESULT_WITH_AVAILABILITY_BIT
+struct TimestampResult {
+		uint64_t value;
+		uint64_t available;
+};
+
+}// namespace
+
+const char* gpuZoneName(GpuZone zone) {
+	switch (zone) {
+		case GpuZone::Background:
+			return "Background";
+		case GpuZone::Culling:
+			return "Culling";
+		case GpuZone::OcclusionCulling:
+			return "OcclusionCulling";
+		case GpuZone::Geometry:
+			return "Geometry";
+		case GpuZone::Blit:
+			return "Blit";
+		default:
+			return "Unknown";
+	}
+}
+
+void RollingTimings::push(float value) {
+	m_samples[m_next] = value;
+	m_next = (m_next + 1) % GPU_TIMING_WINDOW;
+	m_count = std::min(m_count + 1, GPU_TIMING_WINDOW);
+}
+
+void RollingTimings::clear() {
+	m_count = 0;
+	m_next = 0;
+}
+
+TimingSummary RollingTimings::summary() const {
+	if (m_count == 0) {
+		return TimingSummary{};
+	}
+
+	// until the window is full the samples are the first m_count entries
+	std::array<float, GPU_TIMING_WINDOW> sorted;
+	std::copy(m_samples.begin(), m_samples.begin() + m_count, sorted.begin());
+
+	TimingSummary summary{ .min = sorted[0], .avg = 0.f, .max = sorted[0], .p99 = 0.f };
+	for (size_t i = 0; i < m_count; i++) {
+		summary.min = std::min(summary.min, sorted[i]);
+		summary.max = std::max(summary.max, sorted[i]);
+		summary.avg += sorted[i];
+	}
+	summary.avg /= static_cast<float>(m_count);
+
+	const size_t p99Index = (m_count * 99 + 99) / 100 - 1;
+	std::nth_element(sorted.begin(), sorted.begin() + p99Index, sorted.begin() + m_count);
+	summary.p99 = sorted[p99Index];
+	return summary;
+}
+
+void GpuProfiler::init(VkInstance instance, VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, const VkPhysicalDeviceProperties& properties, uint32_t frameCount, bool pipelineStatistics, bool calibratedTimestamps) {
+	m_device = device;
+	m_slots.assign(frameCount, SlotState{});
+	m_timestampPeriod = properties.limits.timestampPeriod;
+
+	uint32_t familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> families(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+	const uint32_t validBits = queueFamily < familyCount ? families[queueFamily].timestampValidBits : 0;
+
+	if (validBits > 0 && properties.limits.timestampPeriod > 0.f) {
+		m_timestampMask = validBits >= 64 ? ~uint64_t{ 0 } : (uint64_t{ 1 } << validBits) - 1;
+
+		VkQueryPoolCreateInfo poolInfo{ .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+		poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		poolInfo.queryCount = TIMESTAMPS_PER_FRAME * frameCount;
+		VK_CHECK(vkCreateQueryPool(m_device, &poolInfo, nullptr, &m_timestampPool));
+	} else {
+		std::cout << "GPU profiler: the graphics queue has no timestamp support, GPU timings are disabled\n";
+	}
+
+	if (pipelineStatistics) {
+		VkQueryPoolCreateInfo poolInfo{ .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+		poolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+		poolInfo.queryCount = frameCount;
+		poolInfo.pipelineStatistics = PIPELINE_STATISTICS;
+		VK_CHECK(vkCreateQueryPool(m_device, &poolInfo, nullptr, &m_statisticsPool));
+	}
+
+	// trace timestamps come from steady_clock, which is CLOCK_MONOTONIC
+	if (calibratedTimestamps && timestampsEnabled()) {
+		auto getTimeDomains = reinterpret_cast<PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT>(vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceCalibrateableTimeDomainsEXT"));
+		uint32_t domainCount = 0;
+		std::vector<VkTimeDomainEXT> domains;
+		if (getTimeDomains != nullptr) {
+			getTimeDomains(physicalDevice, &domainCount, nullptr);
+			domains.resize(domainCount);
+			getTimeDomains(physicalDevice, &domainCount, domains.data());
+		}
+		const bool hasDevice = std::find(domains.begin(), domains.end(), VK_TIME_DOMAIN_DEVICE_EXT) != domains.end();
+		const bool hasMonotonic = std::find(domains.begin(), domains.end(), VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT) != domains.end();
+		if (hasDevice && hasMonotonic) {
+			m_getCalibratedTimestamps = reinterpret_cast<PFN_vkGetCalibratedTimestampsEXT>(vkGetDeviceProcAddr(m_device, "vkGetCalibratedTimestampsEXT"));
+		}
+	}
+	if (calibratedTimestamps && m_getCalibratedTimestamps == nullptr) {
+		std::cout << "GPU profiler: no CLOCK_MONOTONIC time domain, GPU zones are left out of traces\n";
+	}
+}
+
+void GpuProfiler::cleanup() {
+	if (m_timestampPool != VK_NULL_HANDLE) {
+		vkDestroyQueryPool(m_device, m_timestampPool, nullptr);
+		m_timestampPool = VK_NULL_HANDLE;
+	}
+	if (m_statisticsPool != VK_NULL_HANDLE) {
+		vkDestroyQueryPool(m_device, m_statisticsPool, nullptr);
+		m_statisticsPool = VK_NULL_HANDLE;
+	}
+}
+
+void GpuProfiler::beginFrame(VkCommandBuffer cmd, uint32_t slot) {
+	m_currentSlot = slot;
+	// once per frame, so the GPU clock drifting away from the CPU doesn't add up
+	m_calibrated = traceCapturing() && calibrate();
+	readResults(slot);
+
+	SlotState& state = m_slots[slot];
+	state = SlotState{};
+
+	if (timestampsEnabled()) {
+		vkCmdResetQueryPool(cmd, m_timestampPool, firstTimestamp(slot), TIMESTAMPS_PER_FRAME);
+		vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, m_timestampPool, firstTimestamp(slot));
+	}
+	if (statisticsEnabled()) {
+		vkCmdResetQueryPool(cmd, m_statisticsPool, slot, 1);
+	}
+}
+
+void GpuProfiler::endFrame(VkCommandBuffer cmd) {
+	if (!timestampsEnabled()) {
+		return;
+	}
+	vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, m_timestampPool, firstTimestamp(m_currentSlot) + 1);
+	m_slots[m_currentSlot].frameWritten = true;
+}
+
+// NOTE: ALL_COMMANDS on both ends waits for the work recorded before, so a zone only
+// covers its own commands instead of overlapping with whatever was still in flight
+void GpuProfiler::beginZone(VkCommandBuffer cmd, GpuZone zone) {
+	if (!timestampsEnabled()) {
+		return;
+	}
+	const uint32_t query = firstTimestamp(m_currentSlot) + 2 + 2 * static_cast<uint32_t>(zone);
+	vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, m_timestampPool, query);
+}
+
+void GpuProfiler::endZone(VkCommandBuffer cmd, GpuZone zone) {
+	if (!timestampsEnabled()) {
+		return;
+	}
+	const uint32_t query = firstTimestamp(m_currentSlot) + 3 + 2 * static_cast<uint32_t>(zone);
+	vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, m_timestampPool, query);
+	m_slots[m_currentSlot].zoneMask |= 1u << static_cast<uint32_t>(zone);
+}
+
+void GpuProfiler::beginStatistics(VkCommandBuffer cmd) {
+	if (statisticsEnabled()) {
+		vkCmdBeginQuery(cmd, m_statisticsPool, m_currentSlot, 0);
+	}
+}
+
+void GpuProfiler::endStatistics(VkCommandBuffer cmd) {
+	if (statisticsEnabled()) {
+		vkCmdEndQuery(cmd, m_statisticsPool, m_currentSlot);
+		m_slots[m_currentSlot].statisticsWritten = true;
+	}
+}
+
+void GpuProfiler::readResults(uint32_t slot) {
+	const SlotState& state = m_slots[slot];
+	m_latestFrameTime = 0.f;
+
+	// the queries of a slot are only reset once it recorded a frame, reading them before is invalid
+	if (timestampsEnabled() && state.frameWritten) {
+		std::array<TimestampResult, TIMESTAMPS_PER_FRAME> results{};
+		// VK_NOT_READY only means some zones were not written, their availability is 0
+		vkGetQueryPoolResults(m_device, m_timestampPool, firstTimestamp(slot), TIMESTAMPS_PER_FRAME, sizeof(results), results.data(), sizeof(TimestampResult), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+		auto elapsedMs = [&](const TimestampResult& begin, const TimestampResult& end) {
+			const uint64_t ticks = (end.value - begin.value) & m_timestampMask;
+			return static_cast<float>(static_cast<double>(ticks) * m_timestampPeriod / 1'000'000.0);
+		};
+
+		if (results[0].available && results[1].available) {
+			m_latestFrameTime = elapsedMs(results[0], results[1]);
+			m_frameTime.push(m_latestFrameTime);
+#if PM_TRACING
+			if (m_calibrated) {
+				recordGpuTraceZone("GPU Frame", toTraceTime(results[0].value), toTraceTime(results[1].value));
+			}
+#endif
+		}
+		for (uint32_t zone = 0; zone < GPU_ZONE_COUNT; zone++) {
+			const TimestampResult& begin = results[2 + 2 * zone];
+			const TimestampResult& end = results[3 + 2 * zone];
+			if ((state.zoneMask & (1u << zone)) != 0 && begin.available && end.available) {
+				m_zoneTimes[zone].push(elapsedMs(begin, end));
+#if PM_TRACING
+				if (m_calibrated) {
+					recordGpuTraceZone(gpuZoneName(static_cast<GpuZone>(zone)), toTraceTime(begin.value), toTraceTime(end.value));
+				}
+#endif
+			} else if ((state.zoneMask & (1u << zone)) == 0) {
+				// e.g. the culling passes after switching to RenderPath::Classic
+				m_zoneTimes[zone].clear();
+			}
+		}
+	}
+
+	if (statisticsEnabled() && state.statisticsWritten) {
+		std::array<uint64_t, PIPELINE_STATISTIC_COUNT + 1> values{};
+		vkGetQueryPoolResults(m_device, m_statisticsPool, slot, 1, sizeof(values), values.data(), sizeof(values), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+		if (values[PIPELINE_STATISTIC_COUNT] != 0) {
+			m_statistics = PipelineStatistics{
+				.vertexInvocations = values[0],
+				.clippingInvocations = values[1],
+				.clippingPrimitives = values[2],
+				.fragmentInvocations = values[3],
+			};
+		}
+	}
+}
+
+bool GpuProfiler::calibrate() {
+	if (m_getCalibratedTimestamps == nullptr) {
+		return false;
+	}
+
+	const VkCalibratedTimestampInfoEXT infos[2] = {
+		{ .sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT, .timeDomain = VK_TIME_DOMAIN_DEVICE_EXT },
+		{ .sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT, .timeDomain = VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT },
+	};
+	uint64_t timestamps[2] = {};
+	uint64_t maxDeviation = 0;
+	if (m_getCalibratedTimestamps(m_device, 2, infos, timestamps, &maxDeviation) != VK_SUCCESS) {
+		return false;
+	}
+
+	m_calibrationTicks = timestamps[0];
+	m_calibrationNs = timestamps[1];
+	return true;
+}
+
+uint64_t GpuProfiler::toTraceTime(uint64_t ticks) const {
+	// the results are from earlier frames, so the ticks are always before the calibration
+	const uint64_t ticksBefore = (m_calibrationTicks - ticks) & m_timestampMask;
+	return m_calibrationNs - static_cast<uint64_t>(static_cast<double>(ticksBefore) * m_timestampPeriod);
+}
+
+}// namespace pm
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "vk_types.h"
+
+namespace pm {
+
+// GPU work measured by the profiler, each zone is written at most once per frame
+enum class GpuZone : uint8_t {
+	Background,
+	// early object / cluster culling pass
+	Culling,
+	// Hi-Z build and late culling pass, part of Geometry
+	OcclusionCulling,
+	// everything between the start of the first and the end of the last rendering pass
+	Geometry,
+	// draw image to swapchain copy, or to the readback buffer when headless
+	Blit,
+	Count
+};
+constexpr size_t GPU_ZONE_COUNT = static_cast<size_t>(GpuZone::Count);
+
+const char* gpuZoneName(GpuZone zone);
+
+// number of frames the rolling timings are computed over
+constexpr size_t GPU_TIMING_WINDOW = 256;
+
+// milliseconds, all 0 until a sample was recorded
+struct TimingSummary {
+		float min;
+		float avg;
+		float max;
+		float p99;
+};
+
+// of the geometry pass, counted by VkQueryPool pipeline statistics queries
+struct PipelineStatistics {
+		uint64_t vertexInvocations;
+		uint64_t clippingInvocations;
+		uint64_t clippingPrimitives;
+		uint64_t fragmentInvocations;
+};
+
+// Ring buffer of the last GPU_TIMING_WINDOW samples
+class RollingTimings {
+	public:
+		void push(float value);
+		void clear();
+		TimingSummary summary() const;
+
+	private:
+		std::array<float, GPU_TIMING_WINDOW> m_samples{};
+		size_t m_count{ 0 };
+		size_t m_next{ 0 };
+};
+
+// Per frame GPU timestamps and pipeline statistics.
+// Every frame slot owns a range of the query pools. The results of a slot are read in
+// beginFrame, once the slot's fence is signaled, so they arrive FRAME_OVERLAP frames late
+// and reading them never stalls.
+// While a trace capture runs the zones are also put on the GPU track of the trace, moved
+// to the CPU clock with VK_EXT_calibrated_timestamps.
+class GpuProfiler {
+	public:
+		// timestamps are disabled when the queue family can't write them, statistics when
+		// the pipelineStatisticsQuery feature was not enabled. calibratedTimestamps when
+		// VK_EXT_calibrated_timestamps was enabled on the device
+		void init(VkInstance instance, VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, const VkPhysicalDeviceProperties& properties, uint32_t frameCount, bool pipelineStatistics, bool calibratedTimestamps);
+		void cleanup();
+
+		// reads the results of the slot's last frame and resets its queries.
+		// call first in the slot's command buffer, after waiting on its fence
+		void beginFrame(VkCommandBuffer cmd, uint32_t slot);
+		// call last in the slot's command buffer
+		void endFrame(VkCommandBuffer cmd);
+
+		void beginZone(VkCommandBuffer cmd, GpuZone zone);
+		void endZone(VkCommandBuffer cmd, GpuZone zone);
+
+		// NOTE: both outside of a rendering pass, a query may not cross its begin or end
+		void beginStatistics(VkCommandBuffer cmd);
+		void endStatistics(VkCommandBuffer cmd);
+
+		bool timestampsEnabled() const { return m_timestampPool != VK_NULL_HANDLE; }
+		bool statisticsEnabled() const { return m_statisticsPool != VK_NULL_HANDLE; }
+
+		TimingSummary frameTime() const { return m_frameTime.summary(); }
+		// of the frame read in the last beginFrame, 0 when it had no timestamps
+		float latestFrameTime() const { return m_latestFrameTime; }
+		TimingSummary zoneTime(GpuZone zone) const { return m_zoneTimes[static_cast<size_t>(zone)].summary(); }
+		const PipelineStatistics& statistics() const { return m_statistics; }
+
+	private:
+		// frame begin and end, then a begin and end per zone
+		static constexpr uint32_t TIMESTAMPS_PER_FRAME = 2 + 2 * GPU_ZONE_COUNT;
+
+		void readResults(uint32_t slot);
+		// pairs a GPU timestamp with traceNow(), false when the clocks can't be calibrated
+		bool calibrate();
+		uint64_t toTraceTime(uint64_t ticks) const;
+		uint32_t firstTimestamp(uint32_t slot) const { return slot * TIMESTAMPS_PER_FRAME; }
+
+		VkDevice m_device{ VK_NULL_HANDLE };
+		VkQueryPool m_timestampPool{ VK_NULL_HANDLE };
+		VkQueryPool m_statisticsPool{ VK_NULL_HANDLE };
+		// nanoseconds per tick
+		float m_timestampPeriod{ 0.f };
+		uint64_t m_timestampMask{ 0 };
+
+		// null without VK_EXT_calibrated_timestamps or a CLOCK_MONOTONIC time domain
+		PFN_vkGetCalibratedTimestampsEXT m_getCalibratedTimestamps{ nullptr };
+		uint64_t m_calibrationTicks{ 0 };
+		uint64_t m_calibrationNs{ 0 };
+		bool m_calibrated{ false };
+
+		// what every slot wrote the last time it was recorded
+		struct SlotState {
+				uint32_t zoneMask;
+				bool frameWritten;
+				bool statisticsWritten;
+		};
+		std::vector<SlotState> m_slots;
+		uint32_t m_currentSlot{ 0 };
+
+		RollingTimings m_frameTime;
+		float m_latestFrameTime{ 0.f };
+		std::array<RollingTimings, GPU_ZONE_COUNT> m_zoneTimes;
+		PipelineStatistics m_statistics{};
+};
+
+// times a zone from construction to the end of the scope
+class ScopedGpuZone {
+	public:
+		ScopedGpuZone(GpuProfiler& profiler, VkCommandBuffer cmd, GpuZone zone)
+				: m_profiler(profiler), m_cmd(cmd), m_zone(zone) {
+			m_profiler.beginZone(m_cmd, m_zone);
+		}
+		~ScopedGpuZone() { m_profiler.endZone(m_cmd, m_zone); }
+
+		ScopedGpuZone(const ScopedGpuZone&) = delete;
+		ScopedGpuZone& operator=(const ScopedGpuZone&) = delete;
+
+	private:
+		GpuProfiler& m_profiler;
+		VkCommandBuffer m_cmd;
+		GpuZone m_zone;
+};
+
+}// namespace pm
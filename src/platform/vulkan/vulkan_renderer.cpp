@@ -3,17 +3,38 @@
 #include "platform/vulkan/vulkan_descriptor.h"
 #include "platform/vulkan/vulkan_images.h"
 #include "platform/vulkan/vulkan_loader.h"
+#include "scene/texture_compress.h"
+#include "scene/vertex_layout.h"
+#include "trace.h"
 #include "vk_types.h"
 #include "vulkan_pipeline.h"
 #include "vulkan_shader.h"
 #include "vulkan_structures_helpers.h"
 #include <SDL3/SDL_vulkan.h>
+#include <algorithm>
+#include <bit>
 #include <cmath>
+#include <limits>
 #include <glm/gtx/transform.hpp>
+#include <tbb/parallel_for.h>
 #include <vector>
 
 namespace pm {
 
+namespace {
+
+// draws of the same surface of the same mesh, only their transforms differ
+bool sameSurface(const RenderObject& a, const RenderObject& b) {
+	return a.indexBuffer == b.indexBuffer && a.firstIndex == b.firstIndex && a.indexCount == b.indexCount && a.vertexBufferAddress == b.vertexBufferAddress && a.material == b.material;
+}
+
+template<typename T>
+std::span<const uint8_t> byteSpan(std::span<const T> data) {
+	return { reinterpret_cast<const uint8_t*>(data.data()), data.size_bytes() };
+}
+
+}// namespace
+
 void VulkanRenderer::init(VulkanRendererConfig* state) {
 	m_rendererState = state;
 	initVulkan();
@@ -27,15 +48,30 @@ void VulkanRenderer::init(VulkanRendererConfig* state) {
 	m_rendererState->mainCamera->position = glm::vec3(30.f, -00.f, -085.f);
 
 	std::string structurePath = { "res/models/structure.glb" };
-	auto structureFile = loadGltf(this, structurePath);
+	auto loadStart = std::chrono::steady_clock::now();
+	auto structureFile = loadGltf(this, structurePath, MeshProcessOptions{ .optimize = m_rendererState->optimizeMeshes, .generateLods = m_rendererState->generateLods });
 
 	assert(structureFile.has_value());
 
+	// count the GPU copies in the load time too
+	m_uploads.wait(m_uploads.flush());
+	auto loadTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - loadStart);
+	std::cout << std::format("Loaded {} in {:.1f} ms\n", structurePath, loadTime.count());
+	printMeshMemoryReport();
+
 	loadedScenes["structure"] = *structureFile;
+	// new objects, nothing is known about their visibility
+	m_visibilityReset = true;
 }
 
 void VulkanRenderer::resizeSwapchain() {
-	vkDeviceWaitIdle(m_device);
+	// the draw image keeps its size, there is nothing to resize
+	if (m_rendererState->headless) {
+		m_rendererState->resizeRequested = false;
+		return;
+	}
+
+	waitDeviceIdle();
 
 	destroySwapchain();
 
@@ -106,13 +142,19 @@ void VulkanRenderer::initDefaultData() {
 
 	VkSamplerCreateInfo sampl = { .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
 
+	// let the defaults reach every mip level
+	sampl.maxLod = VK_LOD_CLAMP_NONE;
+	sampl.minLod = 0;
+
 	sampl.magFilter = VK_FILTER_NEAREST;
 	sampl.minFilter = VK_FILTER_NEAREST;
+	sampl.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
 
 	vkCreateSampler(m_device, &sampl, nullptr, &defaultSamplerNearest);
 
 	sampl.magFilter = VK_FILTER_LINEAR;
 	sampl.minFilter = VK_FILTER_LINEAR;
+	sampl.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
 	vkCreateSampler(m_device, &sampl, nullptr, &defaultSamplerLinear);
 
 	// Load meshes
@@ -124,28 +166,19 @@ void VulkanRenderer::initDefaultData() {
 	materialResources.colorSampler = defaultSamplerLinear;
 	materialResources.metalRoughImage = whiteImage;
 	materialResources.metalRoughSampler = defaultSamplerLinear;
+	materialResources.constants.colorFactors = glm::vec4{ 1, 1, 1, 1 };
+	materialResources.constants.metalRoughFactors = glm::vec4{ 1, 0.5, 0, 0 };
 
-	// set the uniform buffer for the material data
-	AllocatedBuffer materialConstants = createBuffer(sizeof(GLTFMetallic_Roughness::MaterialConstants), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-
-	// write the buffer
-	GLTFMetallic_Roughness::MaterialConstants* sceneUniformData = (GLTFMetallic_Roughness::MaterialConstants*)materialConstants.allocation->GetMappedData();
-	sceneUniformData->colorFactors = glm::vec4{ 1, 1, 1, 1 };
-	sceneUniformData->metalRoughFactors = glm::vec4{ 1, 0.5, 0, 0 };
-
-	materialResources.dataBuffer = materialConstants.buffer;
-	materialResources.dataBufferOffset = 0;
-
-	defaultData = metalRoughMaterial.writeMaterial(m_device, MaterialPass::MainColor, materialResources, m_globalDescriptorAllocator);
+	// registered first, so it also fills slot 0 of every bindless array, the fallback
+	// when a table is full
+	defaultData = metalRoughMaterial.writeMaterial(MaterialPass::MainColor, materialResources, m_bindless);
 
 	for (auto& m : m_testMeshes) {
-		auto newNode = std::make_shared<MeshNode>();
-		newNode->mesh = m;
+		MeshNode newNode{};
+		newNode.mesh = m;
+		newNode.localTransform = glm::mat4{ 1.f };
 
-		newNode->localTransform = glm::mat4{ 1.f };
-		newNode->worldTransform = glm::mat4{ 1.f };
-
-		for (auto& s : newNode->mesh->surfaces) {
+		for (auto& s : newNode.mesh->surfaces) {
 			s.material = std::make_shared<GLTFMaterial>(defaultData);
 		}
 
@@ -157,10 +190,12 @@ void VulkanRenderer::initVulkan() {
 	vkb::InstanceBuilder builder;
 
 	// make the vulkan instance, with basic debug features
+	// headless skips the surface extensions, so it also works without a display server
 	auto inst = builder.set_app_name("Primal Engine")
 								.request_validation_layers(m_rendererState->useValidationLayers)
 								.use_default_debug_messenger()
 								.require_api_version(1, 3, 0)
+								.set_headless(m_rendererState->headless)
 								.build();
 
 	auto vkbInstance = inst.value();
@@ -169,7 +204,9 @@ void VulkanRenderer::initVulkan() {
 	m_instance = vkbInstance.instance;
 	m_debug_messenger = vkbInstance.debug_messenger;
 
-	SDL_Vulkan_CreateSurface(m_rendererState->window, m_instance, nullptr, &m_surface);
+	if (!m_rendererState->headless) {
+		SDL_Vulkan_CreateSurface(m_rendererState->window, m_instance, nullptr, &m_surface);
+	}
 
 	// vulkan 1.3 features
 	VkPhysicalDeviceVulkan13Features features{};
@@ -180,20 +217,53 @@ void VulkanRenderer::initVulkan() {
 	VkPhysicalDeviceVulkan12Features features12{};
 	features12.bufferDeviceAddress = true;
 	features12.descriptorIndexing = true;
+	features12.drawIndirectCount = true;
+	features12.timelineSemaphore = true;
+	features12.separateDepthStencilLayouts = true;
+	// bindless material table
+	features12.runtimeDescriptorArray = true;
+	features12.descriptorBindingPartiallyBound = true;
+	features12.descriptorBindingSampledImageUpdateAfterBind = true;
+	features12.descriptorBindingUpdateUnusedWhilePending = true;
+	features12.shaderSampledImageArrayNonUniformIndexing = true;
+
+	// vulkan 1.0 features
+	VkPhysicalDeviceFeatures features10{};
+	features10.multiDrawIndirect = true;
 
 	// Use VKBootstrap to select a gpu.
 	// We want a gpu that can write to the SDL surface and supports vulkan 1.3 with the correct features
 	vkb::PhysicalDeviceSelector selector{ vkbInstance };
-	vkb::PhysicalDevice physicalDevice = selector
-																				 .set_minimum_version(1, 3)
-																				 .set_required_features_13(features)
-																				 .set_required_features_12(features12)
-																				 .set_surface(m_surface)
-																				 .select()
-																				 .value();
+	selector.set_minimum_version(1, 3)
+		.set_required_features_13(features)
+		.set_required_features_12(features12)
+		.set_required_features(features10);
+	if (!m_rendererState->headless) {
+		selector.set_surface(m_surface);
+	}
+	// lavapipe, so the whole frame can be measured on hosts without a GPU
+	if (m_rendererState->preferSoftwareDevice) {
+		selector.prefer_gpu_device_type(vkb::PreferredDeviceType::cpu);
+	}
+	auto selected = selector.select();
+	if (!selected) {
+		std::cout << std::format("No Vulkan 1.3 device with the required features: {}\n", selected.error().message());
+		abort();
+	}
+	vkb::PhysicalDevice physicalDevice = selected.value();
 
 	std::cout << std::format("GPU: {}\n", physicalDevice.name);
 
+	// only needed by the profiler, so not a requirement for the device
+	const bool pipelineStatistics = physicalDevice.enable_features_if_present(VkPhysicalDeviceFeatures{ .pipelineStatisticsQuery = VK_TRUE });
+	// cooked textures are BC1/BC5/BC7, without it scenes are loaded with RGBA8 textures
+	m_textureCompressionBC = physicalDevice.enable_features_if_present(VkPhysicalDeviceFeatures{ .textureCompressionBC = VK_TRUE });
+	if (!m_textureCompressionBC) {
+		std::cout << "GPU has no BC texture compression, textures stay uncompressed\n";
+	}
+	// puts the GPU zones on the CPU timeline of traces
+	const bool calibratedTimestamps = PM_TRACING && physicalDevice.enable_extension_if_present(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+
 
 	// create the final vulkan device
 	vkb::DeviceBuilder deviceBuilder{ physicalDevice };
@@ -202,11 +272,22 @@ void VulkanRenderer::initVulkan() {
 	// Get the VkDevice handle used in the rest of a vulkan application
 	m_device = vkbDevice.device;
 	m_chosenGPU = physicalDevice.physical_device;
+	m_gpuProperties = physicalDevice.properties;
 
 	// Get graphics queue with VKBootstrap
 	m_graphicsQueue = vkbDevice.get_queue(vkb::QueueType::graphics).value();
 	m_graphicsQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::graphics).value();
 
+	// uploads go through a dedicated transfer queue when the device has one
+	auto transferQueue = vkbDevice.get_dedicated_queue(vkb::QueueType::transfer);
+	if (transferQueue.has_value()) {
+		m_transferQueue = transferQueue.value();
+		m_transferQueueFamily = vkbDevice.get_dedicated_queue_index(vkb::QueueType::transfer).value();
+	} else {
+		m_transferQueue = m_graphicsQueue;
+		m_transferQueueFamily = m_graphicsQueueFamily;
+	}
+
 	// Create allocator using VMA
 	VmaAllocatorCreateInfo allocatorInfo = {};
 	allocatorInfo.physicalDevice = m_chosenGPU;
@@ -214,10 +295,23 @@ void VulkanRenderer::initVulkan() {
 	allocatorInfo.instance = m_instance;
 	allocatorInfo.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
 	vmaCreateAllocator(&allocatorInfo, &m_allocator);
+
+	m_uploads.init(m_device, m_allocator, m_graphicsQueue, m_graphicsQueueFamily, m_transferQueue, m_transferQueueFamily, m_queueMutex);
+	m_profiler.init(m_instance, m_device, m_chosenGPU, m_graphicsQueueFamily, m_gpuProperties, FRAME_OVERLAP, pipelineStatistics, calibratedTimestamps);
+
+	// the cluster culling pass reads indices as storage buffer words
+	m_vertexPool.init(m_device, m_allocator, VERTEX_POOL_SIZE, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	m_indexPool.init(m_device, m_allocator, INDEX_POOL_SIZE, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	m_meshletPool.init(m_device, m_allocator, MESHLET_POOL_SIZE, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
 }
 
 void VulkanRenderer::initSwapchain() {
-	createSwapchain(m_rendererState->windowExtent.width, m_rendererState->windowExtent.height);
+	if (m_rendererState->headless) {
+		// nothing to present to, frames are as large as the draw image
+		m_swapchainExtent = m_rendererState->windowExtent;
+	} else {
+		createSwapchain(m_rendererState->windowExtent.width, m_rendererState->windowExtent.height);
+	}
 
 	// For render image and depth iamge, we want to allocate them from gpu local memory
 	VmaAllocationCreateInfo rimg_allocinfo = {};
@@ -253,6 +347,8 @@ void VulkanRenderer::initSwapchain() {
 	m_depthImage.imageExtent = drawImageExtent;
 	VkImageUsageFlags depthImageUsages{};
 	depthImageUsages |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+	// read by the Hi-Z reduction
+	depthImageUsages |= VK_IMAGE_USAGE_SAMPLED_BIT;
 
 	VkImageCreateInfo dimg_info = imageCreateInfo(m_depthImage.imageFormat, depthImageUsages, drawImageExtent);
 
@@ -260,6 +356,34 @@ void VulkanRenderer::initSwapchain() {
 	VkImageViewCreateInfo dview_info = imageViewCreateInfo(m_depthImage.imageFormat, m_depthImage.image, VK_IMAGE_ASPECT_DEPTH_BIT);
 
 	VK_CHECK(vkCreateImageView(m_device, &dview_info, nullptr, &m_depthImage.imageView));
+
+	// Hi-Z, the largest power of two that fits in the draw image so each level is an exact 2x2 reduction
+	VkExtent3D hizExtent = {
+		std::bit_floor(drawImageExtent.width),
+		std::bit_floor(drawImageExtent.height),
+		1
+	};
+	m_hizLevels = std::bit_width(std::max(hizExtent.width, hizExtent.height));
+	m_hizImage = allocateImage(hizExtent, VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, m_hizLevels);
+
+	m_hizLevelViews.resize(m_hizLevels);
+	for (uint32_t level = 0; level < m_hizLevels; level++) {
+		VkImageViewCreateInfo levelViewInfo = imageViewCreateInfo(m_hizImage.imageFormat, m_hizImage.image, VK_IMAGE_ASPECT_COLOR_BIT);
+		levelViewInfo.subresourceRange.baseMipLevel = level;
+		levelViewInfo.subresourceRange.levelCount = 1;
+		VK_CHECK(vkCreateImageView(m_device, &levelViewInfo, nullptr, &m_hizLevelViews[level]));
+	}
+
+	// only used with texelFetch, the reduction is done in the shaders
+	VkSamplerCreateInfo hizSamplerInfo = { .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+	hizSamplerInfo.magFilter = VK_FILTER_NEAREST;
+	hizSamplerInfo.minFilter = VK_FILTER_NEAREST;
+	hizSamplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	hizSamplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	hizSamplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	hizSamplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	hizSamplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+	VK_CHECK(vkCreateSampler(m_device, &hizSamplerInfo, nullptr, &m_hizSampler));
 }
 
 void VulkanRenderer::initCommands() {
@@ -316,18 +440,29 @@ void VulkanRenderer::createSwapchain(uint32_t width, uint32_t height) {
 }
 
 void VulkanRenderer::destroySwapchain() {
+	if (m_swapchain == VK_NULL_HANDLE) {
+		return;
+	}
 	vkDestroySwapchainKHR(m_device, m_swapchain, nullptr);
+	m_swapchain = VK_NULL_HANDLE;
 
 	// destroy swapchain resources
 	for (auto& swapchainImageView : m_swapchainImageViews) {
 		vkDestroyImageView(m_device, swapchainImageView, nullptr);
 	}
+	m_swapchainImageViews.clear();
 }
 
 void VulkanRenderer::cleanup() {
-	vkDeviceWaitIdle(m_device);
+	waitDeviceIdle();
 
 	loadedScenes.clear();
+	m_bindless.cleanup();
+
+	// also frees the test meshes, they never return their ranges
+	m_vertexPool.cleanup();
+	m_indexPool.cleanup();
+	m_meshletPool.cleanup();
 
 	for (auto& frame : m_frames) {
 		vkDestroyCommandPool(m_device, frame.m_commandPool, nullptr);
@@ -337,8 +472,33 @@ void VulkanRenderer::cleanup() {
 		vkDestroySemaphore(m_device, frame.m_swapchainSemaphore, nullptr);
 
 		frame.m_frameDescriptors.destroyPools(m_device);
+		destroyBuffer(frame.m_uploadArena.buffer());
+
+		if (frame.m_objectCapacity > 0) {
+			destroyBuffer(frame.m_drawCommandBuffer);
+		}
+		for (const AllocatedBuffer& buffer : frame.m_retiredBuffers) {
+			destroyBuffer(buffer);
+		}
+		if (frame.m_batchCapacity > 0) {
+			destroyBuffer(frame.m_drawCountBuffer);
+		}
+		if (frame.m_clusterIndexCapacity > 0) {
+			destroyBuffer(frame.m_clusterIndexBuffer);
+		}
+		destroyBuffer(frame.m_cullStatsBuffer);
+		if (frame.m_readbackBuffer.buffer != VK_NULL_HANDLE) {
+			destroyBuffer(frame.m_readbackBuffer);
+		}
+	}
+
+	if (m_visibilityCapacity > 0) {
+		destroyBuffer(m_visibilityBuffer);
 	}
 
+	m_uploads.cleanup();
+	m_profiler.cleanup();
+
 	vkDestroyCommandPool(m_device, m_immCommandPool, nullptr);
 	vkDestroyFence(m_device, m_immFence, nullptr);
 
@@ -348,14 +508,34 @@ void VulkanRenderer::cleanup() {
 	vkDestroyImageView(m_device, m_depthImage.imageView, nullptr);
 	vmaDestroyImage(m_allocator, m_depthImage.image, m_depthImage.allocation);
 
+	for (VkImageView levelView : m_hizLevelViews) {
+		vkDestroyImageView(m_device, levelView, nullptr);
+	}
+	destroyImage(m_hizImage);
+	vkDestroySampler(m_device, m_hizSampler, nullptr);
+
 	vkDestroyPipelineLayout(m_device, m_gradientPipelineLayout, nullptr);
 	vkDestroyPipeline(m_device, m_gradientPipeline, nullptr);
 
+	vkDestroyPipelineLayout(m_device, m_cullPipelineLayout, nullptr);
+	vkDestroyPipeline(m_device, m_cullPipeline, nullptr);
+	vkDestroyDescriptorSetLayout(m_device, m_cullDescriptorLayout, nullptr);
+
+	vkDestroyPipelineLayout(m_device, m_clusterCullPipelineLayout, nullptr);
+	vkDestroyPipeline(m_device, m_clusterCullPipeline, nullptr);
+	vkDestroyDescriptorSetLayout(m_device, m_clusterCullDescriptorLayout, nullptr);
+
+	vkDestroyPipelineLayout(m_device, m_hizReducePipelineLayout, nullptr);
+	vkDestroyPipeline(m_device, m_hizReducePipeline, nullptr);
+	vkDestroyDescriptorSetLayout(m_device, m_hizReduceDescriptorLayout, nullptr);
+
 	destroySwapchain();
 
 	vmaDestroyAllocator(m_allocator);
 
-	vkDestroySurfaceKHR(m_instance, m_surface, nullptr);
+	if (m_surface != VK_NULL_HANDLE) {
+		vkDestroySurfaceKHR(m_instance, m_surface, nullptr);
+	}
 	vkDestroyDevice(m_device, nullptr);
 
 	vkb::destroy_debug_utils_messenger(m_instance, m_debug_messenger);
@@ -364,17 +544,69 @@ void VulkanRenderer::cleanup() {
 }
 
 void VulkanRenderer::draw() {
+	PM_TRACE_ZONE("draw");
 	updateScene();
 	// wait until the gpu has finished rendering the last frame. Timeout of 1 second
-	VK_CHECK(vkWaitForFences(m_device, 1, &getCurrentFrame().m_renderFence, true, 1000000000));
+	{
+		PM_TRACE_ZONE("waitForFrameFence");
+		VK_CHECK(vkWaitForFences(m_device, 1, &getCurrentFrame().m_renderFence, true, 1000000000));
+	}
+
+	// every frame that could use them was submitted before this slot's last one
+	for (const AllocatedBuffer& buffer : getCurrentFrame().m_retiredBuffers) {
+		destroyBuffer(buffer);
+	}
+	getCurrentFrame().m_retiredBuffers.clear();
+
+	// written by the last culling passes of this frame slot
+	if (m_rendererState->renderPath != RenderPath::Classic) {
+		vmaInvalidateAllocation(m_allocator, getCurrentFrame().m_cullStatsBuffer.allocation, 0, VK_WHOLE_SIZE);
+		const auto* cullStats = static_cast<const CullStats*>(getCurrentFrame().m_cullStatsBuffer.info.pMappedData);
+		m_rendererState->rendererStats.clusterCount = static_cast<int>(cullStats->clusterCount);
+		m_rendererState->rendererStats.culledClusterCount = static_cast<int>(cullStats->clusterCount - cullStats->visibleClusterCount);
+		m_rendererState->rendererStats.occludedCount = static_cast<int>(cullStats->occludedObjectCount);
+	}
+
+	// copied by this slot's last frame, done now that its fence is signaled
+	FrameData& readbackFrame = getCurrentFrame();
+	if (readbackFrame.m_readbackExtent.width > 0) {
+		PM_TRACE_ZONE("copyReadback");
+		const VkExtent2D extent = readbackFrame.m_readbackExtent;
+		const size_t texelCount = static_cast<size_t>(extent.width) * extent.height;
+		vmaInvalidateAllocation(m_allocator, readbackFrame.m_readbackBuffer.allocation, 0, VK_WHOLE_SIZE);
+		const auto* texels = static_cast<const uint16_t*>(readbackFrame.m_readbackBuffer.info.pMappedData);
+		m_latestReadback.pixels.assign(texels, texels + texelCount * 4);
+		m_latestReadback.extent = extent;
+		m_latestReadback.frameNumber = readbackFrame.m_readbackFrame;
+		readbackFrame.m_readbackExtent = {};
+	}
 
 	getCurrentFrame().m_frameDescriptors.clearPools(m_device);
+	// the last frame of this slot didn't fit, make room for all of it
+	if (getCurrentFrame().m_uploadOverflow > 0) {
+		FrameData& frame = getCurrentFrame();
+		const VkDeviceSize required = frame.m_uploadArena.used() + frame.m_uploadOverflow;
+		const VkDeviceSize capacity = std::max(required, frame.m_uploadArena.capacity() * 2);
+		destroyBuffer(frame.m_uploadArena.buffer());
+		createUploadArena(frame, capacity);
+		frame.m_uploadOverflow = 0;
+	}
+	getCurrentFrame().m_uploadArena.reset();
+
+	// the scene uniform lives in the frame upload arena, the global descriptor already
+	// points at the arena so only the dynamic offset changes. it has to stay in the arena,
+	// so it is pushed before anything else can fill it
+	UploadAllocation sceneAllocation = getCurrentFrame().m_uploadArena.push(m_sceneData, m_gpuProperties.limits.minUniformBufferOffsetAlignment);
+	assert(sceneAllocation.data != nullptr);
+	const uint32_t sceneDataOffset = sceneAllocation.offset;
 
 	uint32_t swapchainImageIndex{};
-	VkResult e = vkAcquireNextImageKHR(m_device, m_swapchain, 1000000000, getCurrentFrame().m_swapchainSemaphore, nullptr, &swapchainImageIndex);
-	if (e == VK_ERROR_OUT_OF_DATE_KHR) {
-		m_rendererState->resizeRequested = true;
-		return;
+	if (!m_rendererState->headless) {
+		VkResult e = vkAcquireNextImageKHR(m_device, m_swapchain, 1000000000, getCurrentFrame().m_swapchainSemaphore, nullptr, &swapchainImageIndex);
+		if (e == VK_ERROR_OUT_OF_DATE_KHR) {
+			m_rendererState->resizeRequested = true;
+			return;
+		}
 	}
 
 	VK_CHECK(vkResetFences(m_device, 1, &getCurrentFrame().m_renderFence));
@@ -395,27 +627,61 @@ void VulkanRenderer::draw() {
 
 	VK_CHECK(vkBeginCommandBuffer(commandBuffer, &commandBeginInfo));
 
+	// the queries of this frame slot were written FRAME_OVERLAP frames ago and the fence
+	// above guarantees they are done
+	m_profiler.beginFrame(commandBuffer, m_frameNumber % FRAME_OVERLAP);
+	RendererStats& stats = m_rendererState->rendererStats;
+	stats.gpuFrameTime = m_profiler.frameTime();
+	stats.gpuLatestFrameTime = m_profiler.latestFrameTime();
+	for (size_t zone = 0; zone < GPU_ZONE_COUNT; zone++) {
+		stats.gpuZoneTimes[zone] = m_profiler.zoneTime(static_cast<GpuZone>(zone));
+	}
+	stats.pipelineStatistics = m_profiler.statistics();
+
 	// transition our main draw image into general layout so we can write into it
 	// we will overwrite it all so we dont care about what was the older layout
 	transitionImage(commandBuffer, m_drawImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
 
-	drawBackground(commandBuffer);
+	{
+		ScopedGpuZone zone(m_profiler, commandBuffer, GpuZone::Background);
+		drawBackground(commandBuffer);
+	}
+
+	if (m_rendererState->renderPath != RenderPath::Classic) {
+		prepareIndirectDraws();
+		ScopedGpuZone zone(m_profiler, commandBuffer, GpuZone::Culling);
+		cullObjects(commandBuffer, CullPhase::Early);
+	}
 
 	// transition the draw image and the depth image into their correct attachment layouts
 	transitionImage(commandBuffer, m_drawImage.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 	transitionImage(commandBuffer, m_depthImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
 
-	drawGeometry(commandBuffer);
+	{
+		ScopedGpuZone zone(m_profiler, commandBuffer, GpuZone::Geometry);
+		m_profiler.beginStatistics(commandBuffer);
+		drawGeometry(commandBuffer, sceneDataOffset);
+		m_profiler.endStatistics(commandBuffer);
+	}
 
-	// transition the draw image and the swapchain image into their correct transfer layouts
-	transitionImage(commandBuffer, m_drawImage.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-	transitionImage(commandBuffer, m_swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+	if (m_rendererState->headless) {
+		readbackDrawImage(commandBuffer);
+	} else {
+		// transition the draw image and the swapchain image into their correct transfer layouts
+		transitionImage(commandBuffer, m_drawImage.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+		transitionImage(commandBuffer, m_swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+		// execute a copy from the draw image into the swapchain
+		{
+			ScopedGpuZone zone(m_profiler, commandBuffer, GpuZone::Blit);
+			copyImageToImage(commandBuffer, m_drawImage.image, m_swapchainImages[swapchainImageIndex], m_drawExtent, m_swapchainExtent);
+		}
 
-	// execute a copy from the draw image into the swapchain
-	copyImageToImage(commandBuffer, m_drawImage.image, m_swapchainImages[swapchainImageIndex], m_drawExtent, m_swapchainExtent);
+		// set swapchain image layout to Present so we can show it on the screen
+		transitionImage(commandBuffer, m_swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+	}
 
-	// set swapchain image layout to Present so we can show it on the screen
-	transitionImage(commandBuffer, m_swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+	m_profiler.endFrame(commandBuffer);
 
 	// finalize the command buffer (we can no longer add commands, but it can now be executed)
 	VK_CHECK(vkEndCommandBuffer(commandBuffer));
@@ -425,14 +691,33 @@ void VulkanRenderer::draw() {
 	// we will signal the m_renderSemaphore, to signal that rendering has finished
 	auto cmdinfo = commandBufferSubmitInfo(commandBuffer);
 
-	auto waitInfo = semaphoreSubmitInfo(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, getCurrentFrame().m_swapchainSemaphore);
+	// also wait for every upload recorded so far, resources created this frame may be used by it
+	VkSemaphoreSubmitInfo waitInfos[2] = {
+		semaphoreSubmitInfo(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, getCurrentFrame().m_swapchainSemaphore),
+		semaphoreSubmitInfo(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, m_uploads.timeline())
+	};
+	waitInfos[1].value = m_uploads.flush();
+
 	auto signalInfo = semaphoreSubmitInfo(VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, getCurrentFrame().m_renderSemaphore);
 
-	VkSubmitInfo2 submit = submitInfo(&cmdinfo, &signalInfo, &waitInfo);
+	VkSubmitInfo2 submit = submitInfo(&cmdinfo, &signalInfo, waitInfos);
+	submit.waitSemaphoreInfoCount = 2;
+	if (m_rendererState->headless) {
+		// nothing was acquired and nothing is presented, only the uploads are waited for
+		submit = submitInfo(&cmdinfo, nullptr, &waitInfos[1]);
+	}
 
 	// submit command buffer to the queue and execute it.
 	// m_renderFence will now block until the graphic commands finish execution
-	VK_CHECK(vkQueueSubmit2(m_graphicsQueue, 1, &submit, getCurrentFrame().m_renderFence));
+	{
+		std::lock_guard<std::mutex> lock(m_queueMutex);
+		VK_CHECK(vkQueueSubmit2(m_graphicsQueue, 1, &submit, getCurrentFrame().m_renderFence));
+	}
+
+	if (m_rendererState->headless) {
+		m_frameNumber++;
+		return;
+	}
 
 	// prepare present
 	// this will put the image we just rendered to into the visible window.
@@ -448,7 +733,12 @@ void VulkanRenderer::draw() {
 
 	presentInfo.pImageIndices = &swapchainImageIndex;
 
-	VkResult presentResult = vkQueuePresentKHR(m_graphicsQueue, &presentInfo);
+	PM_TRACE_ZONE("present");
+	VkResult presentResult;
+	{
+		std::lock_guard<std::mutex> lock(m_queueMutex);
+		presentResult = vkQueuePresentKHR(m_graphicsQueue, &presentInfo);
+	}
 	if (presentResult == VK_ERROR_OUT_OF_DATE_KHR) {
 		m_rendererState->resizeRequested = true;
 	}
@@ -467,28 +757,18 @@ void VulkanRenderer::drawBackground(VkCommandBuffer commandBuffer) {
 	vkCmdDispatch(commandBuffer, std::ceil(m_drawExtent.width / 16.0), std::ceil(m_drawExtent.height / 16.0), 1);
 }
 
-void VulkanRenderer::drawGeometry(VkCommandBuffer commandBuffer) {
+void VulkanRenderer::drawGeometry(VkCommandBuffer commandBuffer, uint32_t sceneDataOffset) {
+	PM_TRACE_ZONE("drawGeometry");
 	m_rendererState->rendererStats.drawCallCount = 0;
 	m_rendererState->rendererStats.triangleCount = 0;
 	auto start = std::chrono::system_clock::now();
 
 	std::vector<uint32_t> opaqueDraws;
-	opaqueDraws.reserve(mainDrawContext.opaqueSurfaces.size());
-
-	for (uint32_t i = 0; i < mainDrawContext.opaqueSurfaces.size(); i++) {
-		opaqueDraws.push_back(i);
+	if (m_rendererState->renderPath == RenderPath::Classic) {
+		sortDraws(mainDrawContext.opaqueSurfaces, opaqueDraws);
 	}
-
-	// sort the opaque surfaces by material and mesh
-	std::sort(opaqueDraws.begin(), opaqueDraws.end(), [&](const auto& iA, const auto& iB) {
-		const auto& A = mainDrawContext.opaqueSurfaces[iA];
-		const auto& B = mainDrawContext.opaqueSurfaces[iB];
-		if (A.material == B.material) {
-			return A.indexBuffer < B.indexBuffer;
-		} else {
-			return A.material < B.material;
-		}
-	});
+	std::vector<uint32_t> transparentDraws;
+	sortDraws(mainDrawContext.transparentSurfaces, transparentDraws);
 
 	VkRenderingAttachmentInfo colorAttachment = attachmentInfo(m_drawImage.imageView, nullptr, VK_IMAGE_LAYOUT_GENERAL);
 	VkRenderingAttachmentInfo depthAttachment = depthAttachmentInfo(m_depthImage.imageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
@@ -519,83 +799,119 @@ void VulkanRenderer::drawGeometry(VkCommandBuffer commandBuffer) {
 	glm::mat4 projection = glm::perspective(glm::radians(70.f), (float)m_drawExtent.width / (float)m_drawExtent.height, 10000.f, 0.1f);
 	projection[1][1] *= -1;
 
-	// allocate a new uniform buffer for the scene data
-	// This should be deleted each frame.
-	AllocatedBuffer gpuSceneDataBuffer = createBuffer(sizeof(GPUSceneData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-
-	// write the buffer
-	auto* sceneUniformData = static_cast<GPUSceneData*>(gpuSceneDataBuffer.allocation->GetMappedData());
-	*sceneUniformData = m_sceneData;
-
-	// create a descriptor set that binds that buffer and update it
-	VkDescriptorSet globalDescriptor = getCurrentFrame().m_frameDescriptors.allocate(m_device, m_gpuSceneDataDescriptorLayout);
-
-	DescriptorWriter writer;
-	writer.writeBuffer(0, gpuSceneDataBuffer.buffer, sizeof(GPUSceneData), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-	writer.updateSet(m_device, globalDescriptor);
+	VkDescriptorSet globalDescriptor = getCurrentFrame().m_globalDescriptor;
+	VkDescriptorSet bindlessSet = m_bindless.set();
+
+	// world matrices of every classic draw this frame, opaque runs first in sorted order,
+	// then the transparent surfaces. each draw points at its slice of the buffer, which
+	// needs the 16 byte alignment of a std430 mat4
+	const size_t classicOpaqueCount = opaqueDraws.size();
+	const size_t instanceCount = classicOpaqueCount + mainDrawContext.transparentSurfaces.size();
+	UploadAllocation instanceAllocation = allocateUpload(std::max<size_t>(instanceCount, 1) * sizeof(glm::mat4), 16);
+	auto instanceTransforms = static_cast<glm::mat4*>(instanceAllocation.data);
+	for (size_t i = 0; i < classicOpaqueCount; i++) {
+		instanceTransforms[i] = mainDrawContext.opaqueSurfaces[opaqueDraws[i]].transform;
+	}
+	for (size_t i = 0; i < transparentDraws.size(); i++) {
+		instanceTransforms[classicOpaqueCount + i] = mainDrawContext.transparentSurfaces[transparentDraws[i]].transform;
+	}
 
 	// NOTE: This is used to avoid rebinding pipelines/materials while rendering
 	MaterialPipeline* lastPipeline = nullptr;
-	MaterialInstance* lastMaterial = nullptr;
 	VkBuffer lastIndexBuffer = VK_NULL_HANDLE;
+	VkIndexType lastIndexType = VK_INDEX_TYPE_MAX_ENUM;
 
 	// TODO: make this more manageable, we don't want a lambda here.
-	auto draw = [&](const RenderObject& r) {
-		if (r.material != lastMaterial) {
-			lastMaterial = r.material;
-			// rebind pipeline and descriptors if the material changed
-			if (r.material->pipeline != lastPipeline) {
-
-				lastPipeline = r.material->pipeline;
-				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, r.material->pipeline->pipeline);
-				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, r.material->pipeline->layout, 0, 1, &globalDescriptor, 0, nullptr);
-
-				VkViewport viewport = {};
-				viewport.x = 0;
-				viewport.y = 0;
-				viewport.width = (float)m_rendererState->windowExtent.width;
-				viewport.height = (float)m_rendererState->windowExtent.height;
-				viewport.minDepth = 0.f;
-				viewport.maxDepth = 1.f;
-
-				vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
-
-				VkRect2D scissor = {};
-				scissor.offset.x = 0;
-				scissor.offset.y = 0;
-				scissor.extent.width = m_rendererState->windowExtent.width;
-				scissor.extent.height = m_rendererState->windowExtent.height;
-
-				vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
-			}
-
-			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, r.material->pipeline->layout, 1, 1, &r.material->materialSet, 0, nullptr);
+	// draws r once per transform in instanceTransforms[firstInstance, firstInstance + count)
+	auto draw = [&](const RenderObject& r, size_t firstInstance, uint32_t count) {
+		// rebind pipeline and descriptors if the pipeline changed, materials are only an index
+		if (r.material->pipeline != lastPipeline) {
+			lastPipeline = r.material->pipeline;
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, r.material->pipeline->pipeline);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, r.material->pipeline->layout, 0, 1, &globalDescriptor, 1, &sceneDataOffset);
+
+			VkViewport viewport = {};
+			viewport.x = 0;
+			viewport.y = 0;
+			viewport.width = (float)m_rendererState->windowExtent.width;
+			viewport.height = (float)m_rendererState->windowExtent.height;
+			viewport.minDepth = 0.f;
+			viewport.maxDepth = 1.f;
+
+			vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+			VkRect2D scissor = {};
+			scissor.offset.x = 0;
+			scissor.offset.y = 0;
+			scissor.extent.width = m_rendererState->windowExtent.width;
+			scissor.extent.height = m_rendererState->windowExtent.height;
+
+			vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+			// every material lives in the bindless table, only the pipeline needs it bound
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, r.material->pipeline->layout, 1, 1, &bindlessSet, 0, nullptr);
 		}
-		// rebind index buffer if needed
-		if (r.indexBuffer != lastIndexBuffer) {
+		// every mesh lives in the shared index buffer, only the index type changes it.
+		// the sort keys put 16 and 32 bit meshes in separate runs
+		if (r.indexBuffer != lastIndexBuffer || r.indexType != lastIndexType) {
 			lastIndexBuffer = r.indexBuffer;
-			vkCmdBindIndexBuffer(commandBuffer, r.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+			lastIndexType = r.indexType;
+			vkCmdBindIndexBuffer(commandBuffer, r.indexBuffer, 0, r.indexType);
 		}
-		// calculate final mesh matrix
 		GPUDrawPushConstants pushConstants{};
-		pushConstants.worldMatrix = r.transform;
 		pushConstants.vertexBuffer = r.vertexBufferAddress;
+		pushConstants.instanceBuffer = instanceAllocation.address + firstInstance * sizeof(glm::mat4);
+		pushConstants.materialIndex = r.material->materialIndex;
 
 		vkCmdPushConstants(commandBuffer, r.material->pipeline->layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPUDrawPushConstants), &pushConstants);
 
-		vkCmdDrawIndexed(commandBuffer, r.indexCount, 1, r.firstIndex, 0, 0);
+		vkCmdDrawIndexed(commandBuffer, r.indexCount, count, r.firstIndex, 0, 0);
 		// stats
 		m_rendererState->rendererStats.drawCallCount++;
-		m_rendererState->rendererStats.triangleCount += r.indexCount / 3;
+		m_rendererState->rendererStats.triangleCount += r.indexCount / 3 * count;
 	};
 
 	// Draw sorted opaques meshes
-	for (auto& r : opaqueDraws) {
-		draw(mainDrawContext.opaqueSurfaces[r]);
+	if (m_rendererState->renderPath != RenderPath::Classic) {
+		drawIndirectBatches(commandBuffer, sceneDataOffset, CullPhase::Early);
+
+		if (occlusionCullingActive()) {
+			// the Hi-Z needs the depth of everything drawn so far, so the pass is split around it
+			vkCmdEndRendering(commandBuffer);
+			m_profiler.beginZone(commandBuffer, GpuZone::OcclusionCulling);
+			buildHiZ(commandBuffer);
+			cullObjects(commandBuffer, CullPhase::Late);
+			m_profiler.endZone(commandBuffer, GpuZone::OcclusionCulling);
+
+			VkRenderingAttachmentInfo lateColorAttachment = attachmentInfo(m_drawImage.imageView, nullptr, VK_IMAGE_LAYOUT_GENERAL);
+			VkRenderingAttachmentInfo lateDepthAttachment = depthAttachmentInfo(m_depthImage.imageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, VK_ATTACHMENT_LOAD_OP_LOAD);
+			VkRenderingInfo lateRenderInfo = renderingInfo(m_drawExtent, &lateColorAttachment, &lateDepthAttachment);
+			vkCmdBeginRendering(commandBuffer, &lateRenderInfo);
+
+			drawIndirectBatches(commandBuffer, sceneDataOffset, CullPhase::Late);
+		}
+
+		// the indirect pipelines are bound now, force a rebind for the classic draws below
+		lastPipeline = nullptr;
+		lastIndexBuffer = VK_NULL_HANDLE;
+		lastIndexType = VK_INDEX_TYPE_MAX_ENUM;
+	} else {
+		// the sort puts copies of the same surface next to each other, each run is one instanced draw
+		size_t runStart = 0;
+		while (runStart < opaqueDraws.size()) {
+			const RenderObject& r = mainDrawContext.opaqueSurfaces[opaqueDraws[runStart]];
+			size_t runEnd = runStart + 1;
+			while (runEnd < opaqueDraws.size() && sameSurface(r, mainDrawContext.opaqueSurfaces[opaqueDraws[runEnd]])) {
+				runEnd++;
+			}
+			draw(r, runStart, static_cast<uint32_t>(runEnd - runStart));
+			runStart = runEnd;
+		}
 	}
 
-	for (auto& r : mainDrawContext.transparentSurfaces) {
-		draw(r);
+	// NOTE: transparent surfaces are drawn back to front, so they are never merged
+	for (size_t i = 0; i < transparentDraws.size(); i++) {
+		draw(mainDrawContext.transparentSurfaces[transparentDraws[i]], classicOpaqueCount + i, 1);
 	}
 
 	vkCmdEndRendering(commandBuffer);
@@ -605,9 +921,400 @@ void VulkanRenderer::drawGeometry(VkCommandBuffer commandBuffer) {
 	m_rendererState->rendererStats.meshDrawTime = elapsed.count() / 1000.0f;
 }
 
+void VulkanRenderer::sortDraws(const std::vector<RenderObject>& surfaces, std::vector<uint32_t>& drawOrder) {
+	PM_TRACE_ZONE("sortDraws");
+	// the keys are copied out first so the sort only touches a dense array
+	m_drawKeys.resize(surfaces.size());
+	for (size_t i = 0; i < surfaces.size(); i++) {
+		m_drawKeys[i] = surfaces[i].sortKey;
+	}
+	m_drawSorter.sort(m_drawKeys, drawOrder);
+}
+
+void VulkanRenderer::prepareIndirectDraws() {
+	PM_TRACE_ZONE("prepareIndirectDraws");
+	FrameData& frame = getCurrentFrame();
+
+	std::vector<uint32_t> drawOrder;
+	sortDraws(mainDrawContext.opaqueSurfaces, drawOrder);
+
+	// split the sorted list into batches that can share one indirect draw
+	m_indirectBatches.clear();
+	for (uint32_t i = 0; i < drawOrder.size(); i++) {
+		const RenderObject& r = mainDrawContext.opaqueSurfaces[drawOrder[i]];
+		const bool newBatch = m_indirectBatches.empty()
+			|| m_indirectBatches.back().pipeline != r.material->indirectPipeline
+			|| m_indirectBatches.back().indexBuffer != r.indexBuffer
+			|| m_indirectBatches.back().indexType != r.indexType;
+		if (newBatch) {
+			m_indirectBatches.push_back(IndirectBatch{
+				.pipeline = r.material->indirectPipeline,
+				.indexBuffer = r.indexBuffer,
+				.indexType = r.indexType,
+				.commandOffset = i,
+				.objectCount = 0 });
+		}
+		m_indirectBatches.back().objectCount++;
+	}
+
+	const auto objectCount = static_cast<uint32_t>(drawOrder.size());
+	const auto batchCount = static_cast<uint32_t>(m_indirectBatches.size());
+	m_indirectObjectCount = objectCount;
+
+	// the fence for this frame has been waited on, so its buffers are free to be replaced.
+	// commands and counts are sized for both occlusion passes
+	if (objectCount > frame.m_objectCapacity) {
+		if (frame.m_objectCapacity > 0) {
+			destroyBuffer(frame.m_drawCommandBuffer);
+		}
+		frame.m_objectCapacity = std::max(objectCount, frame.m_objectCapacity * 2);
+		frame.m_drawCommandBuffer = createBuffer(2 * frame.m_objectCapacity * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	}
+	// shared with the frames in flight, so the old one is only destroyed once they are done
+	if (m_objectIdCount > m_visibilityCapacity) {
+		if (m_visibilityCapacity > 0) {
+			frame.m_retiredBuffers.push_back(m_visibilityBuffer);
+		}
+		m_visibilityCapacity = std::max(m_objectIdCount, m_visibilityCapacity * 2);
+		m_visibilityBuffer = createBuffer(m_visibilityCapacity * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+		m_visibilityReset = true;
+	}
+	if (batchCount > frame.m_batchCapacity) {
+		if (frame.m_batchCapacity > 0) {
+			destroyBuffer(frame.m_drawCountBuffer);
+		}
+		frame.m_batchCapacity = std::max(batchCount, frame.m_batchCapacity * 2);
+		frame.m_drawCountBuffer = createBuffer(2 * frame.m_batchCapacity * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	}
+
+	if (objectCount == 0) {
+		return;
+	}
+
+	m_indirectObjects = allocateUpload(objectCount * sizeof(GPUObjectData), m_gpuProperties.limits.minStorageBufferOffsetAlignment);
+
+	auto* objects = static_cast<GPUObjectData*>(m_indirectObjects.data);
+	uint32_t objectIndex = 0;
+	for (uint32_t batchId = 0; batchId < batchCount; batchId++) {
+		const IndirectBatch& batch = m_indirectBatches[batchId];
+		for (uint32_t i = 0; i < batch.objectCount; i++, objectIndex++) {
+			const RenderObject& r = mainDrawContext.opaqueSurfaces[drawOrder[objectIndex]];
+
+			GPUObjectData& object = objects[objectIndex];
+			object.transform = r.transform;
+			object.sphere = glm::vec4(r.bounds.origin, r.bounds.sphereRadius);
+			object.indexCount = r.indexCount;
+			object.firstIndex = r.firstIndex;
+			object.batchId = batchId;
+			object.commandOffset = batch.commandOffset;
+			object.vertexBuffer = r.vertexBufferAddress;
+			object.materialIndex = r.material->materialIndex;
+			object.objectId = r.objectId;
+		}
+	}
+
+	if (m_rendererState->renderPath == RenderPath::Clusters) {
+		prepareClusterObjects(drawOrder);
+	}
+}
+
+void VulkanRenderer::prepareClusterObjects(std::span<const uint32_t> drawOrder) {
+	FrameData& frame = getCurrentFrame();
+	const auto objectCount = static_cast<uint32_t>(drawOrder.size());
+
+	m_clusterObjects = allocateUpload(objectCount * sizeof(GPUClusterObject), m_gpuProperties.limits.minStorageBufferOffsetAlignment);
+
+	// every object owns a slice as large as its whole LOD, so the culling pass can
+	// compact into it without coordinating with other objects
+	auto* clusterObjects = static_cast<GPUClusterObject*>(m_clusterObjects.data);
+	VkDeviceSize outputOffset = 0;
+	for (uint32_t i = 0; i < objectCount; i++) {
+		const RenderObject& r = mainDrawContext.opaqueSurfaces[drawOrder[i]];
+
+		GPUClusterObject& object = clusterObjects[i];
+		object.meshletBuffer = r.meshletBufferAddress;
+		object.indexBuffer = r.indexBufferAddress;
+		object.firstMeshlet = r.firstMeshlet;
+		object.meshletCount = r.meshletBufferAddress != 0 ? r.meshletCount : 0;
+		object.outputOffset = static_cast<uint32_t>(outputOffset);
+		object.index16 = r.indexType == VK_INDEX_TYPE_UINT16 ? 1 : 0;
+		object.baseIndex = r.baseIndex;
+		object.padding = 0;
+
+		outputOffset += r.indexCount;
+	}
+	m_clusterIndexCount = outputOffset;
+
+	// the fence for this frame has been waited on, so the old buffer is free to be replaced
+	if (m_clusterIndexCount > frame.m_clusterIndexCapacity) {
+		if (frame.m_clusterIndexCapacity > 0) {
+			destroyBuffer(frame.m_clusterIndexBuffer);
+		}
+		frame.m_clusterIndexCapacity = std::max(m_clusterIndexCount, frame.m_clusterIndexCapacity * 2);
+		frame.m_clusterIndexBuffer = createBuffer(frame.m_clusterIndexCapacity * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	}
+}
+
+void VulkanRenderer::readbackDrawImage(VkCommandBuffer commandBuffer) {
+	const uint32_t interval = m_rendererState->readbackInterval;
+	if (interval == 0 || m_frameNumber % interval != 0) {
+		return;
+	}
+
+	FrameData& frame = getCurrentFrame();
+	transitionImage(commandBuffer, m_drawImage.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+
+	{
+		ScopedGpuZone zone(m_profiler, commandBuffer, GpuZone::Blit);
+		// tightly packed rows of the rendered part of the draw image
+		VkBufferImageCopy region{};
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.layerCount = 1;
+		region.imageExtent = { m_drawExtent.width, m_drawExtent.height, 1 };
+		vkCmdCopyImageToBuffer(commandBuffer, m_drawImage.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, frame.m_readbackBuffer.buffer, 1, &region);
+	}
+
+	// the host reads the buffer after waiting on the frame fence
+	VkMemoryBarrier2 hostBarrier{
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+		.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+		.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+		.dstStageMask = VK_PIPELINE_STAGE_2_HOST_BIT,
+		.dstAccessMask = VK_ACCESS_2_HOST_READ_BIT
+	};
+	VkDependencyInfo dependency{
+		.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+		.memoryBarrierCount = 1,
+		.pMemoryBarriers = &hostBarrier
+	};
+	vkCmdPipelineBarrier2(commandBuffer, &dependency);
+
+	frame.m_readbackExtent = m_drawExtent;
+	frame.m_readbackFrame = m_frameNumber;
+}
+
+bool VulkanRenderer::occlusionCullingActive() const {
+	return m_rendererState->occlusionCulling && m_rendererState->renderPath == RenderPath::GPUDriven;
+}
+
+void VulkanRenderer::cullObjects(VkCommandBuffer commandBuffer, CullPhase phase) {
+	FrameData& frame = getCurrentFrame();
+	if (m_indirectObjectCount == 0) {
+		return;
+	}
+
+	const auto batchCount = static_cast<uint32_t>(m_indirectBatches.size());
+	const bool occlusion = occlusionCullingActive();
+
+	if (phase == CullPhase::Early) {
+		// reset the per batch counters of both passes before the compute passes append to them
+		vkCmdFillBuffer(commandBuffer, frame.m_drawCountBuffer.buffer, 0, 2 * batchCount * sizeof(uint32_t), 0);
+		vkCmdFillBuffer(commandBuffer, frame.m_cullStatsBuffer.buffer, 0, sizeof(CullStats), 0);
+		// nothing is known about new objects, so the early pass draws them all. the last
+		// frame's late pass may still be writing the buffer
+		if (m_visibilityReset) {
+			memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+			vkCmdFillBuffer(commandBuffer, m_visibilityBuffer.buffer, 0, VK_WHOLE_SIZE, 1);
+			m_visibilityReset = false;
+		}
+		// also orders the early pass after the visibility writes of the last frame's late pass
+		memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_2_CLEAR_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+
+		if (m_rendererState->renderPath == RenderPath::Clusters) {
+			cullClusters(commandBuffer);
+			return;
+		}
+
+		// pushed for both phases, the early one binds it too
+		GPUOcclusionData occlusionData{};
+		occlusionData.view = m_sceneData.view;
+		occlusionData.projection = glm::vec4(m_sceneData.proj[0][0], m_sceneData.proj[1][1], m_sceneData.proj[2][2], m_sceneData.proj[3][2]);
+		occlusionData.hizSize = glm::vec2(m_hizImage.imageExtent.width, m_hizImage.imageExtent.height);
+		// reversed Z, the near plane is where the depth reaches 1
+		occlusionData.znear = m_sceneData.proj[3][2] / (1.f + m_sceneData.proj[2][2]);
+		occlusionData.hizLevels = m_hizLevels;
+		m_occlusionData = allocateUpload(sizeof(GPUOcclusionData), m_gpuProperties.limits.minStorageBufferOffsetAlignment);
+		*static_cast<GPUOcclusionData*>(m_occlusionData.data) = occlusionData;
+	}
+
+	VkDescriptorSet cullDescriptor = frame.m_frameDescriptors.allocate(m_device, m_cullDescriptorLayout);
+	{
+		DescriptorWriter writer;
+		writer.writeBuffer(0, m_indirectObjects.buffer, m_indirectObjectCount * sizeof(GPUObjectData), m_indirectObjects.offset, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+		writer.writeBuffer(1, frame.m_drawCommandBuffer.buffer, 2 * m_indirectObjectCount * sizeof(VkDrawIndexedIndirectCommand), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+		writer.writeBuffer(2, frame.m_drawCountBuffer.buffer, 2 * batchCount * sizeof(uint32_t), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+		writer.writeBuffer(3, m_visibilityBuffer.buffer, m_objectIdCount * sizeof(uint32_t), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+		writer.writeBuffer(4, frame.m_cullStatsBuffer.buffer, sizeof(CullStats), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+		writer.writeBuffer(5, m_occlusionData.buffer, sizeof(GPUOcclusionData), m_occlusionData.offset, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+		// only read by the late pass, the early one binds last frame's pyramid
+		writer.writeImage(6, m_hizImage.imageView, m_hizSampler, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		writer.updateSet(m_device, cullDescriptor);
+	}
+
+	CullPushConstants pushConstants{};
+	for (uint32_t i = 0; i < Frustum::PLANE_COUNT; i++) {
+		pushConstants.frustumPlanes[i] = glm::vec4(m_frustum.nx[i], m_frustum.ny[i], m_frustum.nz[i], m_frustum.d[i]);
+	}
+	pushConstants.objectCount = m_indirectObjectCount;
+	pushConstants.cullingEnabled = m_rendererState->frustumCulling ? 1 : 0;
+	pushConstants.occlusionEnabled = occlusion ? 1 : 0;
+	pushConstants.phase = static_cast<uint32_t>(phase);
+	pushConstants.commandBase = phase == CullPhase::Late ? m_indirectObjectCount : 0;
+	pushConstants.countBase = phase == CullPhase::Late ? batchCount : 0;
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_cullPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_cullPipelineLayout, 0, 1, &cullDescriptor, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, m_cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushConstants), &pushConstants);
+	vkCmdDispatch(commandBuffer, (m_indirectObjectCount + 63) / 64, 1, 1);
+
+	// draw commands and counts are consumed by the indirect draws
+	memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT);
+	if (phase == CullPhase::Late || !occlusion) {
+		// the stats are read on the CPU after the frame fence
+		memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT);
+	}
+}
+
+void VulkanRenderer::cullClusters(VkCommandBuffer commandBuffer) {
+	FrameData& frame = getCurrentFrame();
+
+	VkDescriptorSet cullDescriptor = frame.m_frameDescriptors.allocate(m_device, m_clusterCullDescriptorLayout);
+	{
+		DescriptorWriter writer;
+		writer.writeBuffer(0, m_indirectObjects.buffer, m_indirectObjectCount * sizeof(GPUObjectData), m_indirectObjects.offset, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+		writer.writeBuffer(1, m_clusterObjects.buffer, m_indirectObjectCount * sizeof(GPUClusterObject), m_clusterObjects.offset, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+		writer.writeBuffer(2, frame.m_drawCommandBuffer.buffer, m_indirectObjectCount * sizeof(VkDrawIndexedIndirectCommand), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+		writer.writeBuffer(3, frame.m_drawCountBuffer.buffer, m_indirectBatches.size() * sizeof(uint32_t), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+		writer.writeBuffer(4, frame.m_clusterIndexBuffer.buffer, std::max<VkDeviceSize>(m_clusterIndexCount, 1) * sizeof(uint32_t), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+		writer.writeBuffer(5, frame.m_cullStatsBuffer.buffer, sizeof(CullStats), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+		writer.updateSet(m_device, cullDescriptor);
+	}
+
+	ClusterCullPushConstants pushConstants{};
+	for (uint32_t i = 0; i < Frustum::PLANE_COUNT; i++) {
+		pushConstants.frustumPlanes[i] = glm::vec4(m_frustum.nx[i], m_frustum.ny[i], m_frustum.nz[i], m_frustum.d[i]);
+	}
+	pushConstants.cameraPosition = glm::vec4(m_lodSelection.cameraPosition, 1.f);
+	pushConstants.objectCount = m_indirectObjectCount;
+	pushConstants.cullingEnabled = m_rendererState->frustumCulling ? 1 : 0;
+	pushConstants.coneCulling = m_rendererState->clusterConeCulling ? 1 : 0;
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_clusterCullPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_clusterCullPipelineLayout, 0, 1, &cullDescriptor, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, m_clusterCullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ClusterCullPushConstants), &pushConstants);
+
+	// one workgroup per object, in rows when there are more objects than a dispatch dimension allows
+	const uint32_t maxGroups = m_gpuProperties.limits.maxComputeWorkGroupCount[0];
+	const uint32_t groupsX = std::min(m_indirectObjectCount, maxGroups);
+	const uint32_t groupsY = (m_indirectObjectCount + groupsX - 1) / groupsX;
+	vkCmdDispatch(commandBuffer, groupsX, groupsY, 1);
+
+	// draw commands and counts are consumed by the indirect draws, the compacted indices by the input assembler
+	memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+		VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_INDEX_READ_BIT);
+	// the stats are read on the CPU after the frame fence
+	memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT);
+}
+
+void VulkanRenderer::buildHiZ(VkCommandBuffer commandBuffer) {
+	transitionImage(commandBuffer, m_depthImage.image, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL);
+	// every level is rewritten, the old contents can be dropped
+	transitionImage(commandBuffer, m_hizImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_hizReducePipeline);
+
+	// level 0 only reads the part of the depth image that was rendered to
+	glm::uvec2 inputSize{ m_drawExtent.width, m_drawExtent.height };
+	for (uint32_t level = 0; level < m_hizLevels; level++) {
+		const glm::uvec2 outputSize{
+			std::max(m_hizImage.imageExtent.width >> level, 1u),
+			std::max(m_hizImage.imageExtent.height >> level, 1u)
+		};
+
+		HiZReducePushConstants pushConstants{ .inputSize = inputSize, .outputSize = outputSize };
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_hizReducePipelineLayout, 0, 1, &m_hizReduceSets[level], 0, nullptr);
+		vkCmdPushConstants(commandBuffer, m_hizReducePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(HiZReducePushConstants), &pushConstants);
+		vkCmdDispatch(commandBuffer, (outputSize.x + 7) / 8, (outputSize.y + 7) / 8, 1);
+
+		// the next level and the late culling pass read what was just written
+		memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+		inputSize = outputSize;
+	}
+
+	transitionImage(commandBuffer, m_depthImage.image, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+}
+
+void VulkanRenderer::drawIndirectBatches(VkCommandBuffer commandBuffer, uint32_t sceneDataOffset, CullPhase phase) {
+	FrameData& frame = getCurrentFrame();
+	if (m_indirectObjectCount == 0) {
+		return;
+	}
+
+	VkDescriptorSet objectDescriptor = frame.m_frameDescriptors.allocate(m_device, m_objectDataDescriptorLayout);
+	{
+		DescriptorWriter writer;
+		writer.writeBuffer(0, m_indirectObjects.buffer, m_indirectObjectCount * sizeof(GPUObjectData), m_indirectObjects.offset, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+		writer.updateSet(m_device, objectDescriptor);
+	}
+
+	MaterialPipeline* lastPipeline = nullptr;
+	VkBuffer lastIndexBuffer = VK_NULL_HANDLE;
+	VkIndexType lastIndexType = VK_INDEX_TYPE_MAX_ENUM;
+	VkDescriptorSet bindlessSet = m_bindless.set();
+	const bool clusterPath = m_rendererState->renderPath == RenderPath::Clusters;
+	const auto batchCount = static_cast<uint32_t>(m_indirectBatches.size());
+	const uint32_t commandBase = phase == CullPhase::Late ? m_indirectObjectCount : 0;
+	const uint32_t countBase = phase == CullPhase::Late ? batchCount : 0;
+
+	for (uint32_t batchId = 0; batchId < m_indirectBatches.size(); batchId++) {
+		const IndirectBatch& batch = m_indirectBatches[batchId];
+
+		// objects carry their material index, so only a new pipeline rebinds anything
+		if (batch.pipeline != lastPipeline) {
+			lastPipeline = batch.pipeline;
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, batch.pipeline->pipeline);
+			VkDescriptorSet sets[] = { frame.m_globalDescriptor, bindlessSet, objectDescriptor };
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, batch.pipeline->layout, 0, 3, sets, 1, &sceneDataOffset);
+		}
+
+		if (clusterPath) {
+			// every batch draws out of the compacted buffer
+			if (lastIndexBuffer != frame.m_clusterIndexBuffer.buffer) {
+				lastIndexBuffer = frame.m_clusterIndexBuffer.buffer;
+				vkCmdBindIndexBuffer(commandBuffer, lastIndexBuffer, 0, VK_INDEX_TYPE_UINT32);
+			}
+		} else if (batch.indexBuffer != lastIndexBuffer || batch.indexType != lastIndexType) {
+			lastIndexBuffer = batch.indexBuffer;
+			lastIndexType = batch.indexType;
+			vkCmdBindIndexBuffer(commandBuffer, batch.indexBuffer, 0, batch.indexType);
+		}
+
+		vkCmdDrawIndexedIndirectCount(commandBuffer,
+			frame.m_drawCommandBuffer.buffer,
+			(commandBase + batch.commandOffset) * sizeof(VkDrawIndexedIndirectCommand),
+			frame.m_drawCountBuffer.buffer,
+			(countBase + batchId) * sizeof(uint32_t),
+			batch.objectCount,
+			sizeof(VkDrawIndexedIndirectCommand));
+
+		m_rendererState->rendererStats.drawCallCount++;
+	}
+
+	if (phase == CullPhase::Late) {
+		return;
+	}
+
+	// NOTE: culling happens on the GPU, so this is the triangle count before culling
+	for (uint32_t i = 0; i < mainDrawContext.opaqueSurfaces.size(); i++) {
+		m_rendererState->rendererStats.triangleCount += mainDrawContext.opaqueSurfaces[i].indexCount / 3;
+	}
+}
+
 void VulkanRenderer::initDescriptors() {
 	std::vector<DescriptorAllocator::PoolSizeRatio> sizes = {
-		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1 }
+		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1 },
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1 },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 }
 	};
 
 	m_globalDescriptorAllocator.init(m_device, 10, sizes);
@@ -622,10 +1329,45 @@ void VulkanRenderer::initDescriptors() {
 	// Vertex/Fragment UBO
 	{
 		DescriptorLayoutBuilder builder;
-		builder.addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+		builder.addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
 		m_gpuSceneDataDescriptorLayout = builder.build(m_device, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
 	}
 
+	// GPU driven path: object buffer for the vertex shader
+	{
+		DescriptorLayoutBuilder builder;
+		builder.addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+		m_objectDataDescriptorLayout = builder.build(m_device, VK_SHADER_STAGE_VERTEX_BIT);
+	}
+
+	// GPU driven path: objects, draw commands, draw counts, visibility, stats and occlusion data
+	// for the culling pass, plus the Hi-Z
+	{
+		DescriptorLayoutBuilder builder;
+		for (uint32_t binding = 0; binding < 6; binding++) {
+			builder.addBinding(binding, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+		}
+		builder.addBinding(6, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		m_cullDescriptorLayout = builder.build(m_device, VK_SHADER_STAGE_COMPUTE_BIT);
+	}
+
+	// cluster path: objects, cluster objects, draw commands, draw counts, compacted indices and stats
+	{
+		DescriptorLayoutBuilder builder;
+		for (uint32_t binding = 0; binding < 6; binding++) {
+			builder.addBinding(binding, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+		}
+		m_clusterCullDescriptorLayout = builder.build(m_device, VK_SHADER_STAGE_COMPUTE_BIT);
+	}
+
+	// Hi-Z reduction: the level above and the level written
+	{
+		DescriptorLayoutBuilder builder;
+		builder.addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		builder.addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+		m_hizReduceDescriptorLayout = builder.build(m_device, VK_SHADER_STAGE_COMPUTE_BIT);
+	}
+
 	m_drawImageDescriptors = m_globalDescriptorAllocator.allocate(m_device, m_drawImageDescriptorLayout);
 
 	{
@@ -634,6 +1376,26 @@ void VulkanRenderer::initDescriptors() {
 		writer.updateSet(m_device, m_drawImageDescriptors);
 	}
 
+	// the images never change, so the reduction sets are written once
+	m_hizReduceSets.resize(m_hizLevels);
+	for (uint32_t level = 0; level < m_hizLevels; level++) {
+		m_hizReduceSets[level] = m_globalDescriptorAllocator.allocate(m_device, m_hizReduceDescriptorLayout);
+
+		DescriptorWriter writer;
+		if (level == 0) {
+			writer.writeImage(0, m_depthImage.imageView, m_hizSampler, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		} else {
+			writer.writeImage(0, m_hizLevelViews[level - 1], m_hizSampler, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		}
+		writer.writeImage(1, m_hizLevelViews[level], VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+		writer.updateSet(m_device, m_hizReduceSets[level]);
+	}
+
+	// the culling pass binds the Hi-Z every frame, it has to be in its layout before the first one is built
+	immediateSubmit([&](VkCommandBuffer cmd) {
+		transitionImage(cmd, m_hizImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+	});
+
 	for (auto& frame : m_frames) {
 		// create a descriptor pool
 		std::vector<DescriptorAllocator::PoolSizeRatio> frame_sizes = {
@@ -645,11 +1407,31 @@ void VulkanRenderer::initDescriptors() {
 
 		frame.m_frameDescriptors = {};
 		frame.m_frameDescriptors.init(m_device, 1000, frame_sizes);
+
+		// the scene uniform set never changes, each frame only picks a new dynamic offset
+		frame.m_globalDescriptor = m_globalDescriptorAllocator.allocate(m_device, m_gpuSceneDataDescriptorLayout);
+		createUploadArena(frame, UPLOAD_ARENA_SIZE);
+		frame.m_uploadOverflow = 0;
+
+		frame.m_cullStatsBuffer = createBuffer(sizeof(CullStats), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
+		*static_cast<CullStats*>(frame.m_cullStatsBuffer.info.pMappedData) = {};
+
+		// large enough for the whole draw image, frames never render more than that
+		if (m_rendererState->headless && m_rendererState->readbackInterval > 0) {
+			const VkDeviceSize readbackSize = static_cast<VkDeviceSize>(m_drawImage.imageExtent.width) * m_drawImage.imageExtent.height * 4 * sizeof(uint16_t);
+			frame.m_readbackBuffer = createBuffer(readbackSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
+		}
 	}
+
+	// textures, samplers and material constants of every loaded scene
+	m_bindless.init(m_device, m_allocator);
 }
 
 void VulkanRenderer::initPipelines() {
 	initBackgroundPipelines();
+	initCullPipeline();
+	initClusterCullPipeline();
+	initHiZPipeline();
 	metalRoughMaterial.buildPipelines(this);
 }
 
@@ -688,6 +1470,99 @@ void VulkanRenderer::initBackgroundPipelines() {
 	vkDestroyShaderModule(m_device, computeDrawShader, nullptr);
 }
 
+void VulkanRenderer::initCullPipeline() {
+	VkPipelineLayoutCreateInfo cullLayout = pipelineLayoutCreateInfo();
+	cullLayout.pSetLayouts = &m_cullDescriptorLayout;
+	cullLayout.setLayoutCount = 1;
+
+	VkPushConstantRange pushConstants{};
+	pushConstants.offset = 0;
+	pushConstants.size = sizeof(CullPushConstants);
+	pushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	cullLayout.pPushConstantRanges = &pushConstants;
+	cullLayout.pushConstantRangeCount = 1;
+
+	VK_CHECK(vkCreatePipelineLayout(m_device, &cullLayout, nullptr, &m_cullPipelineLayout));
+
+	VkShaderModule cullShader{};
+	if (!loadShaderModule("res/shaders/cull.comp.spv", m_device, &cullShader)) {
+		std::cout << std::format("Error when building the culling compute shader \n");
+	}
+
+	VkComputePipelineCreateInfo computePipelineCreateInfo{};
+	computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	computePipelineCreateInfo.pNext = nullptr;
+	computePipelineCreateInfo.layout = m_cullPipelineLayout;
+	computePipelineCreateInfo.stage = pipelineShaderStageCreateInfo(VK_SHADER_STAGE_COMPUTE_BIT, cullShader);
+
+	VK_CHECK(vkCreateComputePipelines(m_device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &m_cullPipeline));
+
+	vkDestroyShaderModule(m_device, cullShader, nullptr);
+}
+
+void VulkanRenderer::initClusterCullPipeline() {
+	VkPipelineLayoutCreateInfo cullLayout = pipelineLayoutCreateInfo();
+	cullLayout.pSetLayouts = &m_clusterCullDescriptorLayout;
+	cullLayout.setLayoutCount = 1;
+
+	VkPushConstantRange pushConstants{};
+	pushConstants.offset = 0;
+	pushConstants.size = sizeof(ClusterCullPushConstants);
+	pushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	cullLayout.pPushConstantRanges = &pushConstants;
+	cullLayout.pushConstantRangeCount = 1;
+
+	VK_CHECK(vkCreatePipelineLayout(m_device, &cullLayout, nullptr, &m_clusterCullPipelineLayout));
+
+	VkShaderModule cullShader{};
+	if (!loadShaderModule("res/shaders/cluster_cull.comp.spv", m_device, &cullShader)) {
+		std::cout << std::format("Error when building the cluster culling compute shader \n");
+	}
+
+	VkComputePipelineCreateInfo computePipelineCreateInfo{};
+	computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	computePipelineCreateInfo.pNext = nullptr;
+	computePipelineCreateInfo.layout = m_clusterCullPipelineLayout;
+	computePipelineCreateInfo.stage = pipelineShaderStageCreateInfo(VK_SHADER_STAGE_COMPUTE_BIT, cullShader);
+
+	VK_CHECK(vkCreateComputePipelines(m_device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &m_clusterCullPipeline));
+
+	vkDestroyShaderModule(m_device, cullShader, nullptr);
+}
+
+void VulkanRenderer::initHiZPipeline() {
+	VkPipelineLayoutCreateInfo reduceLayout = pipelineLayoutCreateInfo();
+	reduceLayout.pSetLayouts = &m_hizReduceDescriptorLayout;
+	reduceLayout.setLayoutCount = 1;
+
+	VkPushConstantRange pushConstants{};
+	pushConstants.offset = 0;
+	pushConstants.size = sizeof(HiZReducePushConstants);
+	pushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	reduceLayout.pPushConstantRanges = &pushConstants;
+	reduceLayout.pushConstantRangeCount = 1;
+
+	VK_CHECK(vkCreatePipelineLayout(m_device, &reduceLayout, nullptr, &m_hizReducePipelineLayout));
+
+	VkShaderModule reduceShader{};
+	if (!loadShaderModule("res/shaders/hiz_reduce.comp.spv", m_device, &reduceShader)) {
+		std::cout << std::format("Error when building the Hi-Z reduction compute shader \n");
+	}
+
+	VkComputePipelineCreateInfo computePipelineCreateInfo{};
+	computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	computePipelineCreateInfo.pNext = nullptr;
+	computePipelineCreateInfo.layout = m_hizReducePipelineLayout;
+	computePipelineCreateInfo.stage = pipelineShaderStageCreateInfo(VK_SHADER_STAGE_COMPUTE_BIT, reduceShader);
+
+	VK_CHECK(vkCreateComputePipelines(m_device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &m_hizReducePipeline));
+
+	vkDestroyShaderModule(m_device, reduceShader, nullptr);
+}
+
 void VulkanRenderer::immediateSubmit(std::function<void(VkCommandBuffer cmd)>&& function) {
 	VK_CHECK(vkResetFences(m_device, 1, &m_immFence));
 	VK_CHECK(vkResetCommandBuffer(m_immCommandBuffer, 0));
@@ -707,11 +1582,56 @@ void VulkanRenderer::immediateSubmit(std::function<void(VkCommandBuffer cmd)>&&
 
 	// submit command buffer to the queue and execute it.
 	//  _renderFence will now block until the graphic commands finish execution
-	VK_CHECK(vkQueueSubmit2(m_graphicsQueue, 1, &submit, m_immFence));
+	{
+		std::lock_guard<std::mutex> lock(m_queueMutex);
+		VK_CHECK(vkQueueSubmit2(m_graphicsQueue, 1, &submit, m_immFence));
+	}
 
 	VK_CHECK(vkWaitForFences(m_device, 1, &m_immFence, true, 9999999999));
 }
 
+void VulkanRenderer::waitDeviceIdle() {
+	// waits on every queue, which needs the same external synchronization as a submit
+	std::lock_guard<std::mutex> lock(m_queueMutex);
+	vkDeviceWaitIdle(m_device);
+}
+
+void VulkanRenderer::createUploadArena(FrameData& frame, VkDeviceSize capacity) {
+	// instance transforms are read through a buffer reference, so the arena needs an address
+	AllocatedBuffer arenaBuffer = createBuffer(capacity, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+	VkBufferDeviceAddressInfo arenaAddressInfo{
+		.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+		.buffer = arenaBuffer.buffer
+	};
+	frame.m_uploadArena.init(arenaBuffer, capacity, vkGetBufferDeviceAddress(m_device, &arenaAddressInfo));
+
+	DescriptorWriter writer;
+	writer.writeBuffer(0, arenaBuffer.buffer, sizeof(GPUSceneData), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
+	writer.updateSet(m_device, frame.m_globalDescriptor);
+}
+
+UploadAllocation VulkanRenderer::allocateUpload(VkDeviceSize size, VkDeviceSize alignment) {
+	FrameData& frame = getCurrentFrame();
+	UploadAllocation allocation = frame.m_uploadArena.allocate(size, alignment);
+	if (allocation.data != nullptr) {
+		return allocation;
+	}
+
+	if (frame.m_uploadOverflow == 0) {
+		std::cout << std::format("Upload arena out of space: requested {} bytes, {} of {} used, growing it\n", size, frame.m_uploadArena.used(), frame.m_uploadArena.capacity());
+	}
+	frame.m_uploadOverflow += size + alignment;
+
+	// same usage as the arena, freed with the frame's other retired buffers
+	AllocatedBuffer buffer = createBuffer(size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+	frame.m_retiredBuffers.push_back(buffer);
+	VkBufferDeviceAddressInfo addressInfo{
+		.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+		.buffer = buffer.buffer
+	};
+	return UploadAllocation{ .data = buffer.info.pMappedData, .buffer = buffer.buffer, .offset = 0, .address = vkGetBufferDeviceAddress(m_device, &addressInfo) };
+}
+
 AllocatedBuffer VulkanRenderer::createBuffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage) {
 	// allocate buffer
 	VkBufferCreateInfo bufferInfo = { .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
@@ -736,69 +1656,269 @@ void VulkanRenderer::destroyBuffer(const AllocatedBuffer& buffer) {
 }
 
 /*
- * Create a staging buffer in CPU memory to hold the vertex + index buffer data.
- * Copy it to the GPU buffer.
+ * Sub-allocate the mesh from the geometry pools and queue its data on the upload manager.
+ * The copies are batched with other uploads, uploadTicket tells when they landed.
  */
-GPUMeshBuffers VulkanRenderer::uploadMesh(std::span<uint32_t> indices, std::span<Vertex> vertices) {
-	const size_t vertexBufferSize = vertices.size() * sizeof(Vertex);
-	const size_t indexBufferSize = indices.size() * sizeof(uint32_t);
+GPUMeshBuffers VulkanRenderer::uploadMesh(std::span<const uint32_t> indices, std::span<const Vertex> vertices, std::span<const Meshlet> meshlets) {
+	// narrowed here, cooked scenes store them at their final width
+	const bool useUint16 = useUint16Indices(vertices.size());
+	std::vector<uint16_t> narrowIndices;
+	std::span<const uint8_t> indexData = byteSpan(indices);
+	if (useUint16) {
+		narrowIndices.resize(indices.size());
+		std::transform(indices.begin(), indices.end(), narrowIndices.begin(), [](uint32_t index) { return static_cast<uint16_t>(index); });
+		indexData = byteSpan(std::span<const uint16_t>{ narrowIndices });
+	}
+
+	// vertices are converted into the layout the vertex shaders were built for
+	std::vector<uint8_t> packedVertices;
+	std::span<const uint8_t> vertexData = byteSpan(vertices);
+	if constexpr (VERTEX_LAYOUT != VertexLayout::Full) {
+		packedVertices.resize(packedVertexSize(vertices.size()));
+		packVertices<VERTEX_LAYOUT>(vertices, packedVertices.data());
+		vertexData = packedVertices;
+	}
+
+	return uploadPackedMesh(vertexData, static_cast<uint32_t>(vertices.size()), indexData, useUint16 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32, meshlets);
+}
+
+GPUMeshBuffers VulkanRenderer::uploadPackedMesh(std::span<const uint8_t> vertexData, uint32_t vertexCount, std::span<const uint8_t> indexData, VkIndexType indexType, std::span<const Meshlet> meshlets) {
+	PM_TRACE_ZONE("uploadMesh");
+	const size_t vertexBufferSize = vertexData.size();
+	const size_t indexBufferSize = indexData.size();
+	const bool useUint16 = indexType == VK_INDEX_TYPE_UINT16;
+	const size_t indexSize = useUint16 ? sizeof(uint16_t) : sizeof(uint32_t);
+	assert(vertexBufferSize == packedVertexSize(vertexCount));
 
 	GPUMeshBuffers newSurface{};
+	newSurface.meshId = allocateMeshId();
+	newSurface.indexType = indexType;
+
+	// pool ranges are 16 byte aligned, which also pads an odd number of 16 bit indices
+	// to the whole words the cluster culling pass reads. full pools grow, so this never fails
+	const GeometryRange vertexRange = m_vertexPool.allocate(vertexBufferSize);
+	const GeometryRange indexRange = m_indexPool.allocate(indexBufferSize);
+	const GeometryRange meshletRange = meshlets.empty() ? GeometryRange{} : m_meshletPool.allocate(meshlets.size_bytes());
+
+	newSurface.resident = true;
+	newSurface.vertexBlock = vertexRange.block;
+	newSurface.indexBlock = indexRange.block;
+	newSurface.meshletBlock = meshletRange.block;
+	newSurface.vertexOffset = vertexRange.offset;
+	newSurface.indexOffset = indexRange.offset;
+	newSurface.meshletOffset = meshletRange.offset;
+	newSurface.indexBuffer = m_indexPool.buffer(indexRange.block);
+	newSurface.firstIndex = static_cast<uint32_t>(newSurface.indexOffset / indexSize);
+	newSurface.vertexBufferAddress = m_vertexPool.address(vertexRange.block) + newSurface.vertexOffset;
+	newSurface.indexBufferAddress = m_indexPool.address(indexRange.block);
+
+	UploadTicket vertexTicket = m_uploads.uploadBuffer(m_vertexPool.buffer(vertexRange.block), newSurface.vertexOffset, vertexData.data(), vertexBufferSize);
+	UploadTicket indexTicket = m_uploads.uploadBuffer(newSurface.indexBuffer, newSurface.indexOffset, indexData.data(), indexBufferSize);
+	newSurface.uploadTicket = std::max(vertexTicket, indexTicket);
+
+	if (!meshlets.empty()) {
+		newSurface.meshletBufferAddress = m_meshletPool.address(meshletRange.block) + newSurface.meshletOffset;
+
+		UploadTicket meshletTicket = m_uploads.uploadBuffer(m_meshletPool.buffer(meshletRange.block), newSurface.meshletOffset, meshlets.data(), meshlets.size_bytes());
+		newSurface.uploadTicket = std::max(newSurface.uploadTicket, meshletTicket);
+	}
 
-	// create vertex buffer
-	newSurface.vertexBuffer = createBuffer(vertexBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	newSurface.vertexCount = vertexCount;
+	newSurface.vertexBytes = vertexBufferSize;
+	newSurface.indexBytes = indexBufferSize;
+	newSurface.meshletBytes = meshlets.size_bytes();
+	m_meshMemory.vertexCount += newSurface.vertexCount;
+	m_meshMemory.vertexBytes += newSurface.vertexBytes;
+	m_meshMemory.indexBytes += newSurface.indexBytes;
+	m_meshMemory.meshletBytes += newSurface.meshletBytes;
+	m_meshMemory.meshCount++;
+	if (useUint16) {
+		m_meshMemory.uint16MeshCount++;
+	}
 
-	// find the adress of the vertex buffer
-	VkBufferDeviceAddressInfo deviceAdressInfo{
-		.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
-		.buffer = newSurface.vertexBuffer.buffer
-	};
-	newSurface.vertexBufferAddress = vkGetBufferDeviceAddress(m_device, &deviceAdressInfo);
+	return newSurface;
+}
+
+void VulkanRenderer::releaseMesh(GPUMeshBuffers& mesh) {
+	if (!mesh.resident) {
+		return;
+	}
+	m_vertexPool.free(GeometryRange{ .block = mesh.vertexBlock, .offset = mesh.vertexOffset });
+	m_indexPool.free(GeometryRange{ .block = mesh.indexBlock, .offset = mesh.indexOffset });
+	if (mesh.meshletBufferAddress != 0) {
+		m_meshletPool.free(GeometryRange{ .block = mesh.meshletBlock, .offset = mesh.meshletOffset });
+	}
 
-	// create index buffer
-	newSurface.indexBuffer = createBuffer(indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	m_meshMemory.vertexCount -= mesh.vertexCount;
+	m_meshMemory.vertexBytes -= mesh.vertexBytes;
+	m_meshMemory.indexBytes -= mesh.indexBytes;
+	m_meshMemory.meshletBytes -= mesh.meshletBytes;
+	m_meshMemory.meshCount--;
+	if (mesh.indexType == VK_INDEX_TYPE_UINT16) {
+		m_meshMemory.uint16MeshCount--;
+	}
+	mesh.resident = false;
 
-	AllocatedBuffer staging = createBuffer(vertexBufferSize + indexBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+	std::lock_guard<std::mutex> lock(m_meshIdMutex);
+	m_freeMeshIds.push_back(mesh.meshId);
+	std::push_heap(m_freeMeshIds.begin(), m_freeMeshIds.end(), std::greater<>{});
+}
 
-	// Get a pointer to which we can write to
-	void* data = staging.allocation->GetMappedData();
+uint32_t VulkanRenderer::allocateMeshId() {
+	std::lock_guard<std::mutex> lock(m_meshIdMutex);
+	if (m_freeMeshIds.empty()) {
+		assert(m_nextMeshId < MAX_SORT_KEY_MESHES);
+		return m_nextMeshId++;
+	}
+	// reused lowest first, so the ids stay dense after a scene is unloaded
+	std::pop_heap(m_freeMeshIds.begin(), m_freeMeshIds.end(), std::greater<>{});
+	const uint32_t meshId = m_freeMeshIds.back();
+	m_freeMeshIds.pop_back();
+	return meshId;
+}
 
-	// copy vertex buffer
-	memcpy(data, vertices.data(), vertexBufferSize);
-	// copy index buffer
-	memcpy(static_cast<char*>(data) + vertexBufferSize, indices.data(), indexBufferSize);
+void VulkanRenderer::compactGeometry() {
+	// pending uploads write to the old ranges, and frames in flight read them
+	m_uploads.wait(m_uploads.flush());
+	waitDeviceIdle();
 
+	std::vector<std::unordered_map<VkDeviceSize, VkDeviceSize>> vertexMoves;
+	std::vector<std::unordered_map<VkDeviceSize, VkDeviceSize>> indexMoves;
+	std::vector<std::unordered_map<VkDeviceSize, VkDeviceSize>> meshletMoves;
 	immediateSubmit([&](VkCommandBuffer cmd) {
-		VkBufferCopy vertexCopy{ 0 };
-		vertexCopy.dstOffset = 0;
-		vertexCopy.srcOffset = 0;
-		vertexCopy.size = vertexBufferSize;
+		vertexMoves = m_vertexPool.compact(cmd);
+		indexMoves = m_indexPool.compact(cmd);
+		meshletMoves = m_meshletPool.compact(cmd);
+	});
+	m_vertexPool.releaseRetired();
+	m_indexPool.releaseRetired();
+	m_meshletPool.releaseRetired();
+
+	// the new offset of a live range. every resident mesh owns one in each pool it uses, a
+	// missing one means the mesh was released or relocated twice
+	auto moved = [](const std::vector<std::unordered_map<VkDeviceSize, VkDeviceSize>>& moves, uint32_t block, VkDeviceSize offset) -> std::optional<VkDeviceSize> {
+		if (block >= moves.size()) {
+			return std::nullopt;
+		}
+		const auto it = moves[block].find(offset);
+		if (it == moves[block].end()) {
+			return std::nullopt;
+		}
+		return it->second;
+	};
 
-		vkCmdCopyBuffer(cmd, staging.buffer, newSurface.vertexBuffer.buffer, 1, &vertexCopy);
+	// every block got a new buffer, so even meshes that kept their offsets need new addresses.
+	// ranges stay in their block
+	auto relocate = [&](GPUMeshBuffers& mesh) {
+		if (!mesh.resident) {
+			return;
+		}
+		const std::optional<VkDeviceSize> vertexOffset = moved(vertexMoves, mesh.vertexBlock, mesh.vertexOffset);
+		const std::optional<VkDeviceSize> indexOffset = moved(indexMoves, mesh.indexBlock, mesh.indexOffset);
+		const std::optional<VkDeviceSize> meshletOffset = mesh.meshletBufferAddress != 0 ? moved(meshletMoves, mesh.meshletBlock, mesh.meshletOffset) : std::optional<VkDeviceSize>{ 0 };
+		assert(vertexOffset.has_value() && indexOffset.has_value() && meshletOffset.has_value());
+		if (!vertexOffset.has_value() || !indexOffset.has_value() || !meshletOffset.has_value()) {
+			// its ranges belong to other meshes now, drawing it would read their geometry
+			std::cout << std::format("Mesh {} has no range in the compacted geometry pools, it is no longer drawn\n", mesh.meshId);
+			mesh.resident = false;
+			return;
+		}
 
-		VkBufferCopy indexCopy{ 0 };
-		indexCopy.dstOffset = 0;
-		indexCopy.srcOffset = vertexBufferSize;
-		indexCopy.size = indexBufferSize;
+		mesh.vertexOffset = *vertexOffset;
+		mesh.indexOffset = *indexOffset;
+		mesh.indexBuffer = m_indexPool.buffer(mesh.indexBlock);
+		mesh.firstIndex = static_cast<uint32_t>(mesh.indexOffset / (mesh.indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t)));
+		mesh.vertexBufferAddress = m_vertexPool.address(mesh.vertexBlock) + mesh.vertexOffset;
+		mesh.indexBufferAddress = m_indexPool.address(mesh.indexBlock);
+		if (mesh.meshletBufferAddress != 0) {
+			mesh.meshletOffset = *meshletOffset;
+			mesh.meshletBufferAddress = m_meshletPool.address(mesh.meshletBlock) + mesh.meshletOffset;
+		}
+	};
 
-		vkCmdCopyBuffer(cmd, staging.buffer, newSurface.indexBuffer.buffer, 1, &indexCopy);
-	});
+	relocate(rectangle);
+	for (auto& mesh : m_testMeshes) {
+		relocate(mesh->meshBuffers);
+	}
+	for (auto& [name, scene] : loadedScenes) {
+		for (auto& mesh : scene->meshList) {
+			relocate(mesh->meshBuffers);
+		}
+	}
+}
 
-	destroyBuffer(staging);
+void VulkanRenderer::unloadScene(const std::string& name) {
+	auto it = loadedScenes.find(name);
+	if (it == loadedScenes.end()) {
+		return;
+	}
 
-	return newSurface;
+	// the scene's geometry and images may still be used by frames in flight
+	waitDeviceIdle();
+	loadedScenes.erase(it);
+	// its object ids go to whatever is drawn next
+	m_visibilityReset = true;
+
+	const float fragmentation = std::max({ m_vertexPool.fragmentation(), m_indexPool.fragmentation(), m_meshletPool.fragmentation() });
+	if (fragmentation > GEOMETRY_COMPACTION_THRESHOLD) {
+		compactGeometry();
+	}
 }
 
 
+uint64_t VulkanRenderer::gpuAllocatedBytes() const {
+	const VkPhysicalDeviceMemoryProperties* memoryProperties = nullptr;
+	vmaGetMemoryProperties(m_allocator, &memoryProperties);
+
+	std::array<VmaBudget, VK_MAX_MEMORY_HEAPS> budgets{};
+	vmaGetHeapBudgets(m_allocator, budgets.data());
+
+	uint64_t bytes = 0;
+	for (uint32_t heap = 0; heap < memoryProperties->memoryHeapCount; heap++) {
+		bytes += budgets[heap].statistics.allocationBytes;
+	}
+	return bytes;
+}
+
+void VulkanRenderer::printMeshMemoryReport() const {
+	constexpr double MB = 1024.0 * 1024.0;
+	const uint64_t vertexCount = m_meshMemory.vertexCount;
+	const uint64_t vertexBytes = m_meshMemory.vertexBytes;
+	const uint64_t fullBytes = vertexCount * sizeof(Vertex);
+
+	std::cout << std::format("Mesh memory: {} vertices in the {} layout, {:.2f} MB of vertices ({:.2f} MB as full vertices, {:.0f}%), {:.2f} MB of indices ({} of {} meshes with 16 bit indices), {:.2f} MB of meshlets\n",
+		vertexCount,
+		VertexTraits<VERTEX_LAYOUT>::name,
+		vertexBytes / MB,
+		fullBytes / MB,
+		fullBytes > 0 ? 100.0 * static_cast<double>(vertexBytes) / static_cast<double>(fullBytes) : 100.0,
+		m_meshMemory.indexBytes / MB,
+		m_meshMemory.uint16MeshCount.load(),
+		m_meshMemory.meshCount.load(),
+		m_meshMemory.meshletBytes / MB);
+	std::cout << std::format("Geometry pools: {:.2f} of {:.0f} MB vertices in {} blocks, {:.2f} of {:.0f} MB indices in {} blocks, {:.2f} of {:.0f} MB meshlets in {} blocks\n",
+		m_vertexPool.used() / MB,
+		m_vertexPool.capacity() / MB,
+		m_vertexPool.blockCount(),
+		m_indexPool.used() / MB,
+		m_indexPool.capacity() / MB,
+		m_indexPool.blockCount(),
+		m_meshletPool.used() / MB,
+		m_meshletPool.capacity() / MB,
+		m_meshletPool.blockCount());
+}
+
 AllocatedImage VulkanRenderer::createImage(VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped) {
+	return allocateImage(size, format, usage, mipmapped ? mipLevelCount(size.width, size.height) : 1);
+}
+
+AllocatedImage VulkanRenderer::allocateImage(VkExtent3D size, VkFormat format, VkImageUsageFlags usage, uint32_t mipLevels) {
 	AllocatedImage newImage{};
 	newImage.imageFormat = format;
 	newImage.imageExtent = size;
 
 	VkImageCreateInfo img_info = imageCreateInfo(format, usage, size);
-	if (mipmapped) {
-		img_info.mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(size.width, size.height)))) + 1;
-	}
+	img_info.mipLevels = mipLevels;
 
 	// always allocate images on dedicated GPU memory
 	VmaAllocationCreateInfo allocinfo = {};
@@ -824,36 +1944,51 @@ AllocatedImage VulkanRenderer::createImage(VkExtent3D size, VkFormat format, VkI
 	return newImage;
 }
 
-AllocatedImage VulkanRenderer::createImage(void* data, VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped) {
+AllocatedImage VulkanRenderer::createImage(const void* data, VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped) {
 	size_t data_size = size.depth * size.width * size.height * 4;
-	AllocatedBuffer uploadbuffer = createBuffer(data_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
 
-	memcpy(uploadbuffer.info.pMappedData, data, data_size);
+	// the mip chain is blitted from level 0, which needs linear filtering support for the format
+	if (mipmapped) {
+		VkFormatProperties formatProperties{};
+		vkGetPhysicalDeviceFormatProperties(m_chosenGPU, format, &formatProperties);
+		if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
+			std::cout << std::format("Format {} can't be blitted with linear filtering, skipping mips", static_cast<int>(format)) << '\n';
+			mipmapped = false;
+		}
+	}
 
 	AllocatedImage newImage = createImage(size, format, usage | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, mipmapped);
+	if (mipmapped) {
+		newImage.uploadTicket = m_uploads.uploadImageMipmapped(newImage.image, size, mipLevelCount(size.width, size.height), data, data_size);
+	} else {
+		newImage.uploadTicket = m_uploads.uploadImage(newImage.image, size, data, data_size);
+	}
 
-	immediateSubmit([&](VkCommandBuffer cmd) {
-		transitionImage(cmd, newImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-		VkBufferImageCopy copyRegion = {};
-		copyRegion.bufferOffset = 0;
-		copyRegion.bufferRowLength = 0;
-		copyRegion.bufferImageHeight = 0;
+	return newImage;
+}
 
-		copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		copyRegion.imageSubresource.mipLevel = 0;
-		copyRegion.imageSubresource.baseArrayLayer = 0;
-		copyRegion.imageSubresource.layerCount = 1;
-		copyRegion.imageExtent = size;
+AllocatedImage VulkanRenderer::createImage(std::span<const uint8_t> mipChain, VkExtent3D size, VkFormat format, uint32_t mipLevels, VkImageUsageFlags usage) {
+	AllocatedImage newImage = allocateImage(size, format, usage | VK_IMAGE_USAGE_TRANSFER_DST_BIT, mipLevels);
 
-		// copy the buffer into the image
-		vkCmdCopyBufferToImage(cmd, uploadbuffer.buffer, newImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+	std::vector<VkBufferImageCopy> regions(mipLevels);
+	VkDeviceSize offset = 0;
+	for (uint32_t mip = 0; mip < mipLevels; mip++) {
+		const uint32_t mipWidth = std::max(size.width >> mip, 1u);
+		const uint32_t mipHeight = std::max(size.height >> mip, 1u);
 
-		transitionImage(cmd, newImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-	});
+		VkBufferImageCopy& region = regions[mip];
+		region.bufferOffset = offset;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = mip;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+		region.imageExtent = VkExtent3D{ mipWidth, mipHeight, 1 };
 
-	destroyBuffer(uploadbuffer);
+		offset += mipLevelSize(format, mipWidth, mipHeight);
+	}
+	assert(offset <= mipChain.size());
 
+	newImage.uploadTicket = m_uploads.uploadImage(newImage.image, regions, mipChain.data(), offset);
 	return newImage;
 }
 
@@ -878,16 +2013,10 @@ void GLTFMetallic_Roughness::buildPipelines(VulkanRenderer* renderer) {
 	matrixRange.size = sizeof(GPUDrawPushConstants);
 	matrixRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
-	DescriptorLayoutBuilder layoutBuilder;
-	layoutBuilder.addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-	layoutBuilder.addBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-	layoutBuilder.addBinding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-
-	materialLayout = layoutBuilder.build(renderer->m_device, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
-
+	// set 1 is the bindless table shared by every material
 	VkDescriptorSetLayout layouts[] = {
 		renderer->m_gpuSceneDataDescriptorLayout,
-		materialLayout
+		renderer->m_bindless.layout()
 	};
 
 	VkPipelineLayoutCreateInfo meshLayoutInfo = pipelineLayoutCreateInfo();
@@ -901,6 +2030,8 @@ void GLTFMetallic_Roughness::buildPipelines(VulkanRenderer* renderer) {
 
 	opaquePipeline.layout = newLayout;
 	transparentPipeline.layout = newLayout;
+	opaquePipeline.sortId = 0;
+	transparentPipeline.sortId = 1;
 
 	// build the stage-create-info for both vertex and fragment stages. This lets
 	// the pipeline know the shader modules per stage
@@ -928,52 +2059,208 @@ void GLTFMetallic_Roughness::buildPipelines(VulkanRenderer* renderer) {
 
 	transparentPipeline.pipeline = pipelineBuilder.buildPipeline(renderer->m_device);
 
+	// opaque variant for the GPU driven path. per object data comes from the
+	// object buffer indexed by gl_InstanceIndex instead of push constants
+	VkShaderModule meshIndirectVertexShader{};
+	if (!loadShaderModule("res/shaders/mesh_indirect.vert.spv", renderer->m_device, &meshIndirectVertexShader)) {
+		std::cout << std::format("Error when building the indirect vertex shader module") << '\n';
+	}
+
+	VkDescriptorSetLayout indirectLayouts[] = {
+		renderer->m_gpuSceneDataDescriptorLayout,
+		renderer->m_bindless.layout(),
+		renderer->m_objectDataDescriptorLayout
+	};
+
+	VkPipelineLayoutCreateInfo indirectLayoutInfo = pipelineLayoutCreateInfo();
+	indirectLayoutInfo.setLayoutCount = 3;
+	indirectLayoutInfo.pSetLayouts = indirectLayouts;
+
+	VkPipelineLayout indirectLayout{};
+	VK_CHECK(vkCreatePipelineLayout(renderer->m_device, &indirectLayoutInfo, nullptr, &indirectLayout));
+
+	opaqueIndirectPipeline.layout = indirectLayout;
+	opaqueIndirectPipeline.sortId = 2;
+
+	pipelineBuilder.setPipelineLayout(indirectLayout);
+	pipelineBuilder.setShaders(meshIndirectVertexShader, meshFragShader);
+	pipelineBuilder.disableBlending();
+	pipelineBuilder.enableDepthTest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
+
+	opaqueIndirectPipeline.pipeline = pipelineBuilder.buildPipeline(renderer->m_device);
+
 	vkDestroyShaderModule(renderer->m_device, meshFragShader, nullptr);
 	vkDestroyShaderModule(renderer->m_device, meshVertexShader, nullptr);
+	vkDestroyShaderModule(renderer->m_device, meshIndirectVertexShader, nullptr);
 }
 
-MaterialInstance GLTFMetallic_Roughness::writeMaterial(VkDevice device, MaterialPass pass, const MaterialResources& resources, DescriptorAllocator& descriptorAllocator) {
+MaterialInstance GLTFMetallic_Roughness::writeMaterial(MaterialPass pass, const MaterialResources& resources, BindlessTable& bindless) {
 	MaterialInstance matData{};
 	matData.passType = pass;
 	if (pass == MaterialPass::Transparent) {
 		matData.pipeline = &transparentPipeline;
+		matData.indirectPipeline = nullptr;
 	} else {
 		matData.pipeline = &opaquePipeline;
+		matData.indirectPipeline = &opaqueIndirectPipeline;
 	}
 
-	matData.materialSet = descriptorAllocator.allocate(device, materialLayout);
+	GPUMaterialData material{};
+	material.colorFactors = resources.constants.colorFactors;
+	material.metalRoughFactors = resources.constants.metalRoughFactors;
+	material.colorTexture = bindless.addTexture(resources.colorImage.imageView);
+	material.colorSampler = bindless.addSampler(resources.colorSampler);
+	material.metalRoughTexture = bindless.addTexture(resources.metalRoughImage.imageView);
+	material.metalRoughSampler = bindless.addSampler(resources.metalRoughSampler);
+	matData.materialIndex = bindless.addMaterial(material);
 
-	writer.clear();
-	writer.writeBuffer(0, resources.dataBuffer, sizeof(MaterialConstants), resources.dataBufferOffset, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-	writer.writeImage(1, resources.colorImage.imageView, resources.colorSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-	writer.writeImage(2, resources.metalRoughImage.imageView, resources.metalRoughSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+	return matData;
+}
 
-	writer.updateSet(device, matData.materialSet);
+bool SurfaceEmitter::occluded(const RenderObject& object) {
+	if (m_ctx.occlusion == nullptr) {
+		return false;
+	}
 
-	return matData;
+	const glm::vec3 boundsMin = object.bounds.origin - object.bounds.extents;
+	const glm::vec3 boundsMax = object.bounds.origin + object.bounds.extents;
+	if (m_ctx.occlusion->isVisible(boundsMin, boundsMax, object.transform)) {
+		return false;
+	}
+	m_ctx.occludedSurfaces++;
+	return true;
 }
 
-void MeshNode::draw(const glm::mat4& topMatrix, DrawContext& ctx) {
-	glm::mat4 nodeMatrix = topMatrix * worldTransform;
+void SurfaceEmitter::add(const RenderObject& object, const glm::vec3& center, float radius) {
+	if (m_ctx.frustum == nullptr) {
+		if (!occluded(object)) {
+			emit(object);
+		}
+		return;
+	}
+
+	m_objects[m_count] = object;
+	m_x[m_count] = center.x;
+	m_y[m_count] = center.y;
+	m_z[m_count] = center.z;
+	m_radius[m_count] = radius;
+
+	if (++m_count == FRUSTUM_BATCH_SIZE) {
+		flush();
+	}
+}
+
+void SurfaceEmitter::flush() {
+	if (m_count == 0) {
+		return;
+	}
+
+	// lanes past m_count hold stale data, mask them out
+	const uint32_t visible = testSpheres(*m_ctx.frustum, m_x, m_y, m_z, m_radius) & ((1u << m_count) - 1);
+
+	for (uint32_t i = 0; i < m_count; i++) {
+		if ((visible & (1u << i)) == 0) {
+			m_ctx.culledSurfaces++;
+		} else if (!occluded(m_objects[i])) {
+			emit(m_objects[i]);
+		}
+	}
+
+	m_count = 0;
+}
+
+void SurfaceEmitter::emit(const RenderObject& object) {
+	if (object.material->passType == MaterialPass::Transparent) {
+		m_ctx.transparentSurfaces.push_back(object);
+	} else {
+		m_ctx.opaqueSurfaces.push_back(object);
+	}
+}
+
+void drawMesh(const MeshAsset& mesh, const glm::mat4& transform, uint32_t firstObjectId, SurfaceEmitter& emitter) {
+	// bounding spheres go to world space with their radius scaled by the largest axis scale
+	const float scale = std::sqrt(std::max({ glm::dot(glm::vec3(transform[0]), glm::vec3(transform[0])),
+		glm::dot(glm::vec3(transform[1]), glm::vec3(transform[1])),
+		glm::dot(glm::vec3(transform[2]), glm::vec3(transform[2])) }));
+	const LodSelection* lodSelection = emitter.lodSelection();
+	if (!mesh.meshBuffers.resident) {
+		return;
+	}
+
+	for (uint32_t surfaceIndex = 0; surfaceIndex < mesh.surfaces.size(); surfaceIndex++) {
+		const GeoSurface& s = mesh.surfaces[surfaceIndex];
+		const glm::vec3 center = glm::vec3(transform * glm::vec4(s.bounds.origin, 1.f));
+		const float radius = s.bounds.sphereRadius * scale;
+
+		uint32_t level = 0;
+		if (lodSelection != nullptr) {
+			level = lodSelection->select(std::span<const LodLevel>(s.lods.data(), s.lodCount), center, radius, scale);
+		}
 
-	for (auto& s : mesh->surfaces) {
 		RenderObject def{};
-		def.indexCount = s.count;
-		def.firstIndex = s.startIndex;
-		def.indexBuffer = mesh->meshBuffers.indexBuffer.buffer;
+		def.indexCount = s.lods[level].count;
+		def.firstIndex = mesh.meshBuffers.firstIndex + s.lods[level].startIndex;
+		def.indexBuffer = mesh.meshBuffers.indexBuffer;
+		def.indexType = mesh.meshBuffers.indexType;
+		def.baseIndex = mesh.meshBuffers.firstIndex;
+		def.indexBufferAddress = mesh.meshBuffers.indexBufferAddress;
+		def.meshletBufferAddress = mesh.meshBuffers.meshletBufferAddress;
+		def.firstMeshlet = s.lods[level].firstMeshlet;
+		def.meshletCount = s.lods[level].meshletCount;
 		def.material = &s.material->data;
+		def.bounds = s.bounds;
 
-		def.transform = nodeMatrix;
-		def.vertexBufferAddress = mesh->meshBuffers.vertexBufferAddress;
+		def.transform = transform;
+		def.vertexBufferAddress = mesh.meshBuffers.vertexBufferAddress;
+		def.objectId = firstObjectId + surfaceIndex;
+
+		static_assert(MAX_BINDLESS_MATERIALS <= MAX_SORT_KEY_MATERIALS && MAX_LOD_COUNT <= MAX_SORT_KEY_LODS);
+		const MaterialInstance& material = *def.material;
+		const float depth = glm::length(center - emitter.cameraPosition());
+		if (material.passType == MaterialPass::Transparent) {
+			def.sortKey = transparentSortKey(material.passType, material.pipeline->sortId, material.materialIndex, mesh.meshBuffers.meshId, depth);
+		} else {
+			const bool wideIndices = mesh.meshBuffers.indexType == VK_INDEX_TYPE_UINT32;
+			def.sortKey = opaqueSortKey(material.passType, material.pipeline->sortId, wideIndices, mesh.meshBuffers.meshId, surfaceIndex, level, material.materialIndex, depth);
+		}
 
-		ctx.opaqueSurfaces.push_back(def);
+		emitter.add(def, center, radius);
 	}
+}
+
+void mergeDrawContexts(std::span<const DrawContext> chunks, DrawContext& target) {
+	// every chunk gets a disjoint slice of the target lists, so the copies can run
+	// in parallel without any locking
+	std::vector<size_t> opaqueOffsets(chunks.size());
+	std::vector<size_t> transparentOffsets(chunks.size());
+
+	size_t opaqueCount = target.opaqueSurfaces.size();
+	size_t transparentCount = target.transparentSurfaces.size();
+	for (size_t i = 0; i < chunks.size(); i++) {
+		opaqueOffsets[i] = opaqueCount;
+		transparentOffsets[i] = transparentCount;
+		opaqueCount += chunks[i].opaqueSurfaces.size();
+		transparentCount += chunks[i].transparentSurfaces.size();
+		target.culledSurfaces += chunks[i].culledSurfaces;
+		target.occludedSurfaces += chunks[i].occludedSurfaces;
+	}
+
+	target.opaqueSurfaces.resize(opaqueCount);
+	target.transparentSurfaces.resize(transparentCount);
+
+	tbb::parallel_for(size_t(0), chunks.size(), [&](size_t i) {
+		std::copy(chunks[i].opaqueSurfaces.begin(), chunks[i].opaqueSurfaces.end(), target.opaqueSurfaces.begin() + opaqueOffsets[i]);
+		std::copy(chunks[i].transparentSurfaces.begin(), chunks[i].transparentSurfaces.end(), target.transparentSurfaces.begin() + transparentOffsets[i]);
+	});
+}
 
-	// recurse down
-	Node::draw(topMatrix, ctx);
+void MeshNode::draw(const glm::mat4& topMatrix, uint32_t firstObjectId, DrawContext& ctx) const {
+	SurfaceEmitter emitter{ ctx };
+	drawMesh(*mesh, topMatrix * localTransform, firstObjectId, emitter);
 }
 
 void VulkanRenderer::updateScene() {
+	PM_TRACE_ZONE("updateScene");
 	auto start = std::chrono::system_clock::now();
 
 	m_rendererState->mainCamera->update();
@@ -995,21 +2282,157 @@ void VulkanRenderer::updateScene() {
 	m_sceneData.sunlightColor = glm::vec4(1.f);
 	m_sceneData.sunlightDirection = glm::vec4(0, 1, 0.5, 1.f);
 
-	loadedNodes["Suzanne"]->draw(glm::mat4{ 1.f }, mainDrawContext);
+	m_frustum = Frustum::fromViewProj(m_sceneData.viewproj);
+	// the GPU driven paths cull in a compute pass, so every surface is kept here
+	const bool cpuCulling = m_rendererState->frustumCulling && m_rendererState->renderPath == RenderPath::Classic;
+	mainDrawContext.frustum = cpuCulling ? &m_frustum : nullptr;
+	mainDrawContext.culledSurfaces = 0;
+
+	const float viewportHeight = static_cast<float>(m_rendererState->windowExtent.height);
+	m_lodSelection = LodSelection::fromViewProj(m_sceneData.view, m_sceneData.proj, viewportHeight, m_rendererState->lodErrorThreshold, m_rendererState->forcedLod);
+	mainDrawContext.lodSelection = &m_lodSelection;
+	mainDrawContext.cameraPosition = m_lodSelection.cameraPosition;
+
+	// the GPU driven path has its own Hi-Z test
+	mainDrawContext.occludedSurfaces = 0;
+	mainDrawContext.occlusion = nullptr;
+	if (m_rendererState->occlusionCulling && m_rendererState->renderPath == RenderPath::Classic) {
+		rasterizeOccluders(*loadedScenes["structure"], glm::mat4{ 1.f });
+		mainDrawContext.occlusion = &m_occlusionBuffer;
+	}
+
+	// every drawn (node, surface) gets the same object id each frame, in drawing order
+	uint32_t objectIdCount = 0;
+	const MeshNode& suzanne = loadedNodes["Suzanne"];
+	suzanne.draw(glm::mat4{ 1.f }, objectIdCount, mainDrawContext);
+	objectIdCount += suzanne.objectIdCount();
 
+	const MeshNode& cube = loadedNodes["Cube"];
 	for (int x = -3; x < 3; x++) {
 
 		glm::mat4 scale = glm::scale(glm::vec3{ 0.2 });
 		glm::mat4 translation = glm::translate(glm::vec3{ x, 1, 0 });
 
-		loadedNodes["Cube"]->draw(translation * scale, mainDrawContext);
+		cube.draw(translation * scale, objectIdCount, mainDrawContext);
+		objectIdCount += cube.objectIdCount();
 	}
 
-	loadedScenes["structure"]->draw(glm::mat4{ 1.f }, mainDrawContext);
+	LoadedGLTF& structure = *loadedScenes["structure"];
+	structure.objectIdBase = objectIdCount;
+	objectIdCount += structure.objectIdCount;
+	collectDraws(structure, glm::mat4{ 1.f });
+
+	// the ids no longer mean the same objects
+	if (objectIdCount != m_objectIdCount) {
+		m_objectIdCount = objectIdCount;
+		m_visibilityReset = true;
+	}
 
 	auto end = std::chrono::system_clock::now();
 	auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
 	m_rendererState->rendererStats.sceneUpdateTime = elapsed.count() / 1000.0f;
+	m_rendererState->rendererStats.culledCount = static_cast<int>(mainDrawContext.culledSurfaces);
+	if (mainDrawContext.occlusion != nullptr) {
+		m_rendererState->rendererStats.occludedCount = static_cast<int>(mainDrawContext.occludedSurfaces);
+	}
+}
+
+void VulkanRenderer::rasterizeOccluders(LoadedGLTF& scene, const glm::mat4& topMatrix) {
+	PM_TRACE_ZONE("rasterizeOccluders");
+	scene.scene.updateTransforms();
+	m_occlusionBuffer.begin(m_sceneData.viewproj);
+
+	// occluders in view, largest on screen first
+	struct Candidate {
+			uint32_t node;
+			float screenSize;
+	};
+	std::vector<Candidate> candidates;
+
+	const glm::vec3 cameraPosition = m_lodSelection.cameraPosition;
+	for (uint32_t node : scene.scene.meshNodes) {
+		const OccluderMesh& occluder = scene.meshList[scene.scene.meshIndices[node]]->occluder;
+		if (occluder.empty()) {
+			continue;
+		}
+
+		const glm::mat4 transform = topMatrix * scene.scene.worldTransforms[node];
+		const float scale = std::sqrt(std::max({ glm::dot(glm::vec3(transform[0]), glm::vec3(transform[0])),
+			glm::dot(glm::vec3(transform[1]), glm::vec3(transform[1])),
+			glm::dot(glm::vec3(transform[2]), glm::vec3(transform[2])) }));
+		const glm::vec3 center = glm::vec3(transform * glm::vec4(occluder.center, 1.f));
+		const float radius = occluder.radius * scale;
+
+		bool inside = true;
+		for (uint32_t plane = 0; plane < Frustum::PLANE_COUNT && inside; plane++) {
+			inside = m_frustum.nx[plane] * center.x + m_frustum.ny[plane] * center.y + m_frustum.nz[plane] * center.z + m_frustum.d[plane] >= -radius;
+		}
+		if (!inside) {
+			continue;
+		}
+
+		// radius over distance, anything the camera is inside of counts as full screen
+		const float distance = glm::length(center - cameraPosition);
+		const float screenSize = distance > radius ? radius / distance : 1.f;
+		if (screenSize >= OCCLUDER_MIN_SCREEN_SIZE) {
+			candidates.push_back(Candidate{ node, screenSize });
+		}
+	}
+
+	std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+		return a.screenSize > b.screenSize;
+	});
+
+	uint32_t triangleCount = 0;
+	for (const Candidate& candidate : candidates) {
+		const OccluderMesh& occluder = scene.meshList[scene.scene.meshIndices[candidate.node]]->occluder;
+		if (triangleCount + occluder.triangleCount() > OCCLUSION_TRIANGLE_BUDGET) {
+			break;
+		}
+		triangleCount += occluder.triangleCount();
+		m_occlusionBuffer.addOccluder(occluder, topMatrix * scene.scene.worldTransforms[candidate.node]);
+	}
+
+	m_occlusionBuffer.rasterize();
+}
+
+void VulkanRenderer::collectDraws(LoadedGLTF& scene, const glm::mat4& topMatrix) {
+	PM_TRACE_ZONE("collectDraws");
+	scene.scene.updateTransforms();
+
+	const size_t nodeCount = scene.scene.meshNodes.size();
+	const size_t chunkCount = (nodeCount + DRAW_COLLECTION_CHUNK_SIZE - 1) / DRAW_COLLECTION_CHUNK_SIZE;
+
+	// not worth waking up the workers for a single chunk
+	if (chunkCount <= 1) {
+		scene.drawRange(topMatrix, 0, nodeCount, mainDrawContext);
+		return;
+	}
+
+	if (m_drawChunks.size() < chunkCount) {
+		m_drawChunks.resize(chunkCount);
+	}
+
+	// chunk boundaries are fixed, so merging the chunks in index order gives exactly
+	// the same list as a single threaded walk no matter how tbb schedules them
+	tbb::parallel_for(size_t(0), chunkCount, [&](size_t chunk) {
+		PM_TRACE_ZONE("collectDrawsChunk");
+		DrawContext& ctx = m_drawChunks[chunk];
+		ctx.opaqueSurfaces.clear();
+		ctx.transparentSurfaces.clear();
+		ctx.frustum = mainDrawContext.frustum;
+		ctx.lodSelection = mainDrawContext.lodSelection;
+		ctx.occlusion = mainDrawContext.occlusion;
+		ctx.cameraPosition = mainDrawContext.cameraPosition;
+		ctx.culledSurfaces = 0;
+		ctx.occludedSurfaces = 0;
+
+		const size_t begin = chunk * DRAW_COLLECTION_CHUNK_SIZE;
+		const size_t end = std::min(begin + DRAW_COLLECTION_CHUNK_SIZE, nodeCount);
+		scene.drawRange(topMatrix, begin, end, ctx);
+	});
+
+	mergeDrawContexts(std::span<const DrawContext>(m_drawChunks.data(), chunkCount), mainDrawContext);
 }
 
 }// namespace pm
@@ -3,11 +3,22 @@
 #include "vulkan_loader.h"
 #include <SDL3/SDL.h>
 #include <VkBootstrap.h>
+#include <atomic>
+#include <limits>
+#include <mutex>
 #include <vulkan/vulkan.h>
 
 #include "camera.h"
+#include "scene/draw_sort.h"
+#include "scene/frustum.h"
+#include "scene/occlusion_buffer.h"
 #include "vk_types.h"
+#include "vulkan_bindless.h"
 #include "vulkan_descriptor.h"
+#include "vulkan_geometry_pool.h"
+#include "vulkan_profiler.h"
+#include "vulkan_upload.h"
+#include "vulkan_upload_arena.h"
 
 namespace pm {
 
@@ -15,8 +26,33 @@ struct RendererStats {
 		float frametime;
 		int triangleCount;
 		int drawCallCount;
+		int culledCount;
+		// clusters tested and rejected by RenderPath::Clusters, read back FRAME_OVERLAP frames late
+		int clusterCount;
+		int culledClusterCount;
+		// objects rejected by the Hi-Z test of RenderPath::GPUDriven, read back FRAME_OVERLAP frames late.
+		// surfaces rejected by the CPU occlusion buffer for RenderPath::Classic
+		int occludedCount;
 		float sceneUpdateTime;
+		// CPU time spent recording drawGeometry, the GPU side is gpuZoneTimes[GpuZone::Geometry]
 		float meshDrawTime;
+		// GPU timestamps over the last GPU_TIMING_WINDOW frames, read back FRAME_OVERLAP frames late
+		TimingSummary gpuFrameTime;
+		// the single GPU frame time read back this frame, 0 when none arrived
+		float gpuLatestFrameTime;
+		std::array<TimingSummary, GPU_ZONE_COUNT> gpuZoneTimes;
+		// of the geometry pass, all 0 when the device has no pipelineStatisticsQuery
+		PipelineStatistics pipelineStatistics;
+};
+
+enum class RenderPath : uint8_t {
+	// one push constant + vkCmdDrawIndexed per RenderObject
+	Classic,
+	// objects culled by a compute pass that writes indirect draws
+	GPUDriven,
+	// like GPUDriven, but each object's meshlets are culled too and the visible
+	// triangles are compacted into a per frame index buffer
+	Clusters
 };
 
 struct VulkanRendererConfig {
@@ -26,6 +62,34 @@ struct VulkanRendererConfig {
 		Camera* mainCamera;
 		bool resizeRequested;
 		RendererStats rendererStats;
+		bool frustumCulling{ true };
+		// reorder glTF meshes for the vertex cache before upload
+		bool optimizeMeshes{ true };
+		// build simplified levels for glTF meshes and pick one per surface from its projected error
+		bool generateLods{ true };
+		float lodErrorThreshold{ 1.f };
+		// >= 0 draws this LOD everywhere, for testing
+		int32_t forcedLod{ -1 };
+		RenderPath renderPath{ RenderPath::Classic };
+		// two pass Hi-Z occlusion culling for RenderPath::GPUDriven, software occlusion
+		// buffer for RenderPath::Classic
+		bool occlusionCulling{ true };
+		// normal cone test for RenderPath::Clusters
+		bool clusterConeCulling{ true };
+		// render into the draw image only, without a window, surface or swapchain
+		bool headless{ false };
+		// pick a CPU implementation such as lavapipe over any GPU
+		bool preferSoftwareDevice{ false };
+		// headless only: copy the draw image to host memory every n frames, 0 never
+		uint32_t readbackInterval{ 0 };
+};
+
+// draw image of a headless frame, RGBA16F texels row after row
+struct FrameReadback {
+		std::vector<uint16_t> pixels;
+		VkExtent2D extent;
+		// frame the pixels were rendered in, pixels is empty until the first readback arrived
+		uint32_t frameNumber;
 };
 
 struct FrameData {
@@ -38,6 +102,36 @@ struct FrameData {
 		VkFence m_renderFence;
 
 		DescriptorAllocator m_frameDescriptors;
+
+		// per frame uniforms and object data, recycled once m_renderFence is signaled
+		UploadArena m_uploadArena;
+		// bytes that didn't fit into the arena this frame, it grows by them before its next use
+		VkDeviceSize m_uploadOverflow;
+		// scene uniform set, written once and bound with a dynamic offset into m_uploadArena
+		VkDescriptorSet m_globalDescriptor;
+
+		// GPU driven path, grown on demand. commands and counts of the early and late
+		// occlusion passes are stored back to back
+		AllocatedBuffer m_drawCommandBuffer;
+		AllocatedBuffer m_drawCountBuffer;
+		uint32_t m_objectCapacity;
+		uint32_t m_batchCapacity;
+
+		// cluster path: compacted indices of the visible meshlets, grown on demand
+		AllocatedBuffer m_clusterIndexBuffer;
+		VkDeviceSize m_clusterIndexCapacity;
+		// CullStats written by the culling passes, read once the frame fence is signaled
+		AllocatedBuffer m_cullStatsBuffer;
+
+		// buffers replaced while earlier frames could still read them, destroyed once this
+		// slot's fence is signaled
+		std::vector<AllocatedBuffer> m_retiredBuffers;
+
+		// headless readback of the draw image, only created when readbackInterval > 0
+		AllocatedBuffer m_readbackBuffer;
+		// what the slot's last frame copied into m_readbackBuffer, width 0 when nothing
+		VkExtent2D m_readbackExtent;
+		uint32_t m_readbackFrame;
 };
 
 struct AllocatedImage {
@@ -46,6 +140,7 @@ struct AllocatedImage {
 		VmaAllocation allocation;
 		VkExtent3D imageExtent;
 		VkFormat imageFormat;
+		UploadTicket uploadTicket;
 };
 
 struct GPUSceneData {
@@ -57,6 +152,97 @@ struct GPUSceneData {
 		glm::vec4 sunlightColor;
 };
 
+// per object data read by cull.comp and mesh_indirect.vert
+struct GPUObjectData {
+		glm::mat4 transform;
+		// local space bounding sphere center + radius
+		glm::vec4 sphere;
+		uint32_t indexCount;
+		uint32_t firstIndex;
+		uint32_t batchId;
+		uint32_t commandOffset;
+		VkDeviceAddress vertexBuffer;
+		uint32_t materialIndex;
+		// RenderObject::objectId, indexes the visibility buffer
+		uint32_t objectId;
+};
+static_assert(sizeof(GPUObjectData) == 112, "GPUObjectData must match the std430 layout in the shaders");
+
+// the two passes of occlusion culling. Early draws what was visible last time, Late
+// tests the rest against the Hi-Z built from the early depth
+enum class CullPhase : uint32_t {
+	Early = 0,
+	Late = 1
+};
+
+struct CullPushConstants {
+		glm::vec4 frustumPlanes[Frustum::PLANE_COUNT];
+		uint32_t objectCount;
+		uint32_t cullingEnabled;
+		uint32_t occlusionEnabled;
+		uint32_t phase;
+		// where the commands and counts of this phase start
+		uint32_t commandBase;
+		uint32_t countBase;
+};
+
+// view space data for the Hi-Z test in cull.comp
+struct GPUOcclusionData {
+		glm::mat4 view;
+		// P00, P11, P22, P32 of the projection
+		glm::vec4 projection;
+		glm::vec2 hizSize;
+		float znear;
+		uint32_t hizLevels;
+};
+
+struct HiZReducePushConstants {
+		glm::uvec2 inputSize;
+		glm::uvec2 outputSize;
+};
+
+// per object data read by cluster_cull.comp next to GPUObjectData
+struct GPUClusterObject {
+		VkDeviceAddress meshletBuffer;
+		VkDeviceAddress indexBuffer;
+		uint32_t firstMeshlet;
+		// 0 when the mesh has no meshlets, its triangles are then split into fixed size runs
+		uint32_t meshletCount;
+		// first slot of the object in the compacted index buffer
+		uint32_t outputOffset;
+		uint32_t index16;
+		// first index of the mesh in indexBuffer, meshlet indices are relative to it
+		uint32_t baseIndex;
+		uint32_t padding;
+};
+static_assert(sizeof(GPUClusterObject) == 40, "GPUClusterObject must match the std430 layout in the shaders");
+
+struct ClusterCullPushConstants {
+		glm::vec4 frustumPlanes[Frustum::PLANE_COUNT];
+		glm::vec4 cameraPosition;
+		uint32_t objectCount;
+		uint32_t cullingEnabled;
+		uint32_t coneCulling;
+		uint32_t padding;
+};
+
+struct CullStats {
+		uint32_t clusterCount;
+		uint32_t visibleClusterCount;
+		uint32_t occludedObjectCount;
+		uint32_t padding;
+};
+
+// consecutive opaque objects sharing a pipeline and index buffer, drawn with a
+// single vkCmdDrawIndexedIndirectCount. materials come from the bindless table
+struct IndirectBatch {
+		MaterialPipeline* pipeline;
+		VkBuffer indexBuffer;
+		VkIndexType indexType;
+		uint32_t commandOffset;
+		uint32_t objectCount;
+};
+
 struct ComputePushConstants {
 		glm::vec4 data1;
 		glm::vec4 data2;
@@ -67,14 +253,11 @@ struct ComputePushConstants {
 struct GLTFMetallic_Roughness {
 		MaterialPipeline opaquePipeline;
 		MaterialPipeline transparentPipeline;
-
-		VkDescriptorSetLayout materialLayout;
+		MaterialPipeline opaqueIndirectPipeline;
 
 		struct MaterialConstants {
 				glm::vec4 colorFactors;
 				glm::vec4 metalRoughFactors;
-				// padding, we need it anyway for uniform buffers
-				glm::vec4 padding[14];
 		};
 
 		struct MaterialResources {
@@ -82,42 +265,134 @@ struct GLTFMetallic_Roughness {
 				VkSampler colorSampler;
 				AllocatedImage metalRoughImage;
 				VkSampler metalRoughSampler;
-				VkBuffer dataBuffer;
-				uint32_t dataBufferOffset;
+				MaterialConstants constants;
 		};
 
-		DescriptorWriter writer;
-
 		void buildPipelines(VulkanRenderer* renderer);
 		void clearResources(VkDevice device);
 
-		MaterialInstance writeMaterial(VkDevice device, MaterialPass pass, const MaterialResources& resources, DescriptorAllocator& descriptorAllocator);
-};
-
-struct MeshNode : public Node {
-		std::shared_ptr<MeshAsset> mesh;
-
-		void draw(const glm::mat4& topMatrix, DrawContext& ctx) override;
+		// registers the images, samplers and constants in the bindless table, release the
+		// returned materialIndex with BindlessTable::releaseMaterial
+		MaterialInstance writeMaterial(MaterialPass pass, const MaterialResources& resources, BindlessTable& bindless);
 };
 
 struct RenderObject {
 		uint32_t indexCount;
+		// in the shared index buffer, the mesh's firstIndex plus the surface start
 		uint32_t firstIndex;
 		VkBuffer indexBuffer;
+		VkIndexType indexType;
+
+		// cluster path, the meshlets of the drawn LOD. their indices start at baseIndex
+		uint32_t baseIndex;
+		VkDeviceAddress indexBufferAddress;
+		VkDeviceAddress meshletBufferAddress;
+		uint32_t firstMeshlet;
+		uint32_t meshletCount;
 
 		MaterialInstance* material;
+		Bounds bounds;
 
 		glm::mat4 transform;
 		VkDeviceAddress vertexBufferAddress;
+
+		// see draw_sort.h, built when the surface is emitted
+		uint64_t sortKey;
+		// the same for a (node, surface) every frame, unlike its place in the sorted draw
+		// list. keys the visibility the occlusion culling passes keep between frames
+		uint32_t objectId;
 };
 
 struct DrawContext {
 		std::vector<RenderObject> opaqueSurfaces;
 		std::vector<RenderObject> transparentSurfaces;
+
+		// when set, surfaces outside of the frustum never make it into the lists above
+		const Frustum* frustum{ nullptr };
+		// when set, surfaces draw the level it selects instead of LOD 0
+		const LodSelection* lodSelection{ nullptr };
+		// when set, surfaces whose box is hidden by the occluders are dropped too
+		const OcclusionBuffer* occlusion{ nullptr };
+		// depth of the sort keys is the distance to this point
+		glm::vec3 cameraPosition{ 0.f };
+		uint32_t culledSurfaces{ 0 };
+		uint32_t occludedSurfaces{ 0 };
+};
+
+// feeds surfaces into the opaque or transparent list of a DrawContext, frustum testing
+// their bounding spheres FRUSTUM_BATCH_SIZE at a time, then testing the boxes of the
+// visible ones against the occlusion buffer. pending surfaces are flushed on destruction
+class SurfaceEmitter {
+	public:
+		explicit SurfaceEmitter(DrawContext& ctx) : m_ctx(ctx) {}
+		~SurfaceEmitter() { flush(); }
+
+		const LodSelection* lodSelection() const { return m_ctx.lodSelection; }
+		const glm::vec3& cameraPosition() const { return m_ctx.cameraPosition; }
+
+		// center and radius of the world space bounding sphere
+		void add(const RenderObject& object, const glm::vec3& center, float radius);
+		void flush();
+
+	private:
+		// counts the surface when it is occluded
+		bool occluded(const RenderObject& object);
+		// appends to the list matching the material pass
+		void emit(const RenderObject& object);
+
+		DrawContext& m_ctx;
+		uint32_t m_count{ 0 };
+
+		std::array<RenderObject, FRUSTUM_BATCH_SIZE> m_objects{};
+		float m_x[FRUSTUM_BATCH_SIZE]{};
+		float m_y[FRUSTUM_BATCH_SIZE]{};
+		float m_z[FRUSTUM_BATCH_SIZE]{};
+		float m_radius[FRUSTUM_BATCH_SIZE]{};
+};
+
+// emit one RenderObject per surface of the mesh, at the LOD the context selects.
+// the surfaces get the object ids firstObjectId and up
+void drawMesh(const MeshAsset& mesh, const glm::mat4& transform, uint32_t firstObjectId, SurfaceEmitter& emitter);
+
+// append every chunk to target, preserving chunk order
+void mergeDrawContexts(std::span<const DrawContext> chunks, DrawContext& target);
+
+// standalone mesh that is not part of a loaded scene
+struct MeshNode {
+		std::shared_ptr<MeshAsset> mesh;
+		glm::mat4 localTransform{ 1.f };
+
+		// one object id per surface, from firstObjectId up
+		void draw(const glm::mat4& topMatrix, uint32_t firstObjectId, DrawContext& ctx) const;
+		uint32_t objectIdCount() const { return static_cast<uint32_t>(mesh->surfaces.size()); }
 };
 
 constexpr uint32_t FRAME_OVERLAP = 2;
 
+// initial size of the per frame upload arena, it grows when a frame needs more
+constexpr VkDeviceSize UPLOAD_ARENA_SIZE = 8 * 1024 * 1024;
+
+// 16 bit indices halve the index memory of every mesh small enough to use them.
+// primitive restart is off so 0xFFFF is a regular index
+constexpr bool useUint16Indices(size_t vertexCount) {
+	return vertexCount <= std::numeric_limits<uint16_t>::max() + size_t(1);
+}
+
+// block sizes of the shared geometry buffers, a full pool adds another block
+constexpr VkDeviceSize VERTEX_POOL_SIZE = 256 * 1024 * 1024;
+constexpr VkDeviceSize INDEX_POOL_SIZE = 128 * 1024 * 1024;
+constexpr VkDeviceSize MESHLET_POOL_SIZE = 32 * 1024 * 1024;
+// unloading a scene compacts the pools once their free space is split up this much
+constexpr float GEOMETRY_COMPACTION_THRESHOLD = 0.5f;
+
+// number of mesh nodes handed to each worker while collecting draws
+constexpr size_t DRAW_COLLECTION_CHUNK_SIZE = 256;
+
+// occluders smaller than this (bounding radius over distance) are not worth rasterizing
+constexpr float OCCLUDER_MIN_SCREEN_SIZE = 0.05f;
+// triangles rasterized into the occlusion buffer per frame, the largest occluders go first
+constexpr uint32_t OCCLUSION_TRIANGLE_BUDGET = 16384;
+
 class VulkanRenderer {
 	public:
 		void init(VulkanRendererConfig* state);
@@ -128,34 +403,77 @@ class VulkanRenderer {
 		// drawing
 		void draw();
 		void drawBackground(VkCommandBuffer commandBuffer);
-		void drawGeometry(VkCommandBuffer commandBuffer);
+		// sceneDataOffset is the dynamic offset of this frame's GPUSceneData in the upload arena
+		void drawGeometry(VkCommandBuffer commandBuffer, uint32_t sceneDataOffset);
+
+		// GPU driven path
+		void prepareIndirectDraws();
+		void cullObjects(VkCommandBuffer commandBuffer, CullPhase phase);
+		void prepareClusterObjects(std::span<const uint32_t> drawOrder);
+		void cullClusters(VkCommandBuffer commandBuffer);
+		void drawIndirectBatches(VkCommandBuffer commandBuffer, uint32_t sceneDataOffset, CullPhase phase);
+		// reduce the depth of the early pass into the min depth pyramid
+		void buildHiZ(VkCommandBuffer commandBuffer);
+		bool occlusionCullingActive() const;
 
 		void cleanup();
 
+		// last draw image copied back by a headless renderer, it lags FRAME_OVERLAP frames
+		// behind since it is only read once the frame's fence is signaled
+		const FrameReadback& latestReadback() const { return m_latestReadback; }
+
 		// Buffers
 		AllocatedBuffer createBuffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage);
 		void destroyBuffer(const AllocatedBuffer& buffer);
 
 		// Images
 		AllocatedImage createImage(VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped = false);
-		AllocatedImage createImage(void* data, VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped = false);
+		AllocatedImage createImage(const void* data, VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped = false);
+		// upload a precomputed mip chain (levels back to back, see texture_compress.h),
+		// used for block compressed textures that can't be blitted on the GPU
+		AllocatedImage createImage(std::span<const uint8_t> mipChain, VkExtent3D size, VkFormat format, uint32_t mipLevels, VkImageUsageFlags usage);
+		AllocatedImage allocateImage(VkExtent3D size, VkFormat format, VkImageUsageFlags usage, uint32_t mipLevels);
 		void destroyImage(const AllocatedImage& img);
 
-		GPUMeshBuffers uploadMesh(std::span<uint32_t> indices, std::span<Vertex> vertices);
+		GPUMeshBuffers uploadMesh(std::span<const uint32_t> indices, std::span<const Vertex> vertices, std::span<const Meshlet> meshlets = {});
+		// geometry already in its GPU form, as cooked scenes store it: vertexData holds
+		// packedVertexSize(vertexCount) bytes in VERTEX_LAYOUT, indexData indices of indexType
+		GPUMeshBuffers uploadPackedMesh(std::span<const uint8_t> vertexData, uint32_t vertexCount, std::span<const uint8_t> indexData, VkIndexType indexType, std::span<const Meshlet> meshlets = {});
+		// returns the mesh's ranges to the geometry pools, the GPU must be done with it
+		void releaseMesh(GPUMeshBuffers& mesh);
+		// packs the geometry pools and moves every mesh to its new ranges. waits for the GPU
+		void compactGeometry();
+		// waits for the GPU, drops the scene and compacts the pools when they are fragmented
+		void unloadScene(const std::string& name);
+		// vertex and index memory of every uploaded mesh, compared against the full vertex layout
+		void printMeshMemoryReport() const;
+		// bytes allocated through VMA over every memory heap
+		uint64_t gpuAllocatedBytes() const;
+		const char* deviceName() const { return m_gpuProperties.deviceName; }
+		// BC1/BC5/BC7 images can be created
+		bool supportsTextureCompressionBC() const { return m_textureCompressionBC; }
 
 		void immediateSubmit(std::function<void(VkCommandBuffer cmd)>&& function);
 		void resizeSwapchain();
 
 		VkDevice m_device;
 		VkDescriptorSetLayout m_gpuSceneDataDescriptorLayout;
+		VkDescriptorSetLayout m_objectDataDescriptorLayout;
+		// textures, samplers and constants of every material, set 1 of the mesh pipelines
+		BindlessTable m_bindless;
 		AllocatedImage m_drawImage;
 		AllocatedImage m_depthImage;
 
 		DrawContext mainDrawContext;
-		std::unordered_map<std::string, std::shared_ptr<Node>> loadedNodes;
+		std::unordered_map<std::string, MeshNode> loadedNodes;
 
 		void updateScene();
 
+		// collect the draws of a scene on worker threads, output order matches LoadedGLTF::draw
+		void collectDraws(LoadedGLTF& scene, const glm::mat4& topMatrix);
+		// fill the occlusion buffer with the largest occluders of the scene in view
+		void rasterizeOccluders(LoadedGLTF& scene, const glm::mat4& topMatrix);
+
 		// Image testing
 		AllocatedImage whiteImage;
 		AllocatedImage blackImage;
@@ -182,6 +500,29 @@ class VulkanRenderer {
 		// specific pipelines
 		void initBackgroundPipelines();
 		void initMeshPipeline();
+		void initCullPipeline();
+		void initClusterCullPipeline();
+		void initHiZPipeline();
+
+		// indices of surfaces in ascending sortKey order
+		void sortDraws(const std::vector<RenderObject>& surfaces, std::vector<uint32_t>& drawOrder);
+
+		// (re)creates the frame's upload arena and points its scene uniform set at it
+		void createUploadArena(FrameData& frame, VkDeviceSize capacity);
+		// allocation from the frame's upload arena. when it is full the allocation gets a
+		// buffer of its own for this frame and the arena grows the next time the frame is used
+		UploadAllocation allocateUpload(VkDeviceSize size, VkDeviceSize alignment);
+
+		// vkDeviceWaitIdle under m_queueMutex
+		void waitDeviceIdle();
+
+		// lowest free mesh id, ids of released meshes are handed out again
+		uint32_t allocateMeshId();
+
+		// headless replacement of the swapchain blit, copies the draw image into the frame's
+		// readback buffer every readbackInterval frames
+		void readbackDrawImage(VkCommandBuffer commandBuffer);
+		FrameReadback m_latestReadback{};
 
 		VulkanRendererConfig* m_rendererState;
 		float m_renderScale{ 1.0f };
@@ -195,12 +536,15 @@ class VulkanRenderer {
 		VkInstance m_instance;
 		VkDebugUtilsMessengerEXT m_debug_messenger;
 		VkPhysicalDevice m_chosenGPU;
-		VkSurfaceKHR m_surface;
+		VkPhysicalDeviceProperties m_gpuProperties;
+		bool m_textureCompressionBC{ false };
+		// both null when headless
+		VkSurfaceKHR m_surface{ VK_NULL_HANDLE };
 
 		// Swapchain
 		void createSwapchain(uint32_t width, uint32_t height);
 		void destroySwapchain();
-		VkSwapchainKHR m_swapchain;
+		VkSwapchainKHR m_swapchain{ VK_NULL_HANDLE };
 		VkFormat m_swapchainImageFormat;
 		std::vector<VkImage> m_swapchainImages;
 		std::vector<VkImageView> m_swapchainImageViews;
@@ -212,6 +556,35 @@ class VulkanRenderer {
 		FrameData& getCurrentFrame() { return m_frames[m_frameNumber % FRAME_OVERLAP]; };
 		VkQueue m_graphicsQueue{};
 		uint32_t m_graphicsQueueFamily{};
+		// same as the graphics queue when the device has no dedicated transfer queue
+		VkQueue m_transferQueue{};
+		uint32_t m_transferQueueFamily{};
+		// held for every submit, present and device wait. the upload manager submits to both
+		// queues from loader threads
+		std::mutex m_queueMutex;
+
+		// Uploads
+		UploadManager m_uploads;
+		GpuProfiler m_profiler;
+		// vertices, indices and meshlets of every mesh
+		GeometryPool m_vertexPool;
+		GeometryPool m_indexPool;
+		GeometryPool m_meshletPool;
+
+		// totals over every resident mesh, meshes are uploaded from loader threads
+		struct MeshMemoryStats {
+				std::atomic<uint64_t> vertexCount{ 0 };
+				std::atomic<uint64_t> vertexBytes{ 0 };
+				std::atomic<uint64_t> indexBytes{ 0 };
+				std::atomic<uint64_t> meshletBytes{ 0 };
+				std::atomic<uint64_t> meshCount{ 0 };
+				std::atomic<uint64_t> uint16MeshCount{ 0 };
+		} m_meshMemory;
+		// unique among resident meshes. released ids are reused so that they stay within the
+		// mesh field of the draw sort keys, meshes are uploaded from loader threads
+		std::mutex m_meshIdMutex;
+		std::vector<uint32_t> m_freeMeshIds;
+		uint32_t m_nextMeshId{ 0 };
 
 		// Allocator
 		VmaAllocator m_allocator;
@@ -231,6 +604,58 @@ class VulkanRenderer {
 		VkPipeline m_gradientPipeline;
 		VkPipelineLayout m_gradientPipelineLayout;
 
+		// GPU driven culling
+		VkDescriptorSetLayout m_cullDescriptorLayout;
+		VkPipeline m_cullPipeline;
+		VkPipelineLayout m_cullPipelineLayout;
+		std::vector<IndirectBatch> m_indirectBatches;
+		uint32_t m_indirectObjectCount{ 0 };
+		// object data of the current frame, lives in the frame upload arena
+		UploadAllocation m_indirectObjects{};
+		// per object id visibility written by the late pass, it decides what the early pass
+		// draws. shared by all frames in flight, each early pass reads what the last late
+		// pass wrote
+		AllocatedBuffer m_visibilityBuffer{};
+		uint32_t m_visibilityCapacity{ 0 };
+		// object ids handed out by the last updateScene
+		uint32_t m_objectIdCount{ 0 };
+		// set when the ids map to different objects, the next early pass then draws everything
+		bool m_visibilityReset{ true };
+
+		// cluster culling
+		VkDescriptorSetLayout m_clusterCullDescriptorLayout;
+		VkPipeline m_clusterCullPipeline;
+		VkPipelineLayout m_clusterCullPipelineLayout;
+		UploadAllocation m_clusterObjects{};
+		// sum of the index counts of every object, the worst case of the compacted buffer
+		VkDeviceSize m_clusterIndexCount{ 0 };
+
+		// occlusion culling: min depth pyramid of the visible part of the depth image, power of
+		// two sized so every level halves exactly. the full view is read by cull.comp, the per
+		// level views by hiz_reduce.comp
+		AllocatedImage m_hizImage;
+		uint32_t m_hizLevels{ 0 };
+		std::vector<VkImageView> m_hizLevelViews;
+		VkSampler m_hizSampler;
+		VkDescriptorSetLayout m_hizReduceDescriptorLayout;
+		// one set per level, level 0 reads the depth image and level i reads level i - 1
+		std::vector<VkDescriptorSet> m_hizReduceSets;
+		VkPipeline m_hizReducePipeline;
+		VkPipelineLayout m_hizReducePipelineLayout;
+		UploadAllocation m_occlusionData{};
+
+		// per chunk draw lists reused by collectDraws
+		std::vector<DrawContext> m_drawChunks;
+
+		// scratch of sortDraws
+		DrawKeySorter m_drawSorter;
+		std::vector<uint64_t> m_drawKeys;
+
+		// camera frustum for the current frame
+		Frustum m_frustum{};
+		LodSelection m_lodSelection{};
+		OcclusionBuffer m_occlusionBuffer;
+
 		// Loaded meshes from GLTF file
 		GPUMeshBuffers rectangle;
 		std::vector<std::shared_ptr<MeshAsset>> m_testMeshes;
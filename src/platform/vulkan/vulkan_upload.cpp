@@ -0,0 +1,418 @@
+#include <algorithm>
+#include <cstring>
+
+#include "trace.h"
+#include "vulkan_images.h"
+#include "vulkan_structures_helpers.h"
+#include "vulkan_upload.h"
+
+namespace pm {
+
+namespace {
+
+constexpr VkDeviceSize STAGING_ALIGNMENT = 16;
+
+VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+void pipelineBarrier(VkCommandBuffer cmd, const VkBufferMemoryBarrier2* bufferBarrier, const VkImageMemoryBarrier2* imageBarrier) {
+	VkDependencyInfo depInfo{ .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+	depInfo.bufferMemoryBarrierCount = bufferBarrier == nullptr ? 0 : 1;
+	depInfo.pBufferMemoryBarriers = bufferBarrier;
+	depInfo.imageMemoryBarrierCount = imageBarrier == nullptr ? 0 : 1;
+	depInfo.pImageMemoryBarriers = imageBarrier;
+
+	vkCmdPipelineBarrier2(cmd, &depInfo);
+}
+
+}// namespace
+
+void UploadManager::init(VkDevice device, VmaAllocator allocator, VkQueue graphicsQueue, uint32_t graphicsFamily, VkQueue transferQueue, uint32_t transferFamily, std::mutex& queueMutex) {
+	m_device = device;
+	m_allocator = allocator;
+	m_graphicsQueue = graphicsQueue;
+	m_graphicsFamily = graphicsFamily;
+	m_transferQueue = transferQueue;
+	m_transferFamily = transferFamily;
+	m_queueMutex = &queueMutex;
+
+	VkSemaphoreTypeCreateInfo timelineInfo{ .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO };
+	timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	timelineInfo.initialValue = 0;
+
+	VkSemaphoreCreateInfo semaphoreInfo = semaphoreCreateInfo();
+	semaphoreInfo.pNext = &timelineInfo;
+
+	VK_CHECK(vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &m_timeline));
+	VK_CHECK(vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &m_transferTimeline));
+
+	for (auto& batch : m_batches) {
+		auto transferPoolInfo = commandPoolCreateInfo(m_transferFamily, 0);
+		VK_CHECK(vkCreateCommandPool(m_device, &transferPoolInfo, nullptr, &batch.transferPool));
+		auto transferAllocateInfo = commandBufferAllocateInfo(batch.transferPool, 1);
+		VK_CHECK(vkAllocateCommandBuffers(m_device, &transferAllocateInfo, &batch.transferCmd));
+
+		if (hasDedicatedTransferQueue()) {
+			auto graphicsPoolInfo = commandPoolCreateInfo(m_graphicsFamily, 0);
+			VK_CHECK(vkCreateCommandPool(m_device, &graphicsPoolInfo, nullptr, &batch.graphicsPool));
+			auto graphicsAllocateInfo = commandBufferAllocateInfo(batch.graphicsPool, 1);
+			VK_CHECK(vkAllocateCommandBuffers(m_device, &graphicsAllocateInfo, &batch.graphicsCmd));
+		}
+
+		batch.ticket = 0;
+		batch.stagingEnd = 0;
+	}
+
+	m_staging = createStagingBuffer(UPLOAD_STAGING_SIZE);
+}
+
+void UploadManager::cleanup() {
+	waitIdle();
+
+	for (auto& batch : m_batches) {
+		vkDestroyCommandPool(m_device, batch.transferPool, nullptr);
+		if (hasDedicatedTransferQueue()) {
+			vkDestroyCommandPool(m_device, batch.graphicsPool, nullptr);
+		}
+	}
+
+	vmaDestroyBuffer(m_allocator, m_staging.buffer, m_staging.allocation);
+
+	vkDestroySemaphore(m_device, m_timeline, nullptr);
+	vkDestroySemaphore(m_device, m_transferTimeline, nullptr);
+}
+
+UploadTicket UploadManager::uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size) {
+	std::scoped_lock lock{ m_mutex };
+
+	// zero sized copies are invalid, an empty index list is fine
+	if (size == 0) {
+		return m_lastSubmitted;
+	}
+
+	StagingAllocation staging = allocateStaging(size);
+	memcpy(staging.data, data, size);
+
+	UploadBatch& batch = recordingBatch();
+
+	VkBufferCopy copy{};
+	copy.srcOffset = staging.offset;
+	copy.dstOffset = dstOffset;
+	copy.size = size;
+	vkCmdCopyBuffer(batch.transferCmd, staging.buffer, dst, 1, &copy);
+
+	// on a single queue the timeline signal already makes the copy visible to waiters
+	if (hasDedicatedTransferQueue()) {
+		VkBufferMemoryBarrier2 release{ .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2 };
+		release.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+		release.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+		release.srcQueueFamilyIndex = m_transferFamily;
+		release.dstQueueFamilyIndex = m_graphicsFamily;
+		release.buffer = dst;
+		release.offset = dstOffset;
+		release.size = size;
+
+		VkBufferMemoryBarrier2 acquire = release;
+		acquire.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+		acquire.srcAccessMask = VK_ACCESS_2_NONE;
+		acquire.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+		acquire.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT;
+
+		pipelineBarrier(batch.transferCmd, &release, nullptr);
+		pipelineBarrier(batch.graphicsCmd, &acquire, nullptr);
+	}
+
+	// batches are submitted in order, so the recording one gets the next ticket
+	return m_lastSubmitted + 1;
+}
+
+UploadTicket UploadManager::uploadImage(VkImage image, VkExtent3D extent, const void* data, VkDeviceSize size) {
+	VkBufferImageCopy copyRegion = {};
+	copyRegion.bufferOffset = 0;
+	copyRegion.bufferRowLength = 0;
+	copyRegion.bufferImageHeight = 0;
+
+	copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	copyRegion.imageSubresource.mipLevel = 0;
+	copyRegion.imageSubresource.baseArrayLayer = 0;
+	copyRegion.imageSubresource.layerCount = 1;
+	copyRegion.imageExtent = extent;
+
+	return uploadImage(image, std::span{ &copyRegion, 1 }, data, size);
+}
+
+UploadTicket UploadManager::uploadImage(VkImage image, std::span<const VkBufferImageCopy> regions, const void* data, VkDeviceSize size) {
+	return recordImageUpload(image, regions, data, size, VkExtent2D{}, 1);
+}
+
+UploadTicket UploadManager::uploadImageMipmapped(VkImage image, VkExtent3D extent, uint32_t mipLevels, const void* data, VkDeviceSize size) {
+	VkBufferImageCopy copyRegion = {};
+	copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	copyRegion.imageSubresource.mipLevel = 0;
+	copyRegion.imageSubresource.baseArrayLayer = 0;
+	copyRegion.imageSubresource.layerCount = 1;
+	copyRegion.imageExtent = extent;
+
+	return recordImageUpload(image, std::span{ &copyRegion, 1 }, data, size, VkExtent2D{ extent.width, extent.height }, mipLevels);
+}
+
+UploadTicket UploadManager::recordImageUpload(VkImage image, std::span<const VkBufferImageCopy> regions, const void* data, VkDeviceSize size, VkExtent2D blitExtent, uint32_t blitMipLevels) {
+	std::scoped_lock lock{ m_mutex };
+
+	StagingAllocation staging = allocateStaging(size);
+	memcpy(staging.data, data, size);
+
+	UploadBatch& batch = recordingBatch();
+
+	VkImageMemoryBarrier2 toTransfer{ .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+	toTransfer.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+	toTransfer.srcAccessMask = VK_ACCESS_2_NONE;
+	toTransfer.dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+	toTransfer.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+	toTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	toTransfer.image = image;
+	toTransfer.subresourceRange = imageSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT);
+	pipelineBarrier(batch.transferCmd, nullptr, &toTransfer);
+
+	std::vector<VkBufferImageCopy> copyRegions(regions.begin(), regions.end());
+	for (VkBufferImageCopy& region : copyRegions) {
+		region.bufferOffset += staging.offset;
+	}
+
+	vkCmdCopyBufferToImage(batch.transferCmd, staging.buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(copyRegions.size()), copyRegions.data());
+
+	// blits need a graphics queue, so an image with mips to generate stays a transfer
+	// destination until it reaches one
+	const bool generateMips = blitMipLevels > 1;
+
+	VkImageMemoryBarrier2 afterCopy = toTransfer;
+	afterCopy.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+	afterCopy.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+	afterCopy.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	if (generateMips) {
+		afterCopy.dstStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+		afterCopy.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT;
+		afterCopy.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	} else {
+		afterCopy.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+		afterCopy.dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+		afterCopy.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	}
+
+	if (hasDedicatedTransferQueue()) {
+		// the layout transition happens once, between the release and the acquire
+		VkImageMemoryBarrier2 release = afterCopy;
+		release.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+		release.dstAccessMask = VK_ACCESS_2_NONE;
+		release.srcQueueFamilyIndex = m_transferFamily;
+		release.dstQueueFamilyIndex = m_graphicsFamily;
+
+		VkImageMemoryBarrier2 acquire = afterCopy;
+		acquire.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+		acquire.srcAccessMask = VK_ACCESS_2_NONE;
+		acquire.srcQueueFamilyIndex = m_transferFamily;
+		acquire.dstQueueFamilyIndex = m_graphicsFamily;
+
+		pipelineBarrier(batch.transferCmd, nullptr, &release);
+		pipelineBarrier(batch.graphicsCmd, nullptr, &acquire);
+	} else {
+		pipelineBarrier(batch.transferCmd, nullptr, &afterCopy);
+	}
+
+	if (generateMips) {
+		generateMipmaps(hasDedicatedTransferQueue() ? batch.graphicsCmd : batch.transferCmd, image, blitExtent, blitMipLevels);
+	}
+
+	return m_lastSubmitted + 1;
+}
+
+UploadTicket UploadManager::flush() {
+	PM_TRACE_ZONE("UploadManager::flush");
+	std::scoped_lock lock{ m_mutex };
+
+	if (m_recording) {
+		submitRecording();
+	}
+	return m_lastSubmitted;
+}
+
+bool UploadManager::isComplete(UploadTicket ticket) const {
+	uint64_t value{};
+	VK_CHECK(vkGetSemaphoreCounterValue(m_device, m_timeline, &value));
+	return value >= ticket;
+}
+
+void UploadManager::wait(UploadTicket ticket) const {
+	VkSemaphoreWaitInfo waitInfo{ .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO };
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &m_timeline;
+	waitInfo.pValues = &ticket;
+
+	VK_CHECK(vkWaitSemaphores(m_device, &waitInfo, UINT64_MAX));
+}
+
+void UploadManager::waitIdle() {
+	std::scoped_lock lock{ m_mutex };
+
+	if (m_recording) {
+		submitRecording();
+	}
+	wait(m_lastSubmitted);
+
+	for (auto& batch : m_batches) {
+		if (batch.ticket != 0) {
+			retireBatch(batch);
+		}
+	}
+}
+
+UploadManager::UploadBatch& UploadManager::recordingBatch() {
+	UploadBatch& batch = m_batches[m_currentBatch];
+	if (m_recording) {
+		return batch;
+	}
+
+	// batches are reused round robin, this one may still be in flight
+	if (batch.ticket != 0) {
+		wait(batch.ticket);
+		retireBatch(batch);
+	}
+
+	auto beginInfo = commandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+
+	VK_CHECK(vkResetCommandPool(m_device, batch.transferPool, 0));
+	VK_CHECK(vkBeginCommandBuffer(batch.transferCmd, &beginInfo));
+
+	if (hasDedicatedTransferQueue()) {
+		VK_CHECK(vkResetCommandPool(m_device, batch.graphicsPool, 0));
+		VK_CHECK(vkBeginCommandBuffer(batch.graphicsCmd, &beginInfo));
+	}
+
+	m_recording = true;
+	return batch;
+}
+
+UploadManager::StagingAllocation UploadManager::allocateStaging(VkDeviceSize size) {
+	if (size > UPLOAD_STAGING_SIZE) {
+		AllocatedBuffer buffer = createStagingBuffer(size);
+		recordingBatch().dedicatedStaging.push_back(buffer);
+		return StagingAllocation{ .buffer = buffer.buffer, .offset = 0, .data = buffer.info.pMappedData };
+	}
+
+	while (true) {
+		VkDeviceSize start = alignUp(m_stagingHead, STAGING_ALIGNMENT);
+
+		// allocations never wrap around the end of the ring
+		if (start % UPLOAD_STAGING_SIZE + size > UPLOAD_STAGING_SIZE) {
+			start = alignUp(start, UPLOAD_STAGING_SIZE);
+		}
+
+		if (start + size - m_stagingTail <= UPLOAD_STAGING_SIZE) {
+			m_stagingHead = start + size;
+
+			const VkDeviceSize offset = start % UPLOAD_STAGING_SIZE;
+			return StagingAllocation{ .buffer = m_staging.buffer, .offset = offset, .data = static_cast<uint8_t*>(m_staging.info.pMappedData) + offset };
+		}
+
+		// the ring is full, submit what we have and wait for the oldest batch
+		if (m_recording) {
+			submitRecording();
+		}
+
+		UploadBatch* oldest = nullptr;
+		for (auto& batch : m_batches) {
+			if (batch.ticket != 0 && (oldest == nullptr || batch.ticket < oldest->ticket)) {
+				oldest = &batch;
+			}
+		}
+
+		if (oldest == nullptr) {
+			// nothing in flight references the ring anymore
+			m_stagingHead = 0;
+			m_stagingTail = 0;
+			continue;
+		}
+
+		wait(oldest->ticket);
+		retireBatch(*oldest);
+	}
+}
+
+UploadTicket UploadManager::submitRecording() {
+	UploadBatch& batch = m_batches[m_currentBatch];
+
+	const UploadTicket ticket = m_lastSubmitted + 1;
+	batch.ticket = ticket;
+	batch.stagingEnd = m_stagingHead;
+
+	VK_CHECK(vkEndCommandBuffer(batch.transferCmd));
+	VkCommandBufferSubmitInfo transferCmdInfo = commandBufferSubmitInfo(batch.transferCmd);
+
+	// loader threads get here too, the render thread submits to the same queues
+	std::lock_guard<std::mutex> queueLock(*m_queueMutex);
+
+	if (!hasDedicatedTransferQueue()) {
+		VkSemaphoreSubmitInfo signalInfo = semaphoreSubmitInfo(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, m_timeline);
+		signalInfo.value = ticket;
+
+		VkSubmitInfo2 submit = submitInfo(&transferCmdInfo, &signalInfo, nullptr);
+		VK_CHECK(vkQueueSubmit2(m_transferQueue, 1, &submit, VK_NULL_HANDLE));
+	} else {
+		// copy on the transfer queue, then acquire ownership on the graphics queue
+		VkSemaphoreSubmitInfo transferSignalInfo = semaphoreSubmitInfo(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, m_transferTimeline);
+		transferSignalInfo.value = ticket;
+
+		VkSubmitInfo2 transferSubmit = submitInfo(&transferCmdInfo, &transferSignalInfo, nullptr);
+		VK_CHECK(vkQueueSubmit2(m_transferQueue, 1, &transferSubmit, VK_NULL_HANDLE));
+
+		VK_CHECK(vkEndCommandBuffer(batch.graphicsCmd));
+		VkCommandBufferSubmitInfo graphicsCmdInfo = commandBufferSubmitInfo(batch.graphicsCmd);
+
+		VkSemaphoreSubmitInfo waitInfo = semaphoreSubmitInfo(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, m_transferTimeline);
+		waitInfo.value = ticket;
+		VkSemaphoreSubmitInfo signalInfo = semaphoreSubmitInfo(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, m_timeline);
+		signalInfo.value = ticket;
+
+		VkSubmitInfo2 graphicsSubmit = submitInfo(&graphicsCmdInfo, &signalInfo, &waitInfo);
+		VK_CHECK(vkQueueSubmit2(m_graphicsQueue, 1, &graphicsSubmit, VK_NULL_HANDLE));
+	}
+
+	m_lastSubmitted = ticket;
+	m_currentBatch = (m_currentBatch + 1) % UPLOAD_BATCH_COUNT;
+	m_recording = false;
+
+	return ticket;
+}
+
+void UploadManager::retireBatch(UploadBatch& batch) {
+	// staging memory is handed out in submission order, everything before this
+	// batch's end is free once it completed
+	m_stagingTail = std::max(m_stagingTail, batch.stagingEnd);
+
+	for (auto& buffer : batch.dedicatedStaging) {
+		vmaDestroyBuffer(m_allocator, buffer.buffer, buffer.allocation);
+	}
+	batch.dedicatedStaging.clear();
+	batch.ticket = 0;
+}
+
+AllocatedBuffer UploadManager::createStagingBuffer(VkDeviceSize size) {
+	VkBufferCreateInfo bufferInfo = { .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+	bufferInfo.size = size;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+	VmaAllocationCreateInfo vmaallocInfo = {};
+	vmaallocInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+	vmaallocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+	AllocatedBuffer newBuffer{};
+	VK_CHECK(vmaCreateBuffer(m_allocator, &bufferInfo, &vmaallocInfo, &newBuffer.buffer, &newBuffer.allocation, &newBuffer.info));
+
+	return newBuffer;
+}
+
+}// namespace pm
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <mutex>
+
+#include "vk_types.h"
+
+namespace pm {
+
+// number of upload batches that can be in flight at the same time
+constexpr uint32_t UPLOAD_BATCH_COUNT = 4;
+
+// size of the staging ring shared by every upload batch
+constexpr VkDeviceSize UPLOAD_STAGING_SIZE = 64 * 1024 * 1024;
+
+// Batches buffer and image uploads into a single command buffer per batch and submits
+// them on the transfer queue (or the graphics queue when there is no dedicated one).
+// Completion is tracked with a timeline semaphore: every upload returns the
+// timeline value of the batch carrying it, so callers can poll or wait instead of
+// stalling the whole queue for each resource.
+//
+// With a dedicated transfer queue, ownership of the written resources is released on
+// the transfer queue and acquired on the graphics queue as part of the same ticket.
+// A full staging ring submits from inside the upload call, on whatever thread made it.
+// Every submission to the queues takes queueMutex, which the renderer shares for its own
+// submits, presents and device waits.
+class UploadManager {
+	public:
+		void init(VkDevice device, VmaAllocator allocator, VkQueue graphicsQueue, uint32_t graphicsFamily, VkQueue transferQueue, uint32_t transferFamily, std::mutex& queueMutex);
+		void cleanup();
+
+		// copy data into dst at dstOffset. data is copied into staging memory right away
+		UploadTicket uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size);
+
+		// copy tightly packed texels into mip 0 of image. the image ends up in
+		// VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+		UploadTicket uploadImage(VkImage image, VkExtent3D extent, const void* data, VkDeviceSize size);
+
+		// copy several regions (usually one per mip level) of data into image. region
+		// buffer offsets are relative to data. same layout transitions as above
+		UploadTicket uploadImage(VkImage image, std::span<const VkBufferImageCopy> regions, const void* data, VkDeviceSize size);
+
+		// copy texels into mip 0, then fill levels [1, mipLevels) with a blit chain on the
+		// graphics queue. the format must support linear blits
+		UploadTicket uploadImageMipmapped(VkImage image, VkExtent3D extent, uint32_t mipLevels, const void* data, VkDeviceSize size);
+
+		// submit the batch being recorded, if any. returns the last submitted ticket
+		UploadTicket flush();
+
+		bool isComplete(UploadTicket ticket) const;
+		void wait(UploadTicket ticket) const;
+		void waitIdle();
+
+		// signaled with the ticket values, graphics submissions can wait on it instead of the CPU
+		VkSemaphore timeline() const { return m_timeline; }
+		UploadTicket lastSubmitted() const { return m_lastSubmitted; }
+		bool hasDedicatedTransferQueue() const { return m_transferFamily != m_graphicsFamily; }
+
+	private:
+		struct UploadBatch {
+				VkCommandPool transferPool;
+				VkCommandBuffer transferCmd;
+				// ownership acquire on the graphics queue, only used with a dedicated transfer queue
+				VkCommandPool graphicsPool;
+				VkCommandBuffer graphicsCmd;
+
+				// ticket of the submission, 0 while the batch is free or recording
+				UploadTicket ticket;
+				// staging ring position after the last allocation of this batch
+				VkDeviceSize stagingEnd;
+				// uploads larger than the whole ring get their own staging buffer
+				std::vector<AllocatedBuffer> dedicatedStaging;
+		};
+
+		struct StagingAllocation {
+				VkBuffer buffer;
+				VkDeviceSize offset;
+				void* data;
+		};
+
+		UploadTicket recordImageUpload(VkImage image, std::span<const VkBufferImageCopy> regions, const void* data, VkDeviceSize size, VkExtent2D blitExtent, uint32_t blitMipLevels);
+		UploadBatch& recordingBatch();
+		StagingAllocation allocateStaging(VkDeviceSize size);
+		UploadTicket submitRecording();
+		void retireBatch(UploadBatch& batch);
+		AllocatedBuffer createStagingBuffer(VkDeviceSize size);
+
+		VkDevice m_device{ VK_NULL_HANDLE };
+		VmaAllocator m_allocator{ VK_NULL_HANDLE };
+
+		VkQueue m_graphicsQueue{ VK_NULL_HANDLE };
+		uint32_t m_graphicsFamily{ 0 };
+		VkQueue m_transferQueue{ VK_NULL_HANDLE };
+		uint32_t m_transferFamily{ 0 };
+		// owned by the renderer, guards both queues
+		std::mutex* m_queueMutex{ nullptr };
+
+		// m_timeline is signaled once a batch is usable on the graphics queue,
+		// m_transferTimeline only orders the transfer and acquire submissions
+		VkSemaphore m_timeline{ VK_NULL_HANDLE };
+		VkSemaphore m_transferTimeline{ VK_NULL_HANDLE };
+		UploadTicket m_lastSubmitted{ 0 };
+
+		std::array<UploadBatch, UPLOAD_BATCH_COUNT> m_batches{};
+		uint32_t m_currentBatch{ 0 };
+		bool m_recording{ false };
+
+		// ring positions grow monotonically, offsets in the buffer are taken modulo the size
+		AllocatedBuffer m_staging{};
+		VkDeviceSize m_stagingHead{ 0 };
+		VkDeviceSize m_stagingTail{ 0 };
+
+		// uploads can be issued from loader worker threads
+		std::mutex m_mutex;
+};
+
+}// namespace pm
@@ -0,0 +1,27 @@
+#include "vulkan_upload_arena.h"
+
+namespace pm {
+
+void UploadArena::init(const AllocatedBuffer& buffer, VkDeviceSize capacity, VkDeviceAddress deviceAddress) {
+	m_buffer = buffer;
+	m_mapped = static_cast<uint8_t*>(buffer.info.pMappedData);
+	m_address = deviceAddress;
+	m_capacity = capacity;
+	m_head = 0;
+}
+
+void UploadArena::reset() {
+	m_head = 0;
+}
+
+UploadAllocation UploadArena::allocate(VkDeviceSize size, VkDeviceSize alignment) {
+	const VkDeviceSize offset = (m_head + alignment - 1) & ~(alignment - 1);
+	if (offset + size > m_capacity) {
+		return UploadAllocation{ .data = nullptr, .buffer = m_buffer.buffer, .offset = 0, .address = 0 };
+	}
+
+	m_head = offset + size;
+	return UploadAllocation{ .data = m_mapped + offset, .buffer = m_buffer.buffer, .offset = static_cast<uint32_t>(offset), .address = m_address != 0 ? m_address + offset : 0 };
+}
+
+}// namespace pm
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "vk_types.h"
+
+namespace pm {
+
+struct UploadAllocation {
+		// nullptr when the arena ran out of space
+		void* data;
+		VkBuffer buffer;
+		uint32_t offset;
+		// device address of data, 0 when the arena has none
+		VkDeviceAddress address;
+};
+
+// Linear allocator over a persistently mapped buffer.
+// Every allocation stays valid until reset(), which the owner calls once the GPU
+// has finished with the frame that used it (after the frame fence is signaled).
+class UploadArena {
+	public:
+		// buffer must be host visible and created with VMA_ALLOCATION_CREATE_MAPPED_BIT.
+		// deviceAddress is the address of the buffer when it can be used as a buffer reference
+		void init(const AllocatedBuffer& buffer, VkDeviceSize capacity, VkDeviceAddress deviceAddress = 0);
+		void reset();
+
+		// alignment must be a power of two
+		UploadAllocation allocate(VkDeviceSize size, VkDeviceSize alignment);
+
+		template<typename T>
+		UploadAllocation push(const T& value, VkDeviceSize alignment) {
+			UploadAllocation allocation = allocate(sizeof(T), alignment);
+			if (allocation.data != nullptr) {
+				*static_cast<T*>(allocation.data) = value;
+			}
+			return allocation;
+		}
+
+		const AllocatedBuffer& buffer() const { return m_buffer; }
+		VkDeviceSize capacity() const { return m_capacity; }
+		VkDeviceSize used() const { return m_head; }
+
+	private:
+		AllocatedBuffer m_buffer{};
+		uint8_t* m_mapped{ nullptr };
+		VkDeviceAddress m_address{ 0 };
+		VkDeviceSize m_capacity{ 0 };
+		VkDeviceSize m_head{ 0 };
+};
+
+}// namespace pm
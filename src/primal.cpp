@@ -1,33 +1,94 @@
+#include <algorithm>
 #include <chrono>
+#include <fstream>
 #include <thread>
 
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_vulkan.h>
 
+#include <glm/gtc/packing.hpp>
+
+#include "benchmark.h"
 #include "primal.h"
+#include "trace.h"
 
 constexpr bool bUseValidationLayers = true;
+// the stats line is printed this often instead of every frame, printing it is not free
+constexpr auto STATS_PRINT_INTERVAL = std::chrono::seconds(1);
+constexpr const char* TRACE_FILE = "trace.json";
+// written by the camera recording, replayed with --camera-path
+constexpr const char* CAMERA_PATH_FILE = "camera_path.txt";
+// seconds between recorded keys, the spline fills in the frames between them
+constexpr float CAMERA_PATH_KEY_INTERVAL = 0.1f;
+// the scripted benchmark path circles the origin at about the distance the renderer
+// places the camera at
+constexpr glm::vec3 BENCHMARK_ORBIT_CENTER{ 0.f };
+constexpr float BENCHMARK_ORBIT_RADIUS = 90.f;
+constexpr float BENCHMARK_ORBIT_HEIGHT = 10.f;
 
 namespace pm {
 
+namespace {
+
+// 8 bit RGB like the swapchain blit, the draw image is linear RGBA16F
+bool writeScreenshot(const std::string& path, const FrameReadback& readback) {
+	std::ofstream file(path, std::ios::binary);
+	if (!file.is_open()) {
+		std::cout << std::format("Failed to write screenshot {}\n", path);
+		return false;
+	}
+
+	const size_t texelCount = static_cast<size_t>(readback.extent.width) * readback.extent.height;
+	std::vector<uint8_t> rgb(texelCount * 3);
+	for (size_t i = 0; i < texelCount; i++) {
+		for (size_t c = 0; c < 3; c++) {
+			const float value = glm::clamp(glm::unpackHalf1x16(readback.pixels[i * 4 + c]), 0.f, 1.f);
+			rgb[i * 3 + c] = static_cast<uint8_t>(value * 255.f + 0.5f);
+		}
+	}
+
+	file << std::format("P6\n{} {}\n255\n", readback.extent.width, readback.extent.height);
+	file.write(reinterpret_cast<const char*>(rgb.data()), static_cast<std::streamsize>(rgb.size()));
+	std::cout << std::format("Wrote frame {} to {}\n", readback.frameNumber, path);
+	return true;
+}
+
+const char* renderPathName(RenderPath path) {
+	switch (path) {
+		case RenderPath::Classic:
+			return "Classic";
+		case RenderPath::GPUDriven:
+			return "GPUDriven";
+		case RenderPath::Clusters:
+			return "Clusters";
+	}
+	return "Unknown";
+}
+
+}// namespace
+
 PrimalApp* loadedEngine = nullptr;
 
 PrimalApp& PrimalApp::get() { return *loadedEngine; }
 
-void PrimalApp::init() {
+void PrimalApp::init(const PrimalAppConfig& config) {
 	assert(loadedEngine == nullptr);
 	loadedEngine = this;
+	m_config = config;
+	m_windowExtent = config.extent;
 
-	SDL_Init(SDL_INIT_VIDEO);
+	if (!m_config.headless) {
+		SDL_Init(SDL_INIT_VIDEO);
 
-	auto window_flags = static_cast<SDL_WindowFlags>(SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
-	SDL_SetRelativeMouseMode(SDL_TRUE);
+		auto window_flags = static_cast<SDL_WindowFlags>(SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
+		SDL_SetRelativeMouseMode(SDL_TRUE);
 
-	m_window = SDL_CreateWindow(
-		"Vulkan Engine",
-		static_cast<int32_t>(m_windowExtent.width),
-		static_cast<int32_t>(m_windowExtent.height),
-		window_flags);
+		m_window = SDL_CreateWindow(
+			"Vulkan Engine",
+			static_cast<int32_t>(m_windowExtent.width),
+			static_cast<int32_t>(m_windowExtent.height),
+			window_flags);
+	}
 
 	m_mainCamera = new Camera();
 	m_mainCamera->velocity = glm::vec3(0.f);
@@ -37,10 +98,14 @@ void PrimalApp::init() {
 	m_mainCamera->yaw = 0;
 
 	m_rendererState = {
-		.useValidationLayers = true,
+		.useValidationLayers = bUseValidationLayers,
 		.windowExtent = m_windowExtent,
 		.window = m_window,
-		.mainCamera = m_mainCamera
+		.mainCamera = m_mainCamera,
+		.headless = m_config.headless,
+		.preferSoftwareDevice = m_config.softwareDevice,
+		// the screenshot needs at least the last frames read back
+		.readbackInterval = m_config.screenshotPath.empty() ? m_config.readbackInterval : std::max(m_config.readbackInterval, 1u)
 	};
 
 	m_renderer.init(&m_rendererState);
@@ -51,16 +116,30 @@ void PrimalApp::init() {
 void PrimalApp::cleanup() {
 	if (m_isInitialized) {
 		m_renderer.cleanup();
-		SDL_DestroyWindow(m_window);
+		if (m_window != nullptr) {
+			SDL_DestroyWindow(m_window);
+		}
 	}
 	loadedEngine = nullptr;
 }
 
 void PrimalApp::run() {
+	if (!m_config.benchmarkReportPath.empty()) {
+		runBenchmark();
+		return;
+	}
+	if (m_config.headless) {
+		runHeadless();
+		return;
+	}
+
 	SDL_Event e;
 	bool bQuit = false;
+	auto lastStatsPrint = std::chrono::system_clock::now();
+	PM_TRACE_THREAD_NAME("Main");
 
 	while (!bQuit) {
+		PM_TRACE_ZONE("frame");
 		auto start = std::chrono::system_clock::now();
 
 		while (SDL_PollEvent(&e) != 0) {
@@ -74,6 +153,40 @@ void PrimalApp::run() {
 				m_stopRendering = false;
 			}
 
+			// debug toggle for the Hi-Z occlusion culling of the GPU driven path
+			if (e.type == SDL_EVENT_KEY_DOWN && e.key.keysym.sym == SDLK_o) {
+				m_rendererState.occlusionCulling = !m_rendererState.occlusionCulling;
+				std::cout << std::format("Occlusion culling {}\n", m_rendererState.occlusionCulling ? "on" : "off");
+			}
+
+			// starts a trace capture, the next press stops it and writes TRACE_FILE
+			if (e.type == SDL_EVENT_KEY_DOWN && e.key.keysym.sym == SDLK_t) {
+				if (!PM_TRACING) {
+					std::cout << "Tracing is compiled out, configure with -DENABLE_TRACING=ON\n";
+				} else if (!traceCapturing()) {
+					beginTraceCapture();
+					std::cout << "Trace capture started\n";
+				} else {
+					endTraceCapture();
+					exportChromeTrace(TRACE_FILE);
+				}
+			}
+
+			// records the camera until the next press and writes CAMERA_PATH_FILE, replayed by --camera-path
+			if (e.type == SDL_EVENT_KEY_DOWN && e.key.keysym.sym == SDLK_r) {
+				if (!m_recordingPath) {
+					m_recordedPath.clear();
+					m_recordStart = std::chrono::steady_clock::now();
+					m_recordingPath = true;
+					std::cout << "Camera path recording started\n";
+				} else {
+					m_recordingPath = false;
+					if (m_recordedPath.save(CAMERA_PATH_FILE)) {
+						std::cout << std::format("Wrote {} camera keys over {:.1f}s to {}\n", m_recordedPath.keyCount(), m_recordedPath.duration(), CAMERA_PATH_FILE);
+					}
+				}
+			}
+
 			m_mainCamera->processSDLEvent(e);
 		}
 
@@ -90,25 +203,180 @@ void PrimalApp::run() {
 
 		draw();
 
+		if (m_recordingPath) {
+			const float time = std::chrono::duration<float>(std::chrono::steady_clock::now() - m_recordStart).count();
+			if (m_recordedPath.empty() || time - m_recordedPath.duration() >= CAMERA_PATH_KEY_INTERVAL) {
+				m_recordedPath.addKey(CameraKey{ .time = time, .position = m_mainCamera->position, .pitch = m_mainCamera->pitch, .yaw = m_mainCamera->yaw });
+			}
+		}
+
 		auto end = std::chrono::system_clock::now();
 		auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
 		m_rendererState.rendererStats.frametime = elapsed.count() / 1000.0f;
 
-		auto stats = std::format("Frametime: {}us | Update: {}us | MeshDraw: {}us | Triangles: {} | DrawCall: {}",
-			m_rendererState.rendererStats.frametime,
-			m_rendererState.rendererStats.sceneUpdateTime,
-			m_rendererState.rendererStats.meshDrawTime,
-			m_rendererState.rendererStats.triangleCount,
-			m_rendererState.rendererStats.drawCallCount);
-		std::cout << stats << '\n';
+		if (end - lastStatsPrint < STATS_PRINT_INTERVAL) {
+			continue;
+		}
+		lastStatsPrint = end;
+
+		printStats();
+	}
+}
+
+// draws frameCount frames as fast as the device allows, there are no events to handle
+void PrimalApp::runHeadless() {
+	auto lastStatsPrint = std::chrono::system_clock::now();
+	PM_TRACE_THREAD_NAME("Main");
+
+	for (uint32_t frame = 0; frame < m_config.frameCount; frame++) {
+		PM_TRACE_ZONE("frame");
+		auto start = std::chrono::system_clock::now();
+
+		draw();
+
+		auto end = std::chrono::system_clock::now();
+		auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+		m_rendererState.rendererStats.frametime = elapsed.count() / 1000.0f;
+
+		if (end - lastStatsPrint >= STATS_PRINT_INTERVAL) {
+			lastStatsPrint = end;
+			printStats();
+		}
+	}
+	printStats();
+
+	const FrameReadback& readback = m_renderer.latestReadback();
+	if (!m_config.screenshotPath.empty() && !readback.pixels.empty()) {
+		writeScreenshot(m_config.screenshotPath, readback);
+	}
+}
+
+// moves the camera along a path at a fixed time step instead of following the input, so
+// every run draws the same frames and reports can be compared
+void PrimalApp::runBenchmark() {
+	PM_TRACE_THREAD_NAME("Main");
+
+	CameraPath path;
+	std::string pathName = "scripted orbit";
+	if (!m_config.cameraPathFile.empty()) {
+		auto loaded = CameraPath::load(m_config.cameraPathFile);
+		if (!loaded) {
+			return;
+		}
+		path = std::move(*loaded);
+		pathName = m_config.cameraPathFile;
+	} else {
+		// one turn over the measured frames
+		path = CameraPath::orbit(BENCHMARK_ORBIT_CENTER, BENCHMARK_ORBIT_RADIUS, BENCHMARK_ORBIT_HEIGHT, static_cast<float>(m_config.frameCount) * m_config.benchmarkTimeStep);
+	}
+
+	std::cout << std::format("Benchmark: {} warmup and {} measured frames along {} ({:.1f}s, dt {:.4f}s)\n",
+		m_config.warmupFrames,
+		m_config.frameCount,
+		pathName,
+		path.duration(),
+		m_config.benchmarkTimeStep);
+
+	std::vector<BenchmarkFrame> frames;
+	frames.reserve(m_config.frameCount);
+	const uint32_t totalFrames = m_config.warmupFrames + m_config.frameCount;
+	bool quit = false;
+	for (uint32_t frame = 0; frame < totalFrames && !quit; frame++) {
+		PM_TRACE_ZONE("frame");
+
+		// the window still has to be serviced, but the input never reaches the camera
+		if (!m_config.headless) {
+			SDL_Event e;
+			while (SDL_PollEvent(&e) != 0) {
+				quit = quit || e.type == SDL_EVENT_QUIT;
+			}
+			if (m_rendererState.resizeRequested) {
+				m_renderer.resizeSwapchain();
+			}
+		}
+
+		// warmup frames hold the first key
+		const uint32_t measuredFrame = frame > m_config.warmupFrames ? frame - m_config.warmupFrames : 0;
+		path.apply(static_cast<float>(measuredFrame) * m_config.benchmarkTimeStep, *m_mainCamera);
+
+		auto start = std::chrono::steady_clock::now();
+		draw();
+		auto elapsed = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start);
+
+		RendererStats& stats = m_rendererState.rendererStats;
+		stats.frametime = elapsed.count();
+		if (frame < m_config.warmupFrames) {
+			continue;
+		}
+		frames.push_back(BenchmarkFrame{
+			.cpuFrameTime = stats.frametime,
+			.gpuFrameTime = stats.gpuLatestFrameTime,
+			.sceneUpdateTime = stats.sceneUpdateTime,
+			.meshDrawTime = stats.meshDrawTime,
+			.drawCallCount = static_cast<uint32_t>(stats.drawCallCount),
+			.triangleCount = static_cast<uint32_t>(stats.triangleCount),
+			.gpuMemoryBytes = m_renderer.gpuAllocatedBytes(),
+			.cpuMemoryBytes = processResidentBytes() });
+	}
+
+	std::string scenes;
+	for (const auto& [name, scene] : m_renderer.loadedScenes) {
+		scenes += scenes.empty() ? name : "," + name;
+	}
+	const BenchmarkInfo info{
+		.scene = scenes,
+		.device = m_renderer.deviceName(),
+		.renderPath = renderPathName(m_rendererState.renderPath),
+		.cameraPath = pathName,
+		.width = m_rendererState.windowExtent.width,
+		.height = m_rendererState.windowExtent.height,
+		.timeStep = m_config.benchmarkTimeStep,
+		.warmupFrames = m_config.warmupFrames
+	};
+	// a window closed early still reports the frames measured so far
+	writeBenchmarkReport(m_config.benchmarkReportPath, info, frames);
+	printStats();
+}
+
+void PrimalApp::printStats() const {
+	auto stats = std::format("Frametime: {:.3f}ms | Update: {:.3f}ms | MeshDraw: {:.3f}ms | Triangles: {} | DrawCall: {} | Culled: {}",
+		m_rendererState.rendererStats.frametime,
+		m_rendererState.rendererStats.sceneUpdateTime,
+		m_rendererState.rendererStats.meshDrawTime,
+		m_rendererState.rendererStats.triangleCount,
+		m_rendererState.rendererStats.drawCallCount,
+		m_rendererState.rendererStats.culledCount);
+	if (m_rendererState.renderPath == RenderPath::Clusters) {
+		const RendererStats& s = m_rendererState.rendererStats;
+		stats += std::format(" | Clusters culled: {}/{} ({:.1f}%)",
+			s.culledClusterCount,
+			s.clusterCount,
+			s.clusterCount > 0 ? 100.0 * s.culledClusterCount / s.clusterCount : 0.0);
+	}
+	if (m_rendererState.renderPath != RenderPath::Clusters && m_rendererState.occlusionCulling) {
+		stats += std::format(" | Occluded: {}", m_rendererState.rendererStats.occludedCount);
+	}
+	{
+		const RendererStats& s = m_rendererState.rendererStats;
+		const TimingSummary& geometry = s.gpuZoneTimes[static_cast<size_t>(GpuZone::Geometry)];
+		stats += std::format(" | GPU: {:.2f}ms (min {:.2f} max {:.2f} p99 {:.2f}) | Geometry: {:.2f}ms | VS: {} FS: {} Clipped prims: {}",
+			s.gpuFrameTime.avg,
+			s.gpuFrameTime.min,
+			s.gpuFrameTime.max,
+			s.gpuFrameTime.p99,
+			geometry.avg,
+			s.pipelineStatistics.vertexInvocations,
+			s.pipelineStatistics.fragmentInvocations,
+			s.pipelineStatistics.clippingPrimitives);
 	}
+	std::cout << stats << '\n';
 }
 
 void PrimalApp::draw() {
 	m_renderer.draw();
 }
 
-GPUMeshBuffers PrimalApp::uploadMesh(std::span<uint32_t> indices, std::span<Vertex> vertices) {
+GPUMeshBuffers PrimalApp::uploadMesh(std::span<const uint32_t> indices, std::span<const Vertex> vertices) {
 	return m_renderer.uploadMesh(indices, vertices);
 }
 
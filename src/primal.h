@@ -1,22 +1,55 @@
 #pragma once
 
+#include <chrono>
+
 #include "camera.h"
+#include "camera_path.h"
 #include "platform/vulkan/vulkan_renderer.h"
 #include "vk_types.h"
 
 namespace pm {
 
+struct PrimalAppConfig {
+		// no window or swapchain, frames only go to the draw image. for benchmarks and
+		// render jobs on machines without a display
+		bool headless{ false };
+		// prefer a CPU Vulkan implementation (lavapipe) over the GPUs
+		bool softwareDevice{ false };
+		VkExtent2D extent{ 1920, 1080 };
+		// headless and benchmark runs: frames run() draws before it returns, for benchmarks
+		// the measured ones after warmupFrames
+		uint32_t frameCount{ 1000 };
+		// headless only: copy the draw image back every n frames, 0 never
+		uint32_t readbackInterval{ 0 };
+		// headless only: the last frame read back is written here as a binary PPM
+		std::string screenshotPath;
+
+		// non-empty runs the deterministic benchmark and writes its JSON report here
+		std::string benchmarkReportPath;
+		// benchmark only: a path recorded with the R key, empty for a scripted orbit
+		std::string cameraPathFile;
+		// benchmark only: drawn before measuring, while pipelines warm up and uploads finish
+		uint32_t warmupFrames{ 60 };
+		// benchmark only: seconds the camera moves per frame, however long the frame took
+		float benchmarkTimeStep{ 1.f / 60.f };
+};
+
 class PrimalApp {
 	public:
-		void init();
+		void init(const PrimalAppConfig& config = {});
 		void run();
 		void draw();
 		void cleanup();
 		PrimalApp& get();
 
-		GPUMeshBuffers uploadMesh(std::span<uint32_t> indices, std::span<Vertex> vertices);
+		GPUMeshBuffers uploadMesh(std::span<const uint32_t> indices, std::span<const Vertex> vertices);
 
 	private:
+		void runHeadless();
+		void runBenchmark();
+		void printStats() const;
+
+		PrimalAppConfig m_config{};
 		bool m_isInitialized{ false };
 		int m_frameNumber{ 0 };
 		bool m_stopRendering{ false };
@@ -26,6 +59,11 @@ class PrimalApp {
 
 		SDL_Window* m_window{ nullptr };
 		Camera* m_mainCamera;
+
+		// camera recording toggled with the R key
+		CameraPath m_recordedPath;
+		bool m_recordingPath{ false };
+		std::chrono::steady_clock::time_point m_recordStart;
 };
 
 }// namespace pm
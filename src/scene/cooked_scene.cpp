@@ -0,0 +1,290 @@
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cooked_scene.h"
+#include "meshlet.h"
+#include "texture_compress.h"
+
+namespace pm {
+
+namespace {
+
+void alignFile(std::vector<uint8_t>& file, uint64_t alignment) {
+	file.resize((file.size() + alignment - 1) / alignment * alignment, 0);
+}
+
+template<typename T>
+CookedRange appendTable(std::vector<uint8_t>& file, const std::vector<T>& table) {
+	alignFile(file, COOKED_BLOB_ALIGNMENT);
+
+	CookedRange range{ .offset = file.size(), .count = table.size() };
+	const auto* bytes = reinterpret_cast<const uint8_t*>(table.data());
+	file.insert(file.end(), bytes, bytes + table.size() * sizeof(T));
+	return range;
+}
+
+}// namespace
+
+std::optional<SourceStamp> sourceStamp(const std::filesystem::path& source) {
+	std::error_code error;
+	const auto size = std::filesystem::file_size(source, error);
+	if (error) {
+		return {};
+	}
+	const auto writeTime = std::filesystem::last_write_time(source, error);
+	if (error) {
+		return {};
+	}
+
+	return SourceStamp{ .size = size, .writeTime = static_cast<int64_t>(writeTime.time_since_epoch().count()) };
+}
+
+std::filesystem::path cookedScenePath(const std::filesystem::path& source) {
+	std::filesystem::path path = source;
+	path += ".pmscene";
+	return path;
+}
+
+CookedString CookedSceneWriter::addString(std::string_view string) {
+	CookedString cooked{ .offset = static_cast<uint32_t>(m_strings.size()), .length = static_cast<uint32_t>(string.size()) };
+	m_strings.append(string);
+	return cooked;
+}
+
+uint64_t CookedSceneWriter::addBlob(const void* data, size_t size) {
+	alignFile(m_blob, COOKED_BLOB_ALIGNMENT);
+
+	const uint64_t offset = m_blob.size();
+	const auto* bytes = static_cast<const uint8_t*>(data);
+	m_blob.insert(m_blob.end(), bytes, bytes + size);
+	return offset;
+}
+
+bool CookedSceneWriter::write(const std::filesystem::path& path, const SourceStamp& stamp) const {
+	CookedSceneHeader header{};
+	header.magic = COOKED_SCENE_MAGIC;
+	header.version = COOKED_SCENE_VERSION;
+	header.vertexLayout = static_cast<uint32_t>(VERTEX_LAYOUT);
+	header.vertexStride = sizeof(GPUVertex);
+	header.sourceSize = stamp.size;
+	header.sourceWriteTime = stamp.writeTime;
+
+	std::vector<uint8_t> file(sizeof(CookedSceneHeader));
+
+	header.meshes = appendTable(file, meshes);
+	header.surfaces = appendTable(file, surfaces);
+	header.nodes = appendTable(file, nodes);
+	header.materials = appendTable(file, materials);
+	header.samplers = appendTable(file, samplers);
+	header.images = appendTable(file, images);
+
+	header.strings = CookedRange{ .offset = file.size(), .count = m_strings.size() };
+	file.insert(file.end(), m_strings.begin(), m_strings.end());
+
+	// blobs keep their alignment in the file so they can be read in place
+	alignFile(file, COOKED_BLOB_ALIGNMENT);
+	header.blobOffset = file.size();
+	header.blobSize = m_blob.size();
+	file.insert(file.end(), m_blob.begin(), m_blob.end());
+
+	memcpy(file.data(), &header, sizeof(CookedSceneHeader));
+
+	// write next to the destination and rename, so a reader never maps a half written file
+	std::filesystem::path tempPath = path;
+	tempPath += ".tmp";
+	{
+		std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+		if (!out) {
+			std::cout << std::format("Failed to open {} for writing\n", tempPath.string());
+			return false;
+		}
+		out.write(reinterpret_cast<const char*>(file.data()), static_cast<std::streamsize>(file.size()));
+		if (!out) {
+			std::cout << std::format("Failed to write {}\n", tempPath.string());
+			return false;
+		}
+	}
+
+	std::error_code error;
+	std::filesystem::rename(tempPath, path, error);
+	if (error) {
+		std::cout << std::format("Failed to move {} to {}: {}\n", tempPath.string(), path.string(), error.message());
+		return false;
+	}
+	return true;
+}
+
+bool CookedSceneFile::open(const std::filesystem::path& path) {
+	close();
+
+	const int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat fileStat {};
+	if (fstat(fd, &fileStat) != 0 || static_cast<size_t>(fileStat.st_size) < sizeof(CookedSceneHeader)) {
+		::close(fd);
+		return false;
+	}
+
+	const auto size = static_cast<size_t>(fileStat.st_size);
+	void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// the mapping stays valid after the descriptor is closed
+	::close(fd);
+	if (mapped == MAP_FAILED) {
+		return false;
+	}
+
+	m_data = static_cast<const uint8_t*>(mapped);
+	m_size = size;
+
+	const CookedSceneHeader& h = header();
+	const bool valid = h.magic == COOKED_SCENE_MAGIC
+										 && h.version == COOKED_SCENE_VERSION
+										 && h.vertexLayout == static_cast<uint32_t>(VERTEX_LAYOUT)
+										 && h.vertexStride == sizeof(GPUVertex)
+										 && validRange(h.meshes, sizeof(CookedMesh))
+										 && validRange(h.surfaces, sizeof(CookedSurface))
+										 && validRange(h.nodes, sizeof(CookedNode))
+										 && validRange(h.materials, sizeof(CookedMaterial))
+										 && validRange(h.samplers, sizeof(CookedSampler))
+										 && validRange(h.images, sizeof(CookedImage))
+										 && validRange(h.strings, 1)
+										 && h.blobOffset <= m_size && h.blobSize <= m_size - h.blobOffset;
+
+	if (!valid) {
+		std::cout << std::format("Ignoring cooked scene {}: unknown version, other vertex layout or corrupt tables\n", path.string());
+		close();
+		return false;
+	}
+	if (!validReferences()) {
+		std::cout << std::format("Ignoring cooked scene {}: tables reference missing entries\n", path.string());
+		close();
+		return false;
+	}
+	return true;
+}
+
+void CookedSceneFile::close() {
+	if (m_data != nullptr) {
+		munmap(const_cast<uint8_t*>(m_data), m_size);
+	}
+	m_data = nullptr;
+	m_size = 0;
+}
+
+bool CookedSceneFile::matchesSource(const std::filesystem::path& source) const {
+	std::optional<SourceStamp> stamp = sourceStamp(source);
+	if (!stamp.has_value() || m_data == nullptr) {
+		return false;
+	}
+	return header().sourceSize == stamp->size && header().sourceWriteTime == stamp->writeTime;
+}
+
+std::string_view CookedSceneFile::string(CookedString string) const {
+	const CookedRange& strings = header().strings;
+	if (string.offset > strings.count || string.length > strings.count - string.offset) {
+		return {};
+	}
+	return { reinterpret_cast<const char*>(m_data + strings.offset + string.offset), string.length };
+}
+
+bool CookedSceneFile::validRange(const CookedRange& range, size_t elementSize) const {
+	return range.offset <= m_size && range.count <= (m_size - range.offset) / elementSize;
+}
+
+bool CookedSceneFile::validReferences() const {
+	const std::span<const CookedMesh> meshTable = meshes();
+	const std::span<const CookedSurface> surfaceTable = surfaces();
+	const size_t materialCount = materials().size();
+
+	for (const CookedMesh& mesh : meshTable) {
+		// 16 bit indices can't address more vertices than that
+		const bool validIndexSize = mesh.indexSize == sizeof(uint32_t) || (mesh.indexSize == sizeof(uint16_t) && mesh.vertexCount <= 65536);
+		const size_t indexBlobCount = mesh.indexSize == sizeof(uint16_t) ? blob<uint16_t>(mesh.indexOffset, mesh.indexCount).size() : blob<uint32_t>(mesh.indexOffset, mesh.indexCount).size();
+		if (mesh.vertexCount > std::numeric_limits<uint32_t>::max()
+				|| blob<uint8_t>(mesh.vertexOffset, packedVertexSize(mesh.vertexCount)).size() != packedVertexSize(mesh.vertexCount)
+				|| !validIndexSize || indexBlobCount != mesh.indexCount
+				|| blob<Meshlet>(mesh.meshletOffset, mesh.meshletCount).size() != mesh.meshletCount
+				|| size_t(mesh.firstSurface) + mesh.surfaceCount > surfaceTable.size()) {
+			return false;
+		}
+
+		// the occlusion rasterizer reads positions[index] without checks
+		const std::span<const glm::vec3> occluderPositions = blob<glm::vec3>(mesh.occluderPositionOffset, mesh.occluderPositionCount);
+		const std::span<const uint32_t> occluderIndices = blob<uint32_t>(mesh.occluderIndexOffset, mesh.occluderIndexCount);
+		if (occluderPositions.size() != mesh.occluderPositionCount || occluderIndices.size() != mesh.occluderIndexCount || mesh.occluderIndexCount % 3 != 0) {
+			return false;
+		}
+		for (uint32_t index : occluderIndices) {
+			if (index >= occluderPositions.size()) {
+				return false;
+			}
+		}
+
+		for (const CookedSurface& surface : surfaceTable.subspan(mesh.firstSurface, mesh.surfaceCount)) {
+			// surfaces without a material fall back to the first one
+			const bool validMaterial = surface.materialIndex >= 0 ? static_cast<size_t>(surface.materialIndex) < materialCount : materialCount > 0;
+			if (!validMaterial
+					|| uint64_t(surface.startIndex) + surface.count > mesh.indexCount
+					|| surface.lodCount == 0 || surface.lodCount > MAX_LOD_COUNT) {
+				return false;
+			}
+			for (uint32_t level = 0; level < surface.lodCount; level++) {
+				const CookedLod& lod = surface.lods[level];
+				if (uint64_t(lod.startIndex) + lod.count > mesh.indexCount
+						|| uint64_t(lod.firstMeshlet) + lod.meshletCount > mesh.meshletCount) {
+					return false;
+				}
+			}
+		}
+	}
+
+	// images that failed to decode at cook time are replaced by the loader, every other one
+	// has to hold exactly its mip chain
+	const std::span<const CookedImage> imageTable = images();
+	for (const CookedImage& image : imageTable) {
+		if (image.valid == 0) {
+			continue;
+		}
+		const auto format = static_cast<VkFormat>(image.format);
+		if (image.width == 0 || image.height == 0
+				|| image.mipLevels == 0 || image.mipLevels > mipLevelCount(image.width, image.height)
+				|| (!isBlockCompressed(format) && format != VK_FORMAT_R8G8B8A8_UNORM)
+				|| image.dataSize != mipChainSize(format, image.width, image.height, image.mipLevels)
+				|| blob<uint8_t>(image.dataOffset, image.dataSize).size() != image.dataSize) {
+			return false;
+		}
+	}
+
+	// a material either has no base color texture or both an image and a sampler
+	const size_t samplerCount = samplers().size();
+	for (const CookedMaterial& material : materials()) {
+		const bool validTexture = material.colorImage == -1
+			|| (material.colorImage >= 0 && static_cast<size_t>(material.colorImage) < imageTable.size()
+				&& material.colorSampler >= 0 && static_cast<size_t>(material.colorSampler) < samplerCount);
+		if (!validTexture || material.passType > static_cast<uint32_t>(MaterialPass::Other)) {
+			return false;
+		}
+	}
+
+	// parents come before their children, which SceneGraph::addNode relies on
+	const std::span<const CookedNode> nodeTable = nodes();
+	for (size_t i = 0; i < nodeTable.size(); i++) {
+		const CookedNode& node = nodeTable[i];
+		if (node.parent < -1 || (node.parent >= 0 && static_cast<size_t>(node.parent) >= i)
+				|| node.meshIndex < -1 || (node.meshIndex >= 0 && static_cast<size_t>(node.meshIndex) >= meshTable.size())) {
+			return false;
+		}
+	}
+	return true;
+}
+
+}// namespace pm
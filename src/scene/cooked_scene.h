@@ -0,0 +1,230 @@
+#pragma once
+
+#include <filesystem>
+
+#include "lod.h"
+#include "vertex_layout.h"
+#include "vk_types.h"
+
+namespace pm {
+
+// Engine native scene cache, written offline by the cooker from a glTF file.
+// Everything is stored in the form the loader uploads it: vertices packed in the GPU vertex
+// layout, indices at their final width, meshlets, occluders, surface tables, the node
+// hierarchy in topological order, material constants and texture mip chains (BC1/BC5/BC7
+// blocks or RGBA8). Loading is a mmap and a memcpy into staging memory. Files cooked for
+// another vertex layout are rejected and the source is loaded instead.
+//
+// The file starts with a CookedSceneHeader followed by the tables it points to.
+// Table ranges are absolute file offsets, strings are relative to the string table
+// and blob offsets (vertices, indices, meshlets, texels) are relative to header.blobOffset.
+
+// "PMSC" in little endian
+constexpr uint32_t COOKED_SCENE_MAGIC = 0x43534D50;
+// bump whenever any struct below or a GPU vertex changes layout
+constexpr uint32_t COOKED_SCENE_VERSION = 5;
+
+constexpr uint64_t COOKED_BLOB_ALIGNMENT = 16;
+
+struct CookedRange {
+		uint64_t offset;
+		uint64_t count;
+};
+
+struct CookedString {
+		uint32_t offset;
+		uint32_t length;
+};
+
+struct CookedSceneHeader {
+		uint32_t magic;
+		uint32_t version;
+		// VertexLayout the vertices are packed in and the size of one packed vertex
+		uint32_t vertexLayout;
+		uint32_t vertexStride;
+
+		// size and write time of the source file, the cache is stale when they differ
+		uint64_t sourceSize;
+		int64_t sourceWriteTime;
+
+		CookedRange meshes;
+		CookedRange surfaces;
+		CookedRange nodes;
+		CookedRange materials;
+		CookedRange samplers;
+		CookedRange images;
+		CookedRange strings;
+
+		uint64_t blobOffset;
+		uint64_t blobSize;
+};
+
+struct CookedMesh {
+		CookedString name;
+		uint32_t firstSurface;
+		uint32_t surfaceCount;
+		// packedVertexSize(vertexCount) bytes in header.vertexLayout
+		uint64_t vertexOffset;
+		uint64_t vertexCount;
+		uint64_t indexOffset;
+		uint64_t indexCount;
+		// 2 or 4 bytes, the width the renderer draws the mesh with
+		uint32_t indexSize;
+		uint32_t padding;
+		// Meshlet structs, see meshlet.h
+		uint64_t meshletOffset;
+		uint64_t meshletCount;
+		// OccluderMesh streams, float3 positions and uint32 indices
+		uint64_t occluderPositionOffset;
+		uint64_t occluderPositionCount;
+		uint64_t occluderIndexOffset;
+		uint64_t occluderIndexCount;
+		float occluderCenter[3];
+		float occluderRadius;
+};
+
+struct CookedLod {
+		uint32_t startIndex;
+		uint32_t count;
+		float error;
+		uint32_t firstMeshlet;
+		uint32_t meshletCount;
+};
+
+struct CookedSurface {
+		uint32_t startIndex;
+		uint32_t count;
+		// -1 when the primitive has no material
+		int32_t materialIndex;
+		float sphereRadius;
+		float origin[3];
+		float extents[3];
+		// lods[0] matches startIndex and count
+		uint32_t lodCount;
+		CookedLod lods[MAX_LOD_COUNT];
+};
+
+// nodes are stored in topological order, parent < own index
+struct CookedNode {
+		CookedString name;
+		int32_t parent;
+		int32_t meshIndex;
+		float localTransform[16];
+};
+
+struct CookedMaterial {
+		CookedString name;
+		float colorFactors[4];
+		float metalRoughFactors[2];
+		// -1 when the material has no base color texture
+		int32_t colorImage;
+		int32_t colorSampler;
+		uint32_t passType;
+		uint32_t padding;
+};
+
+// VkFilter / VkSamplerMipmapMode values
+struct CookedSampler {
+		uint32_t magFilter;
+		uint32_t minFilter;
+		uint32_t mipmapMode;
+};
+
+struct CookedImage {
+		CookedString name;
+		uint32_t width;
+		uint32_t height;
+		// 0 when the image failed to decode at cook time
+		uint32_t valid;
+		// VkFormat of the texels, levels are stored back to back starting with mip 0
+		uint32_t format;
+		uint32_t mipLevels;
+		uint32_t padding;
+		uint64_t dataOffset;
+		uint64_t dataSize;
+};
+
+struct SourceStamp {
+		uint64_t size;
+		int64_t writeTime;
+};
+
+std::optional<SourceStamp> sourceStamp(const std::filesystem::path& source);
+
+// where the cooked cache of a source file lives
+std::filesystem::path cookedScenePath(const std::filesystem::path& source);
+
+// collects the tables and blobs of a scene and writes them out as a cooked file
+class CookedSceneWriter {
+	public:
+		CookedString addString(std::string_view string);
+		// returns the blob relative offset of the copied data
+		uint64_t addBlob(const void* data, size_t size);
+
+		bool write(const std::filesystem::path& path, const SourceStamp& stamp) const;
+
+		std::vector<CookedMesh> meshes;
+		std::vector<CookedSurface> surfaces;
+		std::vector<CookedNode> nodes;
+		std::vector<CookedMaterial> materials;
+		std::vector<CookedSampler> samplers;
+		std::vector<CookedImage> images;
+
+	private:
+		std::string m_strings;
+		std::vector<uint8_t> m_blob;
+};
+
+// read only memory mapping of a cooked file. open() validates the header, the tables and
+// every index a table holds into another one or into the blob
+class CookedSceneFile {
+	public:
+		CookedSceneFile() = default;
+		~CookedSceneFile() { close(); }
+
+		CookedSceneFile(const CookedSceneFile&) = delete;
+		CookedSceneFile& operator=(const CookedSceneFile&) = delete;
+
+		bool open(const std::filesystem::path& path);
+		void close();
+
+		// true when the file was cooked from the current version of source
+		bool matchesSource(const std::filesystem::path& source) const;
+
+		const CookedSceneHeader& header() const { return *reinterpret_cast<const CookedSceneHeader*>(m_data); }
+
+		std::span<const CookedMesh> meshes() const { return table<CookedMesh>(header().meshes); }
+		std::span<const CookedSurface> surfaces() const { return table<CookedSurface>(header().surfaces); }
+		std::span<const CookedNode> nodes() const { return table<CookedNode>(header().nodes); }
+		std::span<const CookedMaterial> materials() const { return table<CookedMaterial>(header().materials); }
+		std::span<const CookedSampler> samplers() const { return table<CookedSampler>(header().samplers); }
+		std::span<const CookedImage> images() const { return table<CookedImage>(header().images); }
+
+		std::string_view string(CookedString string) const;
+
+		// empty span when the range falls outside of the blob
+		template<typename T>
+		std::span<const T> blob(uint64_t offset, uint64_t count) const {
+			const CookedSceneHeader& h = header();
+			if (offset > h.blobSize || count > (h.blobSize - offset) / sizeof(T)) {
+				return {};
+			}
+			return { reinterpret_cast<const T*>(m_data + h.blobOffset + offset), static_cast<size_t>(count) };
+		}
+
+	private:
+		template<typename T>
+		std::span<const T> table(const CookedRange& range) const {
+			return { reinterpret_cast<const T*>(m_data + range.offset), static_cast<size_t>(range.count) };
+		}
+
+		bool validRange(const CookedRange& range, size_t elementSize) const;
+		// mesh, surface, material, image, sampler and parent indices, the blob ranges of meshes
+		// and images and the ranges of every LOD
+		bool validReferences() const;
+
+		const uint8_t* m_data{ nullptr };
+		size_t m_size{ 0 };
+};
+
+}// namespace pm
@@ -0,0 +1,117 @@
+#include "draw_sort.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <format>
+#include <iostream>
+
+namespace pm {
+
+namespace {
+
+// the top bits of a non negative float keep its order, sign bit excluded
+uint64_t quantizeDepth(float depth, uint32_t bits) {
+	const float clamped = depth > 0.f ? depth : 0.f;
+	return std::bit_cast<uint32_t>(clamped) >> (31 - bits);
+}
+
+// a value past its slot saturates instead of wrapping onto small values, so it still sorts
+// after everything that fits and never lands between unrelated draws
+uint64_t field(uint32_t value, uint32_t bits, uint32_t shift, const char* name) {
+	const uint32_t max = (uint32_t{ 1 } << bits) - 1;
+	if (value > max) {
+		// keys are built on the draw collection workers, only the first overflow is printed
+		static std::atomic<bool> reported{ false };
+		if (!reported.exchange(true, std::memory_order_relaxed)) {
+			std::cout << std::format("Draw sort key {} {} does not fit in {} bits, it is clamped to {}\n", name, value, bits, max);
+		}
+		value = max;
+	}
+	return static_cast<uint64_t>(value) << shift;
+}
+
+}// namespace
+
+uint64_t opaqueSortKey(MaterialPass pass, uint32_t pipeline, bool wideIndices, uint32_t mesh, uint32_t surface, uint32_t lod, uint32_t material, float depth) {
+	return field(static_cast<uint32_t>(pass), 2, 62, "pass")
+		| field(pipeline, 5, 57, "pipeline")
+		| field(wideIndices ? 1 : 0, 1, 56, "index type")
+		| field(mesh, 18, 38, "mesh")
+		| field(surface, 8, 30, "surface")
+		| field(lod, 2, 28, "lod")
+		| field(material, 12, 16, "material")
+		| quantizeDepth(depth, 16);
+}
+
+uint64_t transparentSortKey(MaterialPass pass, uint32_t pipeline, uint32_t material, uint32_t mesh, float depth) {
+	// inverted so that the farthest surface gets the smallest key
+	const uint64_t farFirst = ~quantizeDepth(depth, 27) & ((uint64_t{ 1 } << 27) - 1);
+	return field(static_cast<uint32_t>(pass), 2, 62, "pass")
+		| (farFirst << 35)
+		| field(pipeline, 5, 30, "pipeline")
+		| field(material, 12, 18, "material")
+		| field(mesh, 18, 0, "mesh");
+}
+
+void DrawKeySorter::sort(std::span<const uint64_t> keys, std::vector<uint32_t>& order) {
+	constexpr uint32_t PASS_COUNT = 8;
+	constexpr uint32_t BUCKET_COUNT = 256;
+
+	const size_t count = keys.size();
+	order.resize(count);
+	if (count == 0) {
+		return;
+	}
+
+	for (uint32_t i = 0; i < 2; i++) {
+		m_keys[i].resize(count);
+		m_indices[i].resize(count);
+	}
+
+	// all histograms in a single read of the keys
+	std::array<std::array<uint32_t, BUCKET_COUNT>, PASS_COUNT> histograms{};
+	for (size_t i = 0; i < count; i++) {
+		const uint64_t key = keys[i];
+		for (uint32_t pass = 0; pass < PASS_COUNT; pass++) {
+			histograms[pass][(key >> (pass * 8)) & 0xFF]++;
+		}
+		m_keys[0][i] = key;
+		m_indices[0][i] = static_cast<uint32_t>(i);
+	}
+
+	uint32_t source = 0;
+	for (uint32_t pass = 0; pass < PASS_COUNT; pass++) {
+		std::array<uint32_t, BUCKET_COUNT>& histogram = histograms[pass];
+
+		// every key lands in the same bucket, the pass would not move anything
+		const uint32_t firstBucket = (keys[0] >> (pass * 8)) & 0xFF;
+		if (histogram[firstBucket] == count) {
+			continue;
+		}
+
+		uint32_t offset = 0;
+		for (uint32_t bucket = 0; bucket < BUCKET_COUNT; bucket++) {
+			const uint32_t bucketSize = histogram[bucket];
+			histogram[bucket] = offset;
+			offset += bucketSize;
+		}
+
+		const uint64_t* srcKeys = m_keys[source].data();
+		const uint32_t* srcIndices = m_indices[source].data();
+		uint64_t* dstKeys = m_keys[source ^ 1].data();
+		uint32_t* dstIndices = m_indices[source ^ 1].data();
+		for (size_t i = 0; i < count; i++) {
+			const uint64_t key = srcKeys[i];
+			const uint32_t slot = histogram[(key >> (pass * 8)) & 0xFF]++;
+			dstKeys[slot] = key;
+			dstIndices[slot] = srcIndices[i];
+		}
+		source ^= 1;
+	}
+
+	std::copy(m_indices[source].begin(), m_indices[source].end(), order.begin());
+}
+
+}// namespace pm
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include "vk_types.h"
+
+namespace pm {
+
+// Packed 64 bit draw sort keys, compared as plain integers.
+//
+// opaque (most significant first):
+//   pass 2 | pipeline 5 | wide indices 1 | mesh 18 | surface 8 | lod 2 | material 12 | depth 16
+//   state first on purpose: copies of one surface have to stay next to each other so they
+//   merge into instanced draws, and the indirect path batches by pipeline and index buffer.
+//   depth only orders draws of the same state, occlusion is left to the Hi-Z and occluder
+//   culling instead of the draw order.
+//   16 and 32 bit meshes share one index buffer, so the index type splits each pipeline
+//   into at most two index buffer bindings
+// transparent:
+//   pass 2 | depth 27 | pipeline 5 | material 12 | mesh 18
+//   back to front, state only breaks ties
+//
+// every field but depth has to fit its slot. a value that doesn't is clamped to the largest
+// one and reported once, it then only shares its position with other clamped values and
+// never interleaves unrelated draws. the renderer keeps mesh ids below MAX_SORT_KEY_MESHES
+// by reusing released ones.
+// depth is the distance to the camera, quantized through its float bits so that the
+// precision follows the magnitude and no depth range has to be configured
+constexpr uint32_t MAX_SORT_KEY_PIPELINES = 1u << 5;
+constexpr uint32_t MAX_SORT_KEY_MESHES = 1u << 18;
+constexpr uint32_t MAX_SORT_KEY_SURFACES = 1u << 8;
+constexpr uint32_t MAX_SORT_KEY_LODS = 1u << 2;
+constexpr uint32_t MAX_SORT_KEY_MATERIALS = 1u << 12;
+
+uint64_t opaqueSortKey(MaterialPass pass, uint32_t pipeline, bool wideIndices, uint32_t mesh, uint32_t surface, uint32_t lod, uint32_t material, float depth);
+uint64_t transparentSortKey(MaterialPass pass, uint32_t pipeline, uint32_t material, uint32_t mesh, float depth);
+
+// LSD radix sort over 64 bit keys, 8 bits per pass. passes where every key has the same
+// digit are skipped, in practice the pass and pipeline bytes rarely need one.
+// the scratch buffers are kept between calls so a sort per frame does not allocate
+class DrawKeySorter {
+	public:
+		// fills order with the indices of keys in ascending key order, stable for equal keys
+		void sort(std::span<const uint64_t> keys, std::vector<uint32_t>& order);
+
+	private:
+		std::vector<uint64_t> m_keys[2];
+		std::vector<uint32_t> m_indices[2];
+};
+
+}// namespace pm
@@ -0,0 +1,111 @@
+#include <cmath>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "frustum.h"
+
+namespace pm {
+
+Frustum Frustum::fromViewProj(const glm::mat4& viewproj) {
+	// glm is column major, so row i of the matrix is (m[0][i], m[1][i], m[2][i], m[3][i])
+	auto row = [&](int i) {
+		return glm::vec4{ viewproj[0][i], viewproj[1][i], viewproj[2][i], viewproj[3][i] };
+	};
+
+	const glm::vec4 r0 = row(0);
+	const glm::vec4 r1 = row(1);
+	const glm::vec4 r2 = row(2);
+	const glm::vec4 r3 = row(3);
+
+	// clip space is -w <= x, y <= w and 0 <= z <= w
+	const glm::vec4 planes[PLANE_COUNT] = {
+		r3 + r0,
+		r3 - r0,
+		r3 + r1,
+		r3 - r1,
+		r2,
+		r3 - r2
+	};
+
+	Frustum frustum{};
+	for (uint32_t i = 0; i < PLANE_COUNT; i++) {
+		const glm::vec4& p = planes[i];
+		const float invLength = 1.f / std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+		frustum.nx[i] = p.x * invLength;
+		frustum.ny[i] = p.y * invLength;
+		frustum.nz[i] = p.z * invLength;
+		frustum.d[i] = p.w * invLength;
+	}
+
+	return frustum;
+}
+
+#if defined(__AVX__)
+
+uint32_t testSpheres(const Frustum& frustum, const float* x, const float* y, const float* z, const float* radius) {
+	const __m256 px = _mm256_loadu_ps(x);
+	const __m256 py = _mm256_loadu_ps(y);
+	const __m256 pz = _mm256_loadu_ps(z);
+	const __m256 negRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(radius));
+
+	__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+	for (uint32_t i = 0; i < Frustum::PLANE_COUNT; i++) {
+		__m256 dist = _mm256_mul_ps(px, _mm256_set1_ps(frustum.nx[i]));
+		dist = _mm256_add_ps(dist, _mm256_mul_ps(py, _mm256_set1_ps(frustum.ny[i])));
+		dist = _mm256_add_ps(dist, _mm256_mul_ps(pz, _mm256_set1_ps(frustum.nz[i])));
+		dist = _mm256_add_ps(dist, _mm256_set1_ps(frustum.d[i]));
+
+		inside = _mm256_and_ps(inside, _mm256_cmp_ps(dist, negRadius, _CMP_GE_OQ));
+	}
+
+	return static_cast<uint32_t>(_mm256_movemask_ps(inside));
+}
+
+#elif defined(__SSE2__)
+
+uint32_t testSpheres(const Frustum& frustum, const float* x, const float* y, const float* z, const float* radius) {
+	uint32_t mask = 0;
+
+	// two 4 wide halves when AVX is not available
+	for (uint32_t half = 0; half < FRUSTUM_BATCH_SIZE; half += 4) {
+		const __m128 px = _mm_loadu_ps(x + half);
+		const __m128 py = _mm_loadu_ps(y + half);
+		const __m128 pz = _mm_loadu_ps(z + half);
+		const __m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(radius + half));
+
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (uint32_t i = 0; i < Frustum::PLANE_COUNT; i++) {
+			__m128 dist = _mm_mul_ps(px, _mm_set1_ps(frustum.nx[i]));
+			dist = _mm_add_ps(dist, _mm_mul_ps(py, _mm_set1_ps(frustum.ny[i])));
+			dist = _mm_add_ps(dist, _mm_mul_ps(pz, _mm_set1_ps(frustum.nz[i])));
+			dist = _mm_add_ps(dist, _mm_set1_ps(frustum.d[i]));
+
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(dist, negRadius));
+		}
+
+		mask |= static_cast<uint32_t>(_mm_movemask_ps(inside)) << half;
+	}
+
+	return mask;
+}
+
+#else
+
+uint32_t testSpheres(const Frustum& frustum, const float* x, const float* y, const float* z, const float* radius) {
+	uint32_t mask = 0;
+	for (uint32_t s = 0; s < FRUSTUM_BATCH_SIZE; s++) {
+		bool inside = true;
+		for (uint32_t i = 0; i < Frustum::PLANE_COUNT; i++) {
+			const float dist = frustum.nx[i] * x[s] + frustum.ny[i] * y[s] + frustum.nz[i] * z[s] + frustum.d[i];
+			inside = inside && dist >= -radius[s];
+		}
+		mask |= static_cast<uint32_t>(inside) << s;
+	}
+	return mask;
+}
+
+#endif
+
+}// namespace pm
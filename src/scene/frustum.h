@@ -0,0 +1,29 @@
+#pragma once
+
+#include "vk_types.h"
+
+namespace pm {
+
+// View frustum as 6 normalized planes (left, right, bottom, top, near, far) stored
+// as separate component arrays so each plane can be broadcast against a batch of spheres.
+// A point p is inside a plane when nx * p.x + ny * p.y + nz * p.z + d >= 0.
+struct Frustum {
+		static constexpr uint32_t PLANE_COUNT = 6;
+
+		float nx[PLANE_COUNT];
+		float ny[PLANE_COUNT];
+		float nz[PLANE_COUNT];
+		float d[PLANE_COUNT];
+
+		// planes extracted from a Vulkan (0..1 depth) view-projection matrix
+		static Frustum fromViewProj(const glm::mat4& viewproj);
+};
+
+// number of spheres tested by a single testSpheres call, matches one AVX register
+constexpr uint32_t FRUSTUM_BATCH_SIZE = 8;
+
+// test FRUSTUM_BATCH_SIZE spheres given as component arrays.
+// returns a mask where bit i is set when sphere i intersects the frustum
+uint32_t testSpheres(const Frustum& frustum, const float* x, const float* y, const float* z, const float* radius);
+
+}// namespace pm
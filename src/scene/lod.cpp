@@ -0,0 +1,48 @@
+#include <algorithm>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#include "lod.h"
+
+namespace pm {
+
+namespace {
+
+// keeps the error finite when the camera is inside the bounds
+constexpr float MIN_LOD_DISTANCE = 0.01f;
+
+}// namespace
+
+LodSelection LodSelection::fromViewProj(const glm::mat4& view, const glm::mat4& proj, float viewportHeight, float errorThreshold, int32_t forcedLod) {
+	LodSelection selection{};
+	selection.cameraPosition = glm::vec3(glm::inverse(view)[3]);
+	// proj[1][1] is cot(fov / 2), negative when Y is flipped
+	selection.projectionScale = std::abs(proj[1][1]) * viewportHeight * 0.5f;
+	selection.errorThreshold = errorThreshold;
+	selection.forcedLod = forcedLod;
+	return selection;
+}
+
+uint32_t LodSelection::select(std::span<const LodLevel> lods, const glm::vec3& center, float radius, float scale) const {
+	if (lods.size() <= 1) {
+		return 0;
+	}
+
+	const auto coarsest = static_cast<uint32_t>(lods.size() - 1);
+	if (forcedLod >= 0) {
+		return std::min(static_cast<uint32_t>(forcedLod), coarsest);
+	}
+
+	const float distance = std::max(glm::length(center - cameraPosition) - radius, MIN_LOD_DISTANCE);
+	const float pixelsPerUnit = scale * projectionScale / distance;
+
+	// errors grow with the level, stop at the first one that is visible
+	uint32_t level = 0;
+	while (level < coarsest && lods[level + 1].error * pixelsPerUnit <= errorThreshold) {
+		level++;
+	}
+	return level;
+}
+
+}// namespace pm
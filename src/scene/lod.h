@@ -0,0 +1,39 @@
+#pragma once
+
+#include "vk_types.h"
+
+namespace pm {
+
+// levels per surface, LOD 0 is the source geometry
+constexpr uint32_t MAX_LOD_COUNT = 4;
+
+// one level of a surface inside the mesh index buffer.
+// error is the object space distance the level may deviate from LOD 0
+struct LodLevel {
+		uint32_t startIndex;
+		uint32_t count;
+		float error;
+		// clusters covering [startIndex, startIndex + count) in the mesh meshlet list, see meshlet.h
+		uint32_t firstMeshlet;
+		uint32_t meshletCount;
+};
+
+// picks levels from their projected error for one view
+struct LodSelection {
+		glm::vec3 cameraPosition;
+		// pixels covered by one unit at distance one
+		float projectionScale;
+		// coarsest level whose error stays below this many pixels is drawn
+		float errorThreshold;
+		// >= 0 draws this level (or the coarsest one a surface has) at any distance
+		int32_t forcedLod{ -1 };
+
+		// camera taken from the view matrix, projectionScale from proj and the viewport height
+		static LodSelection fromViewProj(const glm::mat4& view, const glm::mat4& proj, float viewportHeight, float errorThreshold, int32_t forcedLod);
+
+		// level for a surface with a world space bounding sphere, scale is the largest axis
+		// scale of its world transform
+		uint32_t select(std::span<const LodLevel> lods, const glm::vec3& center, float radius, float scale) const;
+};
+
+}// namespace pm
@@ -0,0 +1,169 @@
+#include <algorithm>
+
+#include <glm/glm.hpp>
+#include <meshoptimizer.h>
+
+#include "mesh_optimize.h"
+
+namespace pm {
+
+namespace {
+
+constexpr unsigned int CACHE_SIZE = 16;
+// allow the overdraw pass to make the cache up to 5% worse
+constexpr float OVERDRAW_THRESHOLD = 1.05f;
+
+constexpr float LOD_REDUCTION = 0.5f;
+// relative to the mesh extents, caps how far a single simplification step may go
+constexpr float LOD_TARGET_ERROR = 0.05f;
+// a level has to drop at least 15% of the previous one to be worth keeping
+constexpr float LOD_MIN_REDUCTION = 0.85f;
+constexpr size_t LOD_MIN_TRIANGLES = 32;
+
+constexpr size_t OCCLUDER_TRIANGLE_BUDGET = 256;
+// occluders have to stay conservative, so the silhouette may only move by 1% of the extents
+constexpr float OCCLUDER_TARGET_ERROR = 0.01f;
+// anything bigger costs more to rasterize than it saves
+constexpr size_t OCCLUDER_MAX_TRIANGLES = OCCLUDER_TRIANGLE_BUDGET * 4;
+
+meshopt_VertexCacheStatistics analyzeCache(const std::vector<uint32_t>& indices, size_t vertexCount) {
+	return meshopt_analyzeVertexCache(indices.data(), indices.size(), vertexCount, CACHE_SIZE, 0, 0);
+}
+
+}// namespace
+
+MeshOptimizeStats optimizeMesh(std::vector<uint32_t>& indices, std::vector<Vertex>& vertices, std::span<const IndexRange> ranges) {
+	MeshOptimizeStats stats{};
+	stats.vertexCountBefore = vertices.size();
+
+	if (indices.empty() || vertices.empty()) {
+		stats.vertexCountAfter = vertices.size();
+		return stats;
+	}
+
+	const meshopt_VertexCacheStatistics before = analyzeCache(indices, vertices.size());
+	stats.acmrBefore = before.acmr;
+	stats.atvrBefore = before.atvr;
+
+	// merge bitwise identical vertices, glTF exporters often split them per primitive
+	std::vector<uint32_t> remap(vertices.size());
+	const size_t uniqueCount = meshopt_generateVertexRemap(remap.data(), indices.data(), indices.size(), vertices.data(), vertices.size(), sizeof(Vertex));
+
+	meshopt_remapIndexBuffer(indices.data(), indices.data(), indices.size(), remap.data());
+	std::vector<Vertex> uniqueVertices(uniqueCount);
+	meshopt_remapVertexBuffer(uniqueVertices.data(), vertices.data(), vertices.size(), sizeof(Vertex), remap.data());
+	vertices = std::move(uniqueVertices);
+
+	// triangles never move between ranges, each one is drawn on its own
+	for (const IndexRange& range : ranges) {
+		uint32_t* rangeIndices = indices.data() + range.startIndex;
+		meshopt_optimizeVertexCache(rangeIndices, rangeIndices, range.count, vertices.size());
+		meshopt_optimizeOverdraw(rangeIndices, rangeIndices, range.count, &vertices[0].position.x, vertices.size(), sizeof(Vertex), OVERDRAW_THRESHOLD);
+	}
+
+	// vertices unreferenced by any range are dropped here
+	const size_t fetchedCount = meshopt_optimizeVertexFetch(vertices.data(), indices.data(), indices.size(), vertices.data(), vertices.size(), sizeof(Vertex));
+	vertices.resize(fetchedCount);
+
+	const meshopt_VertexCacheStatistics after = analyzeCache(indices, vertices.size());
+	stats.acmrAfter = after.acmr;
+	stats.atvrAfter = after.atvr;
+	stats.vertexCountAfter = vertices.size();
+
+	return stats;
+}
+
+uint32_t generateLods(std::vector<uint32_t>& indices, std::span<const Vertex> vertices, IndexRange source, std::span<LodLevel> lods) {
+	if (lods.empty()) {
+		return 0;
+	}
+	lods[0] = LodLevel{ .startIndex = source.startIndex, .count = source.count, .error = 0.f };
+
+	if (vertices.empty()) {
+		return 1;
+	}
+
+	const float* positions = &vertices[0].position.x;
+	// simplifier errors are relative to the mesh extents
+	const float errorScale = meshopt_simplifyScale(positions, vertices.size(), sizeof(Vertex));
+
+	std::vector<uint32_t> previous(indices.begin() + source.startIndex, indices.begin() + source.startIndex + source.count);
+	std::vector<uint32_t> simplified(previous.size());
+
+	uint32_t levelCount = 1;
+	float error = 0.f;
+	while (levelCount < lods.size()) {
+		const size_t targetIndexCount = static_cast<size_t>(static_cast<float>(previous.size() / 3) * LOD_REDUCTION) * 3;
+		if (targetIndexCount < LOD_MIN_TRIANGLES * 3) {
+			break;
+		}
+
+		// each level starts from the previous one, so the deviation from LOD 0 is bounded by the sum
+		float stepError = 0.f;
+		simplified.resize(previous.size());
+		const size_t indexCount = meshopt_simplify(simplified.data(), previous.data(), previous.size(), positions, vertices.size(), sizeof(Vertex),
+				targetIndexCount, LOD_TARGET_ERROR, 0, &stepError);
+		if (indexCount == 0 || static_cast<float>(indexCount) > static_cast<float>(previous.size()) * LOD_MIN_REDUCTION) {
+			break;
+		}
+		simplified.resize(indexCount);
+		meshopt_optimizeVertexCache(simplified.data(), simplified.data(), simplified.size(), vertices.size());
+
+		error += stepError * errorScale;
+		lods[levelCount] = LodLevel{ .startIndex = static_cast<uint32_t>(indices.size()), .count = static_cast<uint32_t>(indexCount), .error = error };
+		indices.insert(indices.end(), simplified.begin(), simplified.end());
+		levelCount++;
+
+		std::swap(previous, simplified);
+	}
+
+	return levelCount;
+}
+
+OccluderMesh buildOccluder(std::span<const uint32_t> indices, std::span<const Vertex> vertices, std::span<const IndexRange> ranges) {
+	OccluderMesh occluder;
+	if (vertices.empty()) {
+		return occluder;
+	}
+
+	std::vector<uint32_t> source;
+	for (const IndexRange& range : ranges) {
+		source.insert(source.end(), indices.begin() + range.startIndex, indices.begin() + range.startIndex + range.count);
+	}
+	if (source.empty()) {
+		return occluder;
+	}
+
+	// lock the borders, holes in an occluder would let everything behind it through
+	std::vector<uint32_t> simplified(source.size());
+	const size_t indexCount = meshopt_simplify(simplified.data(), source.data(), source.size(), &vertices[0].position.x, vertices.size(), sizeof(Vertex),
+			std::min(source.size(), OCCLUDER_TRIANGLE_BUDGET * 3), OCCLUDER_TARGET_ERROR, meshopt_SimplifyLockBorder, nullptr);
+	if (indexCount == 0 || indexCount > OCCLUDER_MAX_TRIANGLES * 3) {
+		return occluder;
+	}
+	simplified.resize(indexCount);
+
+	// keep only the referenced positions
+	std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+	occluder.indices.reserve(indexCount);
+	for (uint32_t index : simplified) {
+		if (remap[index] == UINT32_MAX) {
+			remap[index] = static_cast<uint32_t>(occluder.positions.size());
+			occluder.positions.push_back(vertices[index].position);
+		}
+		occluder.indices.push_back(remap[index]);
+	}
+
+	glm::vec3 minPos = occluder.positions[0];
+	glm::vec3 maxPos = occluder.positions[0];
+	for (const glm::vec3& position : occluder.positions) {
+		minPos = glm::min(minPos, position);
+		maxPos = glm::max(maxPos, position);
+	}
+	occluder.center = (minPos + maxPos) * 0.5f;
+	occluder.radius = glm::length(maxPos - minPos) * 0.5f;
+
+	return occluder;
+}
+
+}// namespace pm
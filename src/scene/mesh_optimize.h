@@ -0,0 +1,41 @@
+#pragma once
+
+#include "lod.h"
+#include "occlusion_buffer.h"
+#include "vk_types.h"
+
+namespace pm {
+
+// one draw inside a mesh index buffer, indices [startIndex, startIndex + count)
+struct IndexRange {
+		uint32_t startIndex;
+		uint32_t count;
+};
+
+// ACMR: vertex shader invocations per triangle, ATVR: invocations per unique vertex (1.0 is optimal).
+// both are simulated with a 16 entry FIFO post-transform cache
+struct MeshOptimizeStats {
+		size_t vertexCountBefore;
+		size_t vertexCountAfter;
+		float acmrBefore;
+		float atvrBefore;
+		float acmrAfter;
+		float atvrAfter;
+};
+
+// reorder a mesh for the GPU with meshoptimizer: identical vertices are merged, then the
+// triangles of each range are reordered for the post-transform cache and for overdraw and
+// finally vertices are laid out in the order they are first fetched.
+// ranges keep their start and count, only the triangle order inside each one changes
+MeshOptimizeStats optimizeMesh(std::vector<uint32_t>& indices, std::vector<Vertex>& vertices, std::span<const IndexRange> ranges);
+
+// quadric error simplification of source into coarser levels, each aiming at half the
+// triangles of the previous one. the new levels are appended to indices and reuse vertices.
+// lods[0] is source with no error, returns the number of levels written to lods
+uint32_t generateLods(std::vector<uint32_t>& indices, std::span<const Vertex> vertices, IndexRange source, std::span<LodLevel> lods);
+
+// simplify the given ranges together into a low poly occluder with its own compact vertex list.
+// pass only opaque ranges, returns an empty occluder when the mesh doesn't simplify well enough
+OccluderMesh buildOccluder(std::span<const uint32_t> indices, std::span<const Vertex> vertices, std::span<const IndexRange> ranges);
+
+}// namespace pm
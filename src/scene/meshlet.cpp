@@ -0,0 +1,54 @@
+#include <meshoptimizer.h>
+
+#include "meshlet.h"
+
+namespace pm {
+
+namespace {
+
+// trade some vertex reuse for tighter normal cones, see meshopt_buildMeshlets
+constexpr float MESHLET_CONE_WEIGHT = 0.25f;
+
+}// namespace
+
+uint32_t buildMeshlets(std::vector<uint32_t>& indices, std::span<const Vertex> vertices, IndexRange range, std::vector<Meshlet>& meshlets) {
+	if (range.count == 0 || vertices.empty()) {
+		return 0;
+	}
+
+	const float* positions = &vertices[0].position.x;
+	const size_t maxMeshlets = meshopt_buildMeshletsBound(range.count, MESHLET_MAX_VERTICES, MESHLET_MAX_TRIANGLES);
+
+	std::vector<meshopt_Meshlet> built(maxMeshlets);
+	std::vector<unsigned int> meshletVertices(maxMeshlets * MESHLET_MAX_VERTICES);
+	std::vector<unsigned char> meshletTriangles(maxMeshlets * MESHLET_MAX_TRIANGLES * 3);
+
+	const size_t meshletCount = meshopt_buildMeshlets(built.data(), meshletVertices.data(), meshletTriangles.data(),
+			indices.data() + range.startIndex, range.count, positions, vertices.size(), sizeof(Vertex),
+			MESHLET_MAX_VERTICES, MESHLET_MAX_TRIANGLES, MESHLET_CONE_WEIGHT);
+
+	// every triangle lands in exactly one meshlet, so the rewritten range keeps its size
+	uint32_t cursor = range.startIndex;
+	for (size_t m = 0; m < meshletCount; m++) {
+		const meshopt_Meshlet& source = built[m];
+		const unsigned int* localVertices = &meshletVertices[source.vertex_offset];
+		const unsigned char* localTriangles = &meshletTriangles[source.triangle_offset];
+
+		const meshopt_Bounds bounds = meshopt_computeMeshletBounds(localVertices, localTriangles, source.triangle_count, positions, vertices.size(), sizeof(Vertex));
+
+		Meshlet meshlet{};
+		meshlet.sphere = glm::vec4{ bounds.center[0], bounds.center[1], bounds.center[2], bounds.radius };
+		meshlet.cone = glm::vec4{ bounds.cone_axis[0], bounds.cone_axis[1], bounds.cone_axis[2], bounds.cone_cutoff };
+		meshlet.firstIndex = cursor;
+		meshlet.indexCount = source.triangle_count * 3;
+		meshlets.push_back(meshlet);
+
+		for (uint32_t i = 0; i < meshlet.indexCount; i++) {
+			indices[cursor++] = localVertices[localTriangles[i]];
+		}
+	}
+
+	return static_cast<uint32_t>(meshletCount);
+}
+
+}// namespace pm
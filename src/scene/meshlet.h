@@ -0,0 +1,31 @@
+#pragma once
+
+#include "mesh_optimize.h"
+#include "vk_types.h"
+
+namespace pm {
+
+// cluster limits, 124 rather than 126 triangles keeps the index run of a full meshlet
+// a multiple of 4 bytes with 16 bit indices
+constexpr size_t MESHLET_MAX_VERTICES = 64;
+constexpr size_t MESHLET_MAX_TRIANGLES = 124;
+
+// a run of triangles inside the mesh index buffer with its culling data.
+// GPU layout, must match res/shaders/cluster_cull.comp
+struct Meshlet {
+		// object space bounding sphere, center + radius
+		glm::vec4 sphere;
+		// object space normal cone axis + cos of the cutoff angle, a cutoff of 1 disables the backface test
+		glm::vec4 cone;
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		uint32_t padding[2];
+};
+static_assert(sizeof(Meshlet) == 48, "Meshlet must match the std430 layout in the shaders");
+
+// split the triangles of range into meshlets with meshoptimizer. the range is rewritten
+// in meshlet order so each meshlet is a contiguous run of indices, the meshlets are
+// appended to meshlets. returns how many were added
+uint32_t buildMeshlets(std::vector<uint32_t>& indices, std::span<const Vertex> vertices, IndexRange range, std::vector<Meshlet>& meshlets);
+
+}// namespace pm
@@ -0,0 +1,249 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numbers>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include <tbb/parallel_for.h>
+
+#include "mip_filter.h"
+
+namespace pm {
+
+namespace {
+
+// kaiser window half width in destination texels and its shape parameter
+constexpr float KAISER_WIDTH = 3.f;
+constexpr float KAISER_ALPHA = 4.f;
+
+// one RGBA texel in float, a single SSE register when available
+#if defined(__SSE2__)
+
+using Texel = __m128;
+
+inline Texel texelZero() {
+	return _mm_setzero_ps();
+}
+
+inline Texel loadTexel(const uint8_t* p) {
+	int32_t packed;
+	memcpy(&packed, p, 4);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i wide = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+	return _mm_cvtepi32_ps(wide);
+}
+
+inline Texel loadTexel(const float* p) {
+	return _mm_loadu_ps(p);
+}
+
+inline Texel multiplyAdd(Texel acc, Texel t, float weight) {
+	return _mm_add_ps(acc, _mm_mul_ps(t, _mm_set1_ps(weight)));
+}
+
+inline void storeTexel(float* p, Texel t) {
+	_mm_storeu_ps(p, t);
+}
+
+inline void storeTexel(uint8_t* p, Texel t) {
+	// cvtps rounds to nearest, packs saturate to 0..255
+	const __m128i rounded = _mm_cvtps_epi32(t);
+	const __m128i packed16 = _mm_packs_epi32(rounded, rounded);
+	const int32_t packed = _mm_cvtsi128_si32(_mm_packus_epi16(packed16, packed16));
+	memcpy(p, &packed, 4);
+}
+
+#else
+
+struct Texel {
+		float c[4];
+};
+
+inline Texel texelZero() {
+	return Texel{};
+}
+
+inline Texel loadTexel(const uint8_t* p) {
+	return Texel{ { float(p[0]), float(p[1]), float(p[2]), float(p[3]) } };
+}
+
+inline Texel loadTexel(const float* p) {
+	return Texel{ { p[0], p[1], p[2], p[3] } };
+}
+
+inline Texel multiplyAdd(Texel acc, Texel t, float weight) {
+	for (uint32_t ch = 0; ch < 4; ch++) {
+		acc.c[ch] += t.c[ch] * weight;
+	}
+	return acc;
+}
+
+inline void storeTexel(float* p, Texel t) {
+	memcpy(p, t.c, sizeof(t.c));
+}
+
+inline void storeTexel(uint8_t* p, Texel t) {
+	for (uint32_t ch = 0; ch < 4; ch++) {
+		p[ch] = static_cast<uint8_t>(std::clamp(std::lround(t.c[ch]), 0l, 255l));
+	}
+}
+
+#endif
+
+std::vector<uint8_t> downsampleBox(const uint8_t* rgba, uint32_t width, uint32_t height) {
+	const uint32_t outWidth = std::max(width / 2, 1u);
+	const uint32_t outHeight = std::max(height / 2, 1u);
+	std::vector<uint8_t> result(size_t(outWidth) * outHeight * 4);
+
+	tbb::parallel_for(uint32_t(0), outHeight, [&](uint32_t y) {
+		// odd sizes drop the last row or column, 1 texel wide images repeat it
+		const uint8_t* row0 = rgba + size_t(std::min(y * 2, height - 1)) * width * 4;
+		const uint8_t* row1 = rgba + size_t(std::min(y * 2 + 1, height - 1)) * width * 4;
+		uint8_t* out = result.data() + size_t(y) * outWidth * 4;
+
+		uint32_t x = 0;
+#if defined(__SSE2__)
+		if (width >= 2) {
+			// 4 source texels per row become 2 destination texels
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i bias = _mm_set1_epi16(2);
+			for (; x + 2 <= outWidth; x += 2) {
+				const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 8));
+				const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 8));
+
+				// vertical sums, lo holds texels 0 and 1, hi texels 2 and 3
+				const __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+				const __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+
+				// horizontal pairs: (0 + 1, 2 + 3)
+				__m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+				sum = _mm_srli_epi16(_mm_add_epi16(sum, bias), 2);
+
+				_mm_storel_epi64(reinterpret_cast<__m128i*>(out + x * 4), _mm_packus_epi16(sum, sum));
+			}
+		}
+#endif
+		for (; x < outWidth; x++) {
+			const uint32_t x0 = std::min(x * 2, width - 1);
+			const uint32_t x1 = std::min(x * 2 + 1, width - 1);
+			for (uint32_t ch = 0; ch < 4; ch++) {
+				const uint32_t sum = row0[x0 * 4 + ch] + row0[x1 * 4 + ch] + row1[x0 * 4 + ch] + row1[x1 * 4 + ch];
+				out[x * 4 + ch] = static_cast<uint8_t>((sum + 2) / 4);
+			}
+		}
+	});
+
+	return result;
+}
+
+// zeroth order modified bessel function of the first kind
+float besselI0(float x) {
+	float sum = 1.f;
+	float term = 1.f;
+	const float halfSquared = x * x * 0.25f;
+	for (int k = 1; k < 32 && term > sum * 1e-8f; k++) {
+		term *= halfSquared / static_cast<float>(k * k);
+		sum += term;
+	}
+	return sum;
+}
+
+float kaiser(float x) {
+	const float sinc = x == 0.f ? 1.f : std::sin(std::numbers::pi_v<float> * x) / (std::numbers::pi_v<float> * x);
+	const float t = x / KAISER_WIDTH;
+	const float window = besselI0(KAISER_ALPHA * std::sqrt(std::max(1.f - t * t, 0.f))) / besselI0(KAISER_ALPHA);
+	return sinc * window;
+}
+
+// source texels and normalized weights contributing to every destination texel of one axis
+struct FilterTaps {
+		uint32_t tapCount;
+		std::vector<uint32_t> sources;
+		std::vector<float> weights;
+};
+
+FilterTaps kaiserTaps(uint32_t sourceSize, uint32_t destinationSize) {
+	const float scale = static_cast<float>(sourceSize) / static_cast<float>(destinationSize);
+	const float support = KAISER_WIDTH * scale;
+
+	FilterTaps taps{};
+	taps.tapCount = static_cast<uint32_t>(std::ceil(support)) * 2 + 1;
+	taps.sources.resize(size_t(destinationSize) * taps.tapCount);
+	taps.weights.resize(size_t(destinationSize) * taps.tapCount);
+
+	for (uint32_t d = 0; d < destinationSize; d++) {
+		const float center = (static_cast<float>(d) + 0.5f) * scale;
+		const int32_t first = static_cast<int32_t>(std::floor(center - support));
+
+		float total = 0.f;
+		for (uint32_t t = 0; t < taps.tapCount; t++) {
+			const int32_t s = first + static_cast<int32_t>(t);
+			const float weight = std::abs(static_cast<float>(s) + 0.5f - center) < support ? kaiser((static_cast<float>(s) + 0.5f - center) / scale) : 0.f;
+
+			// clamp to edge
+			taps.sources[d * taps.tapCount + t] = static_cast<uint32_t>(std::clamp(s, 0, static_cast<int32_t>(sourceSize) - 1));
+			taps.weights[d * taps.tapCount + t] = weight;
+			total += weight;
+		}
+		for (uint32_t t = 0; t < taps.tapCount; t++) {
+			taps.weights[d * taps.tapCount + t] /= total;
+		}
+	}
+
+	return taps;
+}
+
+std::vector<uint8_t> downsampleKaiser(const uint8_t* rgba, uint32_t width, uint32_t height) {
+	const uint32_t outWidth = std::max(width / 2, 1u);
+	const uint32_t outHeight = std::max(height / 2, 1u);
+
+	const FilterTaps horizontal = kaiserTaps(width, outWidth);
+	const FilterTaps vertical = kaiserTaps(height, outHeight);
+
+	// separable: rows first into a float image, then columns
+	std::vector<float> rows(size_t(outWidth) * height * 4);
+	tbb::parallel_for(uint32_t(0), height, [&](uint32_t y) {
+		const uint8_t* source = rgba + size_t(y) * width * 4;
+		float* out = rows.data() + size_t(y) * outWidth * 4;
+		for (uint32_t x = 0; x < outWidth; x++) {
+			Texel sum = texelZero();
+			for (uint32_t t = 0; t < horizontal.tapCount; t++) {
+				const size_t tap = size_t(x) * horizontal.tapCount + t;
+				sum = multiplyAdd(sum, loadTexel(source + horizontal.sources[tap] * 4), horizontal.weights[tap]);
+			}
+			storeTexel(out + x * 4, sum);
+		}
+	});
+
+	std::vector<uint8_t> result(size_t(outWidth) * outHeight * 4);
+	tbb::parallel_for(uint32_t(0), outHeight, [&](uint32_t y) {
+		uint8_t* out = result.data() + size_t(y) * outWidth * 4;
+		for (uint32_t x = 0; x < outWidth; x++) {
+			Texel sum = texelZero();
+			for (uint32_t t = 0; t < vertical.tapCount; t++) {
+				const size_t tap = size_t(y) * vertical.tapCount + t;
+				sum = multiplyAdd(sum, loadTexel(rows.data() + (size_t(vertical.sources[tap]) * outWidth + x) * 4), vertical.weights[tap]);
+			}
+			storeTexel(out + x * 4, sum);
+		}
+	});
+
+	return result;
+}
+
+}// namespace
+
+std::vector<uint8_t> downsampleImage(const uint8_t* rgba, uint32_t width, uint32_t height, MipFilter filter) {
+	switch (filter) {
+		case MipFilter::Kaiser:
+			return downsampleKaiser(rgba, width, height);
+		case MipFilter::Box:
+		default:
+			return downsampleBox(rgba, width, height);
+	}
+}
+
+}// namespace pm
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "vk_types.h"
+
+namespace pm {
+
+// downsampling filter used when mip chains are built on the CPU
+enum class MipFilter : uint8_t {
+	// 2x2 average, cheapest and the same as a linear GPU blit
+	Box,
+	// kaiser windowed sinc, keeps more detail in the smaller levels
+	Kaiser
+};
+
+// halve a RGBA8 image to max(width / 2, 1) x max(height / 2, 1). rows are spread over worker threads
+std::vector<uint8_t> downsampleImage(const uint8_t* rgba, uint32_t width, uint32_t height, MipFilter filter);
+
+}// namespace pm
@@ -0,0 +1,347 @@
+#include <algorithm>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include <tbb/parallel_for.h>
+
+#include "occlusion_buffer.h"
+
+namespace pm {
+
+namespace {
+
+// triangles smaller than this in pixels can't cover a pixel center reliably
+constexpr float MIN_TRIANGLE_AREA = 1e-4f;
+constexpr float MIN_W = 1e-6f;
+
+// reversed Z: in front of the near plane while z <= w
+float nearDistance(const glm::vec4& v) {
+	return v.w - v.z;
+}
+
+glm::vec3 toScreen(const glm::vec4& clip) {
+	const float invW = 1.f / clip.w;
+	return glm::vec3{ (clip.x * invW * 0.5f + 0.5f) * static_cast<float>(OCCLUSION_WIDTH),
+		(clip.y * invW * 0.5f + 0.5f) * static_cast<float>(OCCLUSION_HEIGHT),
+		clip.z * invW };
+}
+
+// every vertex outside of the same clip plane
+bool outsideClipPlane(const glm::vec4& v0, const glm::vec4& v1, const glm::vec4& v2) {
+	return (v0.x > v0.w && v1.x > v1.w && v2.x > v2.w) || (v0.x < -v0.w && v1.x < -v1.w && v2.x < -v2.w)
+		|| (v0.y > v0.w && v1.y > v1.w && v2.y > v2.w) || (v0.y < -v0.w && v1.y < -v1.w && v2.y < -v2.w)
+		|| (v0.z < 0.f && v1.z < 0.f && v2.z < 0.f);
+}
+
+}// namespace
+
+void OcclusionBuffer::begin(const glm::mat4& viewproj) {
+	m_viewproj = viewproj;
+	m_occluderCount = 0;
+	m_triangles.clear();
+	for (auto& bin : m_bins) {
+		bin.clear();
+	}
+	std::fill(m_depth.begin(), m_depth.end(), 0.f);
+}
+
+void OcclusionBuffer::addOccluder(const OccluderMesh& occluder, const glm::mat4& transform) {
+	const glm::mat4 mvp = m_viewproj * transform;
+
+	m_clipPositions.resize(occluder.positions.size());
+	for (size_t i = 0; i < occluder.positions.size(); i++) {
+		m_clipPositions[i] = mvp * glm::vec4(occluder.positions[i], 1.f);
+	}
+
+	for (size_t i = 0; i + 2 < occluder.indices.size(); i += 3) {
+		const glm::vec4& v0 = m_clipPositions[occluder.indices[i]];
+		const glm::vec4& v1 = m_clipPositions[occluder.indices[i + 1]];
+		const glm::vec4& v2 = m_clipPositions[occluder.indices[i + 2]];
+
+		if (outsideClipPlane(v0, v1, v2)) {
+			continue;
+		}
+
+		const float d[3] = { nearDistance(v0), nearDistance(v1), nearDistance(v2) };
+		if (d[0] >= 0.f && d[1] >= 0.f && d[2] >= 0.f) {
+			addTriangle(v0, v1, v2);
+			continue;
+		}
+		if (d[0] < 0.f && d[1] < 0.f && d[2] < 0.f) {
+			continue;
+		}
+
+		// clip against the near plane, which leaves a triangle or a quad
+		const glm::vec4* v[3] = { &v0, &v1, &v2 };
+		glm::vec4 polygon[4];
+		uint32_t count = 0;
+		for (uint32_t e = 0; e < 3; e++) {
+			const uint32_t next = (e + 1) % 3;
+			if (d[e] >= 0.f) {
+				polygon[count++] = *v[e];
+			}
+			if ((d[e] >= 0.f) != (d[next] >= 0.f)) {
+				const float t = d[e] / (d[e] - d[next]);
+				polygon[count++] = *v[e] + (*v[next] - *v[e]) * t;
+			}
+		}
+
+		for (uint32_t k = 2; k < count; k++) {
+			addTriangle(polygon[0], polygon[k - 1], polygon[k]);
+		}
+	}
+
+	m_occluderCount++;
+}
+
+void OcclusionBuffer::addTriangle(const glm::vec4& c0, const glm::vec4& c1, const glm::vec4& c2) {
+	if (c0.w < MIN_W || c1.w < MIN_W || c2.w < MIN_W) {
+		return;
+	}
+
+	glm::vec3 v0 = toScreen(c0);
+	glm::vec3 v1 = toScreen(c1);
+	glm::vec3 v2 = toScreen(c2);
+
+	// occluders are often single sided walls, so both windings are rasterized
+	float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+	if (std::abs(area) < MIN_TRIANGLE_AREA) {
+		return;
+	}
+	if (area < 0.f) {
+		std::swap(v1, v2);
+		area = -area;
+	}
+
+	Triangle tri{};
+	tri.minX = std::max(0, static_cast<int32_t>(std::floor(std::min({ v0.x, v1.x, v2.x }))));
+	tri.minY = std::max(0, static_cast<int32_t>(std::floor(std::min({ v0.y, v1.y, v2.y }))));
+	tri.maxX = std::min(static_cast<int32_t>(OCCLUSION_WIDTH) - 1, static_cast<int32_t>(std::ceil(std::max({ v0.x, v1.x, v2.x }))));
+	tri.maxY = std::min(static_cast<int32_t>(OCCLUSION_HEIGHT) - 1, static_cast<int32_t>(std::ceil(std::max({ v0.y, v1.y, v2.y }))));
+	if (tri.minX > tri.maxX || tri.minY > tri.maxY) {
+		return;
+	}
+
+	// edge a -> b is positive on the inside, the half pixel offset moves the
+	// evaluation to pixel centers so the rasterizer can use integer coordinates
+	const glm::vec3* corners[3] = { &v0, &v1, &v2 };
+	for (uint32_t e = 0; e < 3; e++) {
+		const glm::vec3& a = *corners[e];
+		const glm::vec3& b = *corners[(e + 1) % 3];
+		tri.edgeA[e] = a.y - b.y;
+		tri.edgeB[e] = b.x - a.x;
+		tri.edgeC[e] = -(tri.edgeA[e] * a.x + tri.edgeB[e] * a.y) + 0.5f * (tri.edgeA[e] + tri.edgeB[e]);
+	}
+
+	// z / w is affine in screen space
+	tri.depthA = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) / area;
+	tri.depthB = ((v1.x - v0.x) * (v2.z - v0.z) - (v2.x - v0.x) * (v1.z - v0.z)) / area;
+	tri.depthC = v0.z - tri.depthA * v0.x - tri.depthB * v0.y + 0.5f * (tri.depthA + tri.depthB);
+
+	const auto index = static_cast<uint32_t>(m_triangles.size());
+	m_triangles.push_back(tri);
+
+	for (int32_t ty = tri.minY / static_cast<int32_t>(OCCLUSION_TILE_SIZE); ty <= tri.maxY / static_cast<int32_t>(OCCLUSION_TILE_SIZE); ty++) {
+		for (int32_t tx = tri.minX / static_cast<int32_t>(OCCLUSION_TILE_SIZE); tx <= tri.maxX / static_cast<int32_t>(OCCLUSION_TILE_SIZE); tx++) {
+			m_bins[ty * OCCLUSION_TILES_X + tx].push_back(index);
+		}
+	}
+}
+
+void OcclusionBuffer::rasterize() {
+	tbb::parallel_for(uint32_t(0), OCCLUSION_TILES_X * OCCLUSION_TILES_Y, [&](uint32_t tile) {
+		rasterizeTile(tile);
+	});
+}
+
+#if defined(__AVX__)
+
+void OcclusionBuffer::rasterizeTile(uint32_t tile) {
+	const int32_t tileX = static_cast<int32_t>((tile % OCCLUSION_TILES_X) * OCCLUSION_TILE_SIZE);
+	const int32_t tileY = static_cast<int32_t>((tile / OCCLUSION_TILES_X) * OCCLUSION_TILE_SIZE);
+	const __m256 laneOffsets = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+	const __m256 zero = _mm256_setzero_ps();
+
+	for (uint32_t index : m_bins[tile]) {
+		const Triangle& tri = m_triangles[index];
+
+		// 8 wide spans, tiles are 8 aligned so a span never leaves the tile
+		const int32_t minX = std::max(tri.minX, tileX) & ~7;
+		const int32_t maxX = std::min(tri.maxX, tileX + static_cast<int32_t>(OCCLUSION_TILE_SIZE) - 1);
+		const int32_t minY = std::max(tri.minY, tileY);
+		const int32_t maxY = std::min(tri.maxY, tileY + static_cast<int32_t>(OCCLUSION_TILE_SIZE) - 1);
+
+		for (int32_t y = minY; y <= maxY; y++) {
+			const float fy = static_cast<float>(y);
+			const __m256 row0 = _mm256_set1_ps(tri.edgeB[0] * fy + tri.edgeC[0]);
+			const __m256 row1 = _mm256_set1_ps(tri.edgeB[1] * fy + tri.edgeC[1]);
+			const __m256 row2 = _mm256_set1_ps(tri.edgeB[2] * fy + tri.edgeC[2]);
+			const __m256 rowDepth = _mm256_set1_ps(tri.depthB * fy + tri.depthC);
+			float* depthRow = m_depth.data() + y * OCCLUSION_WIDTH;
+
+			for (int32_t x = minX; x <= maxX; x += 8) {
+				const __m256 px = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(x)), laneOffsets);
+				const __m256 e0 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(tri.edgeA[0]), px), row0);
+				const __m256 e1 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(tri.edgeA[1]), px), row1);
+				const __m256 e2 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(tri.edgeA[2]), px), row2);
+
+				__m256 inside = _mm256_cmp_ps(e0, zero, _CMP_GE_OQ);
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(e1, zero, _CMP_GE_OQ));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(e2, zero, _CMP_GE_OQ));
+				if (_mm256_movemask_ps(inside) == 0) {
+					continue;
+				}
+
+				const __m256 depth = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(tri.depthA), px), rowDepth);
+				const __m256 old = _mm256_loadu_ps(depthRow + x);
+				_mm256_storeu_ps(depthRow + x, _mm256_blendv_ps(old, _mm256_max_ps(old, depth), inside));
+			}
+		}
+	}
+}
+
+#elif defined(__SSE2__)
+
+void OcclusionBuffer::rasterizeTile(uint32_t tile) {
+	const int32_t tileX = static_cast<int32_t>((tile % OCCLUSION_TILES_X) * OCCLUSION_TILE_SIZE);
+	const int32_t tileY = static_cast<int32_t>((tile / OCCLUSION_TILES_X) * OCCLUSION_TILE_SIZE);
+	const __m128 laneOffsets = _mm_setr_ps(0.f, 1.f, 2.f, 3.f);
+	const __m128 zero = _mm_setzero_ps();
+
+	for (uint32_t index : m_bins[tile]) {
+		const Triangle& tri = m_triangles[index];
+
+		// 4 wide spans, tiles are 4 aligned so a span never leaves the tile
+		const int32_t minX = std::max(tri.minX, tileX) & ~3;
+		const int32_t maxX = std::min(tri.maxX, tileX + static_cast<int32_t>(OCCLUSION_TILE_SIZE) - 1);
+		const int32_t minY = std::max(tri.minY, tileY);
+		const int32_t maxY = std::min(tri.maxY, tileY + static_cast<int32_t>(OCCLUSION_TILE_SIZE) - 1);
+
+		for (int32_t y = minY; y <= maxY; y++) {
+			const float fy = static_cast<float>(y);
+			const __m128 row0 = _mm_set1_ps(tri.edgeB[0] * fy + tri.edgeC[0]);
+			const __m128 row1 = _mm_set1_ps(tri.edgeB[1] * fy + tri.edgeC[1]);
+			const __m128 row2 = _mm_set1_ps(tri.edgeB[2] * fy + tri.edgeC[2]);
+			const __m128 rowDepth = _mm_set1_ps(tri.depthB * fy + tri.depthC);
+			float* depthRow = m_depth.data() + y * OCCLUSION_WIDTH;
+
+			for (int32_t x = minX; x <= maxX; x += 4) {
+				const __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), laneOffsets);
+				const __m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.edgeA[0]), px), row0);
+				const __m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.edgeA[1]), px), row1);
+				const __m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.edgeA[2]), px), row2);
+
+				__m128 inside = _mm_cmpge_ps(e0, zero);
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(e1, zero));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(e2, zero));
+				if (_mm_movemask_ps(inside) == 0) {
+					continue;
+				}
+
+				const __m128 depth = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.depthA), px), rowDepth);
+				const __m128 old = _mm_loadu_ps(depthRow + x);
+				// no blendv before SSE4.1
+				const __m128 merged = _mm_or_ps(_mm_and_ps(inside, _mm_max_ps(old, depth)), _mm_andnot_ps(inside, old));
+				_mm_storeu_ps(depthRow + x, merged);
+			}
+		}
+	}
+}
+
+#else
+
+void OcclusionBuffer::rasterizeTile(uint32_t tile) {
+	const int32_t tileX = static_cast<int32_t>((tile % OCCLUSION_TILES_X) * OCCLUSION_TILE_SIZE);
+	const int32_t tileY = static_cast<int32_t>((tile / OCCLUSION_TILES_X) * OCCLUSION_TILE_SIZE);
+
+	for (uint32_t index : m_bins[tile]) {
+		const Triangle& tri = m_triangles[index];
+
+		const int32_t minX = std::max(tri.minX, tileX);
+		const int32_t maxX = std::min(tri.maxX, tileX + static_cast<int32_t>(OCCLUSION_TILE_SIZE) - 1);
+		const int32_t minY = std::max(tri.minY, tileY);
+		const int32_t maxY = std::min(tri.maxY, tileY + static_cast<int32_t>(OCCLUSION_TILE_SIZE) - 1);
+
+		for (int32_t y = minY; y <= maxY; y++) {
+			float* depthRow = m_depth.data() + y * OCCLUSION_WIDTH;
+			for (int32_t x = minX; x <= maxX; x++) {
+				bool inside = true;
+				for (uint32_t e = 0; e < 3; e++) {
+					inside = inside && tri.edgeA[e] * x + tri.edgeB[e] * y + tri.edgeC[e] >= 0.f;
+				}
+				if (inside) {
+					depthRow[x] = std::max(depthRow[x], tri.depthA * x + tri.depthB * y + tri.depthC);
+				}
+			}
+		}
+	}
+}
+
+#endif
+
+bool OcclusionBuffer::isVisible(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& transform) const {
+	const glm::mat4 mvp = m_viewproj * transform;
+
+	glm::vec2 screenMin{ static_cast<float>(OCCLUSION_WIDTH), static_cast<float>(OCCLUSION_HEIGHT) };
+	glm::vec2 screenMax{ 0.f };
+	// closest point of the box, larger is closer with reversed Z
+	float closest = 0.f;
+	for (uint32_t corner = 0; corner < 8; corner++) {
+		const glm::vec3 p{ corner & 1 ? boundsMax.x : boundsMin.x, corner & 2 ? boundsMax.y : boundsMin.y, corner & 4 ? boundsMax.z : boundsMin.z };
+		const glm::vec4 clip = mvp * glm::vec4(p, 1.f);
+		// the box reaches the camera, nothing can be in front of it
+		if (clip.w < MIN_W || nearDistance(clip) < 0.f) {
+			return true;
+		}
+
+		const glm::vec3 screen = toScreen(clip);
+		screenMin = glm::min(screenMin, glm::vec2(screen));
+		screenMax = glm::max(screenMax, glm::vec2(screen));
+		closest = std::max(closest, screen.z);
+	}
+
+	// every pixel the rectangle touches
+	const int32_t minX = std::max(0, static_cast<int32_t>(std::floor(screenMin.x)));
+	const int32_t minY = std::max(0, static_cast<int32_t>(std::floor(screenMin.y)));
+	const int32_t maxX = std::min(static_cast<int32_t>(OCCLUSION_WIDTH) - 1, static_cast<int32_t>(std::floor(screenMax.x)));
+	const int32_t maxY = std::min(static_cast<int32_t>(OCCLUSION_HEIGHT) - 1, static_cast<int32_t>(std::floor(screenMax.y)));
+	if (minX > maxX || minY > maxY) {
+		// off screen, that is for the frustum test to decide
+		return true;
+	}
+
+	// visible as soon as one pixel has no occluder in front of the box
+	for (int32_t y = minY; y <= maxY; y++) {
+		const float* depthRow = m_depth.data() + y * OCCLUSION_WIDTH;
+		int32_t x = minX;
+#if defined(__AVX__)
+		const __m256 boxDepth = _mm256_set1_ps(closest);
+		for (; x + 7 <= maxX; x += 8) {
+			if (_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(depthRow + x), boxDepth, _CMP_LE_OQ)) != 0) {
+				return true;
+			}
+		}
+#elif defined(__SSE2__)
+		const __m128 boxDepth = _mm_set1_ps(closest);
+		for (; x + 3 <= maxX; x += 4) {
+			if (_mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(depthRow + x), boxDepth)) != 0) {
+				return true;
+			}
+		}
+#endif
+		for (; x <= maxX; x++) {
+			if (depthRow[x] <= closest) {
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+}// namespace pm
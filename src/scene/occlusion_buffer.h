@@ -0,0 +1,80 @@
+#pragma once
+
+#include "vk_types.h"
+
+namespace pm {
+
+// low poly stand-in for the opaque surfaces of a mesh, rasterized into an OcclusionBuffer.
+// empty when the mesh is not worth using as an occluder
+struct OccluderMesh {
+		std::vector<glm::vec3> positions;
+		std::vector<uint32_t> indices;
+		// local space bounding sphere of the positions
+		glm::vec3 center{ 0.f };
+		float radius{ 0.f };
+
+		bool empty() const { return indices.empty(); }
+		uint32_t triangleCount() const { return static_cast<uint32_t>(indices.size() / 3); }
+};
+
+// resolution of the software depth buffer, a multiple of the tile size
+constexpr uint32_t OCCLUSION_WIDTH = 256;
+constexpr uint32_t OCCLUSION_HEIGHT = 128;
+// triangles are binned into square tiles, each one is rasterized by a single worker
+constexpr uint32_t OCCLUSION_TILE_SIZE = 32;
+constexpr uint32_t OCCLUSION_TILES_X = OCCLUSION_WIDTH / OCCLUSION_TILE_SIZE;
+constexpr uint32_t OCCLUSION_TILES_Y = OCCLUSION_HEIGHT / OCCLUSION_TILE_SIZE;
+
+static_assert(OCCLUSION_WIDTH % OCCLUSION_TILE_SIZE == 0 && OCCLUSION_HEIGHT % OCCLUSION_TILE_SIZE == 0);
+
+// Small CPU depth buffer for occlusion culling without GPU readback.
+// Occluders are clipped against the near plane and binned on the calling thread, then
+// rasterize() fills the tiles in parallel with SSE/AVX. Depth is reversed Z like the
+// renderer (0 is far), each pixel keeps the closest occluder.
+// Once rasterized, isVisible() may be called from any number of threads.
+class OcclusionBuffer {
+	public:
+		// clears the buffer and the bins
+		void begin(const glm::mat4& viewproj);
+		void addOccluder(const OccluderMesh& occluder, const glm::mat4& transform);
+		void rasterize();
+
+		// false when the box is completely behind the occluders. boxes crossing the near
+		// plane are always visible, boxes crossing the screen borders are tested against
+		// the part that is on screen
+		bool isVisible(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& transform) const;
+
+		const float* depth() const { return m_depth.data(); }
+		uint32_t triangleCount() const { return static_cast<uint32_t>(m_triangles.size()); }
+		uint32_t occluderCount() const { return m_occluderCount; }
+
+	private:
+		// edge functions and depth plane of a screen space triangle, evaluated at pixel centers
+		struct Triangle {
+				float edgeA[3];
+				float edgeB[3];
+				float edgeC[3];
+				// depth = depthA * x + depthB * y + depthC
+				float depthA;
+				float depthB;
+				float depthC;
+				int32_t minX;
+				int32_t minY;
+				int32_t maxX;
+				int32_t maxY;
+		};
+
+		void addTriangle(const glm::vec4& v0, const glm::vec4& v1, const glm::vec4& v2);
+		void rasterizeTile(uint32_t tile);
+
+		glm::mat4 m_viewproj{ 1.f };
+		uint32_t m_occluderCount{ 0 };
+
+		std::vector<float> m_depth = std::vector<float>(OCCLUSION_WIDTH * OCCLUSION_HEIGHT);
+		std::vector<Triangle> m_triangles;
+		std::array<std::vector<uint32_t>, OCCLUSION_TILES_X * OCCLUSION_TILES_Y> m_bins;
+		// clip space positions of the occluder being added
+		std::vector<glm::vec4> m_clipPositions;
+};
+
+}// namespace pm
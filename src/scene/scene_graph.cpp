@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <cassert>
+
+#include "scene_graph.h"
+
+namespace pm {
+
+uint32_t SceneGraph::addNode(int32_t parent, const glm::mat4& localTransform, int32_t meshIndex, std::string name) {
+	const auto index = static_cast<uint32_t>(parents.size());
+	assert(parent < static_cast<int32_t>(index));
+
+	parents.push_back(parent);
+	localTransforms.push_back(localTransform);
+	worldTransforms.push_back(localTransform);
+	dirty.push_back(1);
+	meshIndices.push_back(meshIndex);
+	names.push_back(std::move(name));
+
+	if (meshIndex != NO_MESH) {
+		meshNodes.push_back(index);
+	}
+
+	m_anyDirty = true;
+	return index;
+}
+
+void SceneGraph::setLocalTransform(uint32_t node, const glm::mat4& transform) {
+	localTransforms[node] = transform;
+	markDirty(node);
+}
+
+void SceneGraph::markDirty(uint32_t node) {
+	dirty[node] = 1;
+	m_anyDirty = true;
+}
+
+void SceneGraph::updateTransforms() {
+	if (!m_anyDirty) {
+		return;
+	}
+
+	const size_t count = parents.size();
+	const int32_t* parent = parents.data();
+	const glm::mat4* local = localTransforms.data();
+	glm::mat4* world = worldTransforms.data();
+	uint8_t* dirtyFlags = dirty.data();
+
+	// parents always come first, so by the time we reach a node its parent world
+	// matrix is final and its dirty flag has already been propagated
+	for (size_t i = 0; i < count; i++) {
+		const int32_t p = parent[i];
+		if (p == NO_PARENT) {
+			if (dirtyFlags[i]) {
+				world[i] = local[i];
+			}
+			continue;
+		}
+
+		dirtyFlags[i] |= dirtyFlags[p];
+		if (dirtyFlags[i]) {
+			world[i] = world[p] * local[i];
+		}
+	}
+
+	std::fill(dirty.begin(), dirty.end(), 0);
+	m_anyDirty = false;
+}
+
+void SceneGraph::reserve(size_t count) {
+	parents.reserve(count);
+	localTransforms.reserve(count);
+	worldTransforms.reserve(count);
+	dirty.reserve(count);
+	meshIndices.reserve(count);
+	names.reserve(count);
+}
+
+void SceneGraph::clear() {
+	parents.clear();
+	localTransforms.clear();
+	worldTransforms.clear();
+	dirty.clear();
+	meshIndices.clear();
+	names.clear();
+	meshNodes.clear();
+	m_anyDirty = false;
+}
+
+}// namespace pm
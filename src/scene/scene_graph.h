@@ -0,0 +1,41 @@
+#pragma once
+
+#include "vk_types.h"
+
+namespace pm {
+
+// Flat transform hierarchy stored as parallel arrays (SoA).
+// Nodes are kept in topological order: a parent is always stored before any of its
+// children, so world transforms can be refreshed with a single linear pass.
+struct SceneGraph {
+		static constexpr int32_t NO_PARENT = -1;
+		static constexpr int32_t NO_MESH = -1;
+
+		std::vector<int32_t> parents;
+		std::vector<glm::mat4> localTransforms;
+		std::vector<glm::mat4> worldTransforms;
+		std::vector<uint8_t> dirty;
+		std::vector<int32_t> meshIndices;
+		std::vector<std::string> names;
+
+		// indices of the nodes that have a mesh attached, in topological order
+		std::vector<uint32_t> meshNodes;
+
+		// parent must already be in the graph (or NO_PARENT), which keeps the order topological
+		uint32_t addNode(int32_t parent, const glm::mat4& localTransform, int32_t meshIndex = NO_MESH, std::string name = {});
+
+		void setLocalTransform(uint32_t node, const glm::mat4& transform);
+		void markDirty(uint32_t node);
+
+		// recompute world transforms for dirty nodes and their descendants
+		void updateTransforms();
+
+		void reserve(size_t count);
+		void clear();
+		size_t size() const { return parents.size(); }
+
+	private:
+		bool m_anyDirty{ false };
+};
+
+}// namespace pm
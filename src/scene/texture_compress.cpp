@@ -0,0 +1,592 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include <tbb/parallel_for.h>
+
+#include "texture_compress.h"
+
+namespace pm {
+
+namespace {
+
+constexpr uint32_t BLOCK_TEXELS = 16;
+
+// BC7 interpolation weights for 4 bit indices, out of 64
+constexpr uint32_t BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// one 4x4 block as float component arrays, so each channel can be loaded as a SIMD register
+struct BlockTexels {
+		alignas(32) float c[4][BLOCK_TEXELS];
+};
+
+BlockTexels toBlock(const uint8_t* texels) {
+	BlockTexels block;
+	for (uint32_t i = 0; i < BLOCK_TEXELS; i++) {
+		for (uint32_t ch = 0; ch < 4; ch++) {
+			block.c[ch][i] = texels[i * 4 + ch];
+		}
+	}
+	return block;
+}
+
+// squared distance of every texel to a palette entry, keeping the closest one.
+// texels points to one array per channel, palette is paletteSize entries of 4 floats.
+// returns the summed squared error of the chosen indices
+#if defined(__AVX__)
+
+float nearestIndices(const float* const* texels, uint32_t channels, const float* palette, uint32_t paletteSize, uint8_t* indices) {
+	float error = 0.f;
+	for (uint32_t half = 0; half < BLOCK_TEXELS; half += 8) {
+		__m256 best = _mm256_set1_ps(std::numeric_limits<float>::max());
+		__m256 bestIndex = _mm256_setzero_ps();
+
+		for (uint32_t p = 0; p < paletteSize; p++) {
+			__m256 dist = _mm256_setzero_ps();
+			for (uint32_t ch = 0; ch < channels; ch++) {
+				const __m256 d = _mm256_sub_ps(_mm256_loadu_ps(texels[ch] + half), _mm256_set1_ps(palette[p * 4 + ch]));
+				dist = _mm256_add_ps(dist, _mm256_mul_ps(d, d));
+			}
+
+			const __m256 closer = _mm256_cmp_ps(dist, best, _CMP_LT_OQ);
+			best = _mm256_blendv_ps(best, dist, closer);
+			bestIndex = _mm256_blendv_ps(bestIndex, _mm256_set1_ps(static_cast<float>(p)), closer);
+		}
+
+		alignas(32) float bestOut[8];
+		alignas(32) int32_t indexOut[8];
+		_mm256_store_ps(bestOut, best);
+		_mm256_store_si256(reinterpret_cast<__m256i*>(indexOut), _mm256_cvttps_epi32(bestIndex));
+		for (uint32_t i = 0; i < 8; i++) {
+			error += bestOut[i];
+			indices[half + i] = static_cast<uint8_t>(indexOut[i]);
+		}
+	}
+	return error;
+}
+
+#elif defined(__SSE2__)
+
+float nearestIndices(const float* const* texels, uint32_t channels, const float* palette, uint32_t paletteSize, uint8_t* indices) {
+	float error = 0.f;
+	for (uint32_t quarter = 0; quarter < BLOCK_TEXELS; quarter += 4) {
+		__m128 best = _mm_set1_ps(std::numeric_limits<float>::max());
+		__m128 bestIndex = _mm_setzero_ps();
+
+		for (uint32_t p = 0; p < paletteSize; p++) {
+			__m128 dist = _mm_setzero_ps();
+			for (uint32_t ch = 0; ch < channels; ch++) {
+				const __m128 d = _mm_sub_ps(_mm_loadu_ps(texels[ch] + quarter), _mm_set1_ps(palette[p * 4 + ch]));
+				dist = _mm_add_ps(dist, _mm_mul_ps(d, d));
+			}
+
+			// no blendv before SSE4.1
+			const __m128 closer = _mm_cmplt_ps(dist, best);
+			best = _mm_or_ps(_mm_and_ps(closer, dist), _mm_andnot_ps(closer, best));
+			bestIndex = _mm_or_ps(_mm_and_ps(closer, _mm_set1_ps(static_cast<float>(p))), _mm_andnot_ps(closer, bestIndex));
+		}
+
+		alignas(16) float bestOut[4];
+		alignas(16) int32_t indexOut[4];
+		_mm_store_ps(bestOut, best);
+		_mm_store_si128(reinterpret_cast<__m128i*>(indexOut), _mm_cvttps_epi32(bestIndex));
+		for (uint32_t i = 0; i < 4; i++) {
+			error += bestOut[i];
+			indices[quarter + i] = static_cast<uint8_t>(indexOut[i]);
+		}
+	}
+	return error;
+}
+
+#else
+
+float nearestIndices(const float* const* texels, uint32_t channels, const float* palette, uint32_t paletteSize, uint8_t* indices) {
+	float error = 0.f;
+	for (uint32_t i = 0; i < BLOCK_TEXELS; i++) {
+		float best = std::numeric_limits<float>::max();
+		for (uint32_t p = 0; p < paletteSize; p++) {
+			float dist = 0.f;
+			for (uint32_t ch = 0; ch < channels; ch++) {
+				const float d = texels[ch][i] - palette[p * 4 + ch];
+				dist += d * d;
+			}
+			if (dist < best) {
+				best = dist;
+				indices[i] = static_cast<uint8_t>(p);
+			}
+		}
+		error += best;
+	}
+	return error;
+}
+
+#endif
+
+// endpoints at both ends of the block's principal axis, found by power iteration
+// on the covariance of the first channels
+void principalEndpoints(const BlockTexels& block, uint32_t channels, float* e0, float* e1) {
+	float mean[4]{};
+	float minC[4];
+	float maxC[4];
+	for (uint32_t ch = 0; ch < channels; ch++) {
+		minC[ch] = 255.f;
+		maxC[ch] = 0.f;
+		for (uint32_t i = 0; i < BLOCK_TEXELS; i++) {
+			mean[ch] += block.c[ch][i];
+			minC[ch] = std::min(minC[ch], block.c[ch][i]);
+			maxC[ch] = std::max(maxC[ch], block.c[ch][i]);
+		}
+		mean[ch] /= BLOCK_TEXELS;
+	}
+
+	float covariance[4][4]{};
+	for (uint32_t i = 0; i < BLOCK_TEXELS; i++) {
+		for (uint32_t a = 0; a < channels; a++) {
+			for (uint32_t b = 0; b < channels; b++) {
+				covariance[a][b] += (block.c[a][i] - mean[a]) * (block.c[b][i] - mean[b]);
+			}
+		}
+	}
+
+	// the bounding box diagonal is a good first guess for the axis
+	float axis[4]{};
+	for (uint32_t ch = 0; ch < channels; ch++) {
+		axis[ch] = maxC[ch] - minC[ch];
+	}
+	for (uint32_t iteration = 0; iteration < 8; iteration++) {
+		float next[4]{};
+		float length = 0.f;
+		for (uint32_t a = 0; a < channels; a++) {
+			for (uint32_t b = 0; b < channels; b++) {
+				next[a] += covariance[a][b] * axis[b];
+			}
+			length = std::max(length, std::abs(next[a]));
+		}
+		if (length <= 0.f) {
+			break;
+		}
+		for (uint32_t ch = 0; ch < channels; ch++) {
+			axis[ch] = next[ch] / length;
+		}
+	}
+
+	float tMin = std::numeric_limits<float>::max();
+	float tMax = std::numeric_limits<float>::lowest();
+	float axisLength = 0.f;
+	for (uint32_t ch = 0; ch < channels; ch++) {
+		axisLength += axis[ch] * axis[ch];
+	}
+	if (axisLength <= 0.f) {
+		// flat block
+		for (uint32_t ch = 0; ch < channels; ch++) {
+			e0[ch] = mean[ch];
+			e1[ch] = mean[ch];
+		}
+		return;
+	}
+
+	for (uint32_t i = 0; i < BLOCK_TEXELS; i++) {
+		float t = 0.f;
+		for (uint32_t ch = 0; ch < channels; ch++) {
+			t += (block.c[ch][i] - mean[ch]) * axis[ch];
+		}
+		tMin = std::min(tMin, t);
+		tMax = std::max(tMax, t);
+	}
+
+	for (uint32_t ch = 0; ch < channels; ch++) {
+		e0[ch] = std::clamp(mean[ch] + axis[ch] * tMin / axisLength, 0.f, 255.f);
+		e1[ch] = std::clamp(mean[ch] + axis[ch] * tMax / axisLength, 0.f, 255.f);
+	}
+}
+
+// least squares endpoints for fixed indices, where texel i is lerp(e0, e1, weights[indices[i]]).
+// returns false when every texel uses the same weight
+bool refitEndpoints(const BlockTexels& block, uint32_t channels, const uint8_t* indices, const float* weights, float* e0, float* e1) {
+	float aa = 0.f;
+	float ab = 0.f;
+	float bb = 0.f;
+	float rhs0[4]{};
+	float rhs1[4]{};
+	for (uint32_t i = 0; i < BLOCK_TEXELS; i++) {
+		const float w = weights[indices[i]];
+		const float iw = 1.f - w;
+		aa += iw * iw;
+		ab += iw * w;
+		bb += w * w;
+		for (uint32_t ch = 0; ch < channels; ch++) {
+			rhs0[ch] += iw * block.c[ch][i];
+			rhs1[ch] += w * block.c[ch][i];
+		}
+	}
+
+	const float det = aa * bb - ab * ab;
+	if (std::abs(det) < 1e-6f) {
+		return false;
+	}
+
+	for (uint32_t ch = 0; ch < channels; ch++) {
+		e0[ch] = std::clamp((bb * rhs0[ch] - ab * rhs1[ch]) / det, 0.f, 255.f);
+		e1[ch] = std::clamp((aa * rhs1[ch] - ab * rhs0[ch]) / det, 0.f, 255.f);
+	}
+	return true;
+}
+
+// writes fields LSB first, the way BC7 lays out its bits
+struct BlockWriter {
+		uint8_t* out;
+		uint32_t position{ 0 };
+
+		void write(uint32_t value, uint32_t bits) {
+			for (uint32_t b = 0; b < bits; b++, position++) {
+				if ((value >> b) & 1) {
+					out[position >> 3] |= static_cast<uint8_t>(1 << (position & 7));
+				}
+			}
+		}
+};
+
+// BC1
+
+uint16_t packRGB565(const float* color) {
+	const auto r = static_cast<uint32_t>(std::lround(color[0] * 31.f / 255.f));
+	const auto g = static_cast<uint32_t>(std::lround(color[1] * 63.f / 255.f));
+	const auto b = static_cast<uint32_t>(std::lround(color[2] * 31.f / 255.f));
+	return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+void unpackRGB565(uint16_t packed, float* color) {
+	const uint32_t r = (packed >> 11) & 31;
+	const uint32_t g = (packed >> 5) & 63;
+	const uint32_t b = packed & 31;
+	color[0] = static_cast<float>((r << 3) | (r >> 2));
+	color[1] = static_cast<float>((g << 2) | (g >> 4));
+	color[2] = static_cast<float>((b << 3) | (b >> 2));
+	color[3] = 0.f;
+}
+
+// indices for the 4 color mode, color0 must be greater than color1
+float bc1Indices(const BlockTexels& block, uint16_t color0, uint16_t color1, uint8_t* indices) {
+	float palette[4][4];
+	unpackRGB565(color0, palette[0]);
+	unpackRGB565(color1, palette[1]);
+	for (uint32_t ch = 0; ch < 3; ch++) {
+		palette[2][ch] = (2.f * palette[0][ch] + palette[1][ch]) / 3.f;
+		palette[3][ch] = (palette[0][ch] + 2.f * palette[1][ch]) / 3.f;
+	}
+
+	const float* texels[] = { block.c[0], block.c[1], block.c[2] };
+	return nearestIndices(texels, 3, &palette[0][0], 4, indices);
+}
+
+struct BC1Candidate {
+		uint16_t color0;
+		uint16_t color1;
+		uint8_t indices[BLOCK_TEXELS];
+		float error;
+};
+
+BC1Candidate bc1Candidate(const BlockTexels& block, const float* e0, const float* e1) {
+	BC1Candidate candidate{ .color0 = packRGB565(e0), .color1 = packRGB565(e1) };
+	if (candidate.color0 < candidate.color1) {
+		std::swap(candidate.color0, candidate.color1);
+	}
+
+	if (candidate.color0 == candidate.color1) {
+		// the decoder switches to 3 color mode, index 0 is still color0
+		float palette[4];
+		unpackRGB565(candidate.color0, palette);
+		const float* texels[] = { block.c[0], block.c[1], block.c[2] };
+		candidate.error = nearestIndices(texels, 3, palette, 1, candidate.indices);
+	} else {
+		candidate.error = bc1Indices(block, candidate.color0, candidate.color1, candidate.indices);
+	}
+	return candidate;
+}
+
+// BC4, one channel of BC5
+
+void encodeBC4Block(const BlockTexels& block, uint32_t channel, uint8_t* out) {
+	float minValue = 255.f;
+	float maxValue = 0.f;
+	for (uint32_t i = 0; i < BLOCK_TEXELS; i++) {
+		minValue = std::min(minValue, block.c[channel][i]);
+		maxValue = std::max(maxValue, block.c[channel][i]);
+	}
+
+	const auto red0 = static_cast<uint8_t>(maxValue);
+	const auto red1 = static_cast<uint8_t>(minValue);
+	out[0] = red0;
+	out[1] = red1;
+
+	uint8_t indices[BLOCK_TEXELS]{};
+	if (red0 > red1) {
+		// 8 value mode: red0, red1, then 6 values from red0 towards red1
+		float palette[8][4]{};
+		palette[0][0] = red0;
+		palette[1][0] = red1;
+		for (uint32_t i = 1; i < 7; i++) {
+			palette[i + 1][0] = static_cast<float>((7 - i) * red0 + i * red1) / 7.f;
+		}
+
+		const float* texels[] = { block.c[channel] };
+		nearestIndices(texels, 1, &palette[0][0], 8, indices);
+	}
+
+	uint64_t bits = 0;
+	for (uint32_t i = 0; i < BLOCK_TEXELS; i++) {
+		bits |= static_cast<uint64_t>(indices[i]) << (3 * i);
+	}
+	for (uint32_t b = 0; b < 6; b++) {
+		out[2 + b] = static_cast<uint8_t>(bits >> (8 * b));
+	}
+}
+
+// BC7 mode 6
+
+struct BC7Endpoints {
+		uint8_t e0[4];
+		uint8_t e1[4];
+		uint32_t p0;
+		uint32_t p1;
+};
+
+// 7 bit endpoint plus a shared low bit, pick the low bit that fits the color best
+void quantizeBC7Endpoint(const float* color, uint8_t* quantized, uint32_t* pBit) {
+	float bestError = std::numeric_limits<float>::max();
+	for (uint32_t p = 0; p < 2; p++) {
+		uint8_t candidate[4];
+		float error = 0.f;
+		for (uint32_t ch = 0; ch < 4; ch++) {
+			const long q = std::clamp(std::lround((color[ch] - static_cast<float>(p)) / 2.f), 0l, 127l);
+			candidate[ch] = static_cast<uint8_t>((q << 1) | p);
+			const float d = candidate[ch] - color[ch];
+			error += d * d;
+		}
+		if (error < bestError) {
+			bestError = error;
+			*pBit = p;
+			memcpy(quantized, candidate, 4);
+		}
+	}
+}
+
+BC7Endpoints quantizeBC7(const float* e0, const float* e1) {
+	BC7Endpoints endpoints{};
+	quantizeBC7Endpoint(e0, endpoints.e0, &endpoints.p0);
+	quantizeBC7Endpoint(e1, endpoints.e1, &endpoints.p1);
+	return endpoints;
+}
+
+float bc7Indices(const BlockTexels& block, const BC7Endpoints& endpoints, uint8_t* indices) {
+	float palette[16][4];
+	for (uint32_t i = 0; i < 16; i++) {
+		for (uint32_t ch = 0; ch < 4; ch++) {
+			palette[i][ch] = static_cast<float>(((64 - BC7_WEIGHTS[i]) * endpoints.e0[ch] + BC7_WEIGHTS[i] * endpoints.e1[ch] + 32) >> 6);
+		}
+	}
+
+	const float* texels[] = { block.c[0], block.c[1], block.c[2], block.c[3] };
+	return nearestIndices(texels, 4, &palette[0][0], 16, indices);
+}
+
+}// namespace
+
+VkFormat compressedFormat(TextureUsage usage) {
+	switch (usage) {
+		case TextureUsage::MetalRough:
+			return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+		case TextureUsage::Normal:
+			return VK_FORMAT_BC5_UNORM_BLOCK;
+		case TextureUsage::Color:
+		default:
+			return VK_FORMAT_BC7_UNORM_BLOCK;
+	}
+}
+
+bool isBlockCompressed(VkFormat format) {
+	return format == VK_FORMAT_BC1_RGB_UNORM_BLOCK || format == VK_FORMAT_BC5_UNORM_BLOCK || format == VK_FORMAT_BC7_UNORM_BLOCK;
+}
+
+uint32_t mipLevelCount(uint32_t width, uint32_t height) {
+	return static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+}
+
+VkDeviceSize mipLevelSize(VkFormat format, uint32_t width, uint32_t height) {
+	const VkDeviceSize blocks = VkDeviceSize((width + 3) / 4) * ((height + 3) / 4);
+	switch (format) {
+		case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+			return blocks * 8;
+		case VK_FORMAT_BC5_UNORM_BLOCK:
+		case VK_FORMAT_BC7_UNORM_BLOCK:
+			return blocks * 16;
+		case VK_FORMAT_R8G8B8A8_UNORM:
+			return VkDeviceSize(width) * height * 4;
+		default:
+			std::cout << std::format("Unsupported texture format {}\n", static_cast<int>(format));
+			return 0;
+	}
+}
+
+VkDeviceSize mipChainSize(VkFormat format, uint32_t width, uint32_t height, uint32_t mipLevels) {
+	VkDeviceSize size = 0;
+	for (uint32_t mip = 0; mip < mipLevels; mip++) {
+		size += mipLevelSize(format, std::max(width >> mip, 1u), std::max(height >> mip, 1u));
+	}
+	return size;
+}
+
+void encodeBC1Block(const uint8_t* texels, uint8_t* out) {
+	const BlockTexels block = toBlock(texels);
+
+	float e0[4];
+	float e1[4];
+	principalEndpoints(block, 3, e0, e1);
+	BC1Candidate best = bc1Candidate(block, e0, e1);
+
+	// one least squares pass on the chosen indices usually pulls the endpoints in
+	constexpr float weights[4] = { 0.f, 1.f, 1.f / 3.f, 2.f / 3.f };
+	if (best.color0 != best.color1) {
+		float color0[4];
+		float color1[4];
+		unpackRGB565(best.color0, color0);
+		unpackRGB565(best.color1, color1);
+		if (refitEndpoints(block, 3, best.indices, weights, color0, color1)) {
+			BC1Candidate refit = bc1Candidate(block, color0, color1);
+			if (refit.error < best.error) {
+				best = refit;
+			}
+		}
+	}
+
+	uint32_t indexBits = 0;
+	for (uint32_t i = 0; i < BLOCK_TEXELS; i++) {
+		indexBits |= static_cast<uint32_t>(best.indices[i]) << (2 * i);
+	}
+
+	memcpy(out, &best.color0, 2);
+	memcpy(out + 2, &best.color1, 2);
+	memcpy(out + 4, &indexBits, 4);
+}
+
+void encodeBC5Block(const uint8_t* texels, uint8_t* out) {
+	const BlockTexels block = toBlock(texels);
+	encodeBC4Block(block, 0, out);
+	encodeBC4Block(block, 1, out + 8);
+}
+
+void encodeBC7Block(const uint8_t* texels, uint8_t* out) {
+	const BlockTexels block = toBlock(texels);
+
+	float e0[4];
+	float e1[4];
+	principalEndpoints(block, 4, e0, e1);
+
+	BC7Endpoints endpoints = quantizeBC7(e0, e1);
+	uint8_t indices[BLOCK_TEXELS];
+	float error = bc7Indices(block, endpoints, indices);
+
+	float weights[16];
+	for (uint32_t i = 0; i < 16; i++) {
+		weights[i] = BC7_WEIGHTS[i] / 64.f;
+	}
+	if (refitEndpoints(block, 4, indices, weights, e0, e1)) {
+		const BC7Endpoints refit = quantizeBC7(e0, e1);
+		uint8_t refitIndices[BLOCK_TEXELS];
+		const float refitError = bc7Indices(block, refit, refitIndices);
+		if (refitError < error) {
+			endpoints = refit;
+			memcpy(indices, refitIndices, BLOCK_TEXELS);
+		}
+	}
+
+	// the top bit of the first index is implied zero, swap the endpoints when it is set
+	if (indices[0] & 8) {
+		std::swap(endpoints.e0, endpoints.e1);
+		std::swap(endpoints.p0, endpoints.p1);
+		for (uint32_t i = 0; i < BLOCK_TEXELS; i++) {
+			indices[i] = 15 - indices[i];
+		}
+	}
+
+	memset(out, 0, 16);
+	BlockWriter writer{ .out = out };
+	writer.write(1 << 6, 7);
+	for (uint32_t ch = 0; ch < 4; ch++) {
+		writer.write(endpoints.e0[ch] >> 1, 7);
+		writer.write(endpoints.e1[ch] >> 1, 7);
+	}
+	writer.write(endpoints.p0, 1);
+	writer.write(endpoints.p1, 1);
+	writer.write(indices[0], 3);
+	for (uint32_t i = 1; i < BLOCK_TEXELS; i++) {
+		writer.write(indices[i], 4);
+	}
+}
+
+void encodeImage(const uint8_t* rgba, uint32_t width, uint32_t height, VkFormat format, uint8_t* out) {
+	if (!isBlockCompressed(format)) {
+		memcpy(out, rgba, mipLevelSize(format, width, height));
+		return;
+	}
+
+	const uint32_t blocksX = (width + 3) / 4;
+	const uint32_t blocksY = (height + 3) / 4;
+	const VkDeviceSize blockSize = mipLevelSize(format, 4, 4);
+
+	tbb::parallel_for(uint32_t(0), blocksY, [&](uint32_t by) {
+		uint8_t texels[BLOCK_TEXELS * 4];
+		for (uint32_t bx = 0; bx < blocksX; bx++) {
+			// gather the block, repeating the edge texels of partial blocks
+			for (uint32_t y = 0; y < 4; y++) {
+				const uint32_t sy = std::min(by * 4 + y, height - 1);
+				for (uint32_t x = 0; x < 4; x++) {
+					const uint32_t sx = std::min(bx * 4 + x, width - 1);
+					memcpy(&texels[(y * 4 + x) * 4], &rgba[(size_t(sy) * width + sx) * 4], 4);
+				}
+			}
+
+			uint8_t* block = out + (size_t(by) * blocksX + bx) * blockSize;
+			switch (format) {
+				case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+					encodeBC1Block(texels, block);
+					break;
+				case VK_FORMAT_BC5_UNORM_BLOCK:
+					encodeBC5Block(texels, block);
+					break;
+				default:
+					encodeBC7Block(texels, block);
+					break;
+			}
+		}
+	});
+}
+
+std::vector<uint8_t> buildTexture(const uint8_t* rgba, uint32_t width, uint32_t height, VkFormat format, uint32_t mipLevels, MipFilter filter) {
+	std::vector<uint8_t> result(mipChainSize(format, width, height, mipLevels));
+
+	std::vector<uint8_t> level;
+	const uint8_t* source = rgba;
+	VkDeviceSize offset = 0;
+	for (uint32_t mip = 0; mip < mipLevels; mip++) {
+		const uint32_t mipWidth = std::max(width >> mip, 1u);
+		const uint32_t mipHeight = std::max(height >> mip, 1u);
+
+		encodeImage(source, mipWidth, mipHeight, format, result.data() + offset);
+		offset += mipLevelSize(format, mipWidth, mipHeight);
+
+		if (mip + 1 < mipLevels) {
+			level = downsampleImage(source, mipWidth, mipHeight, filter);
+			source = level.data();
+		}
+	}
+
+	return result;
+}
+
+}// namespace pm
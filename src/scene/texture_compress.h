@@ -0,0 +1,43 @@
+#pragma once
+
+#include "mip_filter.h"
+#include "vk_types.h"
+
+namespace pm {
+
+// what a texture is sampled as, decides the block format it is cooked to
+enum class TextureUsage : uint8_t {
+	Color,
+	MetalRough,
+	Normal
+};
+
+// BC7 for color (keeps alpha), BC1 for metal-rough (no alpha), BC5 for the XY of normals
+VkFormat compressedFormat(TextureUsage usage);
+
+bool isBlockCompressed(VkFormat format);
+
+// number of levels in a full mip chain down to 1x1
+uint32_t mipLevelCount(uint32_t width, uint32_t height);
+
+// size in bytes of one tightly packed mip level. supports RGBA8 and the BC formats above
+VkDeviceSize mipLevelSize(VkFormat format, uint32_t width, uint32_t height);
+
+// size in bytes of levels [0, mipLevels) stored back to back
+VkDeviceSize mipChainSize(VkFormat format, uint32_t width, uint32_t height, uint32_t mipLevels);
+
+// encode 4x4 blocks of RGBA8 texels (row major, 64 bytes) into out
+void encodeBC1Block(const uint8_t* texels, uint8_t* out);
+void encodeBC5Block(const uint8_t* texels, uint8_t* out);
+// BC7 mode 6 only: one RGBA subset with 4 bit indices
+void encodeBC7Block(const uint8_t* texels, uint8_t* out);
+
+// encode a RGBA8 image of any size into format, edge texels are repeated to fill partial blocks.
+// blocks are encoded on worker threads
+void encodeImage(const uint8_t* rgba, uint32_t width, uint32_t height, VkFormat format, uint8_t* out);
+
+// build mipLevels levels from a RGBA8 image with filter and encode each one into format.
+// levels are stored back to back starting with mip 0
+std::vector<uint8_t> buildTexture(const uint8_t* rgba, uint32_t width, uint32_t height, VkFormat format, uint32_t mipLevels, MipFilter filter);
+
+}// namespace pm
@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <glm/glm.hpp>
+#include <glm/packing.hpp>
+
+#include "vertex_layout.h"
+
+namespace pm {
+
+namespace {
+
+uint32_t packUV(const Vertex& v) {
+	return glm::packHalf2x16(glm::vec2{ v.uv_x, v.uv_y });
+}
+
+uint32_t packColor(const Vertex& v) {
+	return glm::packUnorm4x8(v.color);
+}
+
+}// namespace
+
+uint32_t packOctahedral(const glm::vec3& normal) {
+	const float length = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+	if (length <= 0.f) {
+		return glm::packSnorm2x16(glm::vec2{ 0.f, 0.f });
+	}
+
+	glm::vec3 n = normal / length;
+	glm::vec2 encoded{ n.x, n.y };
+	if (n.z < 0.f) {
+		// fold the lower hemisphere over the diagonals
+		encoded.x = (1.f - std::abs(n.y)) * (n.x >= 0.f ? 1.f : -1.f);
+		encoded.y = (1.f - std::abs(n.x)) * (n.y >= 0.f ? 1.f : -1.f);
+	}
+	return glm::packSnorm2x16(encoded);
+}
+
+glm::vec3 unpackOctahedral(uint32_t packed) {
+	const glm::vec2 e = glm::unpackSnorm2x16(packed);
+	glm::vec3 n{ e.x, e.y, 1.f - std::abs(e.x) - std::abs(e.y) };
+	if (n.z < 0.f) {
+		n.x = (1.f - std::abs(e.y)) * (e.x >= 0.f ? 1.f : -1.f);
+		n.y = (1.f - std::abs(e.x)) * (e.y >= 0.f ? 1.f : -1.f);
+	}
+	return glm::normalize(n);
+}
+
+template<>
+void packVertices<VertexLayout::Full>(std::span<const Vertex> vertices, uint8_t* out) {
+	memcpy(out, vertices.data(), vertices.size_bytes());
+}
+
+template<>
+void packVertices<VertexLayout::Compact>(std::span<const Vertex> vertices, uint8_t* out) {
+	auto* packed = reinterpret_cast<CompactVertex*>(out);
+	for (size_t i = 0; i < vertices.size(); i++) {
+		const Vertex& v = vertices[i];
+		packed[i] = CompactVertex{
+			.position = v.position,
+			.normal = packOctahedral(v.normal),
+			.uv = packUV(v),
+			.color = packColor(v)
+		};
+	}
+}
+
+template<>
+void packVertices<VertexLayout::Quantized>(std::span<const Vertex> vertices, uint8_t* out) {
+	glm::vec3 minPos{ 0.f };
+	glm::vec3 maxPos{ 0.f };
+	if (!vertices.empty()) {
+		minPos = vertices[0].position;
+		maxPos = vertices[0].position;
+	}
+	for (const Vertex& v : vertices) {
+		minPos = glm::min(minPos, v.position);
+		maxPos = glm::max(maxPos, v.position);
+	}
+
+	// flat axes still need a non zero scale
+	glm::vec3 scale = maxPos - minPos;
+	for (int axis = 0; axis < 3; axis++) {
+		if (scale[axis] <= 0.f) {
+			scale[axis] = 1.f;
+		}
+	}
+
+	const QuantizedVertexHeader header{ .positionOffset = glm::vec4{ minPos, 0.f }, .positionScale = glm::vec4{ scale, 0.f } };
+	memcpy(out, &header, sizeof(header));
+
+	auto* packed = reinterpret_cast<QuantizedVertex*>(out + sizeof(header));
+	for (size_t i = 0; i < vertices.size(); i++) {
+		const Vertex& v = vertices[i];
+		const glm::vec3 unorm = glm::clamp((v.position - minPos) / scale, 0.f, 1.f);
+
+		QuantizedVertex q{};
+		for (int axis = 0; axis < 3; axis++) {
+			q.position[axis] = static_cast<uint16_t>(std::lround(unorm[axis] * 65535.f));
+		}
+		q.normal = packOctahedral(v.normal);
+		q.uv = packUV(v);
+		q.color = packColor(v);
+		packed[i] = q;
+	}
+}
+
+}// namespace pm
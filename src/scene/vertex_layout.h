@@ -0,0 +1,96 @@
+#pragma once
+
+#include "vk_types.h"
+
+// GPU vertex layout, chosen at build time with the PRIMAL_VERTEX_LAYOUT cache variable.
+// the same value is passed to the shader compiler, see res/shaders/vertex_layout.glsl
+#ifndef PM_VERTEX_LAYOUT
+#define PM_VERTEX_LAYOUT 1
+#endif
+
+namespace pm {
+
+enum class VertexLayout : uint8_t {
+	// Vertex as is, 48 bytes
+	Full = 0,
+	// float3 position, octahedral snorm16 normal, half2 uv, unorm8 color, 24 bytes
+	Compact = 1,
+	// like Compact with unorm16 position inside the mesh bounds, 20 bytes
+	Quantized = 2
+};
+
+constexpr VertexLayout VERTEX_LAYOUT = static_cast<VertexLayout>(PM_VERTEX_LAYOUT);
+
+struct CompactVertex {
+		glm::vec3 position;
+		uint32_t normal;
+		uint32_t uv;
+		uint32_t color;
+};
+
+struct QuantizedVertex {
+		uint16_t position[3];
+		uint16_t padding;
+		uint32_t normal;
+		uint32_t uv;
+		uint32_t color;
+};
+
+// stored in front of the vertices of a quantized vertex buffer,
+// position = positionOffset + unorm * positionScale
+struct QuantizedVertexHeader {
+		glm::vec4 positionOffset;
+		glm::vec4 positionScale;
+};
+
+static_assert(sizeof(CompactVertex) == 24);
+static_assert(sizeof(QuantizedVertex) == 20);
+
+template<VertexLayout L>
+struct VertexTraits;
+
+template<>
+struct VertexTraits<VertexLayout::Full> {
+		using Type = Vertex;
+		static constexpr size_t headerSize = 0;
+		static constexpr const char* name = "full";
+};
+
+template<>
+struct VertexTraits<VertexLayout::Compact> {
+		using Type = CompactVertex;
+		static constexpr size_t headerSize = 0;
+		static constexpr const char* name = "compact";
+};
+
+template<>
+struct VertexTraits<VertexLayout::Quantized> {
+		using Type = QuantizedVertex;
+		static constexpr size_t headerSize = sizeof(QuantizedVertexHeader);
+		static constexpr const char* name = "quantized";
+};
+
+using GPUVertex = VertexTraits<VERTEX_LAYOUT>::Type;
+
+// bytes needed for count vertices in layout L, header included
+template<VertexLayout L = VERTEX_LAYOUT>
+constexpr size_t packedVertexSize(size_t count) {
+	return VertexTraits<L>::headerSize + count * sizeof(typename VertexTraits<L>::Type);
+}
+
+// octahedral mapping of a unit vector, packed as two snorm16
+uint32_t packOctahedral(const glm::vec3& normal);
+glm::vec3 unpackOctahedral(uint32_t packed);
+
+// convert vertices into layout L, out must hold packedVertexSize<L>(vertices.size()) bytes
+template<VertexLayout L>
+void packVertices(std::span<const Vertex> vertices, uint8_t* out);
+
+template<>
+void packVertices<VertexLayout::Full>(std::span<const Vertex> vertices, uint8_t* out);
+template<>
+void packVertices<VertexLayout::Compact>(std::span<const Vertex> vertices, uint8_t* out);
+template<>
+void packVertices<VertexLayout::Quantized>(std::span<const Vertex> vertices, uint8_t* out);
+
+}// namespace pm
@@ -0,0 +1,190 @@
+#include "trace.h"
+
+#if PM_TRACING
+
+#include <atomic>
+#include <chrono>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "json.h"
+
+namespace pm {
+
+namespace {
+
+// per thread, older zones are overwritten once a capture records more than this
+constexpr size_t TRACE_BUFFER_CAPACITY = size_t{ 1 } << 15;
+constexpr size_t TRACE_BUFFER_MASK = TRACE_BUFFER_CAPACITY - 1;
+// sorts the GPU track below every CPU thread
+constexpr uint32_t GPU_TRACK_ID = 100000;
+
+// traceTicks() on the CPU tracks, nanoseconds on the GPU track
+struct TraceEvent {
+		const char* name;
+		uint64_t begin;
+		uint64_t end;
+};
+
+// Single producer ring, only its thread writes. head is published with release so the
+// exporter sees every event below it
+struct TraceBuffer {
+		std::vector<TraceEvent> events;
+		std::atomic<uint64_t> head{ 0 };
+		uint32_t id;
+		std::string name;
+		bool gpu;
+};
+
+struct TraceRegistry {
+		std::mutex mutex;
+		// owned here so the buffers of finished threads can still be exported
+		std::vector<std::unique_ptr<TraceBuffer>> buffers;
+		std::atomic<bool> capturing{ false };
+		// both clocks at the start and end of the capture, they map ticks to nanoseconds
+		uint64_t beginNs{ 0 };
+		uint64_t beginTicks{ 0 };
+		uint64_t endNs{ 0 };
+		uint64_t endTicks{ 0 };
+};
+
+TraceRegistry& registry() {
+	static TraceRegistry instance;
+	return instance;
+}
+
+TraceBuffer* createBuffer(std::string name, bool gpu) {
+	TraceRegistry& reg = registry();
+	std::lock_guard<std::mutex> lock(reg.mutex);
+	auto buffer = std::make_unique<TraceBuffer>();
+	buffer->events.resize(TRACE_BUFFER_CAPACITY);
+	buffer->id = static_cast<uint32_t>(reg.buffers.size());
+	buffer->name = name.empty() ? std::format("Thread {}", buffer->id) : std::move(name);
+	buffer->gpu = gpu;
+	reg.buffers.push_back(std::move(buffer));
+	return reg.buffers.back().get();
+}
+
+TraceBuffer& threadBuffer() {
+	thread_local TraceBuffer* buffer = createBuffer({}, false);
+	return *buffer;
+}
+
+TraceBuffer& gpuBuffer() {
+	// only the render thread reads back GPU timestamps, so it stays single producer
+	static TraceBuffer* buffer = createBuffer("GPU", true);
+	return *buffer;
+}
+
+void push(TraceBuffer& buffer, const char* name, uint64_t beginNs, uint64_t endNs) {
+	const uint64_t head = buffer.head.load(std::memory_order_relaxed);
+	buffer.events[head & TRACE_BUFFER_MASK] = TraceEvent{ .name = name, .begin = beginNs, .end = endNs };
+	buffer.head.store(head + 1, std::memory_order_release);
+}
+
+}// namespace
+
+uint64_t traceNow() {
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+bool traceCapturing() {
+	return registry().capturing.load(std::memory_order_relaxed);
+}
+
+void beginTraceCapture() {
+	TraceRegistry& reg = registry();
+	reg.beginNs = traceNow();
+	reg.beginTicks = traceTicks();
+	reg.capturing.store(true, std::memory_order_relaxed);
+}
+
+void endTraceCapture() {
+	TraceRegistry& reg = registry();
+	reg.capturing.store(false, std::memory_order_relaxed);
+	reg.endNs = traceNow();
+	reg.endTicks = traceTicks();
+}
+
+void setTraceThreadName(const std::string& name) {
+	TraceBuffer& buffer = threadBuffer();
+	std::lock_guard<std::mutex> lock(registry().mutex);
+	buffer.name = name;
+}
+
+void recordTraceZone(const char* name, uint64_t beginTicks, uint64_t endTicks) {
+	push(threadBuffer(), name, beginTicks, endTicks);
+}
+
+void recordGpuTraceZone(const char* name, uint64_t beginNs, uint64_t endNs) {
+	push(gpuBuffer(), name, beginNs, endNs);
+}
+
+bool exportChromeTrace(const std::string& path) {
+	std::ofstream file(path);
+	if (!file.is_open()) {
+		std::cout << std::format("Failed to write trace {}\n", path);
+		return false;
+	}
+
+	// no new zones start while the rings are read. zones already open still push when
+	// they end, which the head check below accounts for
+	if (traceCapturing()) {
+		endTraceCapture();
+	}
+
+	TraceRegistry& reg = registry();
+	std::lock_guard<std::mutex> lock(reg.mutex);
+
+	// the TSC rate from the two ends of the capture, 1 where traceTicks() is traceNow()
+	const double captureNs = static_cast<double>(reg.endNs - reg.beginNs);
+	const double captureTicks = static_cast<double>(reg.endTicks - reg.beginTicks);
+	const double nsPerTick = captureTicks > 0.0 ? captureNs / captureTicks : 1.0;
+
+	// timestamps in microseconds relative to the capture start
+	size_t eventCount = 0;
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	for (const auto& buffer : reg.buffers) {
+		const uint32_t tid = buffer->gpu ? GPU_TRACK_ID : buffer->id;
+		file << std::format("{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":\"{}\"}}}}", tid, escapeJson(buffer->name));
+		file << std::format(",\n{{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"sort_index\":{}}}}}", tid, tid);
+
+		// snapshot of the head, zones pushed after it are left out
+		const uint64_t head = buffer->head.load(std::memory_order_acquire);
+		const uint64_t first = head > TRACE_BUFFER_CAPACITY ? head - TRACE_BUFFER_CAPACITY : 0;
+		for (uint64_t i = first; i < head; i++) {
+			const TraceEvent event = buffer->events[i & TRACE_BUFFER_MASK];
+			// the producer may have wrapped around onto this slot while it was copied
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (buffer->head.load(std::memory_order_relaxed) >= i + TRACE_BUFFER_CAPACITY) {
+				continue;
+			}
+			// the buffers live across captures, and GPU zones arrive a few frames late
+			const uint64_t captureBegin = buffer->gpu ? reg.beginNs : reg.beginTicks;
+			if (event.begin < captureBegin || event.end < event.begin) {
+				continue;
+			}
+			const double scale = buffer->gpu ? 1.0 : nsPerTick;
+			file << std::format(",\n{{\"name\":\"{}\",\"cat\":\"{}\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}}}",
+				escapeJson(event.name),
+				buffer->gpu ? "gpu" : "cpu",
+				tid,
+				static_cast<double>(event.begin - captureBegin) * scale / 1000.0,
+				static_cast<double>(event.end - event.begin) * scale / 1000.0);
+			eventCount++;
+		}
+		file << ",\n";
+	}
+	file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"PrimalEngine\"}}\n]}\n";
+
+	std::cout << std::format("Wrote {} trace zones over {:.1f}ms to {}\n", eventCount, captureNs / 1'000'000.0, path);
+	return true;
+}
+
+}// namespace pm
+
+#endif
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// CPU (and GPU) zone tracing, exported as Chrome trace JSON which chrome://tracing and
+// ui.perfetto.dev both load. Enabled with the ENABLE_TRACING CMake option, otherwise
+// the macros expand to nothing and the capture functions are empty inline stubs.
+//
+//   PM_TRACE_ZONE("collectDraws");  // times the rest of the scope
+//
+// Zones are only recorded while a capture is running. Each thread writes into its own
+// ring buffer without locks, only the first zone of a thread takes the registry lock.
+// Zones are timed with rdtsc and moved to the steady_clock timeline on export.
+#ifndef PM_TRACING
+#define PM_TRACING 0
+#endif
+
+#if PM_TRACING && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+
+namespace pm {
+
+#if PM_TRACING
+
+// nanoseconds of std::chrono::steady_clock, CLOCK_MONOTONIC on Linux
+uint64_t traceNow();
+bool traceCapturing();
+
+// zone timestamps, cheaper than traceNow(). the invariant TSC where there is one
+inline uint64_t traceTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return traceNow();
+#endif
+}
+
+void beginTraceCapture();
+void endTraceCapture();
+// writes every zone recorded during the last capture and stops a running one first,
+// false if the file can't be written
+bool exportChromeTrace(const std::string& path);
+
+// name of the calling thread's track, the string is copied
+void setTraceThreadName(const std::string& name);
+
+// name must outlive the capture, string literals. begin and end in traceTicks()
+void recordTraceZone(const char* name, uint64_t beginTicks, uint64_t endTicks);
+// on the GPU track, begin and end already converted to traceNow() time
+void recordGpuTraceZone(const char* name, uint64_t beginNs, uint64_t endNs);
+
+class ScopedTraceZone {
+	public:
+		explicit ScopedTraceZone(const char* name)
+				: m_name(traceCapturing() ? name : nullptr), m_begin(m_name != nullptr ? traceTicks() : 0) {}
+		~ScopedTraceZone() {
+			if (m_name != nullptr) {
+				recordTraceZone(m_name, m_begin, traceTicks());
+			}
+		}
+
+		ScopedTraceZone(const ScopedTraceZone&) = delete;
+		ScopedTraceZone& operator=(const ScopedTraceZone&) = delete;
+
+	private:
+		const char* m_name;
+		uint64_t m_begin;
+};
+
+#define PM_TRACE_CONCAT_IMPL(a, b) a##b
+#define PM_TRACE_CONCAT(a, b) PM_TRACE_CONCAT_IMPL(a, b)
+#define PM_TRACE_ZONE(name) ::pm::ScopedTraceZone PM_TRACE_CONCAT(pmTraceZone, __LINE__)(name)
+#define PM_TRACE_THREAD_NAME(name) ::pm::setTraceThreadName(name)
+
+#else
+
+inline bool traceCapturing() { return false; }
+inline void beginTraceCapture() {}
+inline void endTraceCapture() {}
+inline bool exportChromeTrace(const std::string&) { return false; }
+
+#define PM_TRACE_ZONE(name) ((void)0)
+#define PM_TRACE_THREAD_NAME(name) ((void)0)
+
+#endif
+
+}// namespace pm
@@ -39,20 +39,51 @@ struct Vertex {
 		glm::vec4 color;
 };
 
-// holds the resources needed for a mesh
+// timeline value of the upload batch that carries a resource's data, see UploadManager
+using UploadTicket = uint64_t;
+
+// ranges of a mesh in the renderer's geometry pools, the buffers belong to the pools
 struct GPUMeshBuffers {
-		AllocatedBuffer indexBuffer;
-		AllocatedBuffer vertexBuffer;
+		// the shared index pool, the same buffer for every mesh
+		VkBuffer indexBuffer;
+		// UINT16 whenever every vertex of the mesh can be addressed with it
+		VkIndexType indexType;
+		// first index of the mesh in indexBuffer, counted in indexType sized indices
+		uint32_t firstIndex;
+		// start of the index pool, meshlet indices are relative to firstIndex
+		VkDeviceAddress indexBufferAddress;
+		// vertices are pulled from here, so draws never need a vertexOffset
 		VkDeviceAddress vertexBufferAddress;
+		// 0 when the mesh has no meshlets
+		VkDeviceAddress meshletBufferAddress;
+		// pool blocks and byte offsets of the ranges
+		uint32_t indexBlock;
+		uint32_t vertexBlock;
+		uint32_t meshletBlock;
+		VkDeviceSize indexOffset;
+		VkDeviceSize vertexOffset;
+		VkDeviceSize meshletOffset;
+		// what the mesh added to the mesh memory stats, taken back out on release
+		uint32_t vertexCount;
+		VkDeviceSize vertexBytes;
+		VkDeviceSize indexBytes;
+		VkDeviceSize meshletBytes;
+		// false until uploaded and after the mesh is released, it is then never drawn
+		bool resident;
+		UploadTicket uploadTicket;
+		// unique per upload, the mesh part of the draw sort keys
+		uint32_t meshId;
 };
 
 // push constants for our mesh object draws
 struct GPUDrawPushConstants {
-		glm::mat4 worldMatrix;
-
 		// NOTE: sending pointer to vertex data as PushConstants for now.
 		// We might want to set SSBOs using DescriptorSets instead.
 		VkDeviceAddress vertexBuffer;
+		// world matrices of the draw's instances, indexed by gl_InstanceIndex
+		VkDeviceAddress instanceBuffer;
+		// entry in the bindless material buffer
+		uint32_t materialIndex;
 };
 
 enum class MaterialPass : uint8_t {
@@ -63,47 +94,19 @@ enum class MaterialPass : uint8_t {
 struct MaterialPipeline {
 		VkPipeline pipeline;
 		VkPipelineLayout layout;
+		// pipeline part of the draw sort keys
+		uint32_t sortId;
 };
 
 struct MaterialInstance {
 		MaterialPipeline* pipeline;
-		VkDescriptorSet materialSet;
+		// variant used by the GPU driven path, reads transforms from the object buffer
+		MaterialPipeline* indirectPipeline;
+		// entry in the bindless material buffer, draws select it instead of binding a set
+		uint32_t materialIndex;
 		MaterialPass passType;
 };
 
-struct DrawContext;
-
-// base class for a renderable dynamic object
-class IRenderable {
-		virtual void draw(const glm::mat4& topMatrix, DrawContext& ctx) = 0;
-};
-
-// implementation of a drawable scene node.
-// the scene node can hold children and will also keep a transform to propagate
-// to them
-struct Node : public IRenderable {
-		// parent pointer must be a weak pointer to avoid circular dependencies
-		std::weak_ptr<Node> parent;
-		std::vector<std::shared_ptr<Node>> children;
-
-		glm::mat4 localTransform;
-		glm::mat4 worldTransform;
-
-		void refreshTransform(const glm::mat4& parentMatrix) {
-			worldTransform = parentMatrix * localTransform;
-			for (auto c : children) {
-				c->refreshTransform(worldTransform);
-			}
-		}
-
-		 void draw(const glm::mat4& topMatrix, DrawContext& ctx) override {
-			// draw children
-			for (auto& c : children) {
-				c->draw(topMatrix, ctx);
-			}
-		}
-};
-
 #define VK_CHECK(x)                                                                  \
 	do {                                                                               \
 		VkResult err = x;                                                                \
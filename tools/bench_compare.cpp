@@ -0,0 +1,110 @@
+#include <charconv>
+#include <cmath>
+#include <format>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "benchmark.h"
+
+// Compares the summaries of two benchmark reports written by the sandbox's --benchmark mode.
+// usage: bench_compare [--threshold=percent] <baseline.json> <candidate.json>
+// every metric is higher-is-worse. a metric regresses when its p50 or p99 grew by more than
+// the threshold (5% by default), the exit code is 1 when any did or when a metric of the
+// baseline is missing from the candidate.
+
+namespace {
+
+void printUsage() {
+	std::cout << "usage: bench_compare [--threshold=percent] <baseline.json> <candidate.json>\n";
+}
+
+// relative change in percent, 0 when both are 0
+double change(double baseline, double candidate) {
+	if (baseline == 0.0) {
+		return candidate == 0.0 ? 0.0 : 100.0;
+	}
+	return 100.0 * (candidate - baseline) / std::abs(baseline);
+}
+
+}// namespace
+
+int main(int argc, char* argv[]) {
+	std::vector<std::string> args;
+	double threshold = 5.0;
+
+	for (int i = 1; i < argc; i++) {
+		const std::string_view arg = argv[i];
+		if (arg.starts_with("--threshold=")) {
+			// the whole value has to be a non negative number
+			const std::string_view value = arg.substr(12);
+			const auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), threshold);
+			if (error != std::errc{} || end != value.data() + value.size() || !(threshold >= 0.0)) {
+				printUsage();
+				return 1;
+			}
+		} else if (arg.starts_with("--")) {
+			printUsage();
+			return 1;
+		} else {
+			args.emplace_back(arg);
+		}
+	}
+
+	if (args.size() != 2) {
+		printUsage();
+		return 1;
+	}
+
+	const auto baseline = pm::readBenchmarkSummary(args[0]);
+	const auto candidate = pm::readBenchmarkSummary(args[1]);
+	if (!baseline || !candidate) {
+		return 1;
+	}
+
+	std::cout << std::format("{:<16}{:>14}{:>14}{:>9}{:>14}{:>14}{:>9}\n", "metric", "base p50", "new p50", "p50 %", "base p99", "new p99", "p99 %");
+
+	size_t regressions = 0;
+	size_t missing = 0;
+	for (const pm::BenchmarkMetric& base : *baseline) {
+		const pm::BenchmarkMetric* current = nullptr;
+		for (const pm::BenchmarkMetric& metric : *candidate) {
+			if (metric.name == base.name) {
+				current = &metric;
+			}
+		}
+		if (current == nullptr) {
+			std::cout << std::format("{:<16} missing from {}\n", base.name, args[1]);
+			missing++;
+			continue;
+		}
+
+		const double p50Change = change(base.p50, current->p50);
+		const double p99Change = change(base.p99, current->p99);
+		const bool regressed = p50Change > threshold || p99Change > threshold;
+		regressions += regressed ? 1 : 0;
+
+		std::cout << std::format("{:<16}{:>14.3f}{:>14.3f}{:>+8.1f}%{:>14.3f}{:>14.3f}{:>+8.1f}%{}\n",
+			base.name,
+			base.p50,
+			current->p50,
+			p50Change,
+			base.p99,
+			current->p99,
+			p99Change,
+			regressed ? "  REGRESSION" : "");
+	}
+
+	if (missing > 0) {
+		std::cout << std::format("{} metric(s) missing from {}\n", missing, args[1]);
+	}
+	if (regressions > 0) {
+		std::cout << std::format("{} metric(s) regressed by more than {}%\n", regressions, threshold);
+	}
+	if (regressions > 0 || missing > 0) {
+		return 1;
+	}
+	std::cout << std::format("No regressions above {}%\n", threshold);
+	return 0;
+}
@@ -0,0 +1,73 @@
+#include <chrono>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+#include "platform/vulkan/vulkan_loader.h"
+
+// Converts a glTF file into the engine's cooked scene format.
+// usage: cooker [--uncompressed] [--mip-filter=box|kaiser] [--no-mesh-optimize] [--no-lods] [--no-meshlets] <input.gltf|glb> [output]
+// the output defaults to the path loadGltf looks for, next to the input.
+// base color textures are encoded to BC7 with full mip chains, --uncompressed keeps RGBA8 for
+// devices without BC support, which otherwise ignore the cache and load the source.
+// metal-rough and normal maps are not cooked, materials don't bind them yet.
+// meshes are deduplicated and reordered for the vertex cache, --no-mesh-optimize keeps the glTF order.
+// every surface gets a simplified LOD chain, --no-lods stores LOD 0 only.
+// every level is split into meshlets for cluster culling, --no-meshlets skips them.
+
+namespace {
+
+void printUsage() {
+	std::cout << "usage: cooker [--uncompressed] [--mip-filter=box|kaiser] [--no-mesh-optimize] [--no-lods] [--no-meshlets] <input.gltf|glb> [output]\n";
+}
+
+}// namespace
+
+int main(int argc, char* argv[]) {
+	std::vector<std::string_view> args;
+	pm::CookOptions options{};
+
+	for (int i = 1; i < argc; i++) {
+		const std::string_view arg = argv[i];
+		if (arg == "--uncompressed") {
+			options.compressTextures = false;
+		} else if (arg == "--mip-filter=box") {
+			options.mipFilter = pm::MipFilter::Box;
+		} else if (arg == "--mip-filter=kaiser") {
+			options.mipFilter = pm::MipFilter::Kaiser;
+		} else if (arg == "--no-mesh-optimize") {
+			options.meshes.optimize = false;
+		} else if (arg == "--no-lods") {
+			options.meshes.generateLods = false;
+		} else if (arg == "--no-meshlets") {
+			options.meshes.buildMeshlets = false;
+		} else if (arg.starts_with("--")) {
+			printUsage();
+			return 1;
+		} else {
+			args.push_back(arg);
+		}
+	}
+
+	if (args.empty() || args.size() > 2) {
+		printUsage();
+		return 1;
+	}
+
+	const std::filesystem::path source = args[0];
+	const std::filesystem::path destination = args.size() == 2 ? std::filesystem::path{ args[1] } : pm::cookedScenePath(source);
+
+	const auto start = std::chrono::steady_clock::now();
+	if (!pm::cookGltf(source, destination, options)) {
+		std::cout << std::format("Failed to cook {}\n", source.string());
+		return 1;
+	}
+	const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+
+	std::error_code error;
+	const auto size = std::filesystem::file_size(destination, error);
+	std::cout << std::format("Cooked {} -> {} ({} bytes) in {:.1f} ms\n", source.string(), destination.string(), error ? 0 : size, elapsed.count());
+	return 0;
+}